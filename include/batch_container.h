@@ -0,0 +1,129 @@
+#ifndef BATCH_CONTAINER_H
+#define BATCH_CONTAINER_H
+
+#include "change_detector.h"
+#include "frame_backlog.h"
+
+// Byte stream the transfer protocols send from. Reads may straddle any internal
+// boundaries; the source copies whatever is needed into dst.
+class StreamSource
+{
+public:
+    virtual ~StreamSource() {}
+
+    virtual size_t size() const = 0;
+    virtual void read(size_t offset, uint8_t *dst, size_t len) const = 0;
+};
+
+// One frame of a backlog, from `start` bytes in to its end.
+class FrameStreamSource : public StreamSource
+{
+public:
+    FrameStreamSource(const FrameBacklog &backlog, int index, size_t start, size_t len)
+        : m_backlog(backlog), m_index(index), m_start(start), m_len(len) {}
+
+    size_t size() const override { return m_len; }
+    void read(size_t offset, uint8_t *dst, size_t len) const override
+    {
+        m_backlog.read(m_index, m_start + offset, dst, len);
+    }
+
+private:
+    const FrameBacklog &m_backlog;
+    int m_index;
+    size_t m_start;
+    size_t m_len;
+};
+
+// The whole batch as one stream: a header and frame table, followed by the JPEGs
+// back to back. Nothing is copied up front; header bytes are generated and JPEG
+// bytes are read straight from the backlog (arena or flash) as the transfer asks
+// for them.
+//
+// Layout (all little-endian):
+//   "JKB1"  u16 version  u16 frame_count  u32 total_size  u32 device_now_ms  u32 first_offset
+//   frame_count x { u32 id  u32 offset  u32 length  u32 timestamp_ms  u32 crc32  u32 flags }
+//   JPEG data
+//
+// When a transfer resumes mid-frame, the first frame's data starts first_offset
+// bytes into its JPEG (its length counts only the bytes present); the server
+// already holds the rest. crc32 always covers the whole JPEG; flags are the
+// frame's FRAME_FLAG_* bits.
+class BatchContainer : public StreamSource
+{
+public:
+    static const uint16_t VERSION = 3;
+    static const size_t HEADER_SIZE = 20;
+    static const size_t ENTRY_SIZE = 24;
+
+    // Covers the first frame_count frames of the backlog (at most FRAME_QUEUE_LEN),
+    // skipping the first first_offset bytes of the first frame.
+    BatchContainer(const FrameBacklog &backlog, int frame_count, uint32_t now_ms, uint32_t first_offset = 0);
+
+    size_t size() const override { return m_total; }
+    void read(size_t offset, uint8_t *dst, size_t len) const override;
+    int frame_count() const { return m_count; }
+
+    // How many frames lie entirely within the first `bytes` of the stream.
+    int frames_within(size_t bytes) const;
+    // Where frame `index` stands once the first `bytes` of the stream have arrived:
+    // how many bytes of its JPEG the server holds.
+    uint32_t frame_progress(int index, size_t bytes) const;
+
+private:
+    void encode_prefix(size_t index, uint8_t *out) const;
+    void frame_at(int index, FrameRef &frame) const;
+
+    const FrameBacklog &m_backlog;
+    int m_count;
+    uint32_t m_now_ms;
+    uint32_t m_first_offset;
+    size_t m_table_end;
+    size_t m_total;
+    uint32_t m_offsets[FRAME_QUEUE_LEN];
+};
+
+// Preview-first mode: a preview of `count` backlog frames from `first` on, behind
+// a table describing the full frames, so the server can pick the ones it wants
+// in full. Each preview is rendered from its JPEG when the transfer first reads
+// into it; only one is held at a time.
+//
+// Layout (all little-endian):
+//   "JKP1"  u16 version  u16 frame_count  u32 total_size  u32 device_now_ms  u8 cols  u8 rows  u16 reserved
+//   frame_count x { u32 id  u32 offset  u32 length  u32 timestamp_ms  u32 crc32  u32 flags }
+//   frame_count x { u8 valid  cols x rows luma bytes }
+// offset is where the frame's preview record starts; length and crc32 describe
+// the full JPEG. valid is 0, and the pixels zero, for a frame that would not decode.
+class PreviewContainer : public StreamSource
+{
+public:
+    static const uint16_t VERSION = 2;
+    static const size_t HEADER_SIZE = 20;
+    static const size_t ENTRY_SIZE = 24;
+    static const size_t RECORD_SIZE = 1 + PREVIEW_PIXELS;
+
+    PreviewContainer(const FrameBacklog &backlog, int first, int count, uint32_t now_ms, PreviewRenderer &renderer);
+    ~PreviewContainer();
+
+    size_t size() const override { return m_total; }
+    void read(size_t offset, uint8_t *dst, size_t len) const override;
+    int frame_count() const { return m_count; }
+
+private:
+    void encode_prefix(size_t index, uint8_t *out) const;
+    void render(int index) const;
+
+    const FrameBacklog &m_backlog;
+    int m_first;
+    int m_count;
+    uint32_t m_now_ms;
+    size_t m_table_end;
+    size_t m_total;
+    PreviewRenderer &m_renderer;
+    mutable int m_cached;          // Frame whose record is in m_record, -1 for none
+    mutable uint8_t *m_record;     // RECORD_SIZE bytes
+    mutable uint8_t *m_jpeg;       // Copy of a frame that is not in memory (spilled to flash)
+    mutable size_t m_jpeg_capacity;
+};
+
+#endif // BATCH_CONTAINER_H
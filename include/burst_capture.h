@@ -0,0 +1,55 @@
+#ifndef BURST_CAPTURE_H
+#define BURST_CAPTURE_H
+
+#include "frame_queue.h"
+#include "frame_source.h"
+#include "storage_manager.h"
+
+// Paces a burst: platform_micros() and a task delay on the device, a simulated
+// sensor timeline in the native bench.
+class BurstClock
+{
+public:
+    virtual ~BurstClock() {}
+
+    virtual uint64_t now_us() = 0;
+    virtual void wait_until_us(uint64_t deadline_us) = 0;
+};
+
+struct BurstReport
+{
+    uint16_t burst_id;
+    uint8_t requested;
+    uint8_t kept;     // Stored and queued
+    uint8_t failed;   // Capture failed or the arena was full
+    uint32_t span_us; // First frame to last
+    float fps;        // Achieved over span_us; 0 for fewer than two frames
+};
+
+// Takes several frames in one wake at up to a given rate. Each frame is copied
+// into the arena and its framebuffer handed straight back, so with two
+// framebuffers the camera DMA fills one while the other is being stored and the
+// rate is set by the sensor rather than the copy. Frames are tagged
+// FRAME_FLAG_BURST with a shared burst id and their position in the burst.
+class BurstCapture
+{
+public:
+    BurstCapture(StorageManager &storage, FrameQueue &queue);
+
+    // frames is clamped to 1..BURST_FRAMES_MAX; extra_flags (e.g. FRAME_FLAG_EVENT)
+    // go on every frame.
+    BurstReport run(FrameSource &source, BurstClock &clock, int frames, int fps, uint32_t extra_flags);
+
+    const BurstReport &last() const { return m_last; }
+    // Records each burst as a TRACE_BURST tracepoint.
+    void set_telemetry(Telemetry *telemetry) { m_telemetry = telemetry; }
+
+private:
+    StorageManager &m_storage;
+    FrameQueue &m_queue;
+    Telemetry *m_telemetry;
+    uint16_t m_next_id; // Never 0, so a burst frame always has a non-zero id
+    BurstReport m_last;
+};
+
+#endif // BURST_CAPTURE_H
@@ -1,6 +1,31 @@
 #ifndef CAMERA_HANDLER_H
 #define CAMERA_HANDLER_H
 
+#include "frame_source.h"
+#include "device_config.h"
+#include <stdint.h>
+
+// Frame size, quality and XCLK come from device_config.
 void init_camera();
+// Reprograms the sensor with the rate controller's quality and frame size step.
+void apply_camera_rate(uint8_t quality, uint8_t downscale);
+// Takes a new frame size, quality and XCLK. The running sensor is reprogrammed
+// when the framebuffers can hold the new size; a larger one needs a re-init,
+// which this does. Returns true if it did.
+bool reconfigure_camera(const DeviceConfig &config);
+// Puts the sensor in (or takes it out of) register-retaining standby over SCCB.
+// False when the sensor has no such mode.
+bool camera_standby(bool standby);
+
+// Frames straight from the OV sensor via esp_camera_fb_get(); captured_us is
+// the driver's timestamp, taken from esp_timer like platform_micros().
+class EspCameraSource : public FrameSource
+{
+public:
+    bool acquire(Frame &frame) override;
+    void release(Frame &frame) override;
+};
+
+extern EspCameraSource camera_source;
 
 #endif // CAMERA_HANDLER_H
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef CAPTURE_SCHEDULER_H
+#define CAPTURE_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Why a frame is being taken.
+enum CaptureTrigger : uint8_t
+{
+    TRIGGER_NONE,
+    TRIGGER_TIMER, // The timelapse period came round
+    TRIGGER_EVENT, // The PIR output rose
+};
+
+struct SchedulerStats
+{
+    uint32_t timer_captures;
+    uint32_t event_captures;
+    uint32_t edges;     // PIR rising edges seen
+    uint32_t debounced; // Edges inside the hold-off after an event capture (retriggers)
+    uint32_t coalesced; // Timer slots skipped because an event capture had just covered them
+    uint32_t missed;    // Timer slots that went by while the device was busy
+};
+
+// Decides when the capture task takes a frame: on a fixed timelapse grid, and
+// whenever the PIR sensor's output rises. A PIR held high or pulsing with one
+// moving subject must not fire a burst, so rising edges within holdoff_ms of
+// the last event capture only count as retriggers; a timer slot that falls in
+// that window is skipped too, since the event frame already shows the scene.
+//
+// It only does arithmetic on the times and levels it is given, so the firmware
+// feeds it millis() and digitalRead(), and the native bench a simulated
+// timeline. Times may wrap.
+class CaptureScheduler
+{
+public:
+    CaptureScheduler();
+
+    // holdoff_ms 0 turns event capture off; edges are then ignored.
+    void configure(uint32_t interval_ms, uint32_t holdoff_ms);
+    uint32_t interval_ms() const { return m_interval_ms; }
+    uint32_t holdoff_ms() const { return m_holdoff_ms; }
+    bool events_enabled() const { return m_holdoff_ms > 0; }
+
+    // The first timer capture falls one interval after now_ms.
+    void start(uint32_t now_ms);
+
+    // The PIR output level as of now_ms. Call on every wake and on every edge
+    // interrupt; a low-to-high change outside the hold-off queues an event capture.
+    void on_pir(uint32_t now_ms, bool high);
+    // Which level should wake the chip: high while waiting for motion, low while
+    // the sensor is still holding its output up.
+    bool wake_on_high() const { return !m_pir_high; }
+
+    // What to capture now, if anything; an event goes first. Timer slots already
+    // covered or gone by are skipped here.
+    CaptureTrigger poll(uint32_t now_ms);
+    // How long the chip may sleep before the next timer slot, 0 if a capture is due.
+    uint32_t sleep_ms(uint32_t now_ms) const;
+    // Call once the frame poll() asked for has been taken.
+    void captured(CaptureTrigger trigger, uint32_t now_ms);
+
+    const SchedulerStats &stats() const { return m_stats; }
+
+private:
+    static bool reached(uint32_t now_ms, uint32_t deadline_ms) { return (int32_t)(now_ms - deadline_ms) >= 0; }
+    bool in_holdoff(uint32_t now_ms) const;
+    void advance_timer(uint32_t now_ms);
+
+    uint32_t m_interval_ms;
+    uint32_t m_holdoff_ms;
+    uint32_t m_next_timer_ms;
+    uint32_t m_last_event_ms;
+    bool m_has_event;    // m_last_event_ms is valid
+    bool m_event_pending;
+    bool m_pir_high;
+    SchedulerStats m_stats;
+};
+
+#endif // CAPTURE_SCHEDULER_H
@@ -0,0 +1,98 @@
+#ifndef CHANGE_DETECTOR_H
+#define CHANGE_DETECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// Coarse luma grid a frame is reduced to for comparison. VGA has 80x60 luma
+// blocks, so each cell averages 4x4 blocks (32x32 pixels).
+#define CHANGE_GRID_COLS 20
+#define CHANGE_GRID_ROWS 15
+#define CHANGE_GRID_CELLS (CHANGE_GRID_COLS * CHANGE_GRID_ROWS)
+#define CHANGE_CELL_DELTA 10 // A cell counts as changed when its mean luma moves by more than this
+
+// Mean luma of each grid cell, taken from the DC coefficients of a baseline JPEG.
+struct FrameSignature
+{
+    uint8_t cells[CHANGE_GRID_CELLS];
+};
+
+// Entropy-decodes the luma DC coefficients of a baseline (SOF0/SOF1) JPEG and
+// averages them into the grid; no IDCT and no chroma, so it costs a fraction
+// of a full decode. Returns false for progressive or malformed images.
+bool jpeg_dc_signature(const uint8_t *jpeg, size_t len, FrameSignature &signature);
+
+// Renders the preview-first mode's frame previews: PREVIEW_COLS x PREVIEW_ROWS
+// 8-bit luma, each pixel the mean of the 8x8 blocks under it, from the same
+// DC-only decode the change gate uses. It keeps its own tables and accumulators
+// (in PSRAM on the device), so the transfer task can render while
+// the capture task takes signatures.
+class PreviewRenderer
+{
+public:
+    PreviewRenderer();
+    ~PreviewRenderer();
+
+    bool begin();
+    void end();
+    // Fills pixels (PREVIEW_PIXELS bytes). False for images jpeg_dc_signature() would refuse.
+    bool render(const uint8_t *jpeg, size_t len, uint8_t *pixels);
+
+private:
+    struct Workspace;
+    Workspace *m_work;
+};
+
+// Percentage of cells that differ by more than CHANGE_CELL_DELTA once the mean
+// brightness shift between the two frames is taken out, so auto-exposure
+// drift alone does not count as change.
+uint8_t signature_change_percent(const FrameSignature &a, const FrameSignature &b);
+
+struct ChangeStats
+{
+    uint32_t captures;   // Frames examined
+    uint32_t skipped;    // Dropped as near-duplicates of the last kept frame
+    uint32_t keyframes;  // Kept only because the keyframe interval came round
+    uint32_t fallbacks;  // Judged by size because the signature could not be taken
+    uint8_t last_change; // Change score of the most recent frame, in percent
+};
+
+// Gate between the camera and the arena: a frame is kept when it differs from
+// the last kept frame by at least the threshold, or when keyframe_interval
+// captures have passed since the last keyframe. check() only decides; accept()
+// makes the candidate the new reference once the frame has actually been stored.
+class ChangeDetector
+{
+public:
+    ChangeDetector();
+
+    // threshold_percent 0 keeps every frame; keyframe_interval 0 never forces one.
+    void configure(uint8_t threshold_percent, uint16_t keyframe_interval);
+    uint8_t threshold() const { return m_threshold; }
+    uint16_t keyframe_interval() const { return m_keyframe_interval; }
+
+    // keep passes a frame that must be stored anyway (an event frame); it is
+    // still scored, and accept() still makes it the reference.
+    bool check(const uint8_t *jpeg, size_t len, bool keep = false);
+    void accept();
+    void reset();
+
+    const ChangeStats &stats() const { return m_stats; }
+    float skip_percent() const;
+
+private:
+    FrameSignature m_reference;
+    FrameSignature m_candidate;
+    size_t m_reference_len;
+    size_t m_candidate_len;
+    bool m_has_reference;
+    bool m_reference_signed; // m_reference holds a real signature, not just a size
+    bool m_candidate_signed;
+    uint8_t m_threshold;
+    uint16_t m_keyframe_interval;
+    uint16_t m_since_kept; // Captures skipped since the last kept frame
+    ChangeStats m_stats;
+};
+
+#endif // CHANGE_DETECTOR_H
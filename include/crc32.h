@@ -0,0 +1,11 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Standard CRC-32 (IEEE 802.3, same as zlib.crc32 on the server). Pass the previous
+// result as `crc` to continue over several buffers; start with 0.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len);
+
+#endif // CRC32_H
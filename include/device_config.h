@@ -0,0 +1,86 @@
+#ifndef DEVICE_CONFIG_H
+#define DEVICE_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Everything the server can tune, as the device holds it. The capture task owns
+// the live copy; transfer sessions read the chunk size and delays when they start.
+struct DeviceConfig
+{
+    uint32_t interval_s;         // Timelapse period
+    uint32_t budget_bytes;       // Batch byte budget; 0 flushes only when the arena would overflow
+    uint8_t change_pct;          // Change gate threshold in percent of the grid; 0 keeps every frame
+    uint16_t keyframe_interval;  // Keep at least one frame in this many captures; 0 never forces one
+    uint32_t frame_target_bytes; // JPEG size the rate controller aims for; 0 keeps the quality fixed
+    uint16_t event_holdoff_s;    // PIR retriggers this soon after an event capture are ignored; 0 turns PIR off
+    uint8_t burst_frames;        // Frames per motion capture; 0 or 1 takes a single frame
+    uint8_t burst_fps;           // Rate a burst is paced at
+    uint8_t frame_size;          // esp32-camera framesize_t; 4:3 sizes only (CONFIG_FRAME_SIZES)
+    uint8_t jpeg_quality;        // Starting quality; held there when frame_target_bytes is 0
+    uint8_t xclk_mhz;            // Sensor input clock
+    uint16_t chunk_size;         // Largest chunk payload; the negotiated MTU may allow less
+    uint16_t status_delay_ms;    // Pause after a status line before waiting on its answer
+    uint16_t chunk_delay_ms;     // Pause after each stop-and-wait chunk
+    uint16_t image_delay_ms;     // Pause between images sent one by one
+};
+
+// The config characteristic's format, all little-endian:
+//   "JKC1", u8 version, u8 0, then any number of (u8 tag, u8 length, value).
+// A write changes only the tags it carries; each has a fixed width and range
+// (see device_config.cpp) and the write is applied whole or not at all. Tags
+// are append-only, mirrored in srv/app/device_config.py; a tag added later
+// raises the version, and the device refuses versions newer than its own.
+// Reading the characteristic returns every tag except BUDGET_PCT.
+enum ConfigTag : uint8_t
+{
+    CONFIG_TAG_INTERVAL_S = 1,    // u32, 1..86400
+    CONFIG_TAG_BUDGET_PCT,        // u8, 2..95: budget as a share of the frame arena, stored as bytes
+    CONFIG_TAG_BUDGET_BYTES,      // u32, 0 or 16 KiB..arena capacity
+    CONFIG_TAG_CHANGE_PCT,        // u8, 0..100
+    CONFIG_TAG_KEYFRAME_INTERVAL, // u16, 0..1000
+    CONFIG_TAG_FRAME_TARGET,      // u32, 0 or 2 KiB..256 KiB
+    CONFIG_TAG_EVENT_HOLDOFF_S,   // u16, 0..600
+    CONFIG_TAG_BURST_FRAMES,      // u8, 0..BURST_FRAMES_MAX
+    CONFIG_TAG_BURST_FPS,         // u8, 1..30
+    CONFIG_TAG_FRAME_SIZE,        // u8, one of CONFIG_FRAME_SIZES
+    CONFIG_TAG_JPEG_QUALITY,      // u8, 4..63
+    CONFIG_TAG_XCLK_MHZ,          // u8, 8..20
+    CONFIG_TAG_CHUNK_SIZE,        // u16, WINDOW_MIN_CHUNK..CHUNK_SIZE
+    CONFIG_TAG_STATUS_DELAY_MS,   // u16, 0..1000
+    CONFIG_TAG_CHUNK_DELAY_MS,    // u16, 0..100
+    CONFIG_TAG_IMAGE_DELAY_MS,    // u16, 0..5000
+    CONFIG_TAG_END
+};
+
+// 4:3 frame sizes, as bits by esp32-camera framesize_t: QQVGA, QVGA, VGA, SVGA, XGA, UXGA.
+#define CONFIG_FRAME_SIZES ((1u << 1) | (1u << 5) | (1u << 8) | (1u << 9) | (1u << 10) | (1u << 13))
+#define CONFIG_FRAME_SIZE_VGA 8
+
+#define CONFIG_VERSION 1
+#define CONFIG_HEADER_SIZE 6
+#define CONFIG_ENCODED_MAX 96 // Every tag of the current version, with the header
+
+enum ConfigResult : uint8_t
+{
+    CONFIG_OK,
+    CONFIG_BAD_HEADER,   // Too short, or not "JKC1"
+    CONFIG_BAD_VERSION,  // Newer than this firmware
+    CONFIG_UNKNOWN_TAG,
+    CONFIG_BAD_LENGTH,   // A value of the wrong width, or cut off
+    CONFIG_OUT_OF_RANGE
+};
+
+// The firmware's built-in settings.
+DeviceConfig config_defaults();
+
+// Applies a write on top of `config`. On any error `config` is left as it was
+// and `bad_tag` names the offending tag (0 for the header). `arena_bytes` bounds
+// the budget and turns BUDGET_PCT into bytes.
+ConfigResult config_decode(const uint8_t *src, size_t len, DeviceConfig &config, size_t arena_bytes, uint8_t &bad_tag);
+
+// Every tag, for the characteristic's read value and the Preferences blob.
+// Returns the bytes written, 0 if capacity is below CONFIG_ENCODED_MAX.
+size_t config_encode(const DeviceConfig &config, uint8_t *dst, size_t capacity);
+
+#endif // DEVICE_CONFIG_H
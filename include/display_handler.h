@@ -3,7 +3,38 @@
 
 #include <Arduino.h> // Include for basic types if needed
 
+// Build with -D HEADLESS for boards without the OLED: every display call below
+// compiles to nothing, and the driver, its task and its buffers are left out.
+#ifdef HEADLESS
+inline void init_display() {}
+inline void update_display(int, const char *, bool = true) {}
+inline void flash_display(int, const char *, uint32_t) {}
+inline void display_sleep() {}
+inline void display_wake() {}
+#else
+#define DISPLAY_FRAME_MS 100 // At most one I2C flush per this many ms
+#define DISPLAY_TASK_STACK 3072
+
+struct DisplayStats
+{
+    uint32_t draws;      // update_display() calls
+    uint32_t flushes;    // Flushes that sent anything
+    uint32_t pages_sent; // 128x8 pages sent; a full refresh is 8
+    uint32_t reinits;    // Full init() after the panel stopped answering
+};
+
+// Draws go into the framebuffer under a lock and only mark the 128x8 pages they
+// touched; a low-priority task sends just those pages, at most once per
+// DISPLAY_FRAME_MS, so a burst of status updates costs one short I2C write.
 void init_display();
 void update_display(int line, const char *text, bool do_display = true);
+// Shows text on a line for duration_ms, then clears it, without blocking the caller.
+void flash_display(int line, const char *text, uint32_t duration_ms);
+// Panel off for light sleep, and back on after it. The panel keeps its RAM and
+// settings while off, so waking only re-inits it if it stopped answering.
+void display_sleep();
+void display_wake();
+const DisplayStats &display_stats();
+#endif
 
-#endif // DISPLAY_HANDLER_H
\ No newline at end of file
+#endif // DISPLAY_HANDLER_H
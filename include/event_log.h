@@ -0,0 +1,134 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include "log_formats.h"
+#include "protocol.h"
+#include "platform.h"
+#include <atomic>
+
+#define EVLOG_LEVEL_DEBUG 0
+#define EVLOG_LEVEL_INFO 1
+#define EVLOG_LEVEL_WARN 2
+#define EVLOG_LEVEL_ERROR 3
+#define EVLOG_LEVEL_NONE 4
+
+// Records below this level compile to nothing; set with -D EVLOG_LEVEL=0 for debug output.
+#ifndef EVLOG_LEVEL
+#define EVLOG_LEVEL EVLOG_LEVEL_INFO
+#endif
+
+#define EVENT_LOG_ARGS 6   // Arguments a record can carry
+#define EVENT_LOG_LINE 160 // Longest formatted line, including the time and level prefix
+
+struct LogRecord
+{
+    uint32_t time_ms; // platform_micros() / 1000 when written
+    uint16_t format;  // LogFormat
+    uint8_t level;
+    uint8_t argc;
+    uint32_t args[EVENT_LOG_ARGS]; // Integers, or floats by bit pattern
+};
+
+// A log that is cheap to write from anywhere: a call site stores a LogRecord
+// (format id plus raw arguments) in a lock-free ring, and the text is only
+// formatted by whoever drains it. Any task may write; a record that finds the
+// ring full is counted and dropped rather than waiting. Draining is serialized
+// by a lock, so a background flusher and an on-demand flush can share it.
+//
+// The newest drained records are kept so they can be read out over BLE.
+// encode() packs them in the log characteristic's format, all little-endian:
+//   "JKL1", u8 version, u8 0, u16 record count, u32 uptime_ms, u32 sequence of the first record,
+//   u32 records dropped since boot,
+//   record count x (u32 time_ms, u16 format, u8 level, u8 argc, argc x u32 args), oldest first.
+class EventLog
+{
+public:
+    static const uint8_t VERSION = 1;
+
+    EventLog();
+
+    void write(uint8_t level, uint16_t format, const uint32_t *args, uint8_t argc);
+
+    template <typename... A>
+    void log(uint8_t level, uint16_t format, A... args)
+    {
+        static_assert(sizeof...(A) <= EVENT_LOG_ARGS, "too many log arguments");
+        const uint32_t values[] = {0, arg(args)...};
+        write(level, format, values + 1, (uint8_t)sizeof...(A));
+    }
+
+    // Consumer side: takes the oldest record, or a LOGF_DROPPED note when records
+    // were lost since the last call. Call between lock_drain() and unlock_drain().
+    bool pop(LogRecord &record);
+    void lock_drain() { m_drain_lock.lock(); }
+    void unlock_drain() { m_drain_lock.unlock(); }
+
+    // Records still waiting to be drained.
+    size_t pending() const;
+    uint32_t written() const { return m_written.load(std::memory_order_relaxed); }
+    uint32_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+    // Sequence number the next drained record will get.
+    uint32_t drained() const { return m_drained; }
+    // Records taken from the ring so far, not counting drop notes; compare with
+    // written(). Call under the drain lock.
+    uint32_t taken() const { return m_tail; }
+
+    // Packs the kept records from sequence `from` onwards (or the oldest still
+    // kept, if that is later) until dst is full, and moves `from` past the last
+    // one packed. Returns the bytes written, 0 if not even the header fits.
+    size_t encode(uint8_t *dst, size_t capacity, uint32_t &from) const;
+
+    // "<seconds>.<ms> <level> <message>", truncated to capacity. Returns the length.
+    static size_t format(const LogRecord &record, char *dst, size_t capacity);
+    static const char *format_text(uint16_t format);
+
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence; // Bounded MPMC ring after D. Vyukov
+        LogRecord record;
+    };
+
+    static uint32_t arg(float value);
+    static uint32_t arg(double value) { return arg((float)value); }
+    template <typename T>
+    static uint32_t arg(T value) { return (uint32_t)value; }
+
+    Slot m_slots[EVENT_LOG_LEN];
+    std::atomic<uint32_t> m_head; // Next slot to claim
+    std::atomic<uint32_t> m_written;
+    std::atomic<uint32_t> m_dropped;
+
+    // Consumer state, under m_drain_lock.
+    mutable PlatformLock m_drain_lock;
+    uint32_t m_tail;
+    uint32_t m_reported_drops;
+    uint32_t m_drained;
+    LogRecord m_history[EVENT_LOG_HISTORY];
+};
+
+// The firmware's one log, written through the EVLOG_* macros.
+extern EventLog event_log;
+
+#if EVLOG_LEVEL <= EVLOG_LEVEL_DEBUG
+#define EVLOG_DEBUG(...) event_log.log(EVLOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define EVLOG_DEBUG(...) do { } while (0)
+#endif
+#if EVLOG_LEVEL <= EVLOG_LEVEL_INFO
+#define EVLOG_INFO(...) event_log.log(EVLOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define EVLOG_INFO(...) do { } while (0)
+#endif
+#if EVLOG_LEVEL <= EVLOG_LEVEL_WARN
+#define EVLOG_WARN(...) event_log.log(EVLOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define EVLOG_WARN(...) do { } while (0)
+#endif
+#if EVLOG_LEVEL <= EVLOG_LEVEL_ERROR
+#define EVLOG_ERROR(...) event_log.log(EVLOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define EVLOG_ERROR(...) do { } while (0)
+#endif
+
+#endif // EVENT_LOG_H
@@ -0,0 +1,97 @@
+#ifndef FLASH_STORE_H
+#define FLASH_STORE_H
+
+#include "frame_backlog.h"
+#include <stdio.h>
+
+// Second-tier store for batches that could not be delivered, on a flash
+// filesystem: LittleFS on the device, a plain directory in the native build.
+// Only stdio is used, so the same code runs against both.
+//
+// Each spilled batch becomes one segment file, written front to back in
+// FLASH_WRITE_BLOCK pieces with the JPEGs back to back. An append-only index file
+// records where every frame lives and which ones have been delivered; begin()
+// replays it into RAM and compacts it once it is mostly stale. When flash fills,
+// whole segments are evicted, oldest first.
+//
+// Spilling and sending both happen on the transfer task, so there is no locking.
+class FlashStore : public FrameBacklog
+{
+public:
+    FlashStore();
+    ~FlashStore();
+
+    bool begin(const char *dir, size_t capacity);
+    void end();
+
+    // Moves every frame in `source` into a new segment, evicting old segments to
+    // make room. Returns the number of frames spilled.
+    int spill(FrameBacklog &source);
+
+    // --- FrameBacklog: spilled frames, oldest first ---
+    int count() const override { return m_count; }
+    bool peek_at(int index, FrameRef &frame) const override;
+    void read(int index, size_t offset, uint8_t *dst, size_t len) const override;
+    void release_front() override;
+
+    size_t used_bytes() const { return m_used_bytes; }
+    size_t capacity() const { return m_capacity; }
+    uint32_t evicted() const { return m_evicted; }
+
+private:
+    struct Entry
+    {
+        uint32_t segment;
+        uint32_t offset; // Within the segment file
+        uint32_t id;
+        uint32_t length;
+        uint32_t timestamp_ms;
+        uint32_t crc32;
+    };
+
+    // One 32-byte index record. A frame record carries its entry (an event frame
+    // record is the same, for a frame with FRAME_FLAG_EVENT); a release record
+    // marks every frame up to entry.id as delivered.
+    struct IndexRecord
+    {
+        uint32_t kind;
+        Entry entry;
+        uint32_t check; // CRC-32 of the fields above, so a torn append is ignored on replay
+    };
+
+    static const uint32_t RECORD_FRAME = 0x454D5246;       // "FRME"
+    static const uint32_t RECORD_EVENT_FRAME = 0x52465645; // "EVFR"
+    static const uint32_t RECORD_RELEASE = 0x534C4552;     // "RELS"
+
+    const Entry &entry(int index) const { return m_entries[(m_first + index) % FLASH_INDEX_MAX]; }
+    uint8_t flags(int index) const { return m_flags[(m_first + index) % FLASH_INDEX_MAX]; }
+    void push_entry(const Entry &entry, uint8_t flags);
+    void segment_path(uint32_t segment, char *out, size_t size) const;
+    size_t segment_bytes(uint32_t segment) const;
+    void delete_segment(uint32_t segment);
+    void evict_oldest_segment();
+    bool append_records(const IndexRecord *records, int count);
+    static IndexRecord make_record(uint32_t kind, const Entry &entry);
+    static IndexRecord make_frame_record(const Entry &entry, uint8_t flags);
+    bool replay_index();
+    void compact_index();
+    void remove_orphans();
+    void close_reader() const;
+
+    char m_dir[32];
+    size_t m_capacity;
+    size_t m_used_bytes;
+    Entry *m_entries; // Ring of FLASH_INDEX_MAX live frames
+    uint8_t *m_flags; // Their FRAME_FLAG_* bits, in step with m_entries
+    int m_first;
+    int m_count;
+    uint32_t m_next_segment;
+    uint32_t m_index_records; // Records in the index file, live or stale
+    uint32_t m_evicted;
+    FILE *m_index;
+    mutable FILE *m_reader; // The segment last read from, kept open across chunk reads
+    mutable uint32_t m_reader_segment;
+    uint8_t m_block[FLASH_WRITE_BLOCK];
+};
+
+#endif // FLASH_STORE_H
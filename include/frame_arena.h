@@ -0,0 +1,95 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include "protocol.h"
+#include "platform.h"
+
+// A stored frame, pointing straight into the arena.
+struct FrameRef
+{
+    const uint8_t *data;
+    size_t len;
+    uint32_t id;           // Monotonic capture number
+    uint32_t timestamp_ms; // Capture time on the device clock
+    uint32_t crc32;        // Of the JPEG bytes, computed once at capture
+    uint32_t flags;        // FRAME_FLAG_*
+};
+
+// Walks the arena oldest-first without releasing anything.
+struct FrameCursor
+{
+    size_t offset;
+    int remaining;
+};
+
+// One preallocated ring of contiguous, length-prefixed frame records. Appends are
+// O(1), frames are released in capture order once delivered, and the oldest
+// frames are evicted when a new one does not fit. Each record is kept
+// contiguous (a wrap marker pads the end of the ring) so the transfer path can
+// read JPEGs directly out of the arena.
+//
+// The capture task appends and the transfer task releases, concurrently. While
+// the transfer side has the arena pinned nothing is evicted; a frame that does
+// not fit is dropped instead, so the bytes being sent are never overwritten.
+class FrameArena
+{
+public:
+    FrameArena();
+
+    bool begin(size_t capacity);
+    void end();
+
+    // --- Capture side ---
+    bool append(const uint8_t *data, size_t len, uint32_t timestamp_ms, uint32_t flags = 0);
+    const FrameRef &newest() const { return m_newest; }
+
+    // --- Transfer side ---
+    bool oldest(FrameRef &frame) const;
+    void release_oldest();
+    void set_pinned(bool pinned);
+    void clear();
+
+    FrameCursor cursor() const;
+    bool next(FrameCursor &cursor, FrameRef &frame) const;
+
+    int count() const;
+    size_t capacity() const { return m_capacity; }
+    size_t payload_bytes() const;
+    size_t used_bytes() const;
+    uint32_t evicted() const { return m_evicted; }
+    uint32_t dropped() const { return m_dropped; }
+
+private:
+    struct RecordHeader
+    {
+        uint32_t length; // JPEG bytes following the header, or WRAP_MARKER
+        uint32_t id;
+        uint32_t timestamp_ms;
+        uint32_t crc32;
+        uint32_t flags;
+    };
+
+    static const uint32_t WRAP_MARKER = 0xFFFFFFFF;
+
+    static size_t record_size(size_t len);
+    size_t resolve(size_t offset) const;
+    bool reserve(size_t size, size_t &offset);
+    void reset();
+    void release_oldest_locked();
+
+    mutable PlatformLock m_lock;
+    uint8_t *m_buffer;
+    size_t m_capacity;
+    size_t m_head;          // Where the next record goes
+    size_t m_tail;          // Oldest record
+    size_t m_used_bytes;    // Records plus wrap padding
+    size_t m_payload_bytes; // JPEG bytes only
+    int m_count;
+    bool m_pinned;
+    uint32_t m_next_id;
+    uint32_t m_evicted;
+    uint32_t m_dropped;
+    FrameRef m_newest;
+};
+
+#endif // FRAME_ARENA_H
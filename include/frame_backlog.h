@@ -0,0 +1,59 @@
+#ifndef FRAME_BACKLOG_H
+#define FRAME_BACKLOG_H
+
+#include "frame_queue.h"
+
+// Frames waiting to be sent, oldest first, wherever they are kept. The transfer
+// path reads JPEG bytes through read(), so a frame need not be in memory.
+class FrameBacklog
+{
+public:
+    virtual ~FrameBacklog() {}
+
+    virtual int count() const = 0;
+    // Metadata of the frame `index` places from the front; data is NULL when the
+    // frame is not in memory.
+    virtual bool peek_at(int index, FrameRef &frame) const = 0;
+    virtual void read(int index, size_t offset, uint8_t *dst, size_t len) const = 0;
+    // The server has the front frame; drop it.
+    virtual void release_front() = 0;
+};
+
+// The queued frames in the PSRAM arena. Keeps the arena pinned while it exists,
+// so nothing being sent can be evicted.
+class ArenaBacklog : public FrameBacklog
+{
+public:
+    ArenaBacklog(FrameArena &arena, FrameQueue &queue);
+    ~ArenaBacklog();
+
+    int count() const override { return (int)m_queue.size(); }
+    bool peek_at(int index, FrameRef &frame) const override;
+    void read(int index, size_t offset, uint8_t *dst, size_t len) const override;
+    void release_front() override;
+
+private:
+    void prune();
+
+    FrameArena &m_arena;
+    FrameQueue &m_queue;
+};
+
+// One backlog drained before another, e.g. frames spilled to flash ahead of the
+// newer ones still in PSRAM.
+class ChainedBacklog : public FrameBacklog
+{
+public:
+    ChainedBacklog(FrameBacklog &first, FrameBacklog &second) : m_first(first), m_second(second) {}
+
+    int count() const override { return m_first.count() + m_second.count(); }
+    bool peek_at(int index, FrameRef &frame) const override;
+    void read(int index, size_t offset, uint8_t *dst, size_t len) const override;
+    void release_front() override;
+
+private:
+    FrameBacklog &m_first;
+    FrameBacklog &m_second;
+};
+
+#endif // FRAME_BACKLOG_H
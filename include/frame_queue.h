@@ -0,0 +1,11 @@
+#ifndef FRAME_QUEUE_H
+#define FRAME_QUEUE_H
+
+#include "spsc_queue.h"
+#include "frame_arena.h"
+
+// Descriptors of stored frames, handed from the capture task to the transfer task
+// in capture order.
+typedef SpscQueue<FrameRef, FRAME_QUEUE_LEN> FrameQueue;
+
+#endif // FRAME_QUEUE_H
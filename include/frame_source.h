@@ -0,0 +1,26 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One captured JPEG, owned by the source until release() is called.
+struct Frame
+{
+    const uint8_t *buf;
+    size_t len;
+    void *handle;         // Source-specific (camera_fb_t* on the device)
+    uint64_t captured_us; // When the sensor delivered it, on the platform_micros() clock
+};
+
+// Where frames come from: esp_camera_fb_get() on the device, fixture files on the host.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    virtual bool acquire(Frame &frame) = 0;
+    virtual void release(Frame &frame) = 0;
+};
+
+#endif // FRAME_SOURCE_H
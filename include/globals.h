@@ -2,25 +2,80 @@
 #define GLOBALS_H
 
 #include <Arduino.h>
-#include "SSD1306.h"
 #include "esp_camera.h"
 #include <BLEDevice.h>
 #include <Preferences.h>
 #include "esp_sleep.h" // Added for light sleep
+#include "freertos/event_groups.h"
+#include "protocol.h"
+#include "frame_queue.h"
+#include "flash_store.h"
+#include "storage_manager.h"
+#include "transfer_session.h"
+#include "device_config.h"
+#include "quality_controller.h"
+#include "telemetry.h"
+#include "capture_scheduler.h"
+#include "burst_capture.h"
+#include "sensor_warmup.h"
+#include "log_handler.h"
+#include "power_handler.h"
 
 // --- PROTOCOL & BATCH CONFIGURATION ---
-#define CHUNK_SIZE 512
-#define IMAGE_BATCH_SIZE 20 // Maximum number of images we can buffer in PSRAM
 #ifndef BLE_DEVICE_NAME
 #define BLE_DEVICE_NAME "T-Camera-BLE-Batch"
 #endif
 
+// Reported with the telemetry so regressions can be pinned to a build; override with -D FIRMWARE_BUILD=\"...\".
+#ifndef FIRMWARE_BUILD
+#define FIRMWARE_BUILD __DATE__ " " __TIME__
+#endif
+
+// --- FLASH SPILL STORE ---
+#define SPILL_PARTITION_LABEL "spill" // See partitions_spill.csv
+#define SPILL_MOUNT_POINT "/spill"
+
+// --- TASKS ---
+#define CAPTURE_TASK_STACK 8192
+#define TRANSFER_TASK_STACK 8192
+
+// --- BLE LINK PARAMETERS ---
+// Requested for the length of a transfer, then relaxed for the idle tail of the connection.
+#define LINK_FAST_INTERVAL_MIN 6     // 7.5 ms, in 1.25 ms units
+#define LINK_FAST_INTERVAL_MAX 12    // 15 ms
+#define LINK_IDLE_INTERVAL_MIN 40    // 50 ms
+#define LINK_IDLE_INTERVAL_MAX 80    // 100 ms
+#define LINK_SUPERVISION_TIMEOUT 400 // 4 s, in 10 ms units
+#define LINK_DATA_LEN_MAX 251        // LL payload octets with data length extension
+#define LINK_DATA_LEN_DEFAULT 27     // Bluetooth 4.0 packets
+#define LINK_UPDATE_WAIT_MS 500      // How long a session waits for the central to answer
+
+// --- BLE ADVERTISING ---
+// A flush window advertises at a fast interval first, when a server holding a
+// direct connection request connects on the first packet, then drops to a
+// slower one for the rest of the wait.
+#define ADV_FAST_INTERVAL_MIN 32  // 20 ms, in 0.625 ms units
+#define ADV_FAST_INTERVAL_MAX 48  // 30 ms
+#define ADV_SLOW_INTERVAL_MIN 244 // 152.5 ms
+#define ADV_SLOW_INTERVAL_MAX 338 // 211.25 ms
+#define ADV_FAST_WINDOW_MS 5000
+#define CONNECT_WAIT_MS 30000     // Whole window, fast part included
+
+// --- BLE LINK EVENTS (see wait_link_event()) ---
+#define LINK_EVENT_CONNECTED BIT0    // A client is connected
+#define LINK_EVENT_DISCONNECTED BIT1 // No client is connected
+#define LINK_EVENT_READY BIT2        // The server sent 'R' on this connection
+#define LINK_EVENT_PARAMS BIT3       // The central answered a connection parameter request
+#define LINK_EVENT_ONE_SHOT LINK_EVENT_PARAMS
+
 // --- BLE UUIDs ---
 #define SERVICE_UUID "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
 #define CHARACTERISTIC_UUID_STATUS "beb5483e-36e1-4688-b7f5-ea07361b26a8"
 #define CHARACTERISTIC_UUID_DATA "7347e350-5552-4822-8243-b8923a4114d2"
 #define CHARACTERISTIC_UUID_COMMAND "a244c201-1fb5-459e-8fcc-c5c9c331914b"
 #define CHARACTERISTIC_UUID_CONFIG "a31a6820-8437-4f55-8898-5226c04a29a3"
+#define CHARACTERISTIC_UUID_TELEMETRY "d2a5c7f0-3b8e-4c1a-9f62-5e0b7a41c3d8"
+#define CHARACTERISTIC_UUID_LOG "6e1f3b9a-84c2-4d7e-a5f0-2c9b8d17e4a6"
 
 // --- Pin Definitions (Unchanged) ---
 #define PWDN_GPIO_NUM -1
@@ -41,36 +96,54 @@
 #define PCLK_GPIO_NUM 25
 #define I2C_SDA 21
 #define I2C_SCL 22
+#define PIR_GPIO_NUM 19 // AS312 output, active high; not an RTC pin, so light sleep only
 
 // --- CONFIGURATION SETTINGS (Loaded from NVS) ---
-extern int deep_sleep_seconds;
-extern float storage_threshold_percent;
+// Written only by the capture task (apply_new_settings()); other tasks go through
+// transfer_timing() and encode_settings().
+extern DeviceConfig device_config;
 
 // --- GLOBAL OBJECTS ---
-extern SSD1306 display;
 extern Preferences preferences;
 extern BLECharacteristic *pStatusCharacteristic;
+extern FrameArena image_arena;
+extern FrameQueue frame_queue;
+extern FlashStore spill_store;
+extern ChangeDetector change_detector;
+extern QualityController rate_controller;
+extern Telemetry telemetry;
+extern PowerPolicy power_policy;
+extern CaptureScheduler capture_scheduler;
+extern BurstCapture burst_capture;
+extern SensorWarmup sensor_warmup;
 
 // --- GLOBAL STATE FLAGS ---
 extern volatile bool client_connected;
-extern volatile bool next_chunk_requested;
-extern volatile bool transfer_acknowledged;
-extern volatile bool new_config_received;
-extern volatile bool server_ready_for_data; // FIX: Flag for handshake
-extern int image_count;
-extern char pending_config_str[64]; // FIX: Buffer to hold incoming settings
+extern volatile bool new_config_received; // A validated write is waiting for the capture task
+extern volatile uint8_t transfer_window;     // 0 = legacy stop-and-wait, otherwise negotiated window size
+extern volatile bool transfer_in_progress;   // Set by the capture task, cleared by the transfer task
 
 // --- FUNCTION PROTOTYPES ---
-void init_display();
-void update_display(int line, const char *text, bool do_display);
 void init_camera();
 void deinit_camera();
 void start_bluetooth();
 void stop_bluetooth(); // New function for BLE shutdown
-void send_batched_data();
-bool store_image_in_psram();
+void slow_advertising(); // Past ADV_FAST_WINDOW_MS without a connection
+// Blocks until any of the LINK_EVENT_* bits in `events` is set, or the timeout;
+// returns the ones that were. The BLE callbacks set them, so the wait ends the
+// moment the event happens.
+EventBits_t wait_link_event(EventBits_t events, uint32_t timeout_ms);
+bool send_batched_data();
+void publish_telemetry();
+void publish_log();
+StoreResult store_image_in_psram(uint32_t flags);
 void load_settings();
-void apply_new_settings(); // FIX: New function to safely apply settings
-void clear_image_buffers();
+// From the config characteristic (BLE task): validates the write on top of any
+// settings still pending and hands them to the capture task.
+ConfigResult queue_settings(const uint8_t *data, size_t len, uint8_t &bad_tag);
+// The settings as they will stand once anything pending is applied.
+size_t encode_settings(uint8_t *dst, size_t capacity);
+TransferTiming transfer_timing();
+void apply_new_settings(); // On the capture task: applies and saves pending settings
 
 #endif // GLOBALS_H
\ No newline at end of file
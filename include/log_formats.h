@@ -0,0 +1,64 @@
+#ifndef LOG_FORMATS_H
+#define LOG_FORMATS_H
+
+#include <stdint.h>
+
+// Every message the event log can carry. A record holds only the index into this
+// list and its arguments, so entries are append-only: srv/app/device_log.py
+// decodes by position. Arguments are 32-bit integers or floats, so the
+// conversions are limited to %d %i %u %x %X %c %f (with flags, width and
+// precision) and %%.
+#define LOG_FORMATS(X)                                                                                             \
+    X(LOGF_DROPPED, "Log overflow: %u records dropped")                                                            \
+    X(LOGF_STREAM_PROGRESS, "Sent %u/%u bytes")                                                                   \
+    X(LOGF_STREAM_ACKED, "Acked %u/%u chunks")                                                                    \
+    X(LOGF_COMMAND, "Received command: %c (0x%02X)")                                                               \
+    X(LOGF_SERVER_ACK, "ACK received from server")                                                                 \
+    X(LOGF_SERVER_READY, "Received 'Ready' signal from server")                                                    \
+    X(LOGF_SERVER_WINDOW, "Server requested transfer window of %u chunks")                                         \
+    X(LOGF_SERVER_RESUME, "Server holds frame %u up to byte %u (we last saw frame %u byte %u)")                    \
+    X(LOGF_SERVER_CONTAINER, "Server accepts batch containers")                                                    \
+    X(LOGF_SERVER_PREVIEWS, "Server wants previews first; unpicked frames are kept for %u min")                    \
+    X(LOGF_CONFIG_QUEUED, "Queued %u bytes of new settings")                                                       \
+    X(LOGF_CLIENT_CONNECTED, "Client connected")                                                                   \
+    X(LOGF_CLIENT_DISCONNECTED, "Client disconnected")                                                             \
+    X(LOGF_CPU_FREQ, "CPU at %u MHz")                                                                              \
+    X(LOGF_WAKE_TO_FRAME, "Wake to frame: %u ms, skipped %u stale and %u settling frames (exposure usually needs %.1f)") \
+    X(LOGF_MOTION_CAPTURE, "Motion capture. Events: %u taken, %u retriggers ignored; timer: %u taken, %u covered by events") \
+    X(LOGF_TIMELAPSE_CAPTURE, "Timelapse capture. Events: %u taken, %u retriggers ignored; timer: %u taken, %u covered by events") \
+    X(LOGF_BURST, "Burst %u: %u/%u frames over %u ms, %.1f fps achieved (asked %u)")                               \
+    X(LOGF_STORE_FAILED, "Failed to store image. Check camera or frame arena")                                     \
+    X(LOGF_QUEUE_FULL, "Frame queue full; frame stays in the arena for a later batch")                             \
+    X(LOGF_RATE_CONTROL, "Rate control: %u bytes at q%u 1/%u (target %u) -> q%u 1/%u")                             \
+    X(LOGF_CHANGE_GATE, "Change gate: %u%% changed, skipped %u of %u captures (%.1f%%), %u keyframes")             \
+    X(LOGF_ARENA_FILL, "PSRAM: %.1f%% | Imgs: %d")                                                                 \
+    X(LOGF_DISPLAY_STATS, "Display: %u updates in %u flushes, %u pages sent (a full refresh per update would be %u)") \
+    X(LOGF_POWER, "Power per frame: %u ms at full clock, %u ms awake, %u ms idle, %u ms asleep; %.2f mJ (fixed clocks %.2f)") \
+    X(LOGF_CONFIG_REJECTED, "Rejected %u bytes of settings: error %u at tag %u")                                   \
+    X(LOGF_CONNECT_TIME, "Client connected after %u ms of advertising (fast interval %u, bonded peer %u)")         \
+    X(LOGF_BONDED, "Link encrypted with the server's bond (new bond %u)")                                          \
+    X(LOGF_BOND_FAILED, "Pairing with the server failed: reason 0x%02X")                                           \
+    X(LOGF_STATUS_SENT, "Sent status %c%c%c%c... (%u bytes); waiting for ACK")                                     \
+    X(LOGF_STATUS_ACKED, "Server ACK after %u ms")                                                                 \
+    X(LOGF_STREAM_DONE, "Stream complete: %u bytes in %u chunks, %u retransmits")                                  \
+    X(LOGF_SENDING_IMAGE, "Sending image %u of %u (%u bytes)")                                                     \
+    X(LOGF_WINDOWED, "Using windowed transfer: %u chunks of %u bytes")                                             \
+    X(LOGF_WINDOW_FALLBACK, "Notifications carry only %u bytes; using stop-and-wait instead of a window")          \
+    X(LOGF_RESUME_UNKNOWN, "Resume point (frame %u) matches nothing queued; sending the batch from the start")     \
+    X(LOGF_RESUMING, "Resuming at frame %u byte %u (%u frames already delivered)")                                 \
+    X(LOGF_PICK_ASKED, "Asked the server to pick from %u previews")                                                \
+    X(LOGF_PICK_UNKNOWN, "Pick for frame %u, which was not previewed; ignored")                                    \
+    X(LOGF_PICKED, "Server wants %u of %u previewed frames in full")                                               \
+    X(LOGF_PICKS_EXPIRED, "Released %u frames nobody picked within the retention window")
+
+#define LOG_FORMAT_ENUM(id, text) id,
+
+enum LogFormat : uint16_t
+{
+    LOG_FORMATS(LOG_FORMAT_ENUM)
+    LOG_FORMAT_COUNT
+};
+
+#undef LOG_FORMAT_ENUM
+
+#endif // LOG_FORMATS_H
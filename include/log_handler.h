@@ -0,0 +1,24 @@
+#ifndef LOG_HANDLER_H
+#define LOG_HANDLER_H
+
+#include "event_log.h"
+
+#define LOG_FLUSH_PERIOD_MS 50     // How often the flusher looks for records
+#define LOG_UART_TX_BUFFER 2048    // Serial TX buffer, so a line is handed off without waiting for the wire
+#define LOG_TASK_STACK 3072
+#define LOG_TEXT_LINE 192          // Longest PLATFORM_LOG line; longer ones are cut
+#define LOG_TEXT_QUEUE 2048        // Bytes of PLATFORM_LOG lines waiting for the flusher
+
+// Prints the event log, and the lines PLATFORM_LOG queues, from a low-priority
+// task. A text line goes out once every record written before it has, so the
+// two stay in order. A line is only written while the serial TX buffer has
+// room for all of it, so the flusher never waits on the UART and never delays
+// anything else that prints. Lines queued before init_log() are printed
+// directly. Call before Serial.begin().
+void init_log();
+// Hands everything still queued to the UART, waiting for room as needed: before
+// a light sleep or a clock change (followed by Serial.flush()), or when the
+// records must be out before they are read back.
+void log_drain();
+
+#endif // LOG_HANDLER_H
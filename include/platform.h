@@ -0,0 +1,103 @@
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Thin shims that let the batching/transfer code compile both on the ESP32 and in
+// the native host build (env:native).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+
+// Formats a line and queues it for the log task, in order with the event log's
+// records (see log_handler.h); never waits on the UART. For boot and error
+// paths: anything that runs per frame or per command writes an EVLOG_* record.
+void platform_log(const char *format, ...) __attribute__((format(printf, 1, 2)));
+#define PLATFORM_LOG(...) platform_log(__VA_ARGS__)
+
+// Mutex for state shared between the capture and transfer tasks. A FreeRTOS mutex
+// rather than a critical section, since holders may copy a whole JPEG.
+class PlatformLock
+{
+public:
+    PlatformLock() { m_handle = xSemaphoreCreateMutexStatic(&m_storage); }
+    void lock() { xSemaphoreTake(m_handle, portMAX_DELAY); }
+    void unlock() { xSemaphoreGive(m_handle); }
+
+private:
+    StaticSemaphore_t m_storage;
+    SemaphoreHandle_t m_handle;
+};
+
+inline void *platform_alloc_large(size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+}
+
+inline void platform_free_large(void *ptr)
+{
+    heap_caps_free(ptr);
+}
+
+// Microseconds since boot; keeps counting through light sleep.
+inline uint64_t platform_micros()
+{
+    return (uint64_t)esp_timer_get_time();
+}
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <mutex>
+
+class PlatformLock
+{
+public:
+    void lock() { m_mutex.lock(); }
+    void unlock() { m_mutex.unlock(); }
+
+private:
+    std::mutex m_mutex;
+};
+
+// The host build stays quiet unless built with -D NATIVE_VERBOSE.
+#ifdef NATIVE_VERBOSE
+#define PLATFORM_LOG(...) printf(__VA_ARGS__)
+#else
+#define PLATFORM_LOG(...) do { if (0) printf(__VA_ARGS__); } while (0)
+#endif
+
+inline void *platform_alloc_large(size_t size)
+{
+    return malloc(size);
+}
+
+inline void platform_free_large(void *ptr)
+{
+    free(ptr);
+}
+
+inline uint64_t platform_micros()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+#endif
+
+// Holds a PlatformLock for the rest of the scope.
+class PlatformLockGuard
+{
+public:
+    explicit PlatformLockGuard(PlatformLock &lock) : m_lock(lock) { m_lock.lock(); }
+    ~PlatformLockGuard() { m_lock.unlock(); }
+
+private:
+    PlatformLock &m_lock;
+};
+
+#endif // PLATFORM_H
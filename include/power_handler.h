@@ -0,0 +1,27 @@
+#ifndef POWER_HANDLER_H
+#define POWER_HANDLER_H
+
+#include "power_policy.h"
+
+#define POWER_MAX_MHZ 240
+#define POWER_MIN_MHZ 80 // The APB clock stays at 80 MHz, so UART, I2C and camera timing never change
+
+// Hands the policy's locks to esp_pm when the core is built with CONFIG_PM_ENABLE:
+// dynamic frequency scaling between POWER_MIN_MHZ and POWER_MAX_MHZ, plus
+// automatic light sleep where FreeRTOS tickless idle is built in. Otherwise
+// the CPU_MAX lock switches the clock with setCpuFrequencyMhz() and nothing
+// sleeps on its own.
+//
+// POWER_PHASE_ADVERTISE holds no lock, so the connect wait can light-sleep
+// between advertising events. The BT controller only allows that when built
+// with modem sleep on an external 32 kHz crystal (CONFIG_BTDM_CTRL_MODEM_SLEEP,
+// CONFIG_BTDM_CTRL_LPCLK_SEL_EXT_32K_XTAL); with the main-crystal clock it
+// keeps its own no-light-sleep lock while enabled and the wait runs at the
+// idle clock instead.
+void init_power(PowerPolicy &policy);
+// Whether idle time can be spent in automatic light sleep.
+bool power_auto_sleep();
+// Current model for the energy estimate, with the idle current to match.
+PowerModel power_model();
+
+#endif // POWER_HANDLER_H
@@ -0,0 +1,127 @@
+#ifndef POWER_POLICY_H
+#define POWER_POLICY_H
+
+#include "platform.h"
+
+// What the power backend can be asked to hold.
+enum PowerLock : uint8_t
+{
+    POWER_LOCK_CPU_MAX,  // CPU at full clock
+    POWER_LOCK_NO_SLEEP, // No automatic light sleep (DMA or the radio is running)
+    POWER_LOCK_COUNT
+};
+
+// Work that needs more than the idle clock. Each holds a fixed set of locks
+// (see power_policy.cpp); outside them the chip may drop to the minimum clock
+// and, where the backend can, light-sleep on its own.
+enum PowerPhase : uint8_t
+{
+    POWER_PHASE_CAPTURE,   // Camera acquire, warm-up and bursts: full clock, DMA running
+    POWER_PHASE_STORE,     // Change gate and the copy into the arena: full clock
+    POWER_PHASE_ADVERTISE, // BLE up, waiting for the server to connect: holds nothing (see power_handler.h)
+    POWER_PHASE_LINK,      // Connected (ready/disconnect waits): radio running, idle clock
+    POWER_PHASE_TRANSFER,  // Streaming the batch: full clock, radio running
+    POWER_PHASE_COUNT
+};
+
+enum PowerState : uint8_t
+{
+    POWER_STATE_MAX,   // CPU_MAX held
+    POWER_STATE_AWAKE, // Only NO_SLEEP held: minimum clock, no automatic sleep
+    POWER_STATE_IDLE,  // Nothing held: minimum clock, or asleep if the backend sleeps automatically
+    POWER_STATE_SLEEP, // An explicit light sleep between frames
+    POWER_STATE_COUNT
+};
+
+struct PowerStats
+{
+    uint64_t time_us[POWER_STATE_COUNT];
+    uint64_t phase_us;  // Awake with any phase held, which the fixed clocks ran at full speed
+    uint32_t frames;    // Frames captured
+    uint32_t switches;  // Lock acquisitions and releases passed to the backend
+};
+
+// Supply current per state in mA, CPU only: the radio and camera draw the same
+// whichever clock is chosen, so they are left out of the comparison.
+struct PowerModel
+{
+    float max_ma;   // 240 MHz
+    float awake_ma; // 80 MHz
+    float idle_ma;  // Nothing held: awake_ma without automatic light sleep
+    float sleep_ma; // Light sleep
+    float volts;
+};
+
+// esp_pm on the device (or a fixed-clock fallback), a recorder in the native bench.
+class PowerBackend
+{
+public:
+    virtual ~PowerBackend() {}
+
+    virtual void acquire(PowerLock lock) = 0;
+    virtual void release(PowerLock lock) = 0;
+};
+
+// Turns phases into locks and keeps time-in-state counters. Phases nest and
+// may be held by several tasks at once; a lock goes to the backend when the
+// first phase needing it starts and back when the last one ends. Times default
+// to platform_micros(); the bench passes its own timeline.
+class PowerPolicy
+{
+public:
+    PowerPolicy();
+
+    // Without a backend the policy only keeps the counters.
+    void begin(PowerBackend *backend, uint64_t now_us = platform_micros());
+
+    void enter(PowerPhase phase, uint64_t now_us = platform_micros());
+    void leave(PowerPhase phase, uint64_t now_us = platform_micros());
+    // Around an explicit esp_light_sleep_start().
+    void sleep_begin(uint64_t now_us = platform_micros());
+    void sleep_end(uint64_t now_us = platform_micros());
+    void count_frame();
+
+    PowerState state() const;
+    PowerStats stats(uint64_t now_us = platform_micros()) const;
+
+    // Estimated CPU energy per captured frame in mJ, under this policy and under
+    // the fixed clocks it replaces (full speed whenever a phase is held, 80 MHz
+    // otherwise while awake).
+    static float energy_per_frame_mj(const PowerStats &stats, const PowerModel &model);
+    static float fixed_clock_energy_per_frame_mj(const PowerStats &stats, const PowerModel &model);
+
+private:
+    PowerState state_locked() const;
+    void account(uint64_t now_us);
+
+    mutable PlatformLock m_lock;
+    PowerBackend *m_backend;
+    uint8_t m_phases[POWER_PHASE_COUNT];
+    uint8_t m_locks[POWER_LOCK_COUNT];
+    uint8_t m_held; // Phases held, over all kinds
+    bool m_sleeping;
+    uint64_t m_since; // When the counters were last brought up to date
+    PowerStats m_stats;
+};
+
+// Holds a phase for the rest of the scope.
+class PowerPhaseGuard
+{
+public:
+    PowerPhaseGuard(PowerPolicy *policy, PowerPhase phase) : m_policy(policy), m_phase(phase)
+    {
+        if (m_policy)
+            m_policy->enter(m_phase);
+    }
+    ~PowerPhaseGuard()
+    {
+        if (m_policy)
+            m_policy->leave(m_phase);
+    }
+
+private:
+    PowerPolicy *m_policy;
+    PowerPhase m_phase;
+};
+
+#endif // POWER_POLICY_H
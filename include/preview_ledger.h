@@ -0,0 +1,92 @@
+#ifndef PREVIEW_LEDGER_H
+#define PREVIEW_LEDGER_H
+
+#include "frame_backlog.h"
+
+// Preview-first mode's record of which backlog frames the server has seen a
+// preview of. Those are always a prefix of the backlog, oldest first; each one
+// stays queued until the server has pulled it in full, or until it has been
+// held for the retention window without being asked for.
+//
+// The entries live in PSRAM and survive between sessions. sync() lines them up
+// with the backlog again, since frames can be evicted from the arena or the
+// flash store while no one is connected.
+class PreviewLedger
+{
+public:
+    PreviewLedger();
+    ~PreviewLedger();
+
+    bool begin(int capacity);
+    void end();
+
+    void set_retention_ms(uint32_t ms) { m_retention_ms = ms; }
+    uint32_t retention_ms() const { return m_retention_ms; }
+
+    // Drops entries whose frames have left the backlog.
+    void sync(const FrameBacklog &backlog);
+    // Frames at the front of the backlog that have been previewed.
+    int count() const { return m_count; }
+    int capacity() const { return m_capacity; }
+    // Records frames count() .. count() + n - 1 of the backlog as previewed now.
+    // Returns how many fitted.
+    int add(const FrameBacklog &backlog, int n, uint32_t now_ms);
+
+    // The server asks for frame `id` in full; false when it has not been previewed.
+    bool pick(uint32_t id);
+    bool picked(int index) const { return entry(index).state == PICKED; }
+    void mark_delivered(int index) { entry(index).state = DELIVERED; }
+
+    // Releases previewed frames off the front of the backlog that were delivered
+    // or have outlived the retention window, and forgets any pick that was not
+    // sent. Returns the number of frames dropped without being delivered.
+    int release(FrameBacklog &backlog, uint32_t now_ms);
+
+private:
+    enum State : uint8_t
+    {
+        HELD,      // Previewed only
+        PICKED,    // Asked for in full this session
+        DELIVERED  // Sent in full; released once everything before it is
+    };
+
+    struct Entry
+    {
+        uint32_t id;
+        uint32_t crc32;
+        uint32_t previewed_ms;
+        State state;
+    };
+
+    Entry &entry(int index) { return m_entries[(m_first + index) % m_capacity]; }
+    const Entry &entry(int index) const { return m_entries[(m_first + index) % m_capacity]; }
+
+    Entry *m_entries; // Ring of m_capacity
+    int m_capacity;
+    int m_first;
+    int m_count;
+    uint32_t m_retention_ms;
+};
+
+// The frames the server picked from the previews, as a backlog of their own, so
+// the batch container and per-image paths can send them unchanged. Releasing a
+// frame marks it delivered; it leaves the real backlog in PreviewLedger::release().
+class SelectionBacklog : public FrameBacklog
+{
+public:
+    SelectionBacklog(FrameBacklog &backlog, PreviewLedger &ledger) : m_backlog(backlog), m_ledger(ledger) {}
+
+    int count() const override;
+    bool peek_at(int index, FrameRef &frame) const override;
+    void read(int index, size_t offset, uint8_t *dst, size_t len) const override;
+    void release_front() override;
+
+private:
+    // Backlog index of the index-th frame still picked, or -1.
+    int backlog_index(int index) const;
+
+    FrameBacklog &m_backlog;
+    PreviewLedger &m_ledger;
+};
+
+#endif // PREVIEW_LEDGER_H
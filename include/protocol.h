@@ -0,0 +1,31 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// Protocol and batch constants shared by the firmware and the native host build.
+
+#define CHUNK_SIZE 512                // Largest chunk payload; smaller when the negotiated MTU is
+#define ATT_NOTIFY_OVERHEAD 3         // Opcode plus attribute handle in every notification
+#define ATT_MTU_DEFAULT 23            // Until the central exchanges a larger MTU
+#define FRAME_ARENA_BYTES (2 * 1024 * 1024) // Preallocated PSRAM ring holding the batch
+#define FRAME_QUEUE_LEN 256                 // Frame descriptors in flight between capture and transfer
+#define TRANSFER_WINDOW_MAX 16        // Upper bound on chunks in flight in windowed mode
+#define WINDOW_CHUNK_HEADER 2         // u16 little-endian sequence number prefixed to each windowed chunk
+#define WINDOW_MIN_CHUNK 64           // Smaller chunks would overflow the u16 sequence on a full arena
+#define WINDOW_RETRANSMIT_MS 1000     // Resend the oldest unacknowledged chunk after this much silence
+#define FLASH_WRITE_BLOCK 4096        // Spill segments are written in whole flash blocks
+#define FLASH_INDEX_MAX 1024          // Frames the flash spill store can index
+#define TELEMETRY_TRACE_LEN 64        // Tracepoints kept in the telemetry ring
+#define TELEMETRY_PAGE_HEADER 2       // u8 page index, u8 page count before each telemetry notification
+#define EVENT_LOG_LEN 128             // Log records between the call sites and the flusher (power of two)
+#define EVENT_LOG_HISTORY 64          // Flushed log records kept for reading over BLE
+#define PREVIEW_COLS 40               // Preview-first mode: each frame previewed as an 8-bit luma image,
+#define PREVIEW_ROWS 30               // 1/16 scale at VGA (one pixel per 2x2 blocks of 8x8)
+#define PREVIEW_PIXELS (PREVIEW_COLS * PREVIEW_ROWS)
+#define PREVIEW_LEDGER_LEN (FRAME_QUEUE_LEN + FLASH_INDEX_MAX) // Previewed frames the device can hold back
+#define FRAME_FLAG_EVENT 0x01         // Frame flags: captured on a PIR trigger rather than the timelapse timer
+#define FRAME_FLAG_BURST 0x02         // One of a burst; the upper bits say which burst and where in it
+#define FRAME_BURST_INDEX_SHIFT 8     // Bits 8-15: position in the burst, from 0
+#define FRAME_BURST_ID_SHIFT 16       // Bits 16-31: burst id, shared by every frame of one burst
+#define BURST_FRAMES_MAX 30           // Longest burst; keeps a burst well inside the frame queue
+
+#endif // PROTOCOL_H
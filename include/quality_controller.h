@@ -0,0 +1,55 @@
+#ifndef QUALITY_CONTROLLER_H
+#define QUALITY_CONTROLLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// esp32-camera quality scale: lower numbers are better quality and bigger frames.
+struct RateConfig
+{
+    uint32_t target_bytes;  // Frame size to converge on; 0 holds the quality fixed
+    uint8_t quality_min;    // Best quality allowed (smallest number)
+    uint8_t quality_max;    // Worst quality allowed
+    uint8_t hysteresis_pct; // No change while the smoothed size is within this much of the target
+    uint8_t max_step_pct;   // Largest quality change per frame, in percent of the current quality
+    uint8_t max_downscale;  // Frame size steps the controller may drop once quality_max is not enough
+};
+
+// Closed-loop JPEG quality control. A JPEG's size is close to inversely
+// proportional to the quantizer, so after each capture the next quality is the
+// current one scaled by measured/target, rate-limited to max_step_pct and clamped
+// to the bounds. Sizes are smoothed over the frames taken at the current
+// setting, and nothing moves inside the hysteresis band, so sensor noise does
+// not make the quality hunt. The frame right after a change is ignored: with
+// two frame buffers the driver may already have encoded it at the old setting.
+// When even quality_max overshoots, the frame size steps down and the quality
+// is re-aimed for the smaller frame; it steps back up once the full frame
+// would fit comfortably inside the quality range.
+class QualityController
+{
+public:
+    QualityController();
+
+    void configure(const RateConfig &config);
+    const RateConfig &config() const { return m_config; }
+
+    // Starts over from this quality at full frame size.
+    void reset(uint8_t quality);
+
+    // Feeds the size of a frame captured at quality()/downscale(). Returns true
+    // when either changed and the sensor needs reprogramming.
+    bool update(size_t frame_bytes);
+
+    uint8_t quality() const { return m_quality; }
+    uint8_t downscale() const { return m_downscale; }
+    uint32_t smoothed_bytes() const { return m_smoothed; }
+
+private:
+    RateConfig m_config;
+    uint8_t m_quality;
+    uint8_t m_downscale;
+    uint32_t m_smoothed; // Average size at the current setting, 0 right after a change
+    uint8_t m_settling;  // Frames still to ignore after a change
+};
+
+#endif // QUALITY_CONTROLLER_H
@@ -0,0 +1,92 @@
+#ifndef SENSOR_WARMUP_H
+#define SENSOR_WARMUP_H
+
+#include "frame_source.h"
+#include "telemetry.h"
+
+#define WARMUP_MAX_FRAMES 12 // Give up waiting for exposure to settle after this many fresh frames
+#define WARMUP_MAX_STALE 4   // Framebuffers older than the wake; more than fb_count means the timestamps are off
+
+enum WarmupVerdict : uint8_t
+{
+    WARMUP_STALE,    // Captured before the wake; discard
+    WARMUP_SETTLING, // Exposure still moving; discard and take another
+    WARMUP_READY,    // Use this frame
+};
+
+struct WarmupStats
+{
+    uint32_t wakes;
+    uint32_t stale;         // Frames discarded for predating the wake
+    uint32_t settle_frames; // Fresh frames discarded while exposure settled
+    uint32_t capped;        // Wakes that gave up at the frame cap
+    uint32_t unchanged;     // Wakes whose first fresh frame matched the last one used, so were kept at once
+    uint32_t last_latency_us; // Wake to the frame that was used
+    uint8_t last_settle;    // Fresh frames discarded on the last wake
+    uint8_t last_stale;     // Stale frames discarded on the last wake
+};
+
+// Decides which frame after a light-sleep wake is the first worth keeping. A
+// frame captured before the wake is stale. The sensor keeps its exposure through
+// standby, so if the first fresh frame's mean luma matches the last frame used
+// (within the tolerance) the light has not changed and it is kept at once.
+// Otherwise auto exposure is moving, and has settled once two frames in a row
+// agree. No fixed warm-up is assumed: the frames settling took are averaged over
+// the wakes that needed it, and the cap on how long to wait is set from that.
+class SensorWarmup
+{
+public:
+    SensorWarmup();
+
+    // tolerance in luma levels (0-255).
+    void configure(uint8_t tolerance) { m_tolerance = tolerance; }
+    // Frames captured before wake_us are stale, and exposure must settle again.
+    void wake(uint64_t wake_us);
+    bool settling() const { return m_settling; }
+    // Whether judge() will look at the luma of a frame captured at captured_us.
+    bool needs_luma(uint64_t captured_us) const { return m_settling && captured_us >= m_wake_us; }
+
+    // Judges the next frame: when it was captured, its mean luma (-1 if unknown,
+    // which only the cap can settle) and the time now.
+    WarmupVerdict judge(uint64_t captured_us, int luma, uint64_t now_us);
+
+    // Average fresh frames discarded on the wakes where exposure had to move.
+    float expected_settle() const { return m_expected; }
+    uint64_t wake_us() const { return m_wake_us; }
+    const WarmupStats &stats() const { return m_stats; }
+
+private:
+    WarmupVerdict ready(int luma, uint64_t now_us, bool capped);
+
+    uint8_t m_tolerance;
+    bool m_settling;
+    uint8_t m_cap;    // Fresh frames allowed on this wake
+    uint64_t m_wake_us;
+    uint8_t m_fresh;  // Fresh frames judged on this wake
+    uint8_t m_stale;
+    int m_last_luma;
+    int m_used_luma;  // Mean luma of the last frame used, -1 before the first
+    float m_expected;
+    WarmupStats m_stats;
+};
+
+// The camera as seen after a wake: acquire() discards stale and unsettled
+// frames until SensorWarmup is satisfied, then passes frames straight through
+// until the next wake. Each wake is recorded as a TRACE_WARMUP tracepoint.
+class WarmupFrameSource : public FrameSource
+{
+public:
+    WarmupFrameSource(FrameSource &camera, SensorWarmup &warmup) : m_camera(camera), m_warmup(warmup), m_telemetry(NULL) {}
+
+    void set_telemetry(Telemetry *telemetry) { m_telemetry = telemetry; }
+
+    bool acquire(Frame &frame) override;
+    void release(Frame &frame) override { m_camera.release(frame); }
+
+private:
+    FrameSource &m_camera;
+    SensorWarmup &m_warmup;
+    Telemetry *m_telemetry;
+};
+
+#endif // SENSOR_WARMUP_H
@@ -0,0 +1,65 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Lock-free single-producer/single-consumer ring. One task may push and one other
+// task may peek/pop; N must be a power of two.
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert((N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    SpscQueue() : m_head(0), m_tail(0) {}
+
+    bool push(const T &item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == N)
+            return false;
+        m_items[head & (N - 1)] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool peek(T &item) const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return false;
+        item = m_items[tail & (N - 1)];
+        return true;
+    }
+
+    // Consumer side: the index-th item from the front, without removing anything.
+    bool peek_at(size_t index, T &item) const
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (index >= m_head.load(std::memory_order_acquire) - tail)
+            return false;
+        item = m_items[(tail + index) & (N - 1)];
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        if (!peek(item))
+            return false;
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const
+    {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T m_items[N];
+    std::atomic<size_t> m_head;
+    std::atomic<size_t> m_tail;
+};
+
+#endif // SPSC_QUEUE_H
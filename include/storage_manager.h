@@ -0,0 +1,60 @@
+#ifndef STORAGE_MANAGER_H
+#define STORAGE_MANAGER_H
+
+#include "change_detector.h"
+#include "frame_arena.h"
+#include "frame_source.h"
+#include "power_policy.h"
+#include "telemetry.h"
+
+enum StoreResult
+{
+    STORE_FAILED,  // Capture failed or the frame did not fit
+    STORE_KEPT,    // Appended to the arena
+    STORE_SKIPPED, // Near-duplicate of the last kept frame; dropped by the change gate
+};
+
+// Decides when the batch must be flushed by tracking the bytes actually buffered
+// in the arena against a byte budget. The size of the next frame is predicted
+// from a running average (plus twice the running deviation, so a brighter scene
+// does not overrun the budget), and a flush is due as soon as that prediction
+// would no longer fit. With a change detector attached, frames that barely
+// differ from the last kept one are dropped before they reach the arena;
+// event-triggered and burst frames (FRAME_FLAG_EVENT, FRAME_FLAG_BURST) are
+// always kept.
+class StorageManager
+{
+public:
+    explicit StorageManager(FrameArena &arena);
+
+    StoreResult store(FrameSource &source, uint32_t timestamp_ms, uint32_t flags = 0);
+    void set_change_detector(ChangeDetector *detector) { m_detector = detector; }
+    // Times each capture (TRACE_CAPTURE and the latency histogram) and store (TRACE_STORE).
+    void set_telemetry(Telemetry *telemetry) { m_telemetry = telemetry; }
+    // Holds POWER_PHASE_CAPTURE around the camera and POWER_PHASE_STORE around the
+    // gate and the copy, and counts each frame captured.
+    void set_power(PowerPolicy *power) { m_power = power; }
+
+    void set_budget(size_t bytes);
+    size_t budget() const { return m_budget; }
+    size_t buffered_bytes() const { return m_arena.used_bytes(); }
+    size_t last_capture_bytes() const { return m_last_capture; } // Kept or not
+    const FrameRef &newest() const { return m_arena.newest(); }
+    size_t predicted_next() const;
+    float fill_percent() const;
+    bool should_flush() const;
+
+private:
+    void trace_store(uint64_t start_us, uint32_t frame_id);
+
+    FrameArena &m_arena;
+    ChangeDetector *m_detector;
+    Telemetry *m_telemetry;
+    PowerPolicy *m_power;
+    size_t m_last_capture;
+    size_t m_budget;
+    uint32_t m_avg_len; // Running average in bytes, 0 until the first frame
+    uint32_t m_dev_len; // Running mean absolute deviation
+};
+
+#endif // STORAGE_MANAGER_H
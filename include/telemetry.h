@@ -0,0 +1,97 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "protocol.h"
+#include "platform.h"
+
+// Phases of a wake cycle, in the order they usually happen.
+enum TracePhase : uint8_t
+{
+    TRACE_SLEEP_EXIT,      // Light-sleep wakeup until the shutter can open (detail 1 = PIR woke us)
+    TRACE_DISPLAY_INIT,    // Display back on after wake (a full init only if the panel lost its state)
+    TRACE_CAPTURE,         // esp_camera_fb_get()
+    TRACE_STORE,           // Change gate plus the copy into the arena
+    TRACE_BLE_START,       // start_bluetooth()
+    TRACE_CONNECT_WAIT,    // Advertising until the server connects
+    TRACE_READY_WAIT,      // Connected until the server's 'R'
+    TRACE_TRANSFER,        // One image (detail = index) or one container (detail = frames)
+    TRACE_DISCONNECT_WAIT, // Batch sent until the server hangs up
+    TRACE_BURST,           // First to last frame of a burst (detail = frames kept)
+    TRACE_WARMUP,          // Wake until the first usable frame (detail = settling | stale << 8 frames discarded)
+    TRACE_PHASE_COUNT
+};
+
+struct TracePoint
+{
+    uint32_t start_us; // Low 32 bits of platform_micros()
+    uint32_t duration_us;
+    uint8_t phase;
+    uint16_t detail;
+};
+
+// Counts in power-of-two buckets: bucket 0 holds 0, bucket i holds
+// [2^(i-1), 2^i), and the last bucket everything above.
+#define HISTOGRAM_BUCKETS 24
+
+struct Histogram
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t buckets[HISTOGRAM_BUCKETS]; // Saturating
+
+    void clear();
+    void add(uint32_t value);
+    uint32_t mean() const { return count ? (uint32_t)(sum / count) : 0; }
+};
+
+// Where a wake cycle's time goes: a fixed ring of timed tracepoints plus
+// histograms of capture latency, chunk round-trip time and per-session
+// throughput. The capture and transfer tasks both record into it.
+//
+// encode() packs everything into the telemetry characteristic's format, all
+// little-endian:
+//   "JKT1", u8 version, u8 phase count, u8 bucket count, u8 trace count,
+//   u32 uptime_ms, u32 tracepoints recorded since boot, u8 build length + build string,
+//   3 histograms (capture us, chunk RTT us, session bytes/s), each
+//     u32 count, u32 min, u32 max, u32 mean, u16 buckets[bucket count],
+//   trace count x (u32 start_us, u32 duration_us, u8 phase, u8 0, u16 detail), oldest first.
+// When the buffer is short, the oldest tracepoints are left out.
+class Telemetry
+{
+public:
+    static const uint8_t VERSION = 1;
+
+    Telemetry();
+
+    // Open and close a phase timed with platform_micros(). One of each phase
+    // can be open at a time, which is all the two tasks need.
+    void begin(TracePhase phase);
+    void end(TracePhase phase, uint16_t detail = 0);
+    // A phase timed by the caller (the transfer path uses the transport's clock).
+    void record(TracePhase phase, uint64_t start_us, uint32_t duration_us, uint16_t detail = 0);
+
+    void add_capture_latency(uint32_t us);
+    void add_chunk_rtt(uint32_t us);
+    void add_session_rate(uint32_t bytes_per_s);
+
+    size_t encode(uint8_t *dst, size_t capacity, const char *build) const;
+    size_t encoded_size(const char *build) const;
+
+    uint32_t trace_total() const { return m_total; }
+    const Histogram &capture_latency() const { return m_capture; }
+    const Histogram &chunk_rtt() const { return m_rtt; }
+    const Histogram &session_rate() const { return m_rate; }
+
+private:
+    mutable PlatformLock m_lock;
+    TracePoint m_ring[TELEMETRY_TRACE_LEN];
+    uint32_t m_total; // Tracepoints ever recorded; the ring holds the newest
+    uint64_t m_open[TRACE_PHASE_COUNT];
+    Histogram m_capture;
+    Histogram m_rtt;
+    Histogram m_rate;
+};
+
+#endif // TELEMETRY_H
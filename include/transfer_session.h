@@ -0,0 +1,110 @@
+#ifndef TRANSFER_SESSION_H
+#define TRANSFER_SESSION_H
+
+#include "protocol.h"
+#include "transport.h"
+#include "batch_container.h"
+#include "preview_ledger.h"
+#include "telemetry.h"
+
+struct TransferStats
+{
+    uint32_t bytes;       // JPEG payload bytes acknowledged by the server
+    uint32_t chunks;      // Data notifications sent, including retransmits
+    uint32_t retransmits;
+    uint32_t images;      // Images fully delivered
+    uint32_t previews;    // Previews delivered in preview-first mode
+    uint32_t elapsed_ms;  // From the first handshake to the end of the batch
+};
+
+// How far a frame has got: the server holds the first `offset` bytes of frame
+// `frame_id` (offset == the frame length once it is complete). The device keeps
+// one across sessions, and the server hands its own back on connect ('P') so a
+// dropped transfer picks up where it stopped instead of starting over.
+struct ResumePoint
+{
+    uint32_t frame_id;
+    uint32_t offset;
+    uint32_t crc32; // Of the whole frame; a point that matches nothing queued is ignored
+};
+
+// Pauses the sender leaves the receiver, and the largest chunk it sends.
+struct TransferTiming
+{
+    uint16_t chunk_max;       // Payload bytes per chunk, WINDOW_MIN_CHUNK..CHUNK_SIZE; the link may allow less
+    uint16_t status_delay_ms; // After a status line, before waiting on its answer
+    uint16_t chunk_delay_ms;  // After each stop-and-wait chunk
+    uint16_t image_delay_ms;  // Between images sent one by one
+};
+
+// Drives one batch transfer over a Transport, using either the legacy stop-and-wait
+// protocol (window == 0) or the sliding-window protocol. With `container` set the
+// whole batch goes as a single BatchContainer stream behind one handshake;
+// otherwise each image is announced and acknowledged separately.
+class TransferSession
+{
+public:
+    TransferSession(Transport &transport, uint8_t window, bool container = false);
+
+    // Applies the server's resume point at the start of send_batch(). It also tells
+    // us the server confirms the last stop-and-wait chunk of each stream.
+    void resume_from(const ResumePoint &point);
+    // Defaults to {CHUNK_SIZE, 50, 10, 500}; takes effect at send_batch().
+    void set_timing(const TransferTiming &timing);
+    // Records chunk round-trip times and one TRACE_TRANSFER point per stream.
+    void set_telemetry(Telemetry *telemetry) { m_telemetry = telemetry; }
+    // Preview-first mode: send_batch() sends a preview of every frame the server
+    // has not seen yet, then only the frames it picks in full. The rest stay
+    // queued, tracked by `ledger`, until picked or past its retention window.
+    void set_previews(PreviewLedger *ledger, PreviewRenderer *renderer)
+    {
+        m_ledger = ledger;
+        m_renderer = renderer;
+    }
+
+    // Sends every frame in the backlog so far, releasing each one only once the
+    // server has acknowledged all of it. Frames captured meanwhile, and any not
+    // acknowledged before a disconnect, wait for the next batch.
+    bool send_batch(FrameBacklog &backlog);
+    // The same for the frames queued in the arena, pinned for the duration.
+    bool send_batch(FrameArena &arena, FrameQueue &queue);
+    const TransferStats &stats() const { return m_stats; }
+    const ResumePoint &progress() const { return m_progress; }
+    // Payload bytes per chunk, sized from the link at the start of send_batch().
+    uint16_t chunk_size() const { return m_chunk_size; }
+    // 0 when the window was dropped because the link's notifications are too short.
+    uint8_t window() const { return m_window; }
+
+private:
+    void size_chunks();
+    bool wait_for(char type, uint32_t timeout_ms);
+    bool announce(const char *status, const char *label);
+    bool send_stream(const StreamSource &source, const char *label, uint16_t detail);
+    bool send_stream_stop_and_wait(const StreamSource &source, const char *label);
+    bool send_stream_windowed(const StreamSource &source, const char *label);
+    void send_window_chunk(const StreamSource &source, uint16_t seq, bool retransmit);
+    void apply_resume(FrameBacklog &backlog);
+    bool send_images(FrameBacklog &backlog, int image_count);
+    bool send_container(FrameBacklog &backlog, int image_count);
+    bool send_previews(FrameBacklog &backlog);
+    bool send_picks(FrameBacklog &backlog);
+
+    Transport &m_transport;
+    uint8_t m_window;
+    bool m_container;
+    bool m_has_resume;
+    ResumePoint m_resume;
+    ResumePoint m_progress;
+    uint32_t m_start_offset; // Where the first frame of this batch picks up
+    size_t m_stream_acked;   // Bytes of the current stream the server has confirmed
+    uint16_t m_chunk_size;
+    TransferTiming m_timing;
+    TransferStats m_stats;
+    Telemetry *m_telemetry;
+    PreviewLedger *m_ledger;
+    PreviewRenderer *m_renderer;
+    uint64_t m_sent_us[TRANSFER_WINDOW_MAX]; // When each in-flight chunk went out, 0 once retransmitted
+    uint8_t m_packet[WINDOW_CHUNK_HEADER + CHUNK_SIZE];
+};
+
+#endif // TRANSFER_SESSION_H
@@ -0,0 +1,41 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+// A command written by the server to the command characteristic.
+// 'A' = ACK, 'N' = next chunk, 'K' = cumulative ACK (seq, credit), 'X' = NACK (seq),
+// 'F' = send this frame in full (frame_id), 'G' = end of the 'F' list.
+struct TransportCommand
+{
+    char type;
+    uint16_t seq;
+    uint8_t credit;
+    uint32_t frame_id;
+};
+
+// The link the transfer logic talks through. On the device this wraps the BLE
+// characteristics; in the native build it is the link emulator.
+class Transport
+{
+public:
+    virtual ~Transport() {}
+
+    virtual bool is_connected() = 0;
+    virtual void send_status(const char *text) = 0;
+    virtual void send_data(const uint8_t *data, size_t size) = 0;
+    // Largest send_data() the link delivers whole: ATT MTU minus the notification header.
+    virtual size_t max_payload() { return WINDOW_CHUNK_HEADER + CHUNK_SIZE; }
+
+    // Blocks for up to timeout_ms waiting for the next server command.
+    // Returns false on timeout or disconnect.
+    virtual bool wait_command(TransportCommand &cmd, uint32_t timeout_ms) = 0;
+
+    virtual uint32_t now_ms() = 0;
+    virtual uint64_t now_us() { return (uint64_t)now_ms() * 1000; }
+    virtual void sleep_ms(uint32_t ms) = 0;
+};
+
+#endif // TRANSPORT_H
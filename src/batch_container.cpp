@@ -0,0 +1,242 @@
+#include "batch_container.h"
+#include "platform.h"
+#include <algorithm>
+#include <cstring>
+
+static void put_u16(uint8_t *out, uint16_t v)
+{
+    out[0] = v & 0xFF;
+    out[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t v)
+{
+    out[0] = v & 0xFF;
+    out[1] = (v >> 8) & 0xFF;
+    out[2] = (v >> 16) & 0xFF;
+    out[3] = v >> 24;
+}
+
+BatchContainer::BatchContainer(const FrameBacklog &backlog, int frame_count, uint32_t now_ms, uint32_t first_offset)
+    : m_backlog(backlog), m_count(frame_count > FRAME_QUEUE_LEN ? FRAME_QUEUE_LEN : frame_count), m_now_ms(now_ms),
+      m_first_offset(first_offset)
+{
+    m_table_end = HEADER_SIZE + (size_t)m_count * ENTRY_SIZE;
+    size_t offset = m_table_end;
+    for (int i = 0; i < m_count; i++)
+    {
+        FrameRef frame = {};
+        frame_at(i, frame);
+        m_offsets[i] = offset;
+        offset += frame.len;
+    }
+    m_total = offset;
+}
+
+// The backlog frame at `index`, its length trimmed to the bytes this container carries.
+void BatchContainer::frame_at(int index, FrameRef &frame) const
+{
+    m_backlog.peek_at(index, frame);
+    if (index == 0)
+        frame.len -= m_first_offset < frame.len ? m_first_offset : frame.len;
+}
+
+int BatchContainer::frames_within(size_t bytes) const
+{
+    int n = 0;
+    while (n < m_count && (n + 1 < m_count ? m_offsets[n + 1] : m_total) <= bytes)
+        n++;
+    return n;
+}
+
+uint32_t BatchContainer::frame_progress(int index, size_t bytes) const
+{
+    uint32_t skipped = index == 0 ? m_first_offset : 0;
+    return bytes > m_offsets[index] ? skipped + (uint32_t)(bytes - m_offsets[index]) : skipped;
+}
+
+// Fills `out` with the header (index 0) or frame table entry index + 1.
+void BatchContainer::encode_prefix(size_t index, uint8_t *out) const
+{
+    if (index == 0)
+    {
+        memcpy(out, "JKB1", 4);
+        put_u16(out + 4, VERSION);
+        put_u16(out + 6, (uint16_t)m_count);
+        put_u32(out + 8, (uint32_t)m_total);
+        put_u32(out + 12, m_now_ms);
+        put_u32(out + 16, m_first_offset);
+        return;
+    }
+    FrameRef frame = {};
+    frame_at(index - 1, frame);
+    put_u32(out, frame.id);
+    put_u32(out + 4, m_offsets[index - 1]);
+    put_u32(out + 8, (uint32_t)frame.len);
+    put_u32(out + 12, frame.timestamp_ms);
+    put_u32(out + 16, frame.crc32);
+    put_u32(out + 20, frame.flags);
+}
+
+void BatchContainer::read(size_t offset, uint8_t *dst, size_t len) const
+{
+    uint8_t scratch[HEADER_SIZE > ENTRY_SIZE ? HEADER_SIZE : ENTRY_SIZE];
+
+    // Header and frame table, generated on the fly.
+    while (len > 0 && offset < m_table_end)
+    {
+        size_t index, start, size;
+        if (offset < HEADER_SIZE)
+        {
+            index = 0;
+            start = 0;
+            size = HEADER_SIZE;
+        }
+        else
+        {
+            index = 1 + (offset - HEADER_SIZE) / ENTRY_SIZE;
+            start = HEADER_SIZE + (index - 1) * ENTRY_SIZE;
+            size = ENTRY_SIZE;
+        }
+        encode_prefix(index, scratch);
+        size_t n = start + size - offset;
+        if (n > len)
+            n = len;
+        memcpy(dst, scratch + (offset - start), n);
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+
+    // JPEG bytes, straight out of the backlog.
+    int i = std::upper_bound(m_offsets, m_offsets + m_count, (uint32_t)offset) - m_offsets - 1;
+    if (i < 0)
+        i = 0;
+    while (len > 0 && i < m_count)
+    {
+        FrameRef frame = {};
+        frame_at(i, frame);
+        size_t start = m_offsets[i];
+        if (offset >= start + frame.len)
+        {
+            i++;
+            continue;
+        }
+        size_t n = start + frame.len - offset;
+        if (n > len)
+            n = len;
+        m_backlog.read(i, (i == 0 ? m_first_offset : 0) + (offset - start), dst, n);
+        dst += n;
+        offset += n;
+        len -= n;
+        i++;
+    }
+}
+
+PreviewContainer::PreviewContainer(const FrameBacklog &backlog, int first, int count, uint32_t now_ms,
+                                   PreviewRenderer &renderer)
+    : m_backlog(backlog), m_first(first), m_count(count > 0xFFFF ? 0xFFFF : count), m_now_ms(now_ms),
+      m_renderer(renderer), m_cached(-1), m_jpeg(NULL), m_jpeg_capacity(0)
+{
+    m_table_end = HEADER_SIZE + (size_t)m_count * ENTRY_SIZE;
+    m_total = m_table_end + (size_t)m_count * RECORD_SIZE;
+    m_record = (uint8_t *)platform_alloc_large(RECORD_SIZE);
+}
+
+PreviewContainer::~PreviewContainer()
+{
+    platform_free_large(m_record);
+    platform_free_large(m_jpeg);
+}
+
+void PreviewContainer::encode_prefix(size_t index, uint8_t *out) const
+{
+    if (index == 0)
+    {
+        memcpy(out, "JKP1", 4);
+        put_u16(out + 4, VERSION);
+        put_u16(out + 6, (uint16_t)m_count);
+        put_u32(out + 8, (uint32_t)m_total);
+        put_u32(out + 12, m_now_ms);
+        out[16] = PREVIEW_COLS;
+        out[17] = PREVIEW_ROWS;
+        put_u16(out + 18, 0);
+        return;
+    }
+    FrameRef frame = {};
+    m_backlog.peek_at(m_first + (int)index - 1, frame);
+    put_u32(out, frame.id);
+    put_u32(out + 4, (uint32_t)(m_table_end + (index - 1) * RECORD_SIZE));
+    put_u32(out + 8, (uint32_t)frame.len);
+    put_u32(out + 12, frame.timestamp_ms);
+    put_u32(out + 16, frame.crc32);
+    put_u32(out + 20, frame.flags);
+}
+
+// Renders the preview record of frame `index` into m_record. A spilled frame is
+// read into a scratch copy first, since the decoder needs the whole JPEG.
+void PreviewContainer::render(int index) const
+{
+    m_cached = index;
+    memset(m_record, 0, RECORD_SIZE);
+    FrameRef frame = {};
+    if (!m_backlog.peek_at(m_first + index, frame))
+        return;
+    const uint8_t *jpeg = frame.data;
+    if (!jpeg)
+    {
+        if (frame.len > m_jpeg_capacity)
+        {
+            platform_free_large(m_jpeg);
+            m_jpeg = (uint8_t *)platform_alloc_large(frame.len);
+            m_jpeg_capacity = m_jpeg ? frame.len : 0;
+            if (!m_jpeg)
+                return;
+        }
+        m_backlog.read(m_first + index, 0, m_jpeg, frame.len);
+        jpeg = m_jpeg;
+    }
+    m_record[0] = m_renderer.render(jpeg, frame.len, m_record + 1) ? 1 : 0;
+}
+
+void PreviewContainer::read(size_t offset, uint8_t *dst, size_t len) const
+{
+    uint8_t scratch[HEADER_SIZE > ENTRY_SIZE ? HEADER_SIZE : ENTRY_SIZE];
+
+    while (len > 0 && offset < m_table_end)
+    {
+        size_t index = offset < HEADER_SIZE ? 0 : 1 + (offset - HEADER_SIZE) / ENTRY_SIZE;
+        size_t start = index == 0 ? 0 : HEADER_SIZE + (index - 1) * ENTRY_SIZE;
+        size_t size = index == 0 ? HEADER_SIZE : ENTRY_SIZE;
+        encode_prefix(index, scratch);
+        size_t n = start + size - offset;
+        if (n > len)
+            n = len;
+        memcpy(dst, scratch + (offset - start), n);
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+
+    while (len > 0 && offset < m_total)
+    {
+        int index = (int)((offset - m_table_end) / RECORD_SIZE);
+        size_t start = m_table_end + (size_t)index * RECORD_SIZE;
+        size_t n = start + RECORD_SIZE - offset;
+        if (n > len)
+            n = len;
+        if (!m_record)
+        {
+            memset(dst, 0, n);
+        }
+        else
+        {
+            if (m_cached != index)
+                render(index);
+            memcpy(dst, m_record + (offset - start), n);
+        }
+        dst += n;
+        offset += n;
+        len -= n;
+    }
+}
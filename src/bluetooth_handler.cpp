@@ -1,31 +1,170 @@
 #include "globals.h"
 #include "display_handler.h"
+#include "transfer_session.h"
+#include "event_log.h"
 #include <BLE2902.h>
 #include <cstring> // Required for strcpy and strtok
 
-// --- Image Buffers ---
-uint8_t *framebuffers[IMAGE_BATCH_SIZE];
-size_t fb_lengths[IMAGE_BATCH_SIZE];
-int image_count = 0;
-
 // BLE Characteristics
 BLECharacteristic *pStatusCharacteristic = NULL;
 BLECharacteristic *pDataCharacteristic = NULL;
 BLECharacteristic *pCommandCharacteristic = NULL;
 BLECharacteristic *pConfigCharacteristic = NULL;
+BLECharacteristic *pTelemetryCharacteristic = NULL;
+BLECharacteristic *pLogCharacteristic = NULL;
+static BLEServer *pServer = NULL;
+
+// --- Link Parameters ---
+// What the current connection actually negotiated. The MTU is read from the
+// stack when a session starts; the interval and LL data length are updated from
+// GAP events, since the central may grant something other than what we asked for.
+struct BleLink
+{
+    uint16_t conn_id;
+    esp_bd_addr_t peer;
+    uint16_t mtu;
+    uint16_t interval;  // 1.25 ms units
+    uint16_t data_len;  // LL payload octets per packet
+    uint32_t connect_ms; // Advertising before this connection
+    bool fast;          // Connected while still at the fast advertising interval
+    bool known_peer;    // Bonded before this connection
+    bool encrypted;     // Encrypted with a bond, renewed or made on this connection
+};
+static BleLink ble_link = {0, {0}, ATT_MTU_DEFAULT, 0, LINK_DATA_LEN_DEFAULT, 0, false, false, false};
+
+// When this flush window started advertising, and whether it is still at the
+// fast interval (see slow_advertising()).
+static uint64_t advertising_since_us = 0;
+static volatile bool advertising_fast = false;
+
+// --- Transfer Commands ---
+// Flow-control commands ('A', 'N', 'K', 'X') arrive on the BLE task and are consumed by
+// the transfer task. A FreeRTOS queue keeps them in order and wakes the sender the
+// moment one lands; a disconnect posts COMMAND_LINK_DOWN so a blocked wait ends at once.
+#define COMMAND_QUEUE_LEN 32
+#define COMMAND_LINK_DOWN '\0'
+static QueueHandle_t command_queue = NULL;
+static volatile uint8_t requested_window = 0;
+static volatile bool requested_container = false;
+static volatile bool requested_previews = false;
+
+// Where the server says the last transfer stopped ('P' on connect), and where we
+// think it stopped. Both survive disconnects so the next session can resume.
+static ResumePoint server_resume;
+static volatile bool server_resume_valid = false;
+static ResumePoint transfer_progress;
+
+// Connection events, set from the GATT and GAP callbacks and waited on by the
+// transfer task (see wait_link_event()).
+static EventGroupHandle_t link_events = NULL;
+
+// Preview-first mode ('V'): which queued frames the server has seen previews of.
+// Kept across sessions, since unpicked frames are held for the retention window.
+static PreviewLedger preview_ledger;
+static PreviewRenderer preview_renderer;
+
+// The transfer task and the config callback both notify status lines; each
+// value must go out before the next one replaces it.
+static PlatformLock status_lock;
+
+static void notify_status(const char *text)
+{
+    PlatformLockGuard guard(status_lock);
+    pStatusCharacteristic->setValue(text);
+    pStatusCharacteristic->notify();
+}
+
+static void push_command(char type, uint16_t seq, uint8_t credit, uint32_t frame_id = 0)
+{
+    TransportCommand cmd = {type, seq, credit, frame_id};
+    // Never blocks the BLE task; when full, the sender's retransmit timer recovers from the lost command.
+    xQueueSend(command_queue, &cmd, 0);
+}
+
+static uint32_t read_u32(const std::string &value, size_t at)
+{
+    return (uint8_t)value[at] | ((uint8_t)value[at + 1] << 8) | ((uint8_t)value[at + 2] << 16) |
+           ((uint32_t)(uint8_t)value[at + 3] << 24);
+}
+
+// --- BLE Transport ---
+class BleTransport : public Transport
+{
+public:
+    bool is_connected() override
+    {
+        return client_connected;
+    }
+
+    void send_status(const char *text) override
+    {
+        notify_status(text);
+    }
+
+    void send_data(const uint8_t *data, size_t size) override
+    {
+        pDataCharacteristic->setValue((uint8_t *)data, size);
+        pDataCharacteristic->notify();
+    }
+
+    size_t max_payload() override
+    {
+        return ble_link.mtu - ATT_NOTIFY_OVERHEAD;
+    }
+
+    uint64_t now_us() override
+    {
+        return platform_micros();
+    }
+
+    bool wait_command(TransportCommand &cmd, uint32_t timeout_ms) override
+    {
+        if (!client_connected)
+            return false;
+        if (xQueueReceive(command_queue, &cmd, pdMS_TO_TICKS(timeout_ms)) != pdTRUE)
+            return false;
+        return cmd.type != COMMAND_LINK_DOWN;
+    }
+
+    uint32_t now_ms() override
+    {
+        return millis();
+    }
+
+    void sleep_ms(uint32_t ms) override
+    {
+        delay(ms);
+    }
+};
+
+// The config characteristic reads back the settings as they will stand.
+static void publish_settings(BLECharacteristic *characteristic)
+{
+    uint8_t encoded[CONFIG_ENCODED_MAX];
+    size_t len = encode_settings(encoded, sizeof(encoded));
+    characteristic->setValue(encoded, len);
+}
 
 // --- Callback for handling settings changes from the server ---
+// A write is validated here and applied by the capture task straight away,
+// mid-transfer included. The answer is CONFIG:<result>:<tag>:<version>, with
+// result a ConfigResult (0 = queued) and tag the one that was refused.
 class ConfigCallbacks : public BLECharacteristicCallbacks
 {
     void onWrite(BLECharacteristic *pCharacteristic)
     {
         std::string value = pCharacteristic->getValue();
-        if (value.length() > 0 && value.length() < sizeof(pending_config_str))
-        {
-            strcpy(pending_config_str, value.c_str());
-            new_config_received = true;
-            Serial.printf("Queued new settings for processing: %s\n", value.c_str());
-        }
+        uint8_t bad_tag;
+        ConfigResult result = queue_settings((const uint8_t *)value.data(), value.length(), bad_tag);
+        if (result == CONFIG_OK)
+            EVLOG_INFO(LOGF_CONFIG_QUEUED, value.length());
+        else
+            EVLOG_WARN(LOGF_CONFIG_REJECTED, value.length(), result, bad_tag);
+
+        char reply[32];
+        snprintf(reply, sizeof(reply), "CONFIG:%u:%u:%u", result, bad_tag, CONFIG_VERSION);
+        notify_status(reply);
+        publish_settings(pCharacteristic);
     }
 };
 
@@ -38,52 +177,227 @@ class CommandCallbacks : public BLECharacteristicCallbacks
         if (value.length() > 0)
         {
             char cmd = value[0];
-            if (cmd != 'N')
+            if (cmd == 'K' && value.length() >= 4)
+            {
+                // Cumulative ACK: every chunk below seq has arrived, credit more may be in flight.
+                uint16_t seq = (uint8_t)value[1] | ((uint8_t)value[2] << 8);
+                push_command('K', seq, (uint8_t)value[3]);
+                return;
+            }
+            if (cmd == 'X' && value.length() >= 3)
             {
-                Serial.printf("Received command: %c (0x%02X)\n", cmd, cmd);
+                // NACK: the server saw a gap at seq and wants it retransmitted.
+                uint16_t seq = (uint8_t)value[1] | ((uint8_t)value[2] << 8);
+                push_command('X', seq, 0);
+                return;
             }
+            if (cmd != 'N')
+                EVLOG_DEBUG(LOGF_COMMAND, cmd, cmd);
             if (cmd == 'N')
             {
-                next_chunk_requested = true;
+                push_command('N', 0, 0);
             }
             else if (cmd == 'A')
             {
-                transfer_acknowledged = true;
-                Serial.println("ACK received from server");
+                push_command('A', 0, 0);
+                EVLOG_DEBUG(LOGF_SERVER_ACK);
             }
             else if (cmd == 'R') // FIX: Handle the 'Ready' signal from the server
             {
-                server_ready_for_data = true;
-                Serial.println("Received 'Ready' signal from server.");
+                xEventGroupSetBits(link_events, LINK_EVENT_READY);
+                EVLOG_INFO(LOGF_SERVER_READY);
+            }
+            else if (cmd == 'W' && value.length() >= 2) // Window negotiation, answered with WIN: before the batch
+            {
+                uint8_t window = (uint8_t)value[1];
+                requested_window = window > TRANSFER_WINDOW_MAX ? TRANSFER_WINDOW_MAX : window;
+                EVLOG_INFO(LOGF_SERVER_WINDOW, window);
+            }
+            else if (cmd == 'P' && value.length() >= 13) // Resume point: u32 frame id, u32 offset, u32 crc32
+            {
+                server_resume = {read_u32(value, 1), read_u32(value, 5), read_u32(value, 9)};
+                server_resume_valid = true;
+                EVLOG_INFO(LOGF_SERVER_RESUME, server_resume.frame_id, server_resume.offset, transfer_progress.frame_id,
+                           transfer_progress.offset);
+            }
+            else if (cmd == 'B') // Server can take the whole batch as one container stream
+            {
+                requested_container = true;
+                EVLOG_INFO(LOGF_SERVER_CONTAINER);
+            }
+            else if (cmd == 'V' && value.length() >= 3) // Previews first; u16 retention in minutes for unpicked frames
+            {
+                uint16_t minutes = (uint8_t)value[1] | ((uint8_t)value[2] << 8);
+                preview_ledger.set_retention_ms(minutes * 60000UL);
+                requested_previews = true;
+                EVLOG_INFO(LOGF_SERVER_PREVIEWS, minutes);
+            }
+            else if (cmd == 'F') // Frames to send in full after the previews: u32 ids, as many as fit
+            {
+                for (size_t at = 1; at + 4 <= value.length(); at += 4)
+                    push_command('F', 0, 0, read_u32(value, at));
+            }
+            else if (cmd == 'G') // End of the 'F' list
+            {
+                push_command('G', 0, 0);
             }
         }
     }
 };
 
+static void gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    if (event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT && param->update_conn_params.status == ESP_BT_STATUS_SUCCESS)
+    {
+        ble_link.interval = param->update_conn_params.conn_int;
+        xEventGroupSetBits(link_events, LINK_EVENT_PARAMS);
+    }
+    else if (event == ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT && param->pkt_data_lenth_cmpl.status == ESP_BT_STATUS_SUCCESS)
+    {
+        ble_link.data_len = param->pkt_data_lenth_cmpl.params.tx_len;
+    }
+    else if (event == ESP_GAP_BLE_AUTH_CMPL_EVT)
+    {
+        if (param->ble_security.auth_cmpl.success)
+        {
+            ble_link.encrypted = true;
+            EVLOG_INFO(LOGF_BONDED, ble_link.known_peer ? 0 : 1);
+        }
+        else
+        {
+            EVLOG_WARN(LOGF_BOND_FAILED, param->ble_security.auth_cmpl.fail_reason);
+        }
+    }
+}
+
+// Just Works bonding: the camera has no display or keys to confirm a passkey.
+// Nothing requires an encrypted link, so a server that never pairs is still
+// served; a bonded one reconnects without pairing again. Bluedroid keeps the
+// keys in NVS, so bonds survive resets and BLEDevice::deinit().
+static void enable_bonding()
+{
+    esp_ble_auth_req_t auth = ESP_LE_AUTH_BOND;
+    esp_ble_io_cap_t io = ESP_IO_CAP_NONE;
+    uint8_t key_size = 16;
+    uint8_t keys = ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK;
+    esp_ble_gap_set_security_param(ESP_BLE_SM_AUTHEN_REQ_MODE, &auth, sizeof(auth));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_IOCAP_MODE, &io, sizeof(io));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_MAX_KEY_SIZE, &key_size, sizeof(key_size));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_INIT_KEY, &keys, sizeof(keys));
+    esp_ble_gap_set_security_param(ESP_BLE_SM_SET_RSP_KEY, &keys, sizeof(keys));
+}
+
+static bool is_bonded(const esp_bd_addr_t peer)
+{
+    int count = esp_ble_get_bond_device_num();
+    if (count <= 0)
+        return false;
+    esp_ble_bond_dev_t *bonds = (esp_ble_bond_dev_t *)malloc(count * sizeof(esp_ble_bond_dev_t));
+    if (!bonds)
+        return false;
+    bool found = false;
+    if (esp_ble_get_bond_device_list(&count, bonds) == ESP_OK)
+    {
+        for (int i = 0; i < count && !found; i++)
+            found = memcmp(bonds[i].bd_addr, peer, sizeof(esp_bd_addr_t)) == 0;
+    }
+    free(bonds);
+    return found;
+}
+
+// Asks for a short connection interval and the longest LL packets for the
+// transfer, and waits briefly for the central's answer so the LINK: status
+// reports what was granted.
+static void request_fast_link()
+{
+    uint16_t mtu = pServer->getPeerMTU(ble_link.conn_id);
+    ble_link.mtu = mtu > ATT_MTU_DEFAULT ? mtu : ATT_MTU_DEFAULT;
+    esp_ble_gap_set_pkt_data_len(ble_link.peer, LINK_DATA_LEN_MAX);
+    xEventGroupClearBits(link_events, LINK_EVENT_PARAMS);
+    pServer->updateConnParams(ble_link.peer, LINK_FAST_INTERVAL_MIN, LINK_FAST_INTERVAL_MAX, 0, LINK_SUPERVISION_TIMEOUT);
+
+    bool updated = wait_link_event(LINK_EVENT_PARAMS | LINK_EVENT_DISCONNECTED, LINK_UPDATE_WAIT_MS) & LINK_EVENT_PARAMS;
+    PLATFORM_LOG("Link: MTU %u, interval %u.%02u ms%s, LL data length %u\n", ble_link.mtu, ble_link.interval * 125 / 100,
+                 ble_link.interval * 125 % 100, updated ? "" : " (update not confirmed)", ble_link.data_len);
+}
+
+// Back to a long interval for the idle tail of the connection.
+static void relax_link()
+{
+    if (!client_connected)
+        return;
+    pServer->updateConnParams(ble_link.peer, LINK_IDLE_INTERVAL_MIN, LINK_IDLE_INTERVAL_MAX, 0, LINK_SUPERVISION_TIMEOUT);
+    esp_ble_gap_set_pkt_data_len(ble_link.peer, LINK_DATA_LEN_DEFAULT);
+}
+
 class MyServerCallbacks : public BLEServerCallbacks
 {
-    void onConnect(BLEServer *pServer)
+    void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
     {
         client_connected = true;
+        ble_link.conn_id = param->connect.conn_id;
+        memcpy(ble_link.peer, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+        ble_link.mtu = ATT_MTU_DEFAULT;
+        ble_link.interval = param->connect.conn_params.interval;
+        ble_link.data_len = LINK_DATA_LEN_DEFAULT;
+        ble_link.connect_ms = (uint32_t)((platform_micros() - advertising_since_us) / 1000);
+        ble_link.fast = advertising_fast;
+        ble_link.known_peer = is_bonded(ble_link.peer);
+        ble_link.encrypted = false;
+        if (ble_link.known_peer)
+            esp_ble_set_encryption(ble_link.peer, ESP_BLE_SEC_ENCRYPT); // Renews the bond's keys, no pairing
+        // Every new connection starts in legacy mode until the server negotiates a window.
+        requested_window = 0;
+        transfer_window = 0;
+        requested_container = false;
+        requested_previews = false;
+        server_resume_valid = false;
+        xQueueReset(command_queue);
+        xEventGroupClearBits(link_events, LINK_EVENT_READY | LINK_EVENT_DISCONNECTED | LINK_EVENT_PARAMS);
+        xEventGroupSetBits(link_events, LINK_EVENT_CONNECTED);
         update_display(2, "Status: Connected");
-        Serial.println("Client Connected.");
+        EVLOG_INFO(LOGF_CONNECT_TIME, ble_link.connect_ms, ble_link.fast ? 1 : 0, ble_link.known_peer ? 1 : 0);
     }
 
     void onDisconnect(BLEServer *pServer)
     {
         client_connected = false;
+        xEventGroupClearBits(link_events, LINK_EVENT_CONNECTED | LINK_EVENT_READY);
+        xEventGroupSetBits(link_events, LINK_EVENT_DISCONNECTED);
+        TransportCommand down = {COMMAND_LINK_DOWN, 0, 0};
+        xQueueSendToFront(command_queue, &down, 0);
         update_display(2, "Status: Disconnected");
-        Serial.println("Client Disconnected.");
+        EVLOG_INFO(LOGF_CLIENT_DISCONNECTED);
     }
 };
 
+EventBits_t wait_link_event(EventBits_t events, uint32_t timeout_ms)
+{
+    EventBits_t set = xEventGroupWaitBits(link_events, events, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms)) & events;
+    // States stay set while they hold; one-shot events are consumed by whoever waited for them.
+    if (set & LINK_EVENT_ONE_SHOT)
+        xEventGroupClearBits(link_events, set & LINK_EVENT_ONE_SHOT);
+    return set;
+}
+
 void start_bluetooth()
 {
-    Serial.println("Starting BLE server...");
+    PLATFORM_LOG("Starting BLE server...\n");
+    // Created once; they outlive BLEDevice::deinit() between sessions.
+    if (!link_events)
+    {
+        link_events = xEventGroupCreate();
+        command_queue = xQueueCreate(COMMAND_QUEUE_LEN, sizeof(TransportCommand));
+    }
+    xEventGroupClearBits(link_events, LINK_EVENT_CONNECTED | LINK_EVENT_READY | LINK_EVENT_PARAMS);
+    xEventGroupSetBits(link_events, LINK_EVENT_DISCONNECTED);
+    xQueueReset(command_queue);
     BLEDevice::init(BLE_DEVICE_NAME);
     BLEDevice::setMTU(517);
+    BLEDevice::setCustomGapHandler(gap_event_handler);
+    enable_bonding();
 
-    BLEServer *pServer = BLEDevice::createServer();
+    pServer = BLEDevice::createServer();
     pServer->setCallbacks(new MyServerCallbacks());
 
     BLEService *pService = pServer->createService(SERVICE_UUID);
@@ -105,151 +419,196 @@ void start_bluetooth()
 
     pConfigCharacteristic = pService->createCharacteristic(
         CHARACTERISTIC_UUID_CONFIG,
-        BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR);
+        BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR | BLECharacteristic::PROPERTY_READ);
     pConfigCharacteristic->setCallbacks(new ConfigCallbacks());
+    publish_settings(pConfigCharacteristic);
+
+    pTelemetryCharacteristic = pService->createCharacteristic(
+        CHARACTERISTIC_UUID_TELEMETRY,
+        BLECharacteristic::PROPERTY_NOTIFY | BLECharacteristic::PROPERTY_READ);
+    pTelemetryCharacteristic->addDescriptor(new BLE2902());
+
+    pLogCharacteristic = pService->createCharacteristic(
+        CHARACTERISTIC_UUID_LOG,
+        BLECharacteristic::PROPERTY_NOTIFY | BLECharacteristic::PROPERTY_READ);
+    pLogCharacteristic->addDescriptor(new BLE2902());
 
     pService->start();
 
     BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
     pAdvertising->addServiceUUID(SERVICE_UUID);
     pAdvertising->setScanResponse(true);
+    pAdvertising->setMinInterval(ADV_FAST_INTERVAL_MIN);
+    pAdvertising->setMaxInterval(ADV_FAST_INTERVAL_MAX);
+    advertising_fast = true;
+    advertising_since_us = platform_micros();
     BLEDevice::startAdvertising();
 
-    Serial.println("Bluetooth Initialized and Advertising.");
+    PLATFORM_LOG("Bluetooth Initialized and Advertising.\n");
     update_display(3, "BLE Init OK");
 }
 
-void stop_bluetooth()
+// Advertising stops by itself when a client connects, so it is only restarted
+// while nobody is.
+void slow_advertising()
 {
-    Serial.println("Stopping BLE server...");
-    BLEDevice::deinit(false);
-    Serial.println("BLE Stopped.");
+    if (client_connected)
+        return;
+    BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+    pAdvertising->stop();
+    pAdvertising->setMinInterval(ADV_SLOW_INTERVAL_MIN);
+    pAdvertising->setMaxInterval(ADV_SLOW_INTERVAL_MAX);
+    advertising_fast = false;
+    if (!client_connected)
+        pAdvertising->start();
+    PLATFORM_LOG("No connection within %u ms; advertising at the slow interval.\n", ADV_FAST_WINDOW_MS);
 }
 
-void notify_chunk(const uint8_t *data, size_t size)
+void stop_bluetooth()
 {
-    pDataCharacteristic->setValue((uint8_t *)data, size);
-    pDataCharacteristic->notify();
-    delay(10);
+    PLATFORM_LOG("Stopping BLE server...\n");
+    BLEDevice::deinit(false);
+    PLATFORM_LOG("BLE Stopped.\n");
 }
 
-bool wait_for_acknowledgment(uint32_t timeout_ms)
+// Sends frames spilled to flash first, then those still in PSRAM. Returns true
+// once the server has acknowledged every frame that was waiting; in preview-first
+// mode frames held back for the retention window count as still waiting, so
+// they move to flash with anything undelivered.
+bool send_batched_data()
 {
-    uint32_t start = millis();
-    while (!transfer_acknowledged && millis() - start < timeout_ms)
+    if (!client_connected)
+        return false;
+
+    request_fast_link();
+    BleTransport transport;
+    // LINK:<mtu>:<interval in 1.25 ms units>:<LL data length>, so the server can size its reads.
+    char link_buf[40];
+    snprintf(link_buf, sizeof(link_buf), "LINK:%u:%u:%u", ble_link.mtu, ble_link.interval, ble_link.data_len);
+    transport.send_status(link_buf);
+    // CONNECT:<ms advertising before this connection>:<fast interval 0|1>:<bonded 0|1>. Bonded
+    // means the peer's keys were held when it connected; encryption may still be under way.
+    char connect_buf[40];
+    snprintf(connect_buf, sizeof(connect_buf), "CONNECT:%u:%d:%d", (unsigned)ble_link.connect_ms, ble_link.fast ? 1 : 0,
+             ble_link.known_peer ? 1 : 0);
+    transport.send_status(connect_buf);
+
+    TransferSession session(transport, requested_window, requested_container);
+    session.set_timing(transfer_timing());
+    session.set_telemetry(&telemetry);
+    if (server_resume_valid)
+        session.resume_from(server_resume);
+    if (requested_previews && (preview_ledger.capacity() > 0 || preview_ledger.begin(PREVIEW_LEDGER_LEN)) &&
+        preview_renderer.begin())
+        session.set_previews(&preview_ledger, &preview_renderer);
+
+    // CHANGE:<captures>:<skipped>:<keyframes>, totals since boot, for the server's skip rate.
+    const ChangeStats &change = change_detector.stats();
+    char change_buf[48];
+    snprintf(change_buf, sizeof(change_buf), "CHANGE:%u:%u:%u", change.captures, change.skipped, change.keyframes);
+    transport.send_status(change_buf);
+
+    // POWER:<full clock ms>:<awake ms>:<idle ms>:<asleep ms>:<frames>:<auto sleep 0|1>, totals since boot.
+    PowerStats power = power_policy.stats();
+    char power_buf[80];
+    snprintf(power_buf, sizeof(power_buf), "POWER:%u:%u:%u:%u:%u:%d", (unsigned)(power.time_us[POWER_STATE_MAX] / 1000),
+             (unsigned)(power.time_us[POWER_STATE_AWAKE] / 1000), (unsigned)(power.time_us[POWER_STATE_IDLE] / 1000),
+             (unsigned)(power.time_us[POWER_STATE_SLEEP] / 1000), power.frames, power_auto_sleep() ? 1 : 0);
+    transport.send_status(power_buf);
+
+    bool ok;
     {
-        if (!client_connected)
-            return false;
-        delay(10);
+        ArenaBacklog arena_backlog(image_arena, frame_queue);
+        ChainedBacklog backlog(spill_store, arena_backlog);
+        ok = session.send_batch(backlog) && backlog.count() == 0;
     }
-    return transfer_acknowledged;
+    transfer_window = session.window();
+    transfer_progress = session.progress();
+
+    const TransferStats &stats = session.stats();
+    if (stats.elapsed_ms > 0 && stats.bytes > 0)
+        telemetry.add_session_rate((uint32_t)((uint64_t)stats.bytes * 1000 / stats.elapsed_ms));
+    PLATFORM_LOG("Batch %s: %u images, %u previews, %u bytes in %u ms (%u chunks, %u retransmits), %d left in arena, %d on flash\n",
+                 ok ? "sent" : "incomplete", stats.images, stats.previews, stats.bytes, stats.elapsed_ms,
+                 stats.chunks, stats.retransmits, image_arena.count(), spill_store.count());
+    if (!ok && preview_ledger.count() == 0)
+    {
+        PLATFORM_LOG("Transfer stopped in frame %u at byte %u; it resumes on the next connection.\n",
+                     transfer_progress.frame_id, transfer_progress.offset);
+    }
+    relax_link();
+    return ok;
 }
 
-bool wait_for_next_chunk_request(uint32_t timeout_ms)
+// Notifies `data` as [u8 page, u8 page count] + payload pages sized to the MTU.
+// Returns whether every page went out before the client left.
+static bool notify_pages(BLECharacteristic *characteristic, const uint8_t *data, size_t len)
 {
-    uint32_t start = millis();
-    next_chunk_requested = false;
-    while (!next_chunk_requested && millis() - start < timeout_ms)
+    static uint8_t page[TELEMETRY_PAGE_HEADER + CHUNK_SIZE];
+    size_t page_size = ble_link.mtu - ATT_NOTIFY_OVERHEAD - TELEMETRY_PAGE_HEADER;
+    if (page_size > CHUNK_SIZE)
+        page_size = CHUNK_SIZE;
+    uint8_t pages = (len + page_size - 1) / page_size;
+    for (uint8_t i = 0; i < pages; i++)
     {
         if (!client_connected)
             return false;
-        delay(10);
+        size_t offset = (size_t)i * page_size;
+        size_t size = len - offset < page_size ? len - offset : page_size;
+        page[0] = i;
+        page[1] = pages;
+        memcpy(page + TELEMETRY_PAGE_HEADER, data + offset, size);
+        characteristic->setValue(page, TELEMETRY_PAGE_HEADER + size);
+        characteristic->notify();
+        delay(20);
     }
-    return next_chunk_requested;
+    return client_connected;
 }
 
-bool send_single_file_with_flow_control(const uint8_t *buffer, size_t total_size, const char *data_type, int image_num)
+// Notifies the telemetry snapshot in pages that fit the negotiated MTU, each
+// prefixed with its index and the page count. A plain read returns a single
+// snapshot trimmed to fit one attribute (newest tracepoints only).
+void publish_telemetry()
 {
-    if (total_size == 0)
-        return true;
-
-    char status_buf[32];
-    sprintf(status_buf, "%s:%u", data_type, total_size);
-
-    transfer_acknowledged = false;
-    pStatusCharacteristic->setValue(status_buf);
-    pStatusCharacteristic->notify();
-    Serial.printf("[Image %d] Sent STATUS: %s. Waiting for ACK...\n", image_num, status_buf);
-    delay(50);
-
-    if (!wait_for_acknowledgment(10000))
-    {
-        Serial.printf("[Image %d] ERROR: Timeout waiting for server ACK.\n", image_num);
-        return false;
-    }
-
-    Serial.printf("[Image %d] Server ACK received. Starting transfer (%u bytes)...\n", image_num, total_size);
-
-    size_t sent = 0;
-    int chunk_count = 0;
-
-    size_t chunk_size = (total_size < CHUNK_SIZE) ? total_size : CHUNK_SIZE;
-    notify_chunk(buffer, chunk_size);
-    sent += chunk_size;
-    chunk_count++;
-    Serial.printf("[Image %d] Progress: %u/%u bytes\n", image_num, sent, total_size);
-
-    while (sent < total_size)
-    {
-        if (!wait_for_next_chunk_request(15000))
-        {
-            Serial.printf("[Image %d] ERROR: Timeout waiting for chunk request at byte %u/%u\n", image_num, sent, total_size);
-            return false;
-        }
-
-        size_t remaining = total_size - sent;
-        chunk_size = (remaining < CHUNK_SIZE) ? remaining : CHUNK_SIZE;
-        notify_chunk(buffer + sent, chunk_size);
-        sent += chunk_size;
-        chunk_count++;
+    if (!client_connected || !pTelemetryCharacteristic)
+        return;
 
-        if (chunk_count % 5 == 0 || sent == total_size)
-        {
-            Serial.printf("[Image %d] Progress: %u/%u bytes\n", image_num, sent, total_size);
-        }
-    }
+    static uint8_t snapshot[1024];
+    size_t len = telemetry.encode(snapshot, sizeof(snapshot), FIRMWARE_BUILD);
+    if (len == 0)
+        return;
+    bool sent = notify_pages(pTelemetryCharacteristic, snapshot, len);
 
-    Serial.printf("[Image %d] Transfer complete (%u bytes sent in %d chunks).\n", image_num, sent, chunk_count);
-    delay(100);
-    return true;
+    size_t last = telemetry.encode(snapshot, ble_link.mtu - ATT_NOTIFY_OVERHEAD, FIRMWARE_BUILD);
+    pTelemetryCharacteristic->setValue(snapshot, last);
+    PLATFORM_LOG("Telemetry %s: %u bytes, %u tracepoints since boot\n", sent ? "published" : "cut short",
+                 (unsigned)len, telemetry.trace_total());
 }
 
-void send_batched_data()
+// Notifies the event log records drained since the last publish, in pages like
+// the telemetry snapshot. Records that arrive while a page is out wait for the
+// next session; so do all of them if the client goes before the last page.
+void publish_log()
 {
-    if (!client_connected)
+    if (!client_connected || !pLogCharacteristic)
         return;
 
-    char count_buf[32];
-    sprintf(count_buf, "COUNT:%d", image_count);
-
-    transfer_acknowledged = false;
-    pStatusCharacteristic->setValue(count_buf);
-    pStatusCharacteristic->notify();
-    Serial.printf("Notified server: %s. Waiting for ACK...\n", count_buf);
-    delay(50);
-
-    if (!wait_for_acknowledgment(10000))
-    {
-        Serial.println("ERROR: Server did not acknowledge batch start. Aborting.");
+    static uint32_t published = 0;
+    static uint8_t dump[32 + EVENT_LOG_HISTORY * (8 + 4 * EVENT_LOG_ARGS)];
+    log_drain();
+    uint32_t next = published;
+    size_t len = event_log.encode(dump, sizeof(dump), next);
+    if (len == 0)
         return;
-    }
-
-    Serial.println("Server acknowledged batch start. Beginning transfers...");
-    for (int i = 0; i < image_count; i++)
-    {
-        if (!client_connected)
-        {
-            Serial.println("Client disconnected mid-batch. Aborting.");
-            break;
-        }
-        Serial.printf("\n=== Sending image %d of %d (size: %u bytes) ===\n", i + 1, image_count, fb_lengths[i]);
-        if (framebuffers[i] == NULL)
-            continue;
-        if (!send_single_file_with_flow_control(framebuffers[i], fb_lengths[i], "IMAGE", i + 1))
-        {
-            Serial.printf("Failed to send image %d. Aborting batch.\n", i + 1);
-            break;
-        }
-        delay(500);
-    }
-}
\ No newline at end of file
+    bool sent = notify_pages(pLogCharacteristic, dump, len);
+    if (sent)
+        published = next;
+
+    // A plain read returns the newest records that fit one attribute.
+    uint32_t drained = event_log.drained();
+    uint32_t from = drained > EVENT_LOG_HISTORY ? drained - EVENT_LOG_HISTORY : 0;
+    size_t last = event_log.encode(dump, ble_link.mtu - ATT_NOTIFY_OVERHEAD, from);
+    pLogCharacteristic->setValue(dump, last);
+    PLATFORM_LOG("Log %s: %u bytes, %u records written since boot, %u dropped\n", sent ? "published" : "cut short",
+                 (unsigned)len, event_log.written(), event_log.dropped());
+}
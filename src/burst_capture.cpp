@@ -0,0 +1,56 @@
+#include "burst_capture.h"
+#include "platform.h"
+#include <cstring>
+
+BurstCapture::BurstCapture(StorageManager &storage, FrameQueue &queue)
+    : m_storage(storage), m_queue(queue), m_telemetry(NULL), m_next_id(1)
+{
+    memset(&m_last, 0, sizeof(m_last));
+}
+
+BurstReport BurstCapture::run(FrameSource &source, BurstClock &clock, int frames, int fps, uint32_t extra_flags)
+{
+    if (frames < 1)
+        frames = 1;
+    if (frames > BURST_FRAMES_MAX)
+        frames = BURST_FRAMES_MAX;
+    uint32_t period_us = fps > 0 ? 1000000 / fps : 0;
+
+    BurstReport report;
+    memset(&report, 0, sizeof(report));
+    report.burst_id = m_next_id++;
+    if (m_next_id == 0)
+        m_next_id = 1;
+    report.requested = (uint8_t)frames;
+
+    uint64_t start = clock.now_us();
+    uint64_t first = 0, last = 0;
+    for (int i = 0; i < frames; i++)
+    {
+        // Slots are fixed from the start, so a slow frame does not push the rest back.
+        clock.wait_until_us(start + (uint64_t)i * period_us);
+        uint64_t shutter = clock.now_us();
+        uint32_t flags = extra_flags | FRAME_FLAG_BURST | ((uint32_t)i << FRAME_BURST_INDEX_SHIFT) |
+                         ((uint32_t)report.burst_id << FRAME_BURST_ID_SHIFT);
+        if (m_storage.store(source, (uint32_t)(shutter / 1000), flags) != STORE_KEPT)
+        {
+            report.failed++;
+            continue;
+        }
+        if (!m_queue.push(m_storage.newest()))
+            PLATFORM_LOG("Frame queue full; burst frame stays in the arena for a later batch.\n");
+        if (report.kept == 0)
+            first = shutter;
+        last = shutter;
+        report.kept++;
+    }
+    report.span_us = (uint32_t)(last - first);
+    if (report.kept > 1 && report.span_us > 0)
+        report.fps = (report.kept - 1) * 1e6f / report.span_us;
+    if (m_telemetry && report.kept > 0)
+        m_telemetry->record(TRACE_BURST, first, report.span_us, report.kept);
+    PLATFORM_LOG("Burst %u: %u of %u frames in %u ms, %.1f fps (asked %d).\n", report.burst_id, report.kept,
+                 report.requested, report.span_us / 1000, report.fps, fps);
+    m_last = report;
+    return report;
+}
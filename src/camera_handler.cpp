@@ -1,8 +1,27 @@
 #include "globals.h"
 #include "display_handler.h"
+#include "camera_handler.h"
 
 // Stored config to be used for re-initialization after deep sleep
 camera_config_t camera_config;
+EspCameraSource camera_source;
+
+// The 4:3 frame sizes, largest first. The configured size is the rate
+// controller's full frame; each downscale step goes one size further down.
+static const framesize_t frame_size_steps[] = {FRAMESIZE_UXGA, FRAMESIZE_XGA, FRAMESIZE_SVGA,
+                                               FRAMESIZE_VGA,  FRAMESIZE_QVGA, FRAMESIZE_QQVGA};
+static const int frame_size_count = sizeof(frame_size_steps) / sizeof(frame_size_steps[0]);
+static int frame_size_base = 3; // Index of the configured size
+
+static int frame_size_index(uint8_t frame_size)
+{
+    for (int i = 0; i < frame_size_count; i++)
+    {
+        if (frame_size_steps[i] == frame_size)
+            return i;
+    }
+    return 3; // VGA; the config only holds sizes from the list
+}
 
 void init_camera()
 {
@@ -25,10 +44,14 @@ void init_camera()
     camera_config.pin_sccb_scl = SIOC_GPIO_NUM;
     camera_config.pin_pwdn = PWDN_GPIO_NUM;
     camera_config.pin_reset = RESET_GPIO_NUM;
-    camera_config.xclk_freq_hz = 20000000;
+    camera_config.xclk_freq_hz = device_config.xclk_mhz * 1000000;
     camera_config.pixel_format = PIXFORMAT_JPEG;
-    camera_config.frame_size = FRAMESIZE_VGA;
-    camera_config.jpeg_quality = 12;
+    frame_size_base = frame_size_index(device_config.frame_size);
+    camera_config.frame_size = frame_size_steps[frame_size_base];
+    camera_config.jpeg_quality = device_config.jpeg_quality;
+    // Hand out the newest frame and recycle older ones, so a frame that sat in a
+    // buffer while we were busy is not taken for a fresh one.
+    camera_config.grab_mode = CAMERA_GRAB_LATEST;
 
     if (psramFound())
     {
@@ -47,10 +70,58 @@ void init_camera()
         Serial.println("Cam Init Failed!");
         return;
     }
+    rate_controller.reset(device_config.jpeg_quality);
     update_display(2, "Cam Init OK");
     Serial.println("Camera Initialized.");
 }
 
+void apply_camera_rate(uint8_t quality, uint8_t downscale)
+{
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (!sensor)
+        return;
+    int step = frame_size_base + downscale;
+    framesize_t frame_size = frame_size_steps[step < frame_size_count ? step : frame_size_count - 1];
+    if (sensor->status.framesize != frame_size)
+        sensor->set_framesize(sensor, frame_size);
+    sensor->set_quality(sensor, quality);
+}
+
+bool reconfigure_camera(const DeviceConfig &config)
+{
+    sensor_t *sensor = esp_camera_sensor_get();
+    // The framebuffers were sized for the frame size at init; framesize_t grows with the image.
+    if (!sensor || config.frame_size > camera_config.frame_size)
+    {
+        deinit_camera();
+        init_camera();
+        return true;
+    }
+    if (config.xclk_mhz * 1000000 != camera_config.xclk_freq_hz)
+    {
+        sensor->set_xclk(sensor, camera_config.ledc_timer, config.xclk_mhz);
+        camera_config.xclk_freq_hz = config.xclk_mhz * 1000000;
+    }
+    frame_size_base = frame_size_index(config.frame_size);
+    rate_controller.reset(config.jpeg_quality);
+    apply_camera_rate(rate_controller.quality(), rate_controller.downscale());
+    return false;
+}
+
+// OV2640 COM2 (sensor bank register 0x09) bit 4 is standby: the sensor stops
+// its output and analog side but keeps every register, exposure included, so no
+// re-init is needed. Other sensors just keep running.
+#define OV2640_REG_COM2 0x109 // set_reg() takes the bank in bit 8
+#define OV2640_COM2_STANDBY 0x10
+
+bool camera_standby(bool standby)
+{
+    sensor_t *sensor = esp_camera_sensor_get();
+    if (!sensor || sensor->id.PID != OV2640_PID)
+        return false;
+    return sensor->set_reg(sensor, OV2640_REG_COM2, OV2640_COM2_STANDBY, standby ? OV2640_COM2_STANDBY : 0) == 0;
+}
+
 void deinit_camera()
 {
     if (esp_camera_deinit() == ESP_OK)
@@ -61,4 +132,22 @@ void deinit_camera()
     {
         Serial.println("Failed to de-init camera.");
     }
+}
+
+bool EspCameraSource::acquire(Frame &frame)
+{
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb)
+        return false;
+    frame.buf = fb->buf;
+    frame.len = fb->len;
+    frame.handle = fb;
+    frame.captured_us = (uint64_t)fb->timestamp.tv_sec * 1000000ULL + fb->timestamp.tv_usec;
+    return true;
+}
+
+void EspCameraSource::release(Frame &frame)
+{
+    esp_camera_fb_return((camera_fb_t *)frame.handle);
+    frame.handle = NULL;
 }
\ No newline at end of file
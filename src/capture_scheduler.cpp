@@ -0,0 +1,92 @@
+#include "capture_scheduler.h"
+#include <cstring>
+
+CaptureScheduler::CaptureScheduler()
+    : m_interval_ms(10000), m_holdoff_ms(0), m_next_timer_ms(0), m_last_event_ms(0), m_has_event(false),
+      m_event_pending(false), m_pir_high(false)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void CaptureScheduler::configure(uint32_t interval_ms, uint32_t holdoff_ms)
+{
+    m_interval_ms = interval_ms > 0 ? interval_ms : 1;
+    m_holdoff_ms = holdoff_ms;
+    if (holdoff_ms == 0)
+        m_event_pending = false;
+}
+
+void CaptureScheduler::start(uint32_t now_ms)
+{
+    m_next_timer_ms = now_ms + m_interval_ms;
+    m_has_event = false;
+    m_event_pending = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool CaptureScheduler::in_holdoff(uint32_t now_ms) const
+{
+    return m_has_event && !reached(now_ms, m_last_event_ms + m_holdoff_ms);
+}
+
+void CaptureScheduler::on_pir(uint32_t now_ms, bool high)
+{
+    bool rose = high && !m_pir_high;
+    m_pir_high = high;
+    if (!rose || !events_enabled())
+        return;
+    m_stats.edges++;
+    if (in_holdoff(now_ms) || m_event_pending)
+        m_stats.debounced++;
+    else
+        m_event_pending = true;
+}
+
+// Moves the timer to the first slot after now_ms, counting the slots passed over.
+void CaptureScheduler::advance_timer(uint32_t now_ms)
+{
+    m_next_timer_ms += m_interval_ms;
+    if (reached(now_ms, m_next_timer_ms))
+    {
+        uint32_t behind = (now_ms - m_next_timer_ms) / m_interval_ms + 1;
+        m_stats.missed += behind;
+        m_next_timer_ms += behind * m_interval_ms;
+    }
+}
+
+CaptureTrigger CaptureScheduler::poll(uint32_t now_ms)
+{
+    if (m_event_pending)
+        return TRIGGER_EVENT;
+    while (reached(now_ms, m_next_timer_ms))
+    {
+        if (!in_holdoff(m_next_timer_ms))
+            return TRIGGER_TIMER;
+        m_stats.coalesced++;
+        advance_timer(now_ms);
+    }
+    return TRIGGER_NONE;
+}
+
+uint32_t CaptureScheduler::sleep_ms(uint32_t now_ms) const
+{
+    if (m_event_pending || reached(now_ms, m_next_timer_ms))
+        return 0;
+    return m_next_timer_ms - now_ms;
+}
+
+void CaptureScheduler::captured(CaptureTrigger trigger, uint32_t now_ms)
+{
+    if (trigger == TRIGGER_EVENT)
+    {
+        m_event_pending = false;
+        m_has_event = true;
+        m_last_event_ms = now_ms;
+        m_stats.event_captures++;
+    }
+    else if (trigger == TRIGGER_TIMER)
+    {
+        m_stats.timer_captures++;
+        advance_timer(now_ms);
+    }
+}
@@ -0,0 +1,643 @@
+#include "change_detector.h"
+#include "platform.h"
+#include <new>
+#include <string.h>
+
+#define HUFF_LOOKAHEAD 8 // Codes up to this long resolve with one table lookup
+#define MAX_COMPONENTS 4
+#define MAX_PADDING_BYTES 8 // Zero bytes fed past the end of the scan before the image counts as truncated
+
+// Canonical huffman table in the layout of ITU T.81 Annex F, plus a lookahead
+// table for the short codes that make up nearly all of a camera JPEG.
+struct HuffTable
+{
+    bool present;
+    uint8_t lookup_len[1 << HUFF_LOOKAHEAD]; // 0 when the code is longer than the lookahead
+    uint8_t lookup_sym[1 << HUFF_LOOKAHEAD];
+    int32_t maxcode[18];
+    int32_t valptr[17];
+    uint16_t mincode[17];
+    uint8_t symbols[256];
+};
+
+struct Component
+{
+    uint8_t id;
+    uint8_t h;
+    uint8_t v;
+    uint8_t dc_table;
+    uint8_t ac_table;
+};
+
+// The huffman tables of one decode. A few KB, so every caller keeps its own
+// set rather than putting one on the stack.
+struct DcTables
+{
+    HuffTable dc[4];
+    HuffTable ac[4];
+};
+
+// Receives the mean level of each luma block from walk_luma_dc(), in scan order.
+// begin() gives the picture size in blocks before the first one arrives.
+class LumaDcSink
+{
+public:
+    virtual void begin(int blocks_x, int blocks_y) = 0;
+    virtual void block(int x, int y, int level) = 0;
+};
+
+// Only the capture task takes signatures, so its tables and cell sums live here.
+static DcTables signature_tables;
+static int32_t cell_sums[CHANGE_GRID_CELLS];
+static uint16_t cell_counts[CHANGE_GRID_CELLS];
+
+static bool build_table(HuffTable &table, const uint8_t *counts, const uint8_t *symbols, int total)
+{
+    memset(&table, 0, sizeof(table));
+    memcpy(table.symbols, symbols, total);
+    int32_t code = 0;
+    int k = 0;
+    for (int len = 1; len <= 16; len++)
+    {
+        table.valptr[len] = k;
+        table.mincode[len] = (uint16_t)code;
+        for (int i = 0; i < counts[len - 1]; i++, k++, code++)
+        {
+            if (len > HUFF_LOOKAHEAD)
+                continue;
+            int shift = HUFF_LOOKAHEAD - len;
+            for (int fill = 0; fill < (1 << shift); fill++)
+            {
+                table.lookup_len[(code << shift) | fill] = (uint8_t)len;
+                table.lookup_sym[(code << shift) | fill] = symbols[k];
+            }
+        }
+        table.maxcode[len] = counts[len - 1] ? code - 1 : -1;
+        if (code > (1 << len))
+            return false; // Over-subscribed
+        code <<= 1;
+    }
+    table.maxcode[17] = 0x7FFFFFFF;
+    table.present = true;
+    return true;
+}
+
+// Reads the entropy-coded segment MSB first, undoing 0xFF00 byte stuffing. At a
+// marker it feeds zeros, so a truncated scan is caught by the padding count.
+struct BitReader
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    uint32_t bits;
+    int count;
+    int padding;
+    bool at_marker;
+
+    void fill()
+    {
+        while (count <= 24)
+        {
+            uint8_t b = 0;
+            if (!at_marker && p < end && (p[0] != 0xFF || (p + 1 < end && p[1] == 0x00)))
+            {
+                b = *p;
+                p += b == 0xFF ? 2 : 1;
+            }
+            else
+            {
+                at_marker = true;
+                padding++;
+            }
+            bits |= (uint32_t)b << (24 - count);
+            count += 8;
+        }
+    }
+
+    uint32_t peek(int n)
+    {
+        if (count < n)
+            fill();
+        return bits >> (32 - n);
+    }
+
+    void consume(int n)
+    {
+        bits <<= n;
+        count -= n;
+    }
+
+    // Skips to just past the next RSTn marker and starts a fresh bit stream.
+    bool restart()
+    {
+        bits = 0;
+        count = 0;
+        while (p + 1 < end && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7))
+            p++;
+        if (p + 1 >= end)
+            return false;
+        p += 2;
+        at_marker = false;
+        padding = 0;
+        return true;
+    }
+};
+
+static int decode_symbol(BitReader &reader, const HuffTable &table)
+{
+    reader.fill();
+    uint32_t look = reader.peek(HUFF_LOOKAHEAD);
+    if (table.lookup_len[look])
+    {
+        reader.consume(table.lookup_len[look]);
+        return table.lookup_sym[look];
+    }
+    for (int len = HUFF_LOOKAHEAD + 1; len <= 16; len++)
+    {
+        int32_t code = (int32_t)reader.peek(len);
+        if (code <= table.maxcode[len])
+        {
+            reader.consume(len);
+            return table.symbols[table.valptr[len] + code - table.mincode[len]];
+        }
+    }
+    return -1;
+}
+
+static int receive_extend(BitReader &reader, int size)
+{
+    if (size == 0)
+        return 0;
+    int value = (int)reader.peek(size);
+    reader.consume(size);
+    if (value < (1 << (size - 1)))
+        value -= (1 << size) - 1;
+    return value;
+}
+
+// Decodes one block, returning the DC difference; the AC coefficients are only
+// walked past.
+static bool decode_block(BitReader &reader, const HuffTable &dc, const HuffTable &ac, int &dc_diff)
+{
+    int size = decode_symbol(reader, dc);
+    if (size < 0 || size > 15)
+        return false;
+    dc_diff = receive_extend(reader, size);
+    for (int k = 1; k < 64;)
+    {
+        int rs = decode_symbol(reader, ac);
+        if (rs < 0)
+            return false;
+        int run = rs >> 4;
+        size = rs & 15;
+        if (size == 0)
+        {
+            if (run != 15)
+                break; // End of block
+            k += 16;
+            continue;
+        }
+        reader.fill();
+        reader.consume(size);
+        k += run + 1;
+    }
+    return true;
+}
+
+static inline uint16_t read_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Entropy-decodes a baseline JPEG far enough to recover the DC coefficient of
+// every luma block, and hands each block's mean level to the sink.
+static bool walk_luma_dc(const uint8_t *jpeg, size_t len, DcTables &tables, LumaDcSink &sink)
+{
+    if (!jpeg || len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8)
+        return false;
+
+    uint16_t dc_quant[4] = {0, 0, 0, 0};
+    int luma_quant = 0;
+    Component components[MAX_COMPONENTS];
+    int component_count = 0;
+    int width = 0, height = 0;
+    int h_max = 1, v_max = 1;
+    int restart_interval = 0;
+    int scan[MAX_COMPONENTS]; // Frame component index of each scan component
+    int scan_count = 0;
+    for (int i = 0; i < 4; i++)
+        tables.dc[i].present = tables.ac[i].present = false;
+
+    const uint8_t *p = jpeg + 2;
+    const uint8_t *end = jpeg + len;
+    while (scan_count == 0)
+    {
+        if (p + 4 > end || p[0] != 0xFF)
+            return false;
+        uint8_t marker = p[1];
+        if (marker == 0xFF)
+        {
+            p++; // Fill byte
+            continue;
+        }
+        p += 2;
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+            continue; // No length field
+        uint16_t seg_len = read_u16(p);
+        if (seg_len < 2 || p + seg_len > end)
+            return false;
+        const uint8_t *seg = p + 2;
+        const uint8_t *seg_end = p + seg_len;
+        p = seg_end;
+
+        switch (marker)
+        {
+        case 0xDB: // DQT: only the DC entry of each table matters here
+            while (seg < seg_end)
+            {
+                int precision = seg[0] >> 4;
+                int id = seg[0] & 15;
+                int size = 1 + 64 * (precision ? 2 : 1);
+                if (id > 3 || seg + size > seg_end)
+                    return false;
+                dc_quant[id] = precision ? read_u16(seg + 1) : seg[1];
+                seg += size;
+            }
+            break;
+        case 0xC4: // DHT
+            while (seg < seg_end)
+            {
+                if (seg + 17 > seg_end)
+                    return false;
+                int table_class = seg[0] >> 4;
+                int id = seg[0] & 15;
+                int total = 0;
+                for (int i = 0; i < 16; i++)
+                    total += seg[1 + i];
+                if (table_class > 1 || id > 3 || total > 256 || seg + 17 + total > seg_end)
+                    return false;
+                HuffTable &table = table_class ? tables.ac[id] : tables.dc[id];
+                if (!build_table(table, seg + 1, seg + 17, total))
+                    return false;
+                seg += 17 + total;
+            }
+            break;
+        case 0xC0: // Baseline
+        case 0xC1: // Extended sequential, huffman
+            if (seg_len < 8 || seg[0] != 8)
+                return false;
+            height = read_u16(seg + 1);
+            width = read_u16(seg + 3);
+            component_count = seg[5];
+            if (width == 0 || height == 0 || component_count == 0 || component_count > MAX_COMPONENTS ||
+                seg + 6 + 3 * component_count > seg_end)
+                return false;
+            for (int i = 0; i < component_count; i++)
+            {
+                const uint8_t *c = seg + 6 + 3 * i;
+                components[i].id = c[0];
+                components[i].h = c[1] >> 4;
+                components[i].v = c[1] & 15;
+                if (components[i].h == 0 || components[i].v == 0 || components[i].h > 4 || components[i].v > 4 ||
+                    (c[2] & 3) != c[2])
+                    return false;
+                if (i == 0)
+                    luma_quant = c[2];
+                if (components[i].h > h_max)
+                    h_max = components[i].h;
+                if (components[i].v > v_max)
+                    v_max = components[i].v;
+            }
+            break;
+        case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+            return false; // Progressive, lossless or arithmetic coded
+        case 0xDD: // DRI
+            if (seg_len < 4)
+                return false;
+            restart_interval = read_u16(seg);
+            break;
+        case 0xDA: // SOS
+        {
+            if (component_count == 0 || seg_len < 3)
+                return false;
+            int count = seg[0];
+            if (count == 0 || count > component_count || seg + 1 + 2 * count + 3 > seg_end)
+                return false;
+            for (int i = 0; i < count; i++)
+            {
+                int index = -1;
+                for (int c = 0; c < component_count; c++)
+                {
+                    if (components[c].id == seg[1 + 2 * i])
+                        index = c;
+                }
+                if (index < 0)
+                    return false;
+                components[index].dc_table = seg[2 + 2 * i] >> 4;
+                components[index].ac_table = seg[2 + 2 * i] & 15;
+                if (components[index].dc_table > 3 || components[index].ac_table > 3 ||
+                    !tables.dc[components[index].dc_table].present || !tables.ac[components[index].ac_table].present)
+                    return false;
+                scan[i] = index;
+            }
+            if (scan[0] != 0 || dc_quant[luma_quant] == 0)
+                return false; // The first scan has to carry luma
+            scan_count = count;
+            break;
+        }
+        case 0xD9: // EOI before any scan
+            return false;
+        default: // APPn, COM and the like
+            break;
+        }
+    }
+
+    // A lone component is coded block by block; an interleaved scan in MCUs.
+    int luma_blocks_x = ((width * components[0].h + h_max - 1) / h_max + 7) / 8;
+    int luma_blocks_y = ((height * components[0].v + v_max - 1) / v_max + 7) / 8;
+    int mcus_x, mcus_y;
+    if (scan_count == 1)
+    {
+        mcus_x = luma_blocks_x;
+        mcus_y = luma_blocks_y;
+    }
+    else
+    {
+        mcus_x = (width + 8 * h_max - 1) / (8 * h_max);
+        mcus_y = (height + 8 * v_max - 1) / (8 * v_max);
+    }
+
+    sink.begin(luma_blocks_x, luma_blocks_y);
+
+    BitReader reader = {p, end, 0, 0, 0, false};
+    int predictors[MAX_COMPONENTS] = {0, 0, 0, 0};
+    int until_restart = restart_interval;
+    for (int my = 0; my < mcus_y; my++)
+    {
+        for (int mx = 0; mx < mcus_x; mx++)
+        {
+            if (restart_interval)
+            {
+                if (until_restart == 0)
+                {
+                    if (!reader.restart())
+                        return false;
+                    memset(predictors, 0, sizeof(predictors));
+                    until_restart = restart_interval;
+                }
+                until_restart--;
+            }
+            for (int s = 0; s < scan_count; s++)
+            {
+                const Component &component = components[scan[s]];
+                int blocks_h = scan_count == 1 ? 1 : component.h;
+                int blocks_v = scan_count == 1 ? 1 : component.v;
+                for (int by = 0; by < blocks_v; by++)
+                {
+                    for (int bx = 0; bx < blocks_h; bx++)
+                    {
+                        int diff;
+                        if (!decode_block(reader, tables.dc[component.dc_table], tables.ac[component.ac_table], diff))
+                            return false;
+                        predictors[scan[s]] += diff;
+                        if (scan[s] != 0)
+                            continue;
+                        int x = mx * blocks_h + bx;
+                        int y = my * blocks_v + by;
+                        if (x >= luma_blocks_x || y >= luma_blocks_y)
+                            continue; // MCU padding past the picture edge
+                        // DC is eight times the block mean, level-shifted by 128.
+                        sink.block(x, y, predictors[0] * dc_quant[luma_quant] / 8 + 128);
+                    }
+                }
+            }
+            if (reader.padding > MAX_PADDING_BYTES)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static inline uint8_t clamp_level(int level)
+{
+    return (uint8_t)(level < 0 ? 0 : level > 255 ? 255 : level);
+}
+
+// Averages the blocks into the change grid.
+class SignatureSink : public LumaDcSink
+{
+public:
+    void begin(int blocks_x, int blocks_y) override
+    {
+        m_blocks_x = blocks_x;
+        m_blocks_y = blocks_y;
+        memset(cell_sums, 0, sizeof(cell_sums));
+        memset(cell_counts, 0, sizeof(cell_counts));
+    }
+
+    void block(int x, int y, int level) override
+    {
+        int cell = (y * CHANGE_GRID_ROWS / m_blocks_y) * CHANGE_GRID_COLS + x * CHANGE_GRID_COLS / m_blocks_x;
+        cell_sums[cell] += level;
+        cell_counts[cell]++;
+    }
+
+private:
+    int m_blocks_x;
+    int m_blocks_y;
+};
+
+bool jpeg_dc_signature(const uint8_t *jpeg, size_t len, FrameSignature &signature)
+{
+    SignatureSink sink;
+    if (!walk_luma_dc(jpeg, len, signature_tables, sink))
+        return false;
+    for (int i = 0; i < CHANGE_GRID_CELLS; i++)
+        signature.cells[i] = clamp_level(cell_counts[i] ? cell_sums[i] / cell_counts[i] : 0);
+    return true;
+}
+
+// Spreads each block over the preview pixels it overlaps: exactly one at VGA,
+// a 2x2 patch at QVGA, and shared between neighbours when the frame is larger.
+struct PreviewRenderer::Workspace : public LumaDcSink
+{
+    DcTables tables;
+    uint16_t sums[PREVIEW_PIXELS]; // At most 255 blocks of 255 each
+    uint8_t counts[PREVIEW_PIXELS];
+    int blocks_x;
+    int blocks_y;
+
+    void begin(int bx, int by) override
+    {
+        blocks_x = bx;
+        blocks_y = by;
+        memset(sums, 0, sizeof(sums));
+        memset(counts, 0, sizeof(counts));
+    }
+
+    static void span(int block, int blocks, int pixels, int &first, int &last)
+    {
+        first = block * pixels / blocks;
+        last = ((block + 1) * pixels + blocks - 1) / blocks - 1;
+        if (last < first)
+            last = first;
+        if (last >= pixels)
+            last = pixels - 1;
+    }
+
+    void block(int x, int y, int level) override
+    {
+        int x0, x1, y0, y1;
+        span(x, blocks_x, PREVIEW_COLS, x0, x1);
+        span(y, blocks_y, PREVIEW_ROWS, y0, y1);
+        uint8_t value = clamp_level(level);
+        for (int py = y0; py <= y1; py++)
+        {
+            for (int px = x0; px <= x1; px++)
+            {
+                int i = py * PREVIEW_COLS + px;
+                if (counts[i] < 255)
+                {
+                    sums[i] += value;
+                    counts[i]++;
+                }
+            }
+        }
+    }
+};
+
+PreviewRenderer::PreviewRenderer() : m_work(NULL) {}
+
+PreviewRenderer::~PreviewRenderer()
+{
+    end();
+}
+
+bool PreviewRenderer::begin()
+{
+    if (!m_work)
+        m_work = (Workspace *)platform_alloc_large(sizeof(Workspace));
+    if (m_work)
+        new (m_work) Workspace();
+    return m_work != NULL;
+}
+
+void PreviewRenderer::end()
+{
+    if (m_work)
+    {
+        m_work->~Workspace();
+        platform_free_large(m_work);
+        m_work = NULL;
+    }
+}
+
+bool PreviewRenderer::render(const uint8_t *jpeg, size_t len, uint8_t *pixels)
+{
+    if (!m_work || !walk_luma_dc(jpeg, len, m_work->tables, *m_work))
+        return false;
+    for (int i = 0; i < PREVIEW_PIXELS; i++)
+        pixels[i] = m_work->counts[i] ? (uint8_t)(m_work->sums[i] / m_work->counts[i]) : 0;
+    return true;
+}
+
+uint8_t signature_change_percent(const FrameSignature &a, const FrameSignature &b)
+{
+    int32_t shift = 0;
+    for (int i = 0; i < CHANGE_GRID_CELLS; i++)
+        shift += (int32_t)b.cells[i] - a.cells[i];
+    shift /= CHANGE_GRID_CELLS;
+
+    int changed = 0;
+    for (int i = 0; i < CHANGE_GRID_CELLS; i++)
+    {
+        int delta = (int)b.cells[i] - a.cells[i] - shift;
+        if (delta > CHANGE_CELL_DELTA || delta < -CHANGE_CELL_DELTA)
+            changed++;
+    }
+    return (uint8_t)(changed * 100 / CHANGE_GRID_CELLS);
+}
+
+ChangeDetector::ChangeDetector()
+    : m_reference_len(0), m_candidate_len(0), m_has_reference(false), m_reference_signed(false),
+      m_candidate_signed(false), m_threshold(0), m_keyframe_interval(0), m_since_kept(0)
+{
+    reset();
+}
+
+void ChangeDetector::configure(uint8_t threshold_percent, uint16_t keyframe_interval)
+{
+    m_threshold = threshold_percent > 100 ? 100 : threshold_percent;
+    m_keyframe_interval = keyframe_interval;
+}
+
+void ChangeDetector::reset()
+{
+    m_has_reference = false;
+    m_candidate_len = 0;
+    m_since_kept = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+bool ChangeDetector::check(const uint8_t *jpeg, size_t len, bool keep)
+{
+    m_stats.captures++;
+    m_candidate_len = 0;
+    if (m_threshold == 0)
+        return true; // Gate off: keep everything without paying for a signature
+
+    m_candidate_len = len;
+    m_candidate_signed = jpeg_dc_signature(jpeg, len, m_candidate);
+    if (!m_candidate_signed)
+        m_stats.fallbacks++;
+    if (!m_has_reference)
+    {
+        m_stats.last_change = 100;
+        return true;
+    }
+
+    uint8_t change;
+    if (m_candidate_signed && m_reference_signed)
+    {
+        change = signature_change_percent(m_reference, m_candidate);
+    }
+    else
+    {
+        // No signature on one side: fall back to how much the compressed size moved.
+        size_t diff = len > m_reference_len ? len - m_reference_len : m_reference_len - len;
+        size_t percent = m_reference_len ? diff * 100 / m_reference_len : 100;
+        change = (uint8_t)(percent > 100 ? 100 : percent);
+    }
+    m_stats.last_change = change;
+
+    if (change >= m_threshold || keep)
+        return true;
+    if (m_keyframe_interval > 0 && m_since_kept + 1 >= m_keyframe_interval)
+    {
+        m_stats.keyframes++;
+        return true;
+    }
+    m_since_kept++;
+    m_stats.skipped++;
+    return false;
+}
+
+void ChangeDetector::accept()
+{
+    m_since_kept = 0;
+    if (m_candidate_len == 0)
+    {
+        m_has_reference = false;
+        return;
+    }
+    m_reference = m_candidate;
+    m_reference_len = m_candidate_len;
+    m_reference_signed = m_candidate_signed;
+    m_has_reference = true;
+}
+
+float ChangeDetector::skip_percent() const
+{
+    return m_stats.captures ? (float)m_stats.skipped * 100.0f / m_stats.captures : 0;
+}
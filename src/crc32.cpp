@@ -0,0 +1,26 @@
+#include "crc32.h"
+
+static uint32_t crc_table[256];
+static bool crc_table_ready = false;
+
+static void build_crc_table()
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+    crc_table_ready = true;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t len)
+{
+    if (!crc_table_ready)
+        build_crc_table();
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
@@ -0,0 +1,172 @@
+#include "device_config.h"
+#include "protocol.h"
+#include <cstddef>
+#include <cstring>
+
+#define NO_FIELD 0xFF // Tag with no DeviceConfig member of its own
+
+struct ConfigField
+{
+    uint8_t tag;
+    uint8_t width;    // Value bytes on the wire, and the member's size
+    uint8_t offset;   // Into DeviceConfig, or NO_FIELD
+    bool zero_ok;     // 0 is allowed below min (it means "off")
+    uint32_t min;
+    uint32_t max;     // Budgets are bounded by the arena as well
+};
+
+#define FIELD(tag, member, zero_ok, min, max)                                                                       \
+    {                                                                                                               \
+        tag, (uint8_t)sizeof(DeviceConfig::member), (uint8_t)offsetof(DeviceConfig, member), zero_ok, min, max    \
+    }
+
+// Indexed by tag - 1.
+static const ConfigField fields[] = {
+    FIELD(CONFIG_TAG_INTERVAL_S, interval_s, false, 1, 86400),
+    {CONFIG_TAG_BUDGET_PCT, 1, NO_FIELD, false, 2, 95},
+    FIELD(CONFIG_TAG_BUDGET_BYTES, budget_bytes, true, 16 * 1024, FRAME_ARENA_BYTES),
+    FIELD(CONFIG_TAG_CHANGE_PCT, change_pct, true, 0, 100),
+    FIELD(CONFIG_TAG_KEYFRAME_INTERVAL, keyframe_interval, true, 0, 1000),
+    FIELD(CONFIG_TAG_FRAME_TARGET, frame_target_bytes, true, 2048, 256 * 1024),
+    FIELD(CONFIG_TAG_EVENT_HOLDOFF_S, event_holdoff_s, true, 0, 600),
+    FIELD(CONFIG_TAG_BURST_FRAMES, burst_frames, true, 0, BURST_FRAMES_MAX),
+    FIELD(CONFIG_TAG_BURST_FPS, burst_fps, false, 1, 30),
+    FIELD(CONFIG_TAG_FRAME_SIZE, frame_size, false, 1, 13),
+    FIELD(CONFIG_TAG_JPEG_QUALITY, jpeg_quality, false, 4, 63),
+    FIELD(CONFIG_TAG_XCLK_MHZ, xclk_mhz, false, 8, 20),
+    FIELD(CONFIG_TAG_CHUNK_SIZE, chunk_size, false, WINDOW_MIN_CHUNK, CHUNK_SIZE),
+    FIELD(CONFIG_TAG_STATUS_DELAY_MS, status_delay_ms, true, 0, 1000),
+    FIELD(CONFIG_TAG_CHUNK_DELAY_MS, chunk_delay_ms, true, 0, 100),
+    FIELD(CONFIG_TAG_IMAGE_DELAY_MS, image_delay_ms, true, 0, 5000),
+};
+
+#undef FIELD
+
+static const int FIELD_COUNT = sizeof(fields) / sizeof(fields[0]);
+static_assert(FIELD_COUNT == CONFIG_TAG_END - 1, "one field per tag");
+
+DeviceConfig config_defaults()
+{
+    DeviceConfig config;
+    config.interval_s = 10;
+    config.budget_bytes = 0;
+    config.change_pct = 3;
+    config.keyframe_interval = 10;
+    config.frame_target_bytes = 16 * 1024;
+    config.event_holdoff_s = 10;
+    config.burst_frames = 0;
+    config.burst_fps = 10;
+    config.frame_size = CONFIG_FRAME_SIZE_VGA;
+    config.jpeg_quality = 12;
+    config.xclk_mhz = 20;
+    config.chunk_size = CHUNK_SIZE;
+    config.status_delay_ms = 50;
+    config.chunk_delay_ms = 10;
+    config.image_delay_ms = 500;
+    return config;
+}
+
+static uint32_t get_le(const uint8_t *src, uint8_t width)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < width; i++)
+        value |= (uint32_t)src[i] << (8 * i);
+    return value;
+}
+
+static void put_le(uint8_t *dst, uint32_t value, uint8_t width)
+{
+    for (uint8_t i = 0; i < width; i++)
+        dst[i] = (value >> (8 * i)) & 0xFF;
+}
+
+static uint32_t get_member(const DeviceConfig &config, const ConfigField &field)
+{
+    const uint8_t *at = (const uint8_t *)&config + field.offset;
+    if (field.width == 4)
+        return *(const uint32_t *)at;
+    if (field.width == 2)
+        return *(const uint16_t *)at;
+    return *at;
+}
+
+static void set_member(DeviceConfig &config, const ConfigField &field, uint32_t value)
+{
+    uint8_t *at = (uint8_t *)&config + field.offset;
+    if (field.width == 4)
+        *(uint32_t *)at = value;
+    else if (field.width == 2)
+        *(uint16_t *)at = (uint16_t)value;
+    else
+        *at = (uint8_t)value;
+}
+
+static bool in_range(const ConfigField &field, uint32_t value, size_t arena_bytes)
+{
+    if (value == 0 && field.zero_ok)
+        return true;
+    if (value < field.min || value > field.max)
+        return false;
+    if (field.tag == CONFIG_TAG_BUDGET_BYTES && value > arena_bytes)
+        return false;
+    if (field.tag == CONFIG_TAG_FRAME_SIZE && !(CONFIG_FRAME_SIZES & (1u << value)))
+        return false;
+    return true;
+}
+
+ConfigResult config_decode(const uint8_t *src, size_t len, DeviceConfig &config, size_t arena_bytes, uint8_t &bad_tag)
+{
+    bad_tag = 0;
+    if (len < CONFIG_HEADER_SIZE || memcmp(src, "JKC1", 4) != 0)
+        return CONFIG_BAD_HEADER;
+    if (src[4] == 0 || src[4] > CONFIG_VERSION)
+        return CONFIG_BAD_VERSION;
+
+    DeviceConfig next = config;
+    size_t pos = CONFIG_HEADER_SIZE;
+    while (pos < len)
+    {
+        if (pos + 2 > len)
+            return CONFIG_BAD_LENGTH;
+        uint8_t tag = src[pos];
+        uint8_t width = src[pos + 1];
+        bad_tag = tag;
+        if (tag == 0 || tag >= CONFIG_TAG_END)
+            return CONFIG_UNKNOWN_TAG;
+        const ConfigField &field = fields[tag - 1];
+        if (width != field.width || pos + 2 + width > len)
+            return CONFIG_BAD_LENGTH;
+        uint32_t value = get_le(src + pos + 2, width);
+        if (!in_range(field, value, arena_bytes))
+            return CONFIG_OUT_OF_RANGE;
+        if (field.offset == NO_FIELD)
+            next.budget_bytes = (uint32_t)((uint64_t)arena_bytes * value / 100); // BUDGET_PCT
+        else
+            set_member(next, field, value);
+        pos += 2 + width;
+    }
+    bad_tag = 0;
+    config = next;
+    return CONFIG_OK;
+}
+
+size_t config_encode(const DeviceConfig &config, uint8_t *dst, size_t capacity)
+{
+    if (capacity < CONFIG_ENCODED_MAX)
+        return 0;
+    memcpy(dst, "JKC1", 4);
+    dst[4] = CONFIG_VERSION;
+    dst[5] = 0;
+    size_t pos = CONFIG_HEADER_SIZE;
+    for (int i = 0; i < FIELD_COUNT; i++)
+    {
+        const ConfigField &field = fields[i];
+        if (field.offset == NO_FIELD)
+            continue;
+        dst[pos] = field.tag;
+        dst[pos + 1] = field.width;
+        put_le(dst + pos + 2, get_member(config, field), field.width);
+        pos += 2 + field.width;
+    }
+    return pos;
+}
@@ -1,29 +1,247 @@
 #include "globals.h"
 #include "display_handler.h"
 
-// Extern the global display object defined in main.cpp
-extern SSD1306 display;
+#ifndef HEADLESS
+#include "SSD1306.h"
+#include "freertos/semphr.h"
 
-void init_display()
+#define DISPLAY_ADDRESS 0x3c
+#define DISPLAY_WIDTH 128
+#define DISPLAY_PAGES 8    // 64 rows, 8 to a page
+#define DISPLAY_LINES 6    // 10-pixel text lines
+#define DISPLAY_LINE_HEIGHT 10
+#define DISPLAY_DATA_CHUNK 32 // Data bytes per I2C transaction; the Wire buffer holds 128
+
+static SSD1306 display(DISPLAY_ADDRESS, I2C_SDA, I2C_SCL, GEOMETRY_128_64);
+
+// Everything below is guarded by display_lock, which is also held across I2C
+// writes so a flush never interleaves with display_sleep() or a re-init.
+static SemaphoreHandle_t display_lock = NULL;
+static TaskHandle_t display_task_handle = NULL;
+static uint8_t shown[DISPLAY_WIDTH * DISPLAY_PAGES]; // What the panel's RAM holds
+static uint8_t dirty_pages = 0;                       // Bit per page drawn since the last flush
+static bool panel_ok = false;                         // Initialised, and answered the last write
+static uint32_t clear_at[DISPLAY_LINES];              // millis() to blank a flashed line, 0 for none
+static DisplayStats stats;
+
+static void draw_line(int line, const char *text)
 {
-    // Re-initializing after deep sleep is safe and necessary.
+    int top = line * DISPLAY_LINE_HEIGHT;
+    display.setColor(BLACK);
+    display.fillRect(0, top, DISPLAY_WIDTH, DISPLAY_LINE_HEIGHT);
+    display.setColor(WHITE);
+    display.drawString(0, top, text);
+    for (int page = top / 8; page <= (top + DISPLAY_LINE_HEIGHT - 1) / 8 && page < DISPLAY_PAGES; page++)
+        dirty_pages |= 1 << page;
+}
+
+// Panel setup as the driver does it, keeping whatever is already drawn. init()
+// clears both the buffer and the panel, so the drawing is put back and every
+// page is sent again on the next flush.
+static void init_panel()
+{
+    // The driver allocates its buffer in the first init().
+    uint8_t *drawn = display.buffer ? (uint8_t *)malloc(sizeof(shown)) : NULL;
+    if (drawn)
+        memcpy(drawn, display.buffer, sizeof(shown));
     Wire.begin(I2C_SDA, I2C_SCL);
     display.init();
     display.flipScreenVertically();
     display.setFont(ArialMT_Plain_10);
     display.setTextAlignment(TEXT_ALIGN_LEFT);
+    memset(shown, 0, sizeof(shown));
+    if (drawn)
+    {
+        memcpy(display.buffer, drawn, sizeof(shown));
+        free(drawn);
+        dirty_pages = 0xff;
+    }
+    panel_ok = true;
+}
+
+static bool panel_answers()
+{
+    Wire.beginTransmission(DISPLAY_ADDRESS);
+    return Wire.endTransmission() == 0;
+}
+
+// One 128x8 page: a one-page addressing window (the driver leaves the panel in
+// horizontal addressing mode), then the page's columns.
+static bool send_page(int page, const uint8_t *data)
+{
+    static const uint8_t window[] = {0x00, 0x21, 0, DISPLAY_WIDTH - 1, 0x22};
+    Wire.beginTransmission(DISPLAY_ADDRESS);
+    Wire.write(window, sizeof(window));
+    Wire.write((uint8_t)page);
+    Wire.write((uint8_t)page);
+    if (Wire.endTransmission() != 0)
+        return false;
+    for (int x = 0; x < DISPLAY_WIDTH; x += DISPLAY_DATA_CHUNK)
+    {
+        Wire.beginTransmission(DISPLAY_ADDRESS);
+        Wire.write(0x40); // Data stream
+        Wire.write(data + x, DISPLAY_DATA_CHUNK);
+        if (Wire.endTransmission() != 0)
+            return false;
+    }
+    return true;
+}
+
+// Blanks flashed lines that are due, then sends the dirty pages that differ
+// from what the panel shows.
+static void flush()
+{
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    uint32_t now = millis();
+    for (int line = 0; line < DISPLAY_LINES; line++)
+    {
+        if (clear_at[line] && (int32_t)(now - clear_at[line]) >= 0)
+        {
+            draw_line(line, "");
+            clear_at[line] = 0;
+        }
+    }
+    if (!panel_ok)
+    {
+        init_panel();
+        stats.reinits++;
+    }
+    int sent = 0;
+    for (int page = 0; page < DISPLAY_PAGES; page++)
+    {
+        if (!(dirty_pages & (1 << page)))
+            continue;
+        uint8_t *data = display.buffer + page * DISPLAY_WIDTH;
+        if (memcmp(data, shown + page * DISPLAY_WIDTH, DISPLAY_WIDTH) == 0)
+        {
+            dirty_pages &= ~(1 << page);
+            continue;
+        }
+        if (!send_page(page, data))
+        {
+            // Re-init and resend on the next flush.
+            panel_ok = false;
+            break;
+        }
+        memcpy(shown + page * DISPLAY_WIDTH, data, DISPLAY_WIDTH);
+        dirty_pages &= ~(1 << page);
+        sent++;
+    }
+    if (sent)
+    {
+        stats.flushes++;
+        stats.pages_sent += sent;
+    }
+    xSemaphoreGive(display_lock);
+}
+
+// How long the task may block before a flashed line is due to clear.
+static TickType_t next_clear_ticks()
+{
+    uint32_t now = millis();
+    TickType_t wait = portMAX_DELAY;
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    for (int line = 0; line < DISPLAY_LINES; line++)
+    {
+        if (!clear_at[line])
+            continue;
+        int32_t left = (int32_t)(clear_at[line] - now);
+        TickType_t ticks = left > 0 ? pdMS_TO_TICKS(left) : 0;
+        if (ticks < wait)
+            wait = ticks;
+    }
+    xSemaphoreGive(display_lock);
+    return wait;
+}
+
+// Low priority, so flushes only take time nothing else wants. It sleeps until
+// something is drawn, then waits out the rest of the frame so everything drawn
+// meanwhile goes in the same flush.
+static void display_task(void *param)
+{
+    TickType_t last_flush = xTaskGetTickCount() - pdMS_TO_TICKS(DISPLAY_FRAME_MS);
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, next_clear_ticks());
+        TickType_t since = xTaskGetTickCount() - last_flush;
+        if (since < pdMS_TO_TICKS(DISPLAY_FRAME_MS))
+            vTaskDelay(pdMS_TO_TICKS(DISPLAY_FRAME_MS) - since);
+        flush();
+        last_flush = xTaskGetTickCount();
+    }
+}
+
+void init_display()
+{
+    if (!display_lock)
+    {
+        display_lock = xSemaphoreCreateMutex();
+        xTaskCreatePinnedToCore(display_task, "display", DISPLAY_TASK_STACK, NULL, 1, &display_task_handle, 1);
+    }
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    init_panel();
     display.clear();
+    memset(clear_at, 0, sizeof(clear_at));
+    xSemaphoreGive(display_lock);
     update_display(0, "OLED Init OK", true);
     Serial.println("OLED Initialized.");
 }
 
 void update_display(int line, const char *text, bool do_display)
 {
-    // Clear the line before writing new text to prevent artifacts
-    display.setColor(BLACK);
-    display.fillRect(0, line * 10, 128, 10);
-    display.setColor(WHITE);
-    display.drawString(0, line * 10, text);
+    if (!display_lock || line < 0 || line >= DISPLAY_LINES)
+        return;
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    draw_line(line, text);
+    clear_at[line] = 0;
+    stats.draws++;
+    xSemaphoreGive(display_lock);
     if (do_display)
-        display.display();
-}
\ No newline at end of file
+        xTaskNotifyGive(display_task_handle);
+}
+
+void flash_display(int line, const char *text, uint32_t duration_ms)
+{
+    update_display(line, text, true);
+    if (!display_lock || line < 0 || line >= DISPLAY_LINES)
+        return;
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    clear_at[line] = (millis() + duration_ms) | 1; // Never 0
+    xSemaphoreGive(display_lock);
+}
+
+void display_sleep()
+{
+    if (!display_lock)
+        return;
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    if (panel_ok)
+        display.displayOff();
+    xSemaphoreGive(display_lock);
+}
+
+void display_wake()
+{
+    if (!display_lock)
+        return;
+    xSemaphoreTake(display_lock, portMAX_DELAY);
+    // Light sleep keeps the I2C controller and the panel's RAM, so a panel that
+    // still answers only needs switching back on.
+    if (panel_ok && panel_answers())
+    {
+        display.displayOn();
+    }
+    else
+    {
+        init_panel();
+        stats.reinits++;
+    }
+    xSemaphoreGive(display_lock);
+    xTaskNotifyGive(display_task_handle);
+}
+
+const DisplayStats &display_stats()
+{
+    return stats;
+}
+#endif
@@ -0,0 +1,226 @@
+#include "event_log.h"
+#include <cstdio>
+#include <cstring>
+
+#define HEADER_SIZE 20 // Magic, version, pad, record count, uptime, first sequence, dropped
+#define RECORD_FIXED_SIZE 8
+
+EventLog event_log;
+
+#define LOG_FORMAT_TEXT(id, text) text,
+static const char *const format_texts[] = {LOG_FORMATS(LOG_FORMAT_TEXT)};
+#undef LOG_FORMAT_TEXT
+
+static void put_u16(uint8_t *out, uint16_t v)
+{
+    out[0] = v & 0xFF;
+    out[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t v)
+{
+    out[0] = v & 0xFF;
+    out[1] = (v >> 8) & 0xFF;
+    out[2] = (v >> 16) & 0xFF;
+    out[3] = v >> 24;
+}
+
+EventLog::EventLog() : m_head(0), m_written(0), m_dropped(0), m_tail(0), m_reported_drops(0), m_drained(0)
+{
+    for (uint32_t i = 0; i < EVENT_LOG_LEN; i++)
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    memset(m_history, 0, sizeof(m_history));
+}
+
+uint32_t EventLog::arg(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+void EventLog::write(uint8_t level, uint16_t format, const uint32_t *args, uint8_t argc)
+{
+    // Claim a slot by moving the head past it; a slot whose sequence lags the
+    // head is still waiting for the drain, which means the ring is full.
+    uint32_t pos = m_head.load(std::memory_order_relaxed);
+    Slot *slot;
+    for (;;)
+    {
+        slot = &m_slots[pos & (EVENT_LOG_LEN - 1)];
+        int32_t lag = (int32_t)(slot->sequence.load(std::memory_order_acquire) - pos);
+        if (lag == 0)
+        {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (lag < 0)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    LogRecord &record = slot->record;
+    record.time_ms = (uint32_t)(platform_micros() / 1000);
+    record.format = format;
+    record.level = level;
+    record.argc = argc > EVENT_LOG_ARGS ? EVENT_LOG_ARGS : argc;
+    memcpy(record.args, args, record.argc * sizeof(uint32_t));
+    slot->sequence.store(pos + 1, std::memory_order_release);
+    m_written.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool EventLog::pop(LogRecord &record)
+{
+    uint32_t dropped = m_dropped.load(std::memory_order_relaxed);
+    if (dropped != m_reported_drops)
+    {
+        record.time_ms = (uint32_t)(platform_micros() / 1000);
+        record.format = LOGF_DROPPED;
+        record.level = EVLOG_LEVEL_WARN;
+        record.argc = 1;
+        record.args[0] = dropped - m_reported_drops;
+        m_reported_drops = dropped;
+    }
+    else
+    {
+        // A slot is readable once its writer has published it as tail + 1.
+        Slot &slot = m_slots[m_tail & (EVENT_LOG_LEN - 1)];
+        if ((int32_t)(slot.sequence.load(std::memory_order_acquire) - (m_tail + 1)) < 0)
+            return false;
+        record = slot.record;
+        slot.sequence.store(m_tail + EVENT_LOG_LEN, std::memory_order_release);
+        m_tail++;
+    }
+    m_history[m_drained % EVENT_LOG_HISTORY] = record;
+    m_drained++;
+    return true;
+}
+
+size_t EventLog::pending() const
+{
+    PlatformLockGuard guard(m_drain_lock);
+    return m_head.load(std::memory_order_relaxed) - m_tail;
+}
+
+size_t EventLog::encode(uint8_t *dst, size_t capacity, uint32_t &from) const
+{
+    if (capacity < HEADER_SIZE)
+        return 0;
+    PlatformLockGuard guard(m_drain_lock);
+    uint32_t oldest = m_drained > EVENT_LOG_HISTORY ? m_drained - EVENT_LOG_HISTORY : 0;
+    uint32_t first = (int32_t)(from - oldest) > 0 ? from : oldest;
+    if ((int32_t)(first - m_drained) > 0)
+        first = m_drained;
+
+    size_t pos = HEADER_SIZE;
+    uint32_t seq = first;
+    for (; seq != m_drained; seq++)
+    {
+        const LogRecord &record = m_history[seq % EVENT_LOG_HISTORY];
+        size_t size = RECORD_FIXED_SIZE + record.argc * 4;
+        if (pos + size > capacity)
+            break;
+        put_u32(dst + pos, record.time_ms);
+        put_u16(dst + pos + 4, record.format);
+        dst[pos + 6] = record.level;
+        dst[pos + 7] = record.argc;
+        for (uint8_t i = 0; i < record.argc; i++)
+            put_u32(dst + pos + RECORD_FIXED_SIZE + i * 4, record.args[i]);
+        pos += size;
+    }
+
+    memcpy(dst, "JKL1", 4);
+    dst[4] = VERSION;
+    dst[5] = 0;
+    put_u16(dst + 6, (uint16_t)(seq - first));
+    put_u32(dst + 8, (uint32_t)(platform_micros() / 1000));
+    put_u32(dst + 12, first);
+    put_u32(dst + 16, dropped());
+    from = seq;
+    return pos;
+}
+
+const char *EventLog::format_text(uint16_t format)
+{
+    return format < LOG_FORMAT_COUNT ? format_texts[format] : NULL;
+}
+
+// Expands one record's format with its stored arguments, one conversion at a
+// time, since the arguments only exist as 32-bit words.
+size_t EventLog::format(const LogRecord &record, char *dst, size_t capacity)
+{
+    if (capacity == 0)
+        return 0;
+    static const char levels[] = "DIWE";
+    int n = snprintf(dst, capacity, "%u.%03u %c ", (unsigned)(record.time_ms / 1000), (unsigned)(record.time_ms % 1000),
+                     record.level < 4 ? levels[record.level] : '?');
+    size_t len = n < 0 ? 0 : (size_t)n < capacity ? (size_t)n : capacity - 1;
+
+    const char *text = format_text(record.format);
+    if (!text)
+    {
+        n = snprintf(dst + len, capacity - len, "format %u", record.format);
+        text = "";
+        len += n < 0 ? 0 : (size_t)n < capacity - len ? (size_t)n : capacity - len - 1;
+    }
+
+    uint8_t next = 0;
+    for (const char *p = text; *p && len + 1 < capacity; p++)
+    {
+        if (*p != '%')
+        {
+            dst[len++] = *p;
+            continue;
+        }
+        if (p[1] == '%')
+        {
+            dst[len++] = '%';
+            p++;
+            continue;
+        }
+        char spec[16];
+        size_t s = 0;
+        spec[s++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && s < sizeof(spec) - 2)
+            spec[s++] = *p++;
+        if (!*p)
+            break;
+        spec[s++] = *p;
+        spec[s] = '\0';
+        uint32_t value = next < record.argc ? record.args[next] : 0;
+        next++;
+
+        switch (*p)
+        {
+        case 'd':
+        case 'i':
+            n = snprintf(dst + len, capacity - len, spec, (int)(int32_t)value);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+            n = snprintf(dst + len, capacity - len, spec, (unsigned)value);
+            break;
+        case 'f':
+        {
+            float f;
+            memcpy(&f, &value, sizeof(f));
+            n = snprintf(dst + len, capacity - len, spec, (double)f);
+            break;
+        }
+        default:
+            n = snprintf(dst + len, capacity - len, "?");
+            break;
+        }
+        len += n < 0 ? 0 : (size_t)n < capacity - len ? (size_t)n : capacity - len - 1;
+    }
+    dst[len] = '\0';
+    return len;
+}
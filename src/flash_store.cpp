@@ -0,0 +1,430 @@
+#include "flash_store.h"
+#include "crc32.h"
+#include "platform.h"
+#include <cstddef>
+#include <cstring>
+#include <dirent.h>
+
+#define INDEX_FILE "index.bin"
+#define INDEX_TEMP_FILE "index.tmp"
+
+FlashStore::FlashStore()
+    : m_capacity(0), m_used_bytes(0), m_entries(NULL), m_flags(NULL), m_first(0), m_count(0), m_next_segment(1),
+      m_index_records(0), m_evicted(0), m_index(NULL), m_reader(NULL), m_reader_segment(0)
+{
+    m_dir[0] = '\0';
+}
+
+FlashStore::~FlashStore()
+{
+    end();
+}
+
+bool FlashStore::begin(const char *dir, size_t capacity)
+{
+    end();
+    m_entries = (Entry *)platform_alloc_large(FLASH_INDEX_MAX * sizeof(Entry));
+    m_flags = (uint8_t *)platform_alloc_large(FLASH_INDEX_MAX);
+    if (!m_entries || !m_flags)
+    {
+        end();
+        return false;
+    }
+    snprintf(m_dir, sizeof(m_dir), "%s", dir);
+    m_capacity = capacity;
+
+    bool clean = replay_index();
+    remove_orphans();
+    // Rewrite the index after a torn append, or once most of it describes frames
+    // that are long gone.
+    if (!clean || (m_index_records > 64 && m_index_records > 2 * (uint32_t)m_count))
+        compact_index();
+
+    char path[48];
+    snprintf(path, sizeof(path), "%s/" INDEX_FILE, m_dir);
+    m_index = fopen(path, "ab");
+    if (!m_index)
+    {
+        PLATFORM_LOG("Flash spill store: cannot open %s\n", path);
+        end();
+        return false;
+    }
+    PLATFORM_LOG("Flash spill store ready: %d frames, %u/%u bytes.\n", m_count, (unsigned)m_used_bytes,
+                 (unsigned)m_capacity);
+    return true;
+}
+
+void FlashStore::end()
+{
+    close_reader();
+    if (m_index)
+        fclose(m_index);
+    m_index = NULL;
+    if (m_entries)
+        platform_free_large(m_entries);
+    if (m_flags)
+        platform_free_large(m_flags);
+    m_entries = NULL;
+    m_flags = NULL;
+    m_dir[0] = '\0';
+    m_first = 0;
+    m_count = 0;
+    m_used_bytes = 0;
+    m_next_segment = 1;
+    m_index_records = 0;
+    m_evicted = 0;
+}
+
+void FlashStore::segment_path(uint32_t segment, char *out, size_t size) const
+{
+    snprintf(out, size, "%s/seg%05u.bin", m_dir, (unsigned)segment);
+}
+
+size_t FlashStore::segment_bytes(uint32_t segment) const
+{
+    char path[48];
+    segment_path(segment, path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size > 0 ? (size_t)size : 0;
+}
+
+void FlashStore::delete_segment(uint32_t segment)
+{
+    if (m_reader && m_reader_segment == segment)
+        close_reader();
+    size_t bytes = segment_bytes(segment);
+    char path[48];
+    segment_path(segment, path, sizeof(path));
+    remove(path);
+    m_used_bytes = m_used_bytes > bytes ? m_used_bytes - bytes : 0;
+}
+
+// Drops the oldest segment and every frame still indexed in it. Replay notices
+// the missing file, so no index record is needed.
+void FlashStore::evict_oldest_segment()
+{
+    if (m_count == 0)
+        return;
+    uint32_t segment = entry(0).segment;
+    while (m_count > 0 && entry(0).segment == segment)
+    {
+        m_first = (m_first + 1) % FLASH_INDEX_MAX;
+        m_count--;
+        m_evicted++;
+    }
+    delete_segment(segment);
+    PLATFORM_LOG("Flash spill store full: evicted segment %u.\n", (unsigned)segment);
+}
+
+FlashStore::IndexRecord FlashStore::make_record(uint32_t kind, const Entry &entry)
+{
+    IndexRecord record;
+    record.kind = kind;
+    record.entry = entry;
+    record.check = crc32_update(0, (const uint8_t *)&record, offsetof(IndexRecord, check));
+    return record;
+}
+
+FlashStore::IndexRecord FlashStore::make_frame_record(const Entry &entry, uint8_t flags)
+{
+    return make_record(flags & FRAME_FLAG_EVENT ? RECORD_EVENT_FRAME : RECORD_FRAME, entry);
+}
+
+// Appends a frame to the RAM index, dropping the oldest if it is full.
+void FlashStore::push_entry(const Entry &entry, uint8_t flags)
+{
+    if (m_count == FLASH_INDEX_MAX)
+    {
+        m_first = (m_first + 1) % FLASH_INDEX_MAX;
+        m_count--;
+    }
+    int slot = (m_first + m_count) % FLASH_INDEX_MAX;
+    m_entries[slot] = entry;
+    m_flags[slot] = flags;
+    m_count++;
+}
+
+bool FlashStore::append_records(const IndexRecord *records, int count)
+{
+    if (!m_index)
+        return false;
+    bool ok = fwrite(records, sizeof(IndexRecord), count, m_index) == (size_t)count;
+    fflush(m_index);
+    m_index_records += count;
+    return ok;
+}
+
+// Rebuilds the RAM index from the index file. Returns false if the file ends in a
+// torn record.
+bool FlashStore::replay_index()
+{
+    char path[48];
+    snprintf(path, sizeof(path), "%s/" INDEX_FILE, m_dir);
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return true;
+
+    bool clean = true;
+    IndexRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (record.check != crc32_update(0, (const uint8_t *)&record, offsetof(IndexRecord, check)))
+        {
+            clean = false; // Torn append from a reset mid-write; nothing after it is trustworthy
+            break;
+        }
+        m_index_records++;
+        if (record.kind == RECORD_FRAME || record.kind == RECORD_EVENT_FRAME)
+        {
+            push_entry(record.entry, record.kind == RECORD_EVENT_FRAME ? FRAME_FLAG_EVENT : 0);
+            if (record.entry.segment >= m_next_segment)
+                m_next_segment = record.entry.segment + 1;
+        }
+        else if (record.kind == RECORD_RELEASE)
+        {
+            while (m_count > 0 && entry(0).id <= record.entry.id)
+            {
+                m_first = (m_first + 1) % FLASH_INDEX_MAX;
+                m_count--;
+            }
+        }
+    }
+    fclose(file);
+
+    // Keep only frames whose segment is still on flash, and total up what they occupy.
+    int kept = 0;
+    uint32_t last_segment = 0;
+    bool last_present = false;
+    for (int i = 0; i < m_count; i++)
+    {
+        const Entry e = entry(i);
+        uint8_t f = flags(i);
+        if (i == 0 || e.segment != last_segment)
+        {
+            size_t bytes = segment_bytes(e.segment);
+            last_segment = e.segment;
+            last_present = bytes > 0;
+            m_used_bytes += bytes;
+        }
+        if (last_present)
+        {
+            m_entries[(m_first + kept) % FLASH_INDEX_MAX] = e;
+            m_flags[(m_first + kept++) % FLASH_INDEX_MAX] = f;
+        }
+    }
+    m_count = kept;
+    return clean;
+}
+
+// Rewrites the index with just the live frames, then swaps it in.
+void FlashStore::compact_index()
+{
+    char path[48], temp[48];
+    snprintf(path, sizeof(path), "%s/" INDEX_FILE, m_dir);
+    snprintf(temp, sizeof(temp), "%s/" INDEX_TEMP_FILE, m_dir);
+    FILE *file = fopen(temp, "wb");
+    if (!file)
+        return;
+    bool ok = true;
+    for (int i = 0; i < m_count && ok; i++)
+    {
+        IndexRecord record = make_frame_record(entry(i), flags(i));
+        ok = fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    ok = fclose(file) == 0 && ok;
+    if (ok && rename(temp, path) != 0)
+    {
+        remove(path);
+        ok = rename(temp, path) == 0;
+    }
+    if (!ok)
+    {
+        remove(temp);
+        return;
+    }
+    PLATFORM_LOG("Flash spill index compacted from %u to %d records.\n", (unsigned)m_index_records, m_count);
+    m_index_records = m_count;
+}
+
+// Deletes segment files the index does not reference, e.g. a spill cut short by a reset.
+void FlashStore::remove_orphans()
+{
+    DIR *dir = opendir(m_dir);
+    if (!dir)
+        return;
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL)
+    {
+        unsigned segment = 0;
+        if (sscanf(item->d_name, "seg%05u.bin", &segment) != 1)
+            continue;
+        bool referenced = false;
+        for (int i = 0; i < m_count && !referenced; i++)
+            referenced = entry(i).segment == segment;
+        if (!referenced)
+        {
+            char path[48];
+            segment_path(segment, path, sizeof(path));
+            remove(path);
+        }
+        if (segment >= m_next_segment)
+            m_next_segment = segment + 1;
+    }
+    closedir(dir);
+}
+
+int FlashStore::spill(FrameBacklog &source)
+{
+    if (!m_index)
+        return 0;
+
+    // Anything larger than the whole store loses its oldest frames up front.
+    int n = source.count();
+    size_t bytes = 0;
+    FrameRef frame = {};
+    for (int i = 0; i < n; i++)
+    {
+        source.peek_at(i, frame);
+        bytes += frame.len;
+    }
+    while (n > 0 && (bytes + FLASH_WRITE_BLOCK > m_capacity || n > FLASH_INDEX_MAX))
+    {
+        source.peek_at(0, frame);
+        source.release_front();
+        bytes -= frame.len;
+        n--;
+        PLATFORM_LOG("Batch larger than the flash spill store: dropped frame %u.\n", frame.id);
+    }
+    if (n == 0)
+        return 0;
+
+    while (m_count > 0 && (m_used_bytes + bytes + FLASH_WRITE_BLOCK > m_capacity || m_count + n > FLASH_INDEX_MAX))
+        evict_oldest_segment();
+
+    uint32_t segment = m_next_segment++;
+    char path[48];
+    segment_path(segment, path, sizeof(path));
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        PLATFORM_LOG("Flash spill store: cannot create %s\n", path);
+        return 0;
+    }
+    // Our writes are already block sized; stdio buffering would only split them.
+    setvbuf(file, NULL, _IONBF, 0);
+
+    // Stream the frames through one block buffer so every write is a whole block.
+    bool ok = true;
+    size_t fill = 0;
+    uint32_t offset = 0;
+    for (int i = 0; i < n && ok; i++)
+    {
+        source.peek_at(i, frame);
+        for (size_t done = 0; done < frame.len && ok;)
+        {
+            size_t step = frame.len - done;
+            if (step > FLASH_WRITE_BLOCK - fill)
+                step = FLASH_WRITE_BLOCK - fill;
+            source.read(i, done, m_block + fill, step);
+            fill += step;
+            done += step;
+            if (fill == FLASH_WRITE_BLOCK)
+            {
+                ok = fwrite(m_block, 1, fill, file) == fill;
+                fill = 0;
+            }
+        }
+    }
+    if (ok && fill > 0)
+        ok = fwrite(m_block, 1, fill, file) == fill;
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+    {
+        PLATFORM_LOG("Flash spill store: write to %s failed.\n", path);
+        remove(path);
+        return 0;
+    }
+
+    // The segment is complete on flash; only now does the index point at it.
+    IndexRecord records[16];
+    int pending = 0;
+    for (int i = 0; i < n; i++)
+    {
+        source.peek_at(i, frame);
+        Entry e = {segment, offset, frame.id, (uint32_t)frame.len, frame.timestamp_ms, frame.crc32};
+        offset += frame.len;
+        push_entry(e, (uint8_t)frame.flags);
+
+        records[pending++] = make_frame_record(e, (uint8_t)frame.flags);
+        if (pending == 16 || i == n - 1)
+        {
+            append_records(records, pending);
+            pending = 0;
+        }
+    }
+    m_used_bytes += offset;
+
+    for (int i = 0; i < n; i++)
+        source.release_front();
+    PLATFORM_LOG("Spilled %d frames (%u bytes) to flash segment %u; %u/%u bytes used.\n", n, (unsigned)offset,
+                 (unsigned)segment, (unsigned)m_used_bytes, (unsigned)m_capacity);
+    return n;
+}
+
+bool FlashStore::peek_at(int index, FrameRef &frame) const
+{
+    if (index < 0 || index >= m_count)
+        return false;
+    const Entry &e = entry(index);
+    frame.data = NULL;
+    frame.len = e.length;
+    frame.id = e.id;
+    frame.timestamp_ms = e.timestamp_ms;
+    frame.crc32 = e.crc32;
+    frame.flags = flags(index);
+    return true;
+}
+
+void FlashStore::close_reader() const
+{
+    if (m_reader)
+        fclose(m_reader);
+    m_reader = NULL;
+}
+
+void FlashStore::read(int index, size_t offset, uint8_t *dst, size_t len) const
+{
+    if (index < 0 || index >= m_count)
+        return;
+    const Entry &e = entry(index);
+    if (!m_reader || m_reader_segment != e.segment)
+    {
+        close_reader();
+        char path[48];
+        segment_path(e.segment, path, sizeof(path));
+        m_reader = fopen(path, "rb");
+        m_reader_segment = e.segment;
+    }
+    if (!m_reader || fseek(m_reader, e.offset + offset, SEEK_SET) != 0 || fread(dst, 1, len, m_reader) != len)
+        memset(dst, 0, len); // The server's CRC check rejects the frame
+}
+
+void FlashStore::release_front()
+{
+    if (m_count == 0)
+        return;
+    Entry released = entry(0);
+    m_first = (m_first + 1) % FLASH_INDEX_MAX;
+    m_count--;
+
+    IndexRecord record = make_record(RECORD_RELEASE, released);
+    append_records(&record, 1);
+
+    if (m_count == 0 || entry(0).segment != released.segment)
+        delete_segment(released.segment);
+}
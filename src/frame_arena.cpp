@@ -0,0 +1,220 @@
+#include "frame_arena.h"
+#include "crc32.h"
+#include <cstring>
+
+FrameArena::FrameArena()
+    : m_buffer(NULL), m_capacity(0), m_head(0), m_tail(0), m_used_bytes(0), m_payload_bytes(0),
+      m_count(0), m_pinned(false), m_next_id(1), m_evicted(0), m_dropped(0), m_newest()
+{
+}
+
+bool FrameArena::begin(size_t capacity)
+{
+    end();
+    capacity &= ~(size_t)3;
+    uint8_t *buffer = (uint8_t *)platform_alloc_large(capacity);
+    if (!buffer)
+    {
+        PLATFORM_LOG("Frame arena allocation of %u bytes failed\n", (unsigned)capacity);
+        return false;
+    }
+    PlatformLockGuard guard(m_lock);
+    m_buffer = buffer;
+    m_capacity = capacity;
+    reset();
+    PLATFORM_LOG("Frame arena ready (%u bytes).\n", (unsigned)capacity);
+    return true;
+}
+
+void FrameArena::end()
+{
+    PlatformLockGuard guard(m_lock);
+    if (m_buffer)
+        platform_free_large(m_buffer);
+    m_buffer = NULL;
+    m_capacity = 0;
+    reset();
+}
+
+void FrameArena::reset()
+{
+    m_head = 0;
+    m_tail = 0;
+    m_used_bytes = 0;
+    m_payload_bytes = 0;
+    m_count = 0;
+}
+
+void FrameArena::clear()
+{
+    PlatformLockGuard guard(m_lock);
+    reset();
+}
+
+void FrameArena::set_pinned(bool pinned)
+{
+    PlatformLockGuard guard(m_lock);
+    m_pinned = pinned;
+}
+
+int FrameArena::count() const
+{
+    PlatformLockGuard guard(m_lock);
+    return m_count;
+}
+
+size_t FrameArena::payload_bytes() const
+{
+    PlatformLockGuard guard(m_lock);
+    return m_payload_bytes;
+}
+
+size_t FrameArena::used_bytes() const
+{
+    PlatformLockGuard guard(m_lock);
+    return m_used_bytes;
+}
+
+size_t FrameArena::record_size(size_t len)
+{
+    return (sizeof(RecordHeader) + len + 3) & ~(size_t)3;
+}
+
+// Skips the wrap padding at the end of the ring, if offset points into it.
+size_t FrameArena::resolve(size_t offset) const
+{
+    if (m_capacity - offset < sizeof(RecordHeader))
+        return 0;
+    const RecordHeader *header = (const RecordHeader *)(m_buffer + offset);
+    return header->length == WRAP_MARKER ? 0 : offset;
+}
+
+// Finds a contiguous span for a record of `size` bytes without evicting anything.
+bool FrameArena::reserve(size_t size, size_t &offset)
+{
+    if (m_count == 0)
+    {
+        reset();
+        offset = 0;
+        return size <= m_capacity;
+    }
+    if (m_head > m_tail)
+    {
+        if (m_capacity - m_head >= size)
+        {
+            offset = m_head;
+            return true;
+        }
+        if (m_tail >= size)
+        {
+            // Pad out the end of the ring so this record stays contiguous.
+            if (m_capacity - m_head >= sizeof(RecordHeader))
+                ((RecordHeader *)(m_buffer + m_head))->length = WRAP_MARKER;
+            m_used_bytes += m_capacity - m_head;
+            offset = 0;
+            return true;
+        }
+        return false;
+    }
+    // Wrapped (or exactly full when head == tail).
+    if (m_tail - m_head >= size)
+    {
+        offset = m_head;
+        return true;
+    }
+    return false;
+}
+
+bool FrameArena::append(const uint8_t *data, size_t len, uint32_t timestamp_ms, uint32_t flags)
+{
+    PlatformLockGuard guard(m_lock);
+    size_t size = record_size(len);
+    if (!m_buffer || size > m_capacity)
+        return false;
+
+    size_t offset;
+    while (!reserve(size, offset))
+    {
+        if (m_pinned)
+        {
+            m_dropped++;
+            return false;
+        }
+        release_oldest_locked();
+        m_evicted++;
+    }
+
+    RecordHeader *header = (RecordHeader *)(m_buffer + offset);
+    header->length = len;
+    header->id = m_next_id++;
+    header->timestamp_ms = timestamp_ms;
+    header->flags = flags;
+    memcpy(m_buffer + offset + sizeof(RecordHeader), data, len);
+    header->crc32 = crc32_update(0, data, len);
+
+    m_head = offset + size;
+    if (m_head == m_capacity)
+        m_head = 0;
+    m_used_bytes += size;
+    m_payload_bytes += len;
+    m_count++;
+    m_newest = {m_buffer + offset + sizeof(RecordHeader), len, header->id, timestamp_ms, header->crc32, flags};
+    return true;
+}
+
+FrameCursor FrameArena::cursor() const
+{
+    PlatformLockGuard guard(m_lock);
+    return {m_tail, m_count};
+}
+
+bool FrameArena::next(FrameCursor &cursor, FrameRef &frame) const
+{
+    if (cursor.remaining <= 0)
+        return false;
+    PlatformLockGuard guard(m_lock);
+    size_t offset = resolve(cursor.offset);
+    const RecordHeader *header = (const RecordHeader *)(m_buffer + offset);
+    frame.data = m_buffer + offset + sizeof(RecordHeader);
+    frame.len = header->length;
+    frame.id = header->id;
+    frame.timestamp_ms = header->timestamp_ms;
+    frame.crc32 = header->crc32;
+    frame.flags = header->flags;
+    cursor.offset = offset + record_size(header->length);
+    if (cursor.offset == m_capacity)
+        cursor.offset = 0;
+    cursor.remaining--;
+    return true;
+}
+
+bool FrameArena::oldest(FrameRef &frame) const
+{
+    FrameCursor c = cursor();
+    return next(c, frame);
+}
+
+void FrameArena::release_oldest()
+{
+    PlatformLockGuard guard(m_lock);
+    release_oldest_locked();
+}
+
+void FrameArena::release_oldest_locked()
+{
+    if (m_count == 0)
+        return;
+    size_t offset = resolve(m_tail);
+    if (offset != m_tail)
+        m_used_bytes -= m_capacity - m_tail; // The wrap padding goes with the record after it
+    const RecordHeader *header = (const RecordHeader *)(m_buffer + offset);
+    size_t size = record_size(header->length);
+    m_used_bytes -= size;
+    m_payload_bytes -= header->length;
+    m_tail = offset + size;
+    if (m_tail == m_capacity)
+        m_tail = 0;
+    m_count--;
+    if (m_count == 0)
+        reset();
+}
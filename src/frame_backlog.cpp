@@ -0,0 +1,69 @@
+#include "frame_backlog.h"
+#include <cstring>
+
+ArenaBacklog::ArenaBacklog(FrameArena &arena, FrameQueue &queue) : m_arena(arena), m_queue(queue)
+{
+    m_arena.set_pinned(true);
+    prune();
+}
+
+ArenaBacklog::~ArenaBacklog()
+{
+    m_arena.set_pinned(false);
+}
+
+// Drops descriptors of frames the arena has already evicted, so the front of the
+// queue and the oldest frame in the arena line up.
+void ArenaBacklog::prune()
+{
+    FrameRef frame, oldest;
+    while (m_queue.peek(frame) && (!m_arena.oldest(oldest) || frame.id < oldest.id))
+        m_queue.pop(frame);
+}
+
+bool ArenaBacklog::peek_at(int index, FrameRef &frame) const
+{
+    return m_queue.peek_at(index, frame);
+}
+
+void ArenaBacklog::read(int index, size_t offset, uint8_t *dst, size_t len) const
+{
+    FrameRef frame = {};
+    if (m_queue.peek_at(index, frame))
+        memcpy(dst, frame.data + offset, len);
+}
+
+// Pops the delivered descriptor and frees its frame, along with any older frame
+// that never made it into the queue.
+void ArenaBacklog::release_front()
+{
+    FrameRef frame;
+    if (!m_queue.pop(frame))
+        return;
+    uint32_t id = frame.id;
+    while (m_arena.oldest(frame) && frame.id <= id)
+        m_arena.release_oldest();
+}
+
+bool ChainedBacklog::peek_at(int index, FrameRef &frame) const
+{
+    int split = m_first.count();
+    return index < split ? m_first.peek_at(index, frame) : m_second.peek_at(index - split, frame);
+}
+
+void ChainedBacklog::read(int index, size_t offset, uint8_t *dst, size_t len) const
+{
+    int split = m_first.count();
+    if (index < split)
+        m_first.read(index, offset, dst, len);
+    else
+        m_second.read(index - split, offset, dst, len);
+}
+
+void ChainedBacklog::release_front()
+{
+    if (m_first.count() > 0)
+        m_first.release_front();
+    else
+        m_second.release_front();
+}
@@ -0,0 +1,1577 @@
+// Transfer-throughput benchmark for the native build (pio run -e native).
+//
+//   .pio/build/native/program <fixture_dir> [--window N] [--container 0|1] [--batch N | --budget BYTES] [--mtu N]
+//       [--latency MS] [--jitter MS] [--loss P] [--queue N] [--rate KBPS] [--seed N] [--drop-at MS]
+//       [--spill DIR [--flash BYTES]] [--change PCT [--keyframe N]] [--target BYTES [--trace FILE]]
+//       [--telemetry FILE] [--poll MS] [--preview N] [--pir PER_HOUR [--holdoff MS]]
+//       [--burst N [--fps F] [--sensor-fps F]] [--warmup WAKES [--drift P]] [--log RECORDS] [--power FRAMES]
+//       [--config WRITES]
+//
+// Fills a batch from the fixture JPEGs (a fixed count, or until a byte budget
+// would overflow), drains it through the link emulator and
+// reports bytes/s, chunks/s and time-to-drain-batch. Without --window the
+// stop-and-wait, windowed and windowed batch-container modes are run for comparison.
+// With --drop-at the link goes down at that virtual time and a second session
+// resumes from the server's resume point; every frame must still arrive exactly once.
+// With --spill, batches are spilled to a flash store in DIR (a file-backed stand-in
+// for the LittleFS partition), reloaded as after a reset and sent from there.
+// With --change, the fixtures are replayed in name order through the change gate
+// as a recorded capture sequence: it times the DC signature kernel, reports
+// what the gate keeps and skips, and checks the kernel on known inputs.
+// With --target, the JPEG quality controller is run against a size-vs-quality
+// trace (one scene per block of "quality bytes" lines in FILE), or without one
+// against a nominal curve through each fixture's size at quality 12, and must
+// settle every scene near the target or at a bound.
+// Every transfer run records chunk round-trip times into a Telemetry and prints
+// their summary; --telemetry FILE writes the last run's encoded snapshot there
+// (decode it with python -m app.telemetry FILE from srv/). --poll models a sender
+// that checks for commands in a delay(MS) loop instead of blocking on a queue.
+// With --preview, the batch goes once as a plain container and once preview-first
+// with the server pulling every Nth frame in full, and the airtime is compared.
+// With --pir, an hour of simulated PIR activity (PER_HOUR motion episodes) drives
+// the capture scheduler against a 60 s timelapse; event captures must fire on the
+// first edge and respect the hold-off, and their tags must reach the server.
+// With --burst, N frames are taken at --fps from a simulated sensor running at
+// --sensor-fps, with one framebuffer and with two; the achieved rates are
+// compared and the burst tags must reach the server.
+// With --warmup, WAKES simulated light-sleep wakes (in a fraction P of which the
+// light changed while asleep, so exposure has to move) go through the warm-up
+// logic; it must never use a stale frame, and use an unsettled one rarely and
+// no more often than a fixed warm-up does.
+// With --log, RECORDS event log records are written and drained: a record must
+// format exactly as printf would, three writers racing one drain must lose
+// nothing unaccounted for and keep their own order, and the cost of a record is
+// compared with formatting the line at the call site. --telemetry FILE writes
+// the encoded log there (decode it with python -m app.device_log FILE from srv/).
+// With --power, FRAMES timelapse cycles (with a transfer session every --batch
+// frames) are replayed through the power policy: the locks handed to the
+// backend must match the phases held at every step, the wait for the server to
+// connect must be spent idle (light-sleeping where the backend can), and the
+// energy per frame is compared with the fixed clocks it replaces.
+// With --config, the settings codec must refuse each kind of malformed or
+// out-of-range write and leave the settings untouched, WRITES randomly mutated
+// writes must be applied whole or not at all, and a batch is sent with the
+// default and then the written chunk size and delays. --telemetry FILE writes an
+// encoded config there (python -m app.device_config FILE from srv/ decodes it).
+
+#include "burst_capture.h"
+#include "capture_scheduler.h"
+#include "change_detector.h"
+#include "device_config.h"
+#include "event_log.h"
+#include "fixture_source.h"
+#include "flash_store.h"
+#include "link_emulator.h"
+#include "power_policy.h"
+#include "preview_ledger.h"
+#include "sensor_warmup.h"
+#include "quality_controller.h"
+#include "frame_arena.h"
+#include "storage_manager.h"
+#include "telemetry.h"
+#include "transfer_session.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+
+// Fills the arena with batch_size fixtures, or until the storage manager calls for a
+// flush when a byte budget is given, keeping copies to verify against. With
+// event_every, every event_every-th frame is tagged as event-triggered. Every
+// fill starts from the first fixture, so runs compared side by side send the
+// same images.
+static int fill_arena(FrameArena &arena, FrameQueue &queue, FixtureFrameSource &source, int batch_size,
+                      size_t budget, std::vector<std::vector<uint8_t>> &expected, int event_every = 0)
+{
+    arena.clear();
+    expected.clear();
+    source.rewind();
+    StorageManager storage(arena);
+    storage.set_budget(budget);
+    for (int i = 0; budget > 0 ? !storage.should_flush() : i < batch_size; i++)
+    {
+        uint32_t flags = event_every > 0 && i % event_every == 0 ? FRAME_FLAG_EVENT : 0;
+        if (storage.store(source, i * 10000, flags) != STORE_KEPT || !queue.push(arena.newest()))
+            break;
+    }
+    FrameCursor cursor = arena.cursor();
+    FrameRef frame;
+    while (arena.next(cursor, frame))
+        expected.push_back(std::vector<uint8_t>(frame.data, frame.data + frame.len));
+    return arena.count();
+}
+
+static int count_verified(const std::vector<std::vector<uint8_t>> &received,
+                          const std::vector<std::vector<uint8_t>> &expected)
+{
+    int verified = 0;
+    for (size_t i = 0; i < received.size() && i < expected.size(); i++)
+    {
+        if (received[i] == expected[i])
+            verified++;
+    }
+    return verified;
+}
+
+// Spills three batches into a flash store of flash_bytes, so the oldest segments
+// are evicted, then reopens it and drains it through the emulator. Whatever
+// survived must arrive intact and in order, with its event tags, and the store
+// must end up empty.
+static bool run_spill_check(const LinkConfig &link, FrameArena &arena, FixtureFrameSource &source, int batch_size,
+                            const char *dir, size_t flash_bytes, int window, bool container)
+{
+    FlashStore store;
+    if (!store.begin(dir, flash_bytes))
+    {
+        fprintf(stderr, "Cannot open a flash store in %s\n", dir);
+        return false;
+    }
+    while (store.count() > 0)
+        store.release_front(); // Leftovers from an earlier run
+
+    const int batches = 3;
+    std::vector<std::vector<uint8_t>> spilled, expected;
+    std::vector<FrameRef> spilled_refs;
+    int written = 0;
+    for (int batch = 0; batch < batches; batch++)
+    {
+        FrameQueue queue;
+        fill_arena(arena, queue, source, batch_size, 0, expected, 3);
+        ArenaBacklog backlog(arena, queue);
+        FrameRef frame;
+        for (int i = 0; backlog.peek_at(i, frame); i++)
+            spilled_refs.push_back(frame);
+        written += store.spill(backlog);
+        spilled.insert(spilled.end(), expected.begin(), expected.end());
+    }
+    int kept = store.count();
+    uint32_t evicted = store.evicted();
+    size_t used = store.used_bytes();
+
+    // Reopen from the index, as after a reset.
+    store.end();
+    if (!store.begin(dir, flash_bytes))
+        return false;
+    bool reloaded = store.count() == kept && store.used_bytes() == used;
+    expected.assign(spilled.end() - store.count(), spilled.end());
+    std::vector<uint32_t> tagged;
+    for (size_t i = spilled_refs.size() - store.count(); i < spilled_refs.size(); i++)
+    {
+        if (spilled_refs[i].flags & FRAME_FLAG_EVENT)
+            tagged.push_back(spilled_refs[i].id);
+    }
+
+    LinkEmulator emulator(link);
+    TransferSession session(emulator, (uint8_t)window, container);
+    session.resume_from(emulator.server_resume());
+    bool ok = session.send_batch(store);
+    emulator.sleep_ms(2000);
+    bool drained = store.count() == 0 && store.used_bytes() == 0;
+    bool tags_ok = emulator.event_ids() == tagged;
+
+    const TransferStats &stats = session.stats();
+    int verified = count_verified(emulator.received_images(), expected);
+    printf("flash spill          %s  spilled=%d  kept=%d  evicted=%u  used=%u/%u  reloaded=%s  images=%u  "
+           "drain=%.2fs  crc_errors=%u  verified=%d/%d  events=%u/%u  drained=%s\n",
+           ok ? "ok  " : "FAIL", written, kept, evicted, (unsigned)used, (unsigned)flash_bytes,
+           reloaded ? "yes" : "NO", stats.images, stats.elapsed_ms / 1000.0, emulator.stats().crc_errors, verified,
+           (int)expected.size(), (unsigned)emulator.event_ids().size(), (unsigned)tagged.size(), drained ? "yes" : "NO");
+    store.end();
+    return ok && reloaded && drained && tags_ok && evicted > 0 && verified == (int)expected.size();
+}
+
+// Replays the fixtures once through a change detector at threshold/keyframe and
+// reports the skip rate and the cost of a signature. The same sequence then goes
+// through the storage manager, which must append exactly the frames kept.
+static bool run_change_check(FrameArena &arena, FixtureFrameSource &source, int threshold, int keyframe)
+{
+    bool ok = true;
+    const int repeats = 20;
+    double total_us = 0;
+    size_t total_bytes = 0;
+    int signed_count = 0;
+    for (size_t i = 0; i < source.count(); i++)
+    {
+        const std::vector<uint8_t> &jpeg = source.fixture(i);
+        FrameSignature signature;
+        bool valid = false;
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; r++)
+            valid = jpeg_dc_signature(jpeg.data(), jpeg.size(), signature);
+        auto end = std::chrono::steady_clock::now();
+        total_us += std::chrono::duration<double, std::micro>(end - start).count() / repeats;
+        total_bytes += jpeg.size();
+        if (!valid)
+            continue;
+        signed_count++;
+
+        // Known answers: a frame never differs from itself, and a truncated scan is refused.
+        FrameSignature truncated;
+        if (signature_change_percent(signature, signature) != 0 ||
+            jpeg_dc_signature(jpeg.data(), jpeg.size() / 2, truncated))
+        {
+            printf("  signature self-check failed on %s\n", source.name(i).c_str());
+            ok = false;
+        }
+    }
+
+    ChangeDetector detector;
+    detector.configure((uint8_t)threshold, (uint16_t)keyframe);
+    for (size_t i = 0; i < source.count(); i++)
+    {
+        const std::vector<uint8_t> &jpeg = source.fixture(i);
+        bool keep = detector.check(jpeg.data(), jpeg.size());
+        printf("  %-32s %7u bytes  change=%3u%%  %s\n", source.name(i).c_str(), (unsigned)jpeg.size(),
+               detector.stats().last_change, keep ? "kept" : "skipped");
+        if (keep)
+            detector.accept();
+    }
+    ChangeStats stats = detector.stats();
+
+    // The same sequence through the storage manager, as the capture task runs it.
+    ChangeDetector gate;
+    gate.configure((uint8_t)threshold, (uint16_t)keyframe);
+    StorageManager storage(arena);
+    storage.set_change_detector(&gate);
+    arena.clear();
+    source.rewind();
+    int appended = 0;
+    for (size_t i = 0; i < source.count(); i++)
+    {
+        if (storage.store(source, (uint32_t)i * 10000) == STORE_KEPT)
+            appended++;
+    }
+    uint32_t kept = stats.captures - stats.skipped;
+    ok &= appended == (int)kept && gate.stats().skipped == stats.skipped;
+
+    double seconds = total_us / 1e6;
+    printf("change gate          %s  threshold=%d%%  keyframe=%d  captures=%u  kept=%u  skipped=%u (%.1f%%)  "
+           "keyframes=%u  fallbacks=%u  signature=%.0fus/frame (%.1f MB/s)  signed=%d/%u  appended=%d\n",
+           ok ? "ok  " : "FAIL", threshold, keyframe, stats.captures, kept, stats.skipped, detector.skip_percent(),
+           stats.keyframes, stats.fallbacks, total_us / source.count(), seconds > 0 ? total_bytes / seconds / 1e6 : 0.0,
+           signed_count, (unsigned)source.count(), appended);
+    return ok;
+}
+
+// Frame size against quality for one scene: recorded points, interpolated, or
+// a nominal curve through anchor_bytes at quality 12 when there are none.
+struct SizeCurve
+{
+    std::vector<std::pair<int, double>> points; // Sorted by quality
+    double anchor_bytes;
+};
+
+#define CURVE_HEADER_BYTES 600.0 // Headers and tables, independent of quality
+#define CURVE_EXPONENT 0.85      // Size falls a little slower than 1/quality
+#define DOWNSCALE_BYTES 0.3      // One frame size step down (VGA to QVGA)
+
+static double curve_bytes(const SizeCurve &curve, int quality, int downscale)
+{
+    double bytes;
+    if (curve.points.empty())
+    {
+        bytes = CURVE_HEADER_BYTES + (curve.anchor_bytes - CURVE_HEADER_BYTES) * pow(12.0 / quality, CURVE_EXPONENT);
+    }
+    else if (quality <= curve.points.front().first)
+    {
+        bytes = curve.points.front().second * pow((double)curve.points.front().first / quality, CURVE_EXPONENT);
+    }
+    else if (quality >= curve.points.back().first)
+    {
+        bytes = curve.points.back().second * pow((double)curve.points.back().first / quality, CURVE_EXPONENT);
+    }
+    else
+    {
+        size_t i = 1;
+        while (curve.points[i].first < quality)
+            i++;
+        const std::pair<int, double> &lo = curve.points[i - 1], &hi = curve.points[i];
+        bytes = lo.second + (hi.second - lo.second) * (quality - lo.first) / (hi.first - lo.first);
+    }
+    return bytes * pow(DOWNSCALE_BYTES, downscale);
+}
+
+// Reads scenes of "quality bytes" lines; a blank line or a '#' line starts the next scene.
+static bool load_trace(const char *path, std::vector<SizeCurve> &scenes)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    SizeCurve scene = {};
+    char line[128];
+    while (fgets(line, sizeof(line), f))
+    {
+        int quality;
+        double bytes;
+        if (sscanf(line, "%d %lf", &quality, &bytes) == 2 && quality > 0 && bytes > 0)
+        {
+            scene.points.push_back(std::make_pair(quality, bytes));
+        }
+        else if (!scene.points.empty())
+        {
+            scenes.push_back(scene);
+            scene.points.clear();
+        }
+    }
+    fclose(f);
+    if (!scene.points.empty())
+        scenes.push_back(scene);
+    for (SizeCurve &s : scenes)
+        std::sort(s.points.begin(), s.points.end());
+    return !scenes.empty();
+}
+
+// Runs the controller for a while on each scene in turn, carrying its state
+// across scene cuts like a lighting change would. Frames come out one setting
+// late, as with two frame buffers, and with +-5% noise.
+static bool run_rate_check(FixtureFrameSource &source, uint32_t target, const char *trace, uint32_t seed)
+{
+    std::vector<SizeCurve> scenes;
+    if (trace && !load_trace(trace, scenes))
+    {
+        fprintf(stderr, "Cannot read a size trace from %s\n", trace);
+        return false;
+    }
+    if (!trace)
+    {
+        for (size_t i = 0; i < source.count(); i++)
+            scenes.push_back({{}, (double)source.fixture(i).size()});
+    }
+
+    QualityController controller;
+    RateConfig config = controller.config();
+    config.target_bytes = target;
+    controller.configure(config);
+    controller.reset(12);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> noise(0.95, 1.05);
+    const int frames_per_scene = 40;
+    const double band = (config.hysteresis_pct + 10) / 100.0; // Hysteresis plus the noise, both ways
+    int encoded_quality = controller.quality(), encoded_scale = 0;
+    int staged_quality = encoded_quality, staged_scale = 0;
+    bool ok = true;
+
+    for (size_t scene = 0; scene < scenes.size(); scene++)
+    {
+        int settled_at = -1, late_changes = 0;
+        double late_error = 0;
+        char path[256] = "";
+        size_t path_len = 0;
+        for (int frame = 0; frame < frames_per_scene; frame++)
+        {
+            double bytes = curve_bytes(scenes[scene], encoded_quality, encoded_scale) * noise(rng);
+            bool changed = controller.update((size_t)bytes);
+            if (changed && path_len + 16 < sizeof(path))
+            {
+                path_len += snprintf(path + path_len, sizeof(path) - path_len, " q%u%s", controller.quality(),
+                                     controller.downscale() ? "/2" : "");
+            }
+            encoded_quality = staged_quality;
+            encoded_scale = staged_scale;
+            staged_quality = controller.quality();
+            staged_scale = controller.downscale();
+
+            double error = fabs(bytes - target) / target;
+            if (error <= band)
+            {
+                if (settled_at < 0)
+                    settled_at = frame;
+            }
+            else
+            {
+                settled_at = -1;
+            }
+            if (frame >= frames_per_scene / 2 && changed)
+                late_changes++;
+            if (frame >= frames_per_scene - 10)
+                late_error += error / 10;
+        }
+
+        // Out of reach counts as settled once the controller sits at the matching bound.
+        double best = curve_bytes(scenes[scene], config.quality_min, 0);
+        double worst = curve_bytes(scenes[scene], config.quality_max, config.max_downscale);
+        bool unreachable = best < target * (1 - band) || worst > target * (1 + band);
+        bool pinned = (best < target && controller.quality() == config.quality_min && controller.downscale() == 0) ||
+                      (worst > target && controller.quality() == config.quality_max &&
+                       controller.downscale() == config.max_downscale);
+        bool scene_ok = late_changes <= 2 && (settled_at >= 0 || (unreachable && pinned));
+        ok &= scene_ok;
+        printf("  scene %-3u %s  q%u%s  settled at frame %d  late changes=%d  late error=%.1f%%  path:%s\n",
+               (unsigned)scene, scene_ok ? "ok  " : "FAIL", controller.quality(), controller.downscale() ? "/2" : "",
+               settled_at, late_changes, late_error * 100, path_len ? path : " -");
+    }
+    printf("rate control         %s  target=%u  scenes=%u  quality %u..%u  hysteresis=%u%%  %s\n", ok ? "ok  " : "FAIL",
+           target, (unsigned)scenes.size(), config.quality_min, config.quality_max, config.hysteresis_pct,
+           trace ? trace : "nominal curve through the fixtures");
+    return ok;
+}
+
+static void write_telemetry(const Telemetry &telemetry, const char *path)
+{
+    std::vector<uint8_t> snapshot(telemetry.encoded_size("host-bench"));
+    snapshot.resize(telemetry.encode(snapshot.data(), snapshot.size(), "host-bench"));
+    FILE *f = fopen(path, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return;
+    }
+    fwrite(snapshot.data(), 1, snapshot.size(), f);
+    fclose(f);
+}
+
+static bool run_transfer(const LinkConfig &link, FrameArena &arena, FixtureFrameSource &source, int batch_size,
+                         size_t budget, int window, bool container, const char *telemetry_path)
+{
+    Telemetry telemetry;
+    std::vector<std::vector<uint8_t>> expected;
+    FrameQueue queue;
+    int batch_count = fill_arena(arena, queue, source, batch_size, budget, expected);
+
+    LinkEmulator emulator(link);
+    TransferSession session(emulator, (uint8_t)window, container);
+    session.set_telemetry(&telemetry);
+    session.resume_from(emulator.server_resume());
+    bool ok = session.send_batch(arena, queue);
+    emulator.sleep_ms(2000); // Let the last notifications land before checking what arrived
+    TransferStats stats = session.stats();
+    window = session.window(); // 0 if the MTU was too small for windowed chunks
+    unsigned chunk_size = session.chunk_size();
+
+    if (!emulator.is_connected())
+    {
+        // Reconnect and pick up from wherever the server says it stopped.
+        ResumePoint stopped = session.progress();
+        ResumePoint resume = emulator.server_resume();
+        emulator.reconnect();
+        TransferSession resumed(emulator, (uint8_t)window, container);
+        resumed.set_telemetry(&telemetry);
+        resumed.resume_from(resume);
+        ok = resumed.send_batch(arena, queue);
+        emulator.sleep_ms(2000);
+
+        const TransferStats &more = resumed.stats();
+        printf("  link dropped at %ums: device saw frame %u byte %u acked, server resumed at frame %u byte %u; "
+               "%u images (%u bytes) had been delivered, %u more after reconnecting\n",
+               link.drop_at_ms, stopped.frame_id, stopped.offset, resume.frame_id, resume.offset, stats.images,
+               stats.bytes, more.images);
+        stats.bytes += more.bytes;
+        stats.chunks += more.chunks;
+        stats.retransmits += more.retransmits;
+        stats.images += more.images;
+        stats.elapsed_ms += more.elapsed_ms;
+    }
+
+    const LinkStats &link_stats = emulator.stats();
+    double seconds = stats.elapsed_ms / 1000.0;
+
+    int verified = count_verified(emulator.received_images(), expected);
+
+    char mode[32];
+    if (window > 0)
+        snprintf(mode, sizeof(mode), "window(%d)%s", window, container ? "+batch" : "");
+    else
+        snprintf(mode, sizeof(mode), "stop-and-wait%s", container ? "+batch" : "");
+
+    printf("%-20s %s  images=%u/%d  bytes=%u  drain=%.2fs  %.0f B/s  %.1f chunks/s  retransmits=%u  "
+           "dropped(queue/loss)=%u/%u  truncated=%u  crc_errors=%u  verified=%d/%d\n",
+           mode, ok ? "ok  " : "FAIL", stats.images, batch_count, stats.bytes, seconds,
+           seconds > 0 ? stats.bytes / seconds : 0.0, seconds > 0 ? stats.chunks / seconds : 0.0,
+           stats.retransmits, link_stats.dropped_queue, link_stats.dropped_loss, link_stats.truncated,
+           link_stats.crc_errors, verified, batch_count);
+    const Histogram &rtt = telemetry.chunk_rtt();
+    printf("%-20s chunk=%uB  rtt: samples=%u  min=%.1fms  mean=%.1fms  max=%.1fms  transfers traced=%u\n", "", chunk_size, rtt.count,
+           rtt.min / 1000.0, rtt.mean() / 1000.0, rtt.max / 1000.0, telemetry.trace_total());
+    if (telemetry_path)
+        write_telemetry(telemetry, telemetry_path);
+    return ok && verified == batch_count;
+}
+
+static void put_tlv(std::vector<uint8_t> &out, uint8_t tag, uint8_t width, uint32_t value)
+{
+    out.push_back(tag);
+    out.push_back(width);
+    for (uint8_t i = 0; i < width; i++)
+        out.push_back((value >> (8 * i)) & 0xFF);
+}
+
+static std::vector<uint8_t> config_write(std::initializer_list<std::vector<uint8_t>> tlvs, uint8_t version = CONFIG_VERSION)
+{
+    std::vector<uint8_t> out = {'J', 'K', 'C', '1', version, 0};
+    for (const std::vector<uint8_t> &tlv : tlvs)
+        out.insert(out.end(), tlv.begin(), tlv.end());
+    return out;
+}
+
+static std::vector<uint8_t> tlv(uint8_t tag, uint8_t width, uint32_t value)
+{
+    std::vector<uint8_t> out;
+    put_tlv(out, tag, width, value);
+    return out;
+}
+
+static bool same_config(const DeviceConfig &a, const DeviceConfig &b)
+{
+    uint8_t ea[CONFIG_ENCODED_MAX], eb[CONFIG_ENCODED_MAX];
+    size_t la = config_encode(a, ea, sizeof(ea));
+    return la == config_encode(b, eb, sizeof(eb)) && memcmp(ea, eb, la) == 0;
+}
+
+static bool run_config_check(const LinkConfig &link, FrameArena &arena, FixtureFrameSource &source, int batch_size,
+                             int writes, const char *dump_path)
+{
+    const DeviceConfig defaults = config_defaults();
+    const size_t arena_bytes = arena.capacity();
+    struct Case
+    {
+        const char *name;
+        std::vector<uint8_t> data;
+        ConfigResult want;
+        uint8_t want_tag;
+    };
+    std::vector<uint8_t> bad_magic = config_write({});
+    bad_magic[3] = '2';
+    std::vector<uint8_t> cut_off = config_write({tlv(CONFIG_TAG_INTERVAL_S, 4, 30)});
+    cut_off.pop_back(); // The last value loses a byte
+    const Case cases[] = {
+        {"empty write", config_write({}), CONFIG_OK, 0},
+        {"short header", {'J', 'K', 'C'}, CONFIG_BAD_HEADER, 0},
+        {"wrong magic", bad_magic, CONFIG_BAD_HEADER, 0},
+        {"newer version", config_write({tlv(CONFIG_TAG_CHUNK_SIZE, 2, 256)}, CONFIG_VERSION + 1), CONFIG_BAD_VERSION, 0},
+        {"unknown tag", config_write({tlv(CONFIG_TAG_CHUNK_SIZE, 2, 256), tlv(CONFIG_TAG_END, 1, 1)}),
+         CONFIG_UNKNOWN_TAG, CONFIG_TAG_END},
+        {"wrong width", config_write({tlv(CONFIG_TAG_CHUNK_SIZE, 1, 200)}), CONFIG_BAD_LENGTH, CONFIG_TAG_CHUNK_SIZE},
+        {"cut off", cut_off, CONFIG_BAD_LENGTH, CONFIG_TAG_INTERVAL_S},
+        {"chunk too small", config_write({tlv(CONFIG_TAG_CHUNK_SIZE, 2, WINDOW_MIN_CHUNK - 1)}), CONFIG_OUT_OF_RANGE,
+         CONFIG_TAG_CHUNK_SIZE},
+        {"chunk too big", config_write({tlv(CONFIG_TAG_CHUNK_SIZE, 2, CHUNK_SIZE + 1)}), CONFIG_OUT_OF_RANGE,
+         CONFIG_TAG_CHUNK_SIZE},
+        {"not 4:3", config_write({tlv(CONFIG_TAG_FRAME_SIZE, 1, 6)}), CONFIG_OUT_OF_RANGE, CONFIG_TAG_FRAME_SIZE},
+        {"zero interval", config_write({tlv(CONFIG_TAG_INTERVAL_S, 4, 0)}), CONFIG_OUT_OF_RANGE, CONFIG_TAG_INTERVAL_S},
+        {"budget over arena", config_write({tlv(CONFIG_TAG_BUDGET_BYTES, 4, (uint32_t)arena_bytes + 1)}),
+         CONFIG_OUT_OF_RANGE, CONFIG_TAG_BUDGET_BYTES},
+        {"late bad value", config_write({tlv(CONFIG_TAG_JPEG_QUALITY, 1, 20), tlv(CONFIG_TAG_XCLK_MHZ, 1, 40)}),
+         CONFIG_OUT_OF_RANGE, CONFIG_TAG_XCLK_MHZ},
+        {"target off", config_write({tlv(CONFIG_TAG_FRAME_TARGET, 4, 0)}), CONFIG_OK, 0},
+        {"budget share", config_write({tlv(CONFIG_TAG_BUDGET_PCT, 1, 50)}), CONFIG_OK, 0},
+    };
+
+    int failures = 0;
+    for (const Case &c : cases)
+    {
+        DeviceConfig config = defaults;
+        uint8_t bad_tag = 0xFF;
+        ConfigResult result = config_decode(c.data.data(), c.data.size(), config, arena_bytes, bad_tag);
+        bool ok = result == c.want && bad_tag == c.want_tag;
+        if (result != CONFIG_OK)
+            ok &= same_config(config, defaults);
+        else if (!strcmp(c.name, "budget share"))
+            ok &= config.budget_bytes == arena_bytes / 2;
+        else if (!strcmp(c.name, "target off"))
+            ok &= config.frame_target_bytes == 0;
+        if (!ok)
+        {
+            printf("  config case '%s': result %u tag %u, wanted %u tag %u\n", c.name, result, bad_tag, c.want,
+                   c.want_tag);
+            failures++;
+        }
+    }
+
+    // Mutated writes: whatever is accepted must survive a round trip; whatever
+    // is refused must leave the settings as they were.
+    std::mt19937 rng(link.seed);
+    uint8_t base[CONFIG_ENCODED_MAX];
+    size_t base_len = config_encode(defaults, base, sizeof(base));
+    int accepted = 0, partial = 0;
+    for (int i = 0; i < writes; i++)
+    {
+        std::vector<uint8_t> data(base, base + base_len);
+        int flips = 1 + rng() % 3;
+        for (int f = 0; f < flips; f++)
+            data[CONFIG_HEADER_SIZE + rng() % (base_len - CONFIG_HEADER_SIZE)] ^= (uint8_t)(1 << (rng() % 8));
+        if (rng() % 4 == 0)
+            data.resize(CONFIG_HEADER_SIZE + rng() % (base_len - CONFIG_HEADER_SIZE));
+        DeviceConfig config = defaults;
+        uint8_t bad_tag;
+        if (config_decode(data.data(), data.size(), config, arena_bytes, bad_tag) == CONFIG_OK)
+        {
+            accepted++;
+            uint8_t again[CONFIG_ENCODED_MAX];
+            size_t len = config_encode(config, again, sizeof(again));
+            DeviceConfig reread = defaults;
+            if (config_decode(again, len, reread, arena_bytes, bad_tag) != CONFIG_OK || !same_config(config, reread))
+                partial++;
+        }
+        else if (!same_config(config, defaults))
+        {
+            partial++;
+        }
+    }
+    failures += partial;
+    printf("config codec         %s  cases=%d  mutated writes=%d accepted=%d  torn=%d  encoded=%uB\n",
+           failures == 0 ? "ok  " : "FAIL", (int)(sizeof(cases) / sizeof(cases[0])), writes, accepted, partial,
+           (unsigned)base_len);
+
+    // The same stop-and-wait batch at the built-in timing, with shorter delays,
+    // and with small chunks on top, each as a server would write it.
+    DeviceConfig tuned = defaults;
+    std::vector<uint8_t> write = config_write({tlv(CONFIG_TAG_STATUS_DELAY_MS, 2, 10), tlv(CONFIG_TAG_CHUNK_DELAY_MS, 2, 0),
+                                               tlv(CONFIG_TAG_IMAGE_DELAY_MS, 2, 50)});
+    uint8_t bad_tag;
+    bool ok = config_decode(write.data(), write.size(), tuned, arena_bytes, bad_tag) == CONFIG_OK;
+    DeviceConfig small = tuned;
+    write = config_write({tlv(CONFIG_TAG_CHUNK_SIZE, 2, 128)});
+    ok &= config_decode(write.data(), write.size(), small, arena_bytes, bad_tag) == CONFIG_OK;
+    const DeviceConfig *runs[] = {&defaults, &tuned, &small};
+    const char *names[] = {"built-in timing", "shorter delays", "128 B chunks"};
+    for (int run = 0; run < 3; run++)
+    {
+        const DeviceConfig *config = runs[run];
+        std::vector<std::vector<uint8_t>> expected;
+        FrameQueue queue;
+        int batch_count = fill_arena(arena, queue, source, batch_size, 0, expected);
+        LinkEmulator emulator(link);
+        TransferSession session(emulator, 0, false);
+        session.set_timing({config->chunk_size, config->status_delay_ms, config->chunk_delay_ms, config->image_delay_ms});
+        bool sent = session.send_batch(arena, queue);
+        emulator.sleep_ms(2000);
+        int verified = count_verified(emulator.received_images(), expected);
+        const TransferStats &stats = session.stats();
+        unsigned chunk_limit = std::min<unsigned>(config->chunk_size, link.mtu - ATT_NOTIFY_OVERHEAD);
+        bool run_ok = sent && verified == batch_count && session.chunk_size() == chunk_limit;
+        ok &= run_ok;
+        printf("%-20s %s  chunk=%uB  delays=%u/%u/%ums  images=%u/%d  drain=%.2fs  verified=%d/%d\n",
+               names[run], run_ok ? "ok  " : "FAIL",
+               session.chunk_size(), config->status_delay_ms, config->chunk_delay_ms, config->image_delay_ms,
+               stats.images, batch_count, stats.elapsed_ms / 1000.0, verified, batch_count);
+    }
+
+    if (dump_path)
+    {
+        uint8_t encoded[CONFIG_ENCODED_MAX];
+        size_t len = config_encode(tuned, encoded, sizeof(encoded));
+        FILE *f = fopen(dump_path, "wb");
+        if (f)
+        {
+            fwrite(encoded, 1, len, f);
+            fclose(f);
+        }
+    }
+    return ok && failures == 0;
+}
+
+// Sends the same batch as one container, then preview-first with the server
+// picking every pick_every-th frame, first with a long retention window (the
+// passed-over frames must stay queued) and then with none (they must go). Only
+// the picked frames may arrive in full.
+static bool run_preview_check(const LinkConfig &link, FrameArena &arena, FixtureFrameSource &source, int batch_size,
+                              size_t budget, int window, int pick_every)
+{
+    std::vector<std::vector<uint8_t>> expected;
+    FrameQueue queue;
+    int batch_count = fill_arena(arena, queue, source, batch_size, budget, expected);
+    LinkEmulator full_link(link);
+    TransferSession full(full_link, (uint8_t)window, true);
+    bool full_ok = full.send_batch(arena, queue);
+    const TransferStats &full_stats = full.stats();
+
+    PreviewLedger ledger;
+    PreviewRenderer renderer;
+    if (!ledger.begin(PREVIEW_LEDGER_LEN) || !renderer.begin())
+        return false;
+    ledger.set_retention_ms(60 * 60 * 1000);
+    fill_arena(arena, queue, source, batch_size, budget, expected);
+    LinkConfig picking = link;
+    picking.pick_every = pick_every;
+    LinkEmulator preview_link(picking);
+    TransferSession preview(preview_link, (uint8_t)window, true);
+    preview.set_previews(&ledger, &renderer);
+    bool preview_ok = preview.send_batch(arena, queue);
+    TransferStats stats = preview.stats();
+    int held = (int)queue.size();
+
+    // Next session: nothing new to preview, nothing picked, retention over.
+    ledger.set_retention_ms(0);
+    TransferSession expiry(preview_link, (uint8_t)window, true);
+    expiry.set_previews(&ledger, &renderer);
+    preview_ok &= expiry.send_batch(arena, queue);
+    stats.chunks += expiry.stats().chunks;
+    stats.elapsed_ms += expiry.stats().elapsed_ms;
+
+    std::vector<std::vector<uint8_t>> wanted;
+    for (int i = 0; i < batch_count; i += pick_every)
+        wanted.push_back(expected[i]);
+    int verified = count_verified(preview_link.received_images(), wanted);
+    bool match = preview_link.received_images().size() == wanted.size() && verified == (int)wanted.size();
+    int picked = (int)wanted.size();
+    // A picked frame behind a held one stays queued until the held one goes.
+    int held_expected = pick_every == 1 ? 0 : batch_count - 1;
+    bool held_ok = held == held_expected && queue.size() == 0 && ledger.count() == 0;
+
+    printf("%-20s %s  images=%u/%d  drain=%.2fs  chunks=%u\n", "full container", full_ok ? "ok  " : "FAIL",
+           full_stats.images, batch_count, full_stats.elapsed_ms / 1000.0, full_stats.chunks);
+    printf("%-20s %s  previews=%u (decoded %u)  picked=%u  drain=%.2fs  chunks=%u  held=%d then %u  "
+           "crc_errors=%u  verified=%d/%d\n",
+           "preview-first", preview_ok && match && held_ok ? "ok  " : "FAIL", stats.previews,
+           preview_link.stats().previews, stats.images, stats.elapsed_ms / 1000.0, stats.chunks, held,
+           (unsigned)queue.size(), preview_link.stats().crc_errors, verified, picked);
+    if (stats.elapsed_ms > 0 && stats.chunks > 0)
+        printf("%-20s %.1fx less airtime, %.1fx fewer chunks, picking 1 in %d\n", "", (double)full_stats.elapsed_ms / stats.elapsed_ms,
+               (double)full_stats.chunks / stats.chunks, pick_every);
+    ledger.end();
+    renderer.end();
+    return full_ok && preview_ok && match && held_ok && stats.previews == (uint32_t)batch_count;
+}
+
+// One motion episode in a simulated PIR timeline: the sensor pulses high, each
+// pulse at least its ~2.5 s hold time, with short gaps, for as long as the
+// subject keeps moving.
+struct PirEpisode
+{
+    uint32_t start_ms;
+    uint32_t end_ms;
+};
+
+struct PirChange
+{
+    uint32_t at_ms;
+    bool high;
+};
+
+static void make_pir_timeline(double per_hour, uint32_t duration_ms, uint32_t seed, std::vector<PirEpisode> &episodes,
+                              std::vector<PirChange> &changes)
+{
+    std::mt19937 rng(seed);
+    std::exponential_distribution<double> gap(per_hour / 3600e3);
+    std::uniform_int_distribution<uint32_t> length(5000, 60000), pulse(2500, 4000), rest(300, 3000);
+    uint32_t t = (uint32_t)gap(rng);
+    while (t < duration_ms)
+    {
+        PirEpisode episode = {t, std::min(t + length(rng), duration_ms)};
+        while (t < episode.end_ms)
+        {
+            changes.push_back({t, true});
+            t += pulse(rng);
+            changes.push_back({t, false});
+            t += rest(rng);
+        }
+        episode.end_ms = t;
+        episodes.push_back(episode);
+        t += (uint32_t)gap(rng) + 1;
+    }
+}
+
+// Replays a simulated hour of PIR activity through the capture scheduler as the
+// capture task drives it: sleep until the next timer slot or the next PIR level
+// change, whichever comes first. Every rising edge must either fire an event
+// capture at once or fall inside the hold-off of the last one, every timer slot
+// must be taken or covered by an event frame, and the frames must reach the
+// server with their event tags, in a container and one at a time.
+static bool run_pir_check(const LinkConfig &link, FrameArena &arena, FixtureFrameSource &source, double per_hour,
+                          uint32_t holdoff_ms, int batch_size)
+{
+    const uint32_t duration_ms = 3600 * 1000;
+    const uint32_t interval_ms = 60 * 1000;
+    std::vector<PirEpisode> episodes;
+    std::vector<PirChange> changes;
+    make_pir_timeline(per_hour, duration_ms, link.seed, episodes, changes);
+
+    CaptureScheduler scheduler;
+    scheduler.configure(interval_ms, holdoff_ms);
+    scheduler.start(0);
+    struct Capture
+    {
+        uint32_t at_ms;
+        CaptureTrigger trigger;
+    };
+    std::vector<Capture> captures;
+    uint32_t now = 0, wakes = 0;
+    size_t next_change = 0;
+    for (;;)
+    {
+        CaptureTrigger trigger = scheduler.poll(now);
+        if (trigger != TRIGGER_NONE)
+        {
+            captures.push_back({now, trigger});
+            scheduler.captured(trigger, now);
+            continue;
+        }
+        if (now >= duration_ms)
+            break;
+        // Armed for the opposite of the current level, so every change wakes the chip.
+        uint32_t wake = now + scheduler.sleep_ms(now);
+        wakes++;
+        if (next_change < changes.size() && changes[next_change].at_ms <= wake)
+        {
+            now = changes[next_change].at_ms;
+            scheduler.on_pir(now, changes[next_change++].high);
+        }
+        else
+        {
+            now = wake;
+        }
+    }
+    const SchedulerStats &stats = scheduler.stats();
+
+    bool ok = stats.edges == stats.event_captures + stats.debounced;
+    uint32_t last_event = 0;
+    bool have_event = false;
+    size_t c = 0;
+    for (const PirChange &change : changes)
+    {
+        if (!change.high || change.at_ms > duration_ms)
+            continue;
+        while (c < captures.size() && captures[c].at_ms < change.at_ms)
+        {
+            if (captures[c].trigger == TRIGGER_EVENT)
+            {
+                ok &= !have_event || captures[c].at_ms - last_event >= holdoff_ms;
+                last_event = captures[c].at_ms;
+                have_event = true;
+            }
+            c++;
+        }
+        bool fired = c < captures.size() && captures[c].at_ms == change.at_ms && captures[c].trigger == TRIGGER_EVENT;
+        bool retrigger = have_event && change.at_ms - last_event < holdoff_ms;
+        ok &= fired != retrigger;
+    }
+    uint32_t slots = duration_ms / interval_ms;
+    ok &= stats.timer_captures + stats.coalesced == slots && stats.missed == 0;
+    for (const Capture &capture : captures)
+        ok &= capture.trigger != TRIGGER_TIMER || capture.at_ms % interval_ms == 0;
+
+    // The timer alone, for comparison: an episode is only seen if a slot falls inside it.
+    int caught = 0;
+    double latency_s = 0;
+    for (const PirEpisode &episode : episodes)
+    {
+        uint32_t slot = (episode.start_ms + interval_ms - 1) / interval_ms * interval_ms;
+        if (slot <= episode.end_ms)
+        {
+            caught++;
+            latency_s += (slot - episode.start_ms) / 1000.0;
+        }
+    }
+
+    printf("pir schedule         %s  episodes=%u  edges=%u  event=%u  debounced=%u  timer=%u  coalesced=%u  "
+           "wakes=%u  frames/h=%u\n",
+           ok ? "ok  " : "FAIL", (unsigned)episodes.size(), stats.edges, stats.event_captures, stats.debounced,
+           stats.timer_captures, stats.coalesced, wakes, (unsigned)captures.size());
+    printf("%-20s every episode captured at its first edge; a %us timer alone would catch %d of %u, %.1fs late on average\n",
+           "", interval_ms / 1000, caught, (unsigned)episodes.size(), caught ? latency_s / caught : 0.0);
+
+    // The first batch_size frames through the arena and over the link, tagged by trigger.
+    std::vector<uint32_t> tagged;
+    for (int container = 0; container < 2; container++)
+    {
+        arena.clear();
+        source.rewind();
+        FrameQueue queue;
+        StorageManager storage(arena);
+        storage.set_budget(0);
+        tagged.clear();
+        for (size_t i = 0; i < captures.size() && (int)i < batch_size; i++)
+        {
+            uint32_t flags = captures[i].trigger == TRIGGER_EVENT ? FRAME_FLAG_EVENT : 0;
+            if (storage.store(source, captures[i].at_ms, flags) != STORE_KEPT || !queue.push(arena.newest()))
+                break;
+            if (flags)
+                tagged.push_back(arena.newest().id);
+        }
+        LinkEmulator emulator(link);
+        TransferSession session(emulator, 8, container != 0);
+        bool sent = session.send_batch(arena, queue);
+        emulator.sleep_ms(2000);
+        bool tags_ok = sent && emulator.event_ids() == tagged;
+        printf("%-20s %s  %s  images=%u  events=%u/%u\n", "event tags", tags_ok ? "ok  " : "FAIL",
+               container ? "container" : "per-image", session.stats().images, (unsigned)emulator.event_ids().size(),
+               (unsigned)tagged.size());
+        ok &= tags_ok;
+    }
+    return ok;
+}
+
+// Virtual time for a burst; waiting just moves the clock forward.
+class SimClock : public BurstClock
+{
+public:
+    uint64_t now_us() override { return m_now_us; }
+    void wait_until_us(uint64_t deadline_us) override { m_now_us = std::max(m_now_us, deadline_us); }
+    void advance_us(uint64_t us) { m_now_us += us; }
+
+private:
+    uint64_t m_now_us = 0;
+};
+
+// The camera driver as the capture task sees it during a burst: every free
+// framebuffer is filled with the next whole frame from the sensor, one at a
+// time, starting at a VSYNC. With frames taken back to back CAMERA_GRAB_LATEST
+// behaves the same, as there is never an older full buffer to recycle. Acquiring waits for the oldest full buffer; the
+// store's copy out of it is charged at copy_bytes_per_us before it is released.
+class SimSensorSource : public FrameSource
+{
+public:
+    SimSensorSource(FrameSource &frames, SimClock &clock, int fb_count, uint32_t frame_us, double copy_bytes_per_us)
+        : m_frames(frames), m_clock(clock), m_frame_us(frame_us), m_copy_bytes_per_us(copy_bytes_per_us)
+    {
+        for (int i = 0; i < fb_count; i++)
+            m_ready_us.push_back(fill(0));
+    }
+
+    bool acquire(Frame &frame) override
+    {
+        if (m_ready_us.empty() || !m_frames.acquire(frame))
+            return false;
+        m_clock.wait_until_us(m_ready_us.front());
+        frame.captured_us = m_ready_us.front();
+        m_ready_us.erase(m_ready_us.begin());
+        return true;
+    }
+
+    void release(Frame &frame) override
+    {
+        m_clock.advance_us((uint64_t)(frame.len / m_copy_bytes_per_us));
+        m_frames.release(frame);
+        m_ready_us.push_back(fill(m_clock.now_us()));
+    }
+
+private:
+    // When a buffer freed at free_us holds a new frame.
+    uint64_t fill(uint64_t free_us)
+    {
+        uint64_t start = std::max((free_us + m_frame_us - 1) / m_frame_us * m_frame_us, m_dma_free_us);
+        m_dma_free_us = start + m_frame_us;
+        return m_dma_free_us;
+    }
+
+    FrameSource &m_frames;
+    SimClock &m_clock;
+    uint32_t m_frame_us;
+    double m_copy_bytes_per_us;
+    uint64_t m_dma_free_us = 0;
+    std::vector<uint64_t> m_ready_us; // Full buffers, oldest first
+};
+
+// Runs one burst from the simulated sensor with one framebuffer and with two. With
+// two the rate must reach the lesser of the requested and sensor rates; every
+// frame must be kept, tagged with the burst id and its position, and arrive at the
+// server with those tags in a container.
+static bool run_burst_check(const LinkConfig &link, FrameArena &arena, FixtureFrameSource &source, int frames, int fps,
+                            int sensor_fps)
+{
+    const double copy_bytes_per_us = 10.0; // PSRAM to PSRAM memcpy on the ESP32, about 10 MB/s
+    const uint32_t frame_us = 1000000 / sensor_fps;
+    bool ok = true;
+    float rates[2] = {0, 0};
+    for (int fb_count = 1; fb_count <= 2; fb_count++)
+    {
+        arena.clear();
+        source.rewind();
+        FrameQueue queue;
+        StorageManager storage(arena);
+        storage.set_budget(0);
+        ChangeDetector detector;
+        detector.configure(3, 10);
+        storage.set_change_detector(&detector);
+        BurstCapture burst(storage, queue);
+        SimClock clock;
+        SimSensorSource sensor(source, clock, fb_count, frame_us, copy_bytes_per_us);
+        BurstReport report = burst.run(sensor, clock, frames, fps, FRAME_FLAG_EVENT);
+        rates[fb_count - 1] = report.fps;
+
+        int expected = std::min(frames, BURST_FRAMES_MAX);
+        bool tags_ok = report.burst_id == 1 && report.kept == expected && report.failed == 0;
+        FrameCursor cursor = arena.cursor();
+        FrameRef frame;
+        std::vector<uint32_t> tags;
+        while (arena.next(cursor, frame))
+            tags.push_back(frame.flags);
+        for (int i = 0; i < (int)tags.size(); i++)
+        {
+            tags_ok &= tags[i] == (FRAME_FLAG_EVENT | FRAME_FLAG_BURST | (uint32_t)i << FRAME_BURST_INDEX_SHIFT |
+                                   1u << FRAME_BURST_ID_SHIFT);
+        }
+        tags_ok &= (int)tags.size() == expected;
+
+        LinkEmulator emulator(link);
+        TransferSession session(emulator, 8, true);
+        bool sent = session.send_batch(arena, queue);
+        emulator.sleep_ms(2000);
+        const std::vector<uint32_t> &received = emulator.received_flags();
+        tags_ok &= sent && received == tags;
+
+        float limit = (float)std::min(fps > 0 ? fps : sensor_fps, sensor_fps);
+        bool rate_ok = fb_count == 1 || report.fps >= limit * 0.95f;
+        printf("burst fb_count=%d     %s  frames=%u/%u  span=%ums  fps=%.1f (asked %d, sensor %d)  tagged=%u  sent=%u\n",
+               fb_count, tags_ok && rate_ok ? "ok  " : "FAIL", report.kept, report.requested, report.span_us / 1000,
+               report.fps, fps, sensor_fps, (unsigned)tags.size(), (unsigned)received.size());
+        ok &= tags_ok && rate_ok;
+    }
+    printf("%-20s two framebuffers reach %.2fx the single-buffer rate\n", "", rates[0] > 0 ? rates[1] / rates[0] : 0.0);
+    return ok;
+}
+
+// Replays light-sleep wakes through SensorWarmup against a simulated sensor. Two
+// framebuffers filled before the sleep come back first, then fresh frames at the
+// sensor rate. Auto exposure holds each scene at its own settled luma; when the
+// light changed while the chip slept, the first fresh frame is off by up to 80
+// levels and exposure closes half the gap each frame. A frame more than 4 levels
+// from the settled luma counts as unsettled. The fixed warm-up it is compared
+// with drops 5 frames on every wake, as a guessed delay would.
+static bool run_warmup_check(int wakes, double drift, uint32_t seed, int sensor_fps)
+{
+    const uint32_t frame_us = 1000000 / sensor_fps;
+    const int fixed_skip = 5;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::uniform_int_distribution<int> settled_level(100, 140), offset(20, 80), noise(-1, 1);
+
+    SensorWarmup warmup;
+    warmup.configure(2);
+    uint64_t now = 0;
+    int settled = 120, stale_used = 0, unsettled = 0, fixed_unsettled = 0;
+    double latency_us = 0;
+    for (int w = 0; w < wakes; w++)
+    {
+        int before = settled, gap = 0;
+        if (unit(rng) < drift)
+        {
+            settled = settled_level(rng);
+            gap = unit(rng) < 0.5 ? offset(rng) : -offset(rng);
+        }
+        now += 60 * 1000000ULL;
+        warmup.wake(now);
+
+        auto luma_at = [&](int fresh) { return settled + (int)(gap * std::pow(0.5, fresh)) + noise(rng); };
+        int fresh = 0, stale = 0;
+        for (;;)
+        {
+            bool is_stale = stale < 2;
+            uint64_t captured = is_stale ? now - 1000 : now + (uint64_t)(fresh + 1) * frame_us;
+            int luma = is_stale ? before : luma_at(fresh);
+            uint64_t t = std::max(now, captured);
+            WarmupVerdict verdict = warmup.judge(captured, warmup.needs_luma(captured) ? luma : -1, t);
+            if (verdict == WARMUP_READY)
+            {
+                stale_used += is_stale;
+                unsettled += abs(luma - settled) > 4;
+                latency_us += t - now;
+                break;
+            }
+            if (is_stale)
+                stale++;
+            else
+                fresh++;
+        }
+        // The fixed warm-up keeps the frame after fixed_skip discards, the first two stale.
+        fixed_unsettled += abs(luma_at(fixed_skip - 2) - settled) > 4;
+    }
+    const WarmupStats &stats = warmup.stats();
+    double fixed_latency_us = (double)(fixed_skip - 1) * frame_us;
+    double mean_us = latency_us / wakes;
+    bool ok = stale_used == 0 && stats.stale == 2u * wakes && unsettled <= wakes / 25 && unsettled <= fixed_unsettled;
+    printf("sensor warm-up       %s  wakes=%d  drift=%.2f  stale=%u  settle=%.2f frames/wake  unchanged=%u  capped=%u  "
+           "expected=%.2f  unsettled=%d  stale_used=%d\n",
+           ok ? "ok  " : "FAIL", wakes, drift, stats.stale, (double)stats.settle_frames / wakes, stats.unchanged,
+           stats.capped, warmup.expected_settle(), unsettled, stale_used);
+    printf("%-20s wake to usable frame %.0f ms on average; a fixed %d-frame warm-up takes %.0f ms (%d unsettled)\n",
+           "", mean_us / 1000, fixed_skip, fixed_latency_us / 1000, fixed_unsettled);
+    return ok;
+}
+
+// Formats a record and strips the "<time> <level> " prefix.
+static std::string log_message(const LogRecord &record)
+{
+    char line[EVENT_LOG_LINE];
+    EventLog::format(record, line, sizeof(line));
+    const char *message = strchr(strchr(line, ' ') + 1, ' ') + 1;
+    return message;
+}
+
+static bool run_log_check(int records, const char *dump_path)
+{
+    bool ok = true;
+    EventLog *log = new EventLog();
+    LogRecord record;
+
+    // Each conversion the formats use, against printf with the real types.
+    char buf[EVENT_LOG_LINE];
+    int mismatches = 0;
+    auto check = [&](const char *expected) {
+        log->lock_drain();
+        bool popped = log->pop(record);
+        log->unlock_drain();
+        std::string got = popped ? log_message(record) : "nothing";
+        if (got != expected && mismatches++ == 0)
+            fprintf(stderr, "  expected \"%s\", got \"%s\"\n", expected, got.c_str());
+    };
+    std::mt19937 rng(1);
+    for (int i = 0; i < 200; i++)
+    {
+        uint32_t a = rng(), b = rng() % 100000;
+        float f = (float)(rng() % 10000) / 7.0f;
+        int neg = -(int)(rng() % 1000);
+        char c = 'A' + rng() % 26;
+        log->log(EVLOG_LEVEL_INFO, LOGF_STREAM_PROGRESS, a, b);
+        snprintf(buf, sizeof(buf), EventLog::format_text(LOGF_STREAM_PROGRESS), a, b);
+        check(buf);
+        log->log(EVLOG_LEVEL_DEBUG, LOGF_COMMAND, c, c);
+        snprintf(buf, sizeof(buf), EventLog::format_text(LOGF_COMMAND), c, c);
+        check(buf);
+        log->log(EVLOG_LEVEL_INFO, LOGF_CHANGE_GATE, b % 100, b, a, f, 3);
+        snprintf(buf, sizeof(buf), EventLog::format_text(LOGF_CHANGE_GATE), b % 100, b, a, (double)f, 3);
+        check(buf);
+        log->log(EVLOG_LEVEL_INFO, LOGF_ARENA_FILL, f, neg);
+        snprintf(buf, sizeof(buf), EventLog::format_text(LOGF_ARENA_FILL), (double)f, neg);
+        check(buf);
+    }
+    ok &= mismatches == 0;
+
+    // Three writers and a drain running side by side; every record is either
+    // drained, in order per writer, or counted as dropped.
+    EventLog *race = new EventLog();
+    const int writers = 3;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < writers; t++)
+        threads.emplace_back([race, t, records] {
+            for (int i = 0; i < records; i++)
+            {
+                race->log(EVLOG_LEVEL_INFO, LOGF_STREAM_PROGRESS, t, i);
+                if (i % 32 == 31)
+                    std::this_thread::yield(); // Writers on the device run between other work
+            }
+        });
+    std::atomic<bool> writing(true);
+    uint32_t drained = 0, drops = 0;
+    int out_of_order = 0;
+    std::thread drain([&] {
+        int64_t last[writers] = {-1, -1, -1};
+        LogRecord r;
+        for (;;)
+        {
+            bool done = !writing.load();
+            race->lock_drain();
+            bool any = false;
+            while (race->pop(r))
+            {
+                any = true;
+                if (r.format == LOGF_DROPPED)
+                {
+                    drops += r.args[0];
+                    continue;
+                }
+                drained++;
+                out_of_order += (int64_t)r.args[1] <= last[r.args[0]];
+                last[r.args[0]] = r.args[1];
+            }
+            race->unlock_drain();
+            if (done && !any)
+                break;
+        }
+    });
+    for (std::thread &t : threads)
+        t.join();
+    writing = false;
+    drain.join();
+    bool race_ok = out_of_order == 0 && drained + drops == (uint32_t)(writers * records) &&
+                   drained == race->written() && drops == race->dropped();
+    ok &= race_ok;
+
+    // A record at the call site against the line it replaces.
+    auto start = std::chrono::steady_clock::now();
+    uint32_t sink = 0;
+    for (int i = 0; i < records; i++)
+    {
+        if ((i & (EVENT_LOG_LEN / 2 - 1)) == 0)
+        {
+            log->lock_drain();
+            while (log->pop(record))
+                sink += record.args[0];
+            log->unlock_drain();
+        }
+        log->log(EVLOG_LEVEL_INFO, LOGF_STREAM_PROGRESS, (uint32_t)i * 512, 65536u);
+    }
+    double record_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / records;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < records; i++)
+    {
+        snprintf(buf, sizeof(buf), "[Image %d] Progress: %u/%u bytes\n", 3, (unsigned)i * 512, 65536u);
+        sink += (uint8_t)buf[12];
+    }
+    double printf_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / records;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < records; i++)
+    {
+        log->log(EVLOG_LEVEL_INFO, LOGF_STREAM_PROGRESS, (uint32_t)i * 512, 65536u);
+        log->lock_drain();
+        log->pop(record);
+        log->unlock_drain();
+        sink += EventLog::format(record, buf, sizeof(buf));
+    }
+    double flush_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / records;
+
+    // Everything drained is kept for BLE up to EVENT_LOG_HISTORY records.
+    std::vector<uint8_t> dump(32 + EVENT_LOG_HISTORY * (8 + 4 * EVENT_LOG_ARGS));
+    uint32_t from = 0;
+    dump.resize(log->encode(dump.data(), dump.size(), from));
+    uint16_t count = dump.size() >= 8 ? dump[6] | dump[7] << 8 : 0;
+    ok &= count == EVENT_LOG_HISTORY && from == log->drained();
+    if (dump_path)
+    {
+        FILE *f = fopen(dump_path, "wb");
+        if (f)
+        {
+            fwrite(dump.data(), 1, dump.size(), f);
+            fclose(f);
+        }
+    }
+
+    printf("event log            %s  records=%d  format mismatches=%d  race: %u drained + %u dropped of %d, "
+           "%d out of order  dump=%u records/%u bytes\n",
+           ok ? "ok  " : "FAIL", records, mismatches, drained, drops, writers * records, out_of_order, count,
+           (unsigned)dump.size());
+    printf("%-20s %.0f ns per record at the call site vs %.0f ns to format the line there; %.0f ns to drain and "
+           "format later (%u)\n",
+           "", record_ns, printf_ns, flush_ns, sink & 1);
+    delete log;
+    delete race;
+    return ok;
+}
+
+// Keeps the locks the policy holds, to check them against the phases.
+class RecordingPowerBackend : public PowerBackend
+{
+public:
+    RecordingPowerBackend() : held{false, false}, errors(0) {}
+    void acquire(PowerLock lock) override
+    {
+        errors += held[lock];
+        held[lock] = true;
+    }
+    void release(PowerLock lock) override
+    {
+        errors += !held[lock];
+        held[lock] = false;
+    }
+
+    bool held[POWER_LOCK_COUNT];
+    int errors; // Acquired twice or released while not held
+};
+
+struct PowerEvent
+{
+    uint64_t at_us;
+    int op; // 0 enter, 1 leave, 2 sleep begin, 3 sleep end, 4 frame
+    PowerPhase phase;
+};
+
+// The two firmware tasks on one timeline. The capture task wakes every 10 s,
+// holds the capture phase through the camera and warm-up, the store phase
+// through the copy, stays up 60 ms for the log and display, then light-sleeps
+// unless a transfer is running. Every batch_size frames the transfer task holds
+// the advertise phase from BLE start to stop, the link phase once the server
+// connects after 1-30 s, and the transfer phase while 20 kB frames stream at
+// 60 kB/s. The connect wait must be charged to the idle state (automatic light
+// sleep) whenever the capture task is not working through it.
+static bool run_power_check(int frames, int batch_size, uint32_t seed)
+{
+    const uint64_t interval_us = 10 * 1000000ULL;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> settle(0, 3), connect_ms(1000, 30000);
+    std::vector<PowerEvent> events;
+    uint64_t transfer_until = 0;
+    int sessions = 0;
+    for (int i = 0; i < frames; i++)
+    {
+        uint64_t t = (uint64_t)i * interval_us;
+        uint64_t captured = t + 120000 + settle(rng) * 40000;
+        uint64_t stored = captured + 25000;
+        uint64_t done = stored + 60000;
+        events.push_back({t, 0, POWER_PHASE_CAPTURE});
+        events.push_back({captured, 1, POWER_PHASE_CAPTURE});
+        events.push_back({captured, 4, POWER_PHASE_CAPTURE});
+        events.push_back({captured, 0, POWER_PHASE_STORE});
+        events.push_back({stored, 1, POWER_PHASE_STORE});
+        bool transferring = done < transfer_until;
+        if (!transferring && (i + 1) % batch_size == 0)
+        {
+            uint64_t link = done;
+            uint64_t connected = link + 350000 + (uint64_t)connect_ms(rng) * 1000;
+            uint64_t ready = connected + 150000;
+            uint64_t sent = ready + (uint64_t)batch_size * 20000 * 1000000 / 60000;
+            transfer_until = sent + 1500000;
+            events.push_back({link, 0, POWER_PHASE_ADVERTISE});
+            events.push_back({connected, 0, POWER_PHASE_LINK});
+            events.push_back({ready, 0, POWER_PHASE_TRANSFER});
+            events.push_back({sent, 1, POWER_PHASE_TRANSFER});
+            events.push_back({transfer_until, 1, POWER_PHASE_LINK});
+            events.push_back({transfer_until, 1, POWER_PHASE_ADVERTISE});
+            transferring = true;
+            sessions++;
+        }
+        if (!transferring && i + 1 < frames)
+        {
+            events.push_back({done, 2, POWER_PHASE_CAPTURE});
+            events.push_back({t + interval_us, 3, POWER_PHASE_CAPTURE});
+        }
+    }
+    uint64_t end = std::max((uint64_t)frames * interval_us, transfer_until);
+    std::stable_sort(events.begin(), events.end(),
+                     [](const PowerEvent &a, const PowerEvent &b) { return a.at_us < b.at_us; });
+
+    RecordingPowerBackend backend;
+    PowerPolicy policy;
+    policy.begin(&backend, 0);
+    int held[POWER_PHASE_COUNT] = {0};
+    int mismatches = 0;
+    uint64_t prev_us = 0, wait_us = 0, wait_free_us = 0, wait_idle_us = 0;
+    for (const PowerEvent &e : events)
+    {
+        // Advertising and not yet connected: what the policy charges the wait to.
+        if (held[POWER_PHASE_ADVERTISE] && !held[POWER_PHASE_LINK])
+        {
+            uint64_t dt = e.at_us - prev_us;
+            wait_us += dt;
+            if (!held[POWER_PHASE_CAPTURE] && !held[POWER_PHASE_STORE])
+                wait_free_us += dt;
+            if (policy.state() == POWER_STATE_IDLE)
+                wait_idle_us += dt;
+        }
+        prev_us = e.at_us;
+        if (e.op == 0)
+        {
+            policy.enter(e.phase, e.at_us);
+            held[e.phase]++;
+        }
+        else if (e.op == 1)
+        {
+            policy.leave(e.phase, e.at_us);
+            held[e.phase]--;
+        }
+        else if (e.op == 2)
+            policy.sleep_begin(e.at_us);
+        else if (e.op == 3)
+            policy.sleep_end(e.at_us);
+        else
+            policy.count_frame();
+        bool want_max = held[POWER_PHASE_CAPTURE] || held[POWER_PHASE_STORE] || held[POWER_PHASE_TRANSFER];
+        bool want_awake = held[POWER_PHASE_CAPTURE] || held[POWER_PHASE_LINK] || held[POWER_PHASE_TRANSFER];
+        mismatches += backend.held[POWER_LOCK_CPU_MAX] != want_max || backend.held[POWER_LOCK_NO_SLEEP] != want_awake;
+    }
+
+    PowerStats stats = policy.stats(end);
+    uint64_t total = 0;
+    for (int s = 0; s < POWER_STATE_COUNT; s++)
+        total += stats.time_us[s];
+    PowerModel model = {50.0f, 25.0f, 25.0f, 0.8f, 3.3f};
+    float fixed_mj = PowerPolicy::fixed_clock_energy_per_frame_mj(stats, model);
+    float dfs_mj = PowerPolicy::energy_per_frame_mj(stats, model);
+    model.idle_ma = model.sleep_ma;
+    float auto_sleep_mj = PowerPolicy::energy_per_frame_mj(stats, model);
+    bool ok = mismatches == 0 && backend.errors == 0 && total == end && stats.frames == (uint32_t)frames &&
+              auto_sleep_mj <= dfs_mj && dfs_mj <= fixed_mj && wait_idle_us == wait_free_us &&
+              (sessions == 0 || wait_idle_us > 0);
+    printf("power policy         %s  frames=%d  batch=%d  lock mismatches=%d  backend errors=%d  switches=%u  "
+           "accounted=%.1f/%.1f s\n",
+           ok ? "ok  " : "FAIL", frames, batch_size, mismatches, backend.errors, stats.switches, total / 1e6, end / 1e6);
+    printf("%-20s per frame: %.0f ms full clock, %.0f ms awake, %.0f ms idle, %.0f ms asleep (fixed clocks: %.0f ms "
+           "full clock)\n",
+           "", stats.time_us[POWER_STATE_MAX] / 1e3 / frames, stats.time_us[POWER_STATE_AWAKE] / 1e3 / frames,
+           stats.time_us[POWER_STATE_IDLE] / 1e3 / frames, stats.time_us[POWER_STATE_SLEEP] / 1e3 / frames,
+           stats.phase_us / 1e3 / frames);
+    printf("%-20s CPU energy per frame: fixed clocks %.1f mJ, frequency scaling %.1f mJ, plus automatic light sleep "
+           "%.1f mJ\n",
+           "", fixed_mj, dfs_mj, auto_sleep_mj);
+    if (sessions > 0)
+        printf("%-20s connect wait per session: %.0f ms, %.0f ms idle (%.0f ms with no capture running), "
+               "%.1f mJ at the idle clock, %.1f mJ light-sleeping\n",
+               "", wait_us / 1e3 / sessions, wait_idle_us / 1e3 / sessions, wait_free_us / 1e3 / sessions,
+               wait_idle_us * model.awake_ma * model.volts / 1e6 / sessions,
+               wait_idle_us * model.sleep_ma * model.volts / 1e6 / sessions);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <fixture_dir> [--window N] [--container 0|1] [--batch N | --budget BYTES] [--mtu N] [--latency MS] "
+                        "[--jitter MS] [--loss P] [--queue N] [--rate KBPS] [--seed N] [--drop-at MS] [--spill DIR [--flash BYTES]] "
+                        "[--change PCT [--keyframe N]] [--target BYTES [--trace FILE]] [--telemetry FILE] [--poll MS] [--preview N] "
+                        "[--pir PER_HOUR [--holdoff MS]] [--burst N [--fps F] [--sensor-fps F]] "
+                        "[--warmup WAKES [--drift P]] [--log RECORDS] [--power FRAMES] [--config WRITES]\n",
+                argv[0]);
+        return 2;
+    }
+
+    LinkConfig link;
+    int window = -1;
+    int container = -1;
+    int batch_size = 20;
+    size_t budget = 0;
+    const char *spill_dir = NULL;
+    size_t flash_bytes = 384 * 1024;
+    int change_threshold = -1;
+    int keyframe = 10;
+    uint32_t target_bytes = 0;
+    const char *trace = NULL;
+    const char *telemetry_path = NULL;
+    int pick_every = 0;
+    double pir_rate = 0;
+    uint32_t holdoff_ms = 10000;
+    int burst_frames = 0;
+    int burst_fps = 25;
+    int sensor_fps = 25;
+    int warmup_wakes = 0;
+    double drift = 0.2;
+    int log_records = 0;
+    int power_frames = 0;
+    int config_writes = 0;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        const char *opt = argv[i];
+        const char *val = argv[i + 1];
+        if (!strcmp(opt, "--window"))
+            window = atoi(val);
+        else if (!strcmp(opt, "--batch"))
+            batch_size = atoi(val);
+        else if (!strcmp(opt, "--container"))
+            container = atoi(val);
+        else if (!strcmp(opt, "--budget"))
+            budget = strtoul(val, NULL, 10);
+        else if (!strcmp(opt, "--mtu"))
+            link.mtu = atoi(val);
+        else if (!strcmp(opt, "--latency"))
+            link.latency_ms = atoi(val);
+        else if (!strcmp(opt, "--jitter"))
+            link.jitter_ms = atoi(val);
+        else if (!strcmp(opt, "--loss"))
+            link.loss = atof(val);
+        else if (!strcmp(opt, "--queue"))
+            link.queue_depth = atoi(val);
+        else if (!strcmp(opt, "--rate"))
+            link.rate_kbps = atoi(val);
+        else if (!strcmp(opt, "--seed"))
+            link.seed = atoi(val);
+        else if (!strcmp(opt, "--drop-at"))
+            link.drop_at_ms = atoi(val);
+        else if (!strcmp(opt, "--spill"))
+            spill_dir = val;
+        else if (!strcmp(opt, "--flash"))
+            flash_bytes = strtoul(val, NULL, 10);
+        else if (!strcmp(opt, "--change"))
+            change_threshold = atoi(val);
+        else if (!strcmp(opt, "--keyframe"))
+            keyframe = atoi(val);
+        else if (!strcmp(opt, "--target"))
+            target_bytes = strtoul(val, NULL, 10);
+        else if (!strcmp(opt, "--trace"))
+            trace = val;
+        else if (!strcmp(opt, "--poll"))
+            link.poll_ms = atoi(val);
+        else if (!strcmp(opt, "--preview"))
+            pick_every = atoi(val);
+        else if (!strcmp(opt, "--pir"))
+            pir_rate = atof(val);
+        else if (!strcmp(opt, "--holdoff"))
+            holdoff_ms = strtoul(val, NULL, 10);
+        else if (!strcmp(opt, "--burst"))
+            burst_frames = atoi(val);
+        else if (!strcmp(opt, "--fps"))
+            burst_fps = atoi(val);
+        else if (!strcmp(opt, "--sensor-fps"))
+            sensor_fps = atoi(val);
+        else if (!strcmp(opt, "--warmup"))
+            warmup_wakes = atoi(val);
+        else if (!strcmp(opt, "--drift"))
+            drift = atof(val);
+        else if (!strcmp(opt, "--log"))
+            log_records = atoi(val);
+        else if (!strcmp(opt, "--power"))
+            power_frames = atoi(val);
+        else if (!strcmp(opt, "--config"))
+            config_writes = atoi(val);
+        else if (!strcmp(opt, "--telemetry"))
+            telemetry_path = val;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", opt);
+            return 2;
+        }
+    }
+
+    FixtureFrameSource source;
+    if (!source.load(argv[1]))
+    {
+        fprintf(stderr, "No JPEG fixtures found in %s\n", argv[1]);
+        return 1;
+    }
+
+    FrameArena arena;
+    if (!arena.begin(FRAME_ARENA_BYTES))
+        return 1;
+
+    printf("fixtures=%u  batch=%d  mtu=%u  latency=%ums  jitter=%ums  loss=%.3f  queue=%u  rate=%ukbps  poll=%ums\n",
+           (unsigned)source.count(), batch_size, link.mtu, link.latency_ms, link.jitter_ms, link.loss,
+           link.queue_depth, link.rate_kbps, link.poll_ms);
+
+    bool ok = true;
+    if (target_bytes > 0)
+    {
+        ok &= run_rate_check(source, target_bytes, trace, link.seed);
+    }
+    else if (change_threshold >= 0)
+    {
+        ok &= run_change_check(arena, source, change_threshold, keyframe);
+    }
+    else if (power_frames > 0 && batch_size > 0)
+    {
+        ok &= run_power_check(power_frames, batch_size, link.seed);
+    }
+    else if (config_writes > 0 && batch_size > 0)
+    {
+        ok &= run_config_check(link, arena, source, batch_size, config_writes, telemetry_path);
+    }
+    else if (log_records > 0)
+    {
+        ok &= run_log_check(log_records, telemetry_path);
+    }
+    else if (warmup_wakes > 0 && sensor_fps > 0)
+    {
+        ok &= run_warmup_check(warmup_wakes, drift, link.seed, sensor_fps);
+    }
+    else if (burst_frames > 0 && sensor_fps > 0)
+    {
+        ok &= run_burst_check(link, arena, source, burst_frames, burst_fps, sensor_fps);
+    }
+    else if (pir_rate > 0)
+    {
+        ok &= run_pir_check(link, arena, source, pir_rate, holdoff_ms, batch_size);
+    }
+    else if (pick_every > 0)
+    {
+        ok &= run_preview_check(link, arena, source, batch_size, budget, window < 0 ? 8 : window, pick_every);
+    }
+    else if (spill_dir)
+    {
+        ok &= run_spill_check(link, arena, source, batch_size, spill_dir, flash_bytes, window < 0 ? 8 : window,
+                              container != 0);
+    }
+    else if (window < 0)
+    {
+        ok &= run_transfer(link, arena, source, batch_size, budget, 0, false, telemetry_path);
+        ok &= run_transfer(link, arena, source, batch_size, budget, 8, false, telemetry_path);
+        ok &= run_transfer(link, arena, source, batch_size, budget, 8, true, telemetry_path);
+    }
+    else
+    {
+        ok &= run_transfer(link, arena, source, batch_size, budget, window, container > 0, telemetry_path);
+    }
+    arena.end();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,71 @@
+#include "fixture_source.h"
+#include "platform.h"
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <strings.h>
+
+static bool is_jpeg_name(const std::string &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos)
+        return false;
+    const char *ext = name.c_str() + dot + 1;
+    return strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0;
+}
+
+bool FixtureFrameSource::load(const char *directory)
+{
+    DIR *dir = opendir(directory);
+    if (!dir)
+    {
+        fprintf(stderr, "Cannot open fixture directory %s\n", directory);
+        return false;
+    }
+    std::vector<std::string> names;
+    while (struct dirent *entry = readdir(dir))
+    {
+        if (is_jpeg_name(entry->d_name))
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (const std::string &name : names)
+    {
+        std::string path = std::string(directory) + "/" + name;
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f)
+            continue;
+        std::vector<uint8_t> data;
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+            data.insert(data.end(), buf, buf + n);
+        fclose(f);
+        if (data.empty())
+            continue;
+        m_frames.push_back(data);
+        m_names.push_back(name);
+    }
+    m_next = 0;
+    return !m_frames.empty();
+}
+
+bool FixtureFrameSource::acquire(Frame &frame)
+{
+    if (m_frames.empty())
+        return false;
+    const std::vector<uint8_t> &data = m_frames[m_next];
+    frame.buf = data.data();
+    frame.len = data.size();
+    frame.handle = NULL;
+    frame.captured_us = platform_micros();
+    m_next = (m_next + 1) % m_frames.size();
+    return true;
+}
+
+void FixtureFrameSource::release(Frame &frame)
+{
+    frame.handle = NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef FIXTURE_SOURCE_H
+#define FIXTURE_SOURCE_H
+
+#include "frame_source.h"
+#include <string>
+#include <vector>
+
+// Stands in for the camera in the native build: serves the JPEGs found in a
+// directory in name order, wrapping around when it runs out.
+class FixtureFrameSource : public FrameSource
+{
+public:
+    bool load(const char *directory);
+
+    bool acquire(Frame &frame) override;
+    void release(Frame &frame) override;
+
+    void rewind() { m_next = 0; }
+    size_t count() const { return m_frames.size(); }
+    const std::vector<uint8_t> &fixture(size_t index) const { return m_frames[index]; }
+    const std::string &name(size_t index) const { return m_names[index]; }
+
+private:
+    std::vector<std::vector<uint8_t>> m_frames;
+    std::vector<std::string> m_names;
+    size_t m_next = 0;
+};
+
+#endif // FIXTURE_SOURCE_H
@@ -0,0 +1,461 @@
+#include "link_emulator.h"
+#include "protocol.h"
+#include "crc32.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// Mirrors WINDOW_GAP_TIMEOUT in srv/app/config.py
+#define SERVER_GAP_TIMEOUT_MS 1500
+#define SERVER_MAX_RETRIES 10
+
+LinkEmulator::LinkEmulator(const LinkConfig &config) : m_config(config), m_rng(config.seed)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+uint64_t LinkEmulator::delivery_us(uint64_t from_us)
+{
+    int64_t jitter = 0;
+    if (m_config.jitter_ms > 0)
+    {
+        std::uniform_int_distribution<int64_t> dist(-(int64_t)m_config.jitter_ms * 1000, (int64_t)m_config.jitter_ms * 1000);
+        jitter = dist(m_rng);
+    }
+    int64_t at = (int64_t)from_us + (int64_t)m_config.latency_ms * 1000 + jitter;
+    return at < (int64_t)from_us ? from_us : (uint64_t)at;
+}
+
+void LinkEmulator::schedule(Event event)
+{
+    event.order = m_order++;
+    m_events.push(event);
+}
+
+void LinkEmulator::send_status(const char *text)
+{
+    if (!m_connected)
+        return;
+    Event event = {};
+    event.at_us = delivery_us(m_now_us);
+    event.kind = STATUS_TO_SERVER;
+    event.payload.assign(text, text + strlen(text));
+    schedule(event);
+}
+
+void LinkEmulator::send_data(const uint8_t *data, size_t size)
+{
+    if (!m_connected)
+        return;
+    m_stats.notifies++;
+    size_t max_payload = m_config.mtu > 3 ? m_config.mtu - 3 : 0;
+    if (size > max_payload)
+    {
+        m_stats.truncated++;
+        size = max_payload;
+    }
+
+    while (!m_tx_queue.empty() && m_tx_queue.front() <= m_now_us)
+        m_tx_queue.pop_front();
+    if (m_tx_queue.size() >= m_config.queue_depth)
+    {
+        m_stats.dropped_queue++;
+        return;
+    }
+
+    uint64_t air_us = (uint64_t)size * 8 * 1000 / (m_config.rate_kbps ? m_config.rate_kbps : 1);
+    uint64_t depart = std::max(m_now_us, m_air_free_us) + air_us;
+    m_air_free_us = depart;
+    m_tx_queue.push_back(depart);
+
+    std::uniform_real_distribution<double> roll(0.0, 1.0);
+    if (m_config.loss > 0 && roll(m_rng) < m_config.loss)
+    {
+        m_stats.dropped_loss++;
+        return;
+    }
+
+    // The link layer delivers in order, so jitter never reorders notifications.
+    Event event = {};
+    event.at_us = std::max(delivery_us(depart), m_last_data_us);
+    m_last_data_us = event.at_us;
+    event.kind = DATA_TO_SERVER;
+    event.payload.assign(data, data + size);
+    schedule(event);
+}
+
+// Everything still in the air is lost; the server keeps what it has so far.
+void LinkEmulator::disconnect()
+{
+    m_connected = false;
+    if (m_active)
+        server_keep_partial();
+    m_active = false;
+    m_timer_generation++;
+    m_events = decltype(m_events)();
+    m_tx_queue.clear();
+    m_inbox.clear();
+}
+
+void LinkEmulator::reconnect()
+{
+    m_connected = true;
+    m_config.drop_at_ms = 0;
+    m_window = 0;
+    m_have_last_ack = false;
+    m_air_free_us = m_last_data_us = m_last_command_us = m_now_us;
+}
+
+bool LinkEmulator::advance_to(uint64_t deadline_us, bool stop_on_command)
+{
+    uint64_t drop_us = m_connected && m_config.drop_at_ms ? (uint64_t)m_config.drop_at_ms * 1000 : UINT64_MAX;
+    if (deadline_us >= drop_us)
+    {
+        if (advance_to(drop_us - 1, stop_on_command))
+            return true;
+        m_now_us = drop_us;
+        disconnect();
+        return false;
+    }
+
+    while (!m_events.empty() && m_events.top().at_us <= deadline_us)
+    {
+        Event event = m_events.top();
+        m_events.pop();
+        if (event.at_us > m_now_us)
+            m_now_us = event.at_us;
+
+        switch (event.kind)
+        {
+        case STATUS_TO_SERVER:
+            server_on_status(std::string(event.payload.begin(), event.payload.end()));
+            break;
+        case DATA_TO_SERVER:
+            server_on_data(event.payload);
+            break;
+        case SERVER_TIMER:
+            server_on_timer(event.generation);
+            break;
+        case COMMAND_TO_DEVICE:
+            m_inbox.push_back(event.cmd);
+            if (stop_on_command)
+                return true;
+            break;
+        }
+    }
+    if (deadline_us > m_now_us)
+        m_now_us = deadline_us;
+    return false;
+}
+
+bool LinkEmulator::wait_command(TransportCommand &cmd, uint32_t timeout_ms)
+{
+    if (!m_connected)
+        return false;
+    uint64_t start_us = m_now_us;
+    if (m_inbox.empty())
+        advance_to(m_now_us + (uint64_t)timeout_ms * 1000, true);
+    if (m_inbox.empty())
+        return false;
+    if (m_config.poll_ms > 0 && m_now_us > start_us)
+    {
+        // A polling sender only looks again at its next tick after the command landed.
+        uint64_t tick_us = (uint64_t)m_config.poll_ms * 1000;
+        advance_to(start_us + (m_now_us - start_us + tick_us - 1) / tick_us * tick_us, false);
+    }
+    cmd = m_inbox.front();
+    m_inbox.pop_front();
+    return true;
+}
+
+void LinkEmulator::sleep_ms(uint32_t ms)
+{
+    advance_to(m_now_us + (uint64_t)ms * 1000, false);
+}
+
+// --- Server model (see srv/app/ble_handler.py) ---
+
+void LinkEmulator::server_send(char type, uint16_t seq, uint8_t credit, uint32_t frame_id)
+{
+    m_stats.commands++;
+    Event event = {};
+    event.at_us = std::max(delivery_us(m_now_us + (uint64_t)m_config.server_delay_ms * 1000), m_last_command_us);
+    m_last_command_us = event.at_us;
+    event.kind = COMMAND_TO_DEVICE;
+    event.cmd = {type, seq, credit, frame_id};
+    schedule(event);
+}
+
+void LinkEmulator::server_arm_timer()
+{
+    Event event = {};
+    event.at_us = m_now_us + (uint64_t)SERVER_GAP_TIMEOUT_MS * 1000;
+    event.kind = SERVER_TIMER;
+    event.generation = ++m_timer_generation;
+    schedule(event);
+}
+
+void LinkEmulator::server_on_status(const std::string &status)
+{
+    if (status.compare(0, 4, "WIN:") == 0)
+    {
+        unsigned window = 0, chunk = 0;
+        if (sscanf(status.c_str(), "WIN:%u:%u", &window, &chunk) == 2)
+        {
+            m_window = (uint8_t)window;
+            m_chunk_size = chunk;
+        }
+    }
+    else if (status.compare(0, 6, "COUNT:") == 0)
+    {
+        server_send('A');
+    }
+    else if (status.compare(0, 5, "PICK:") == 0)
+    {
+        server_pick();
+    }
+    else if (status.compare(0, 6, "IMAGE:") == 0 || status.compare(0, 6, "BATCH:") == 0 ||
+             status.compare(0, 8, "PREVIEW:") == 0)
+    {
+        // IMAGE:<length>:<id>:<offset>:<crc32>:<flags> carries length - offset bytes.
+        unsigned length = 0, id = 0, offset = 0, crc = 0, flags = 0;
+        m_is_preview = status[0] == 'P';
+        m_is_container = status[0] == 'B';
+        sscanf(status.c_str() + status.find(':') + 1, "%u:%u:%u:%u:%u", &length, &id, &offset, &crc, &flags);
+        m_frame_id = id;
+        m_frame_flags = flags;
+        m_frame_offset = m_is_container ? 0 : offset;
+        m_frame_crc = crc;
+        m_expected = length - m_frame_offset;
+        m_image.clear();
+        m_active = true;
+        if (m_window > 0)
+        {
+            size_t total_chunks = (m_expected + m_chunk_size - 1) / m_chunk_size;
+            m_image.assign(m_expected, 0);
+            m_received.assign(total_chunks, false);
+            m_nacked.clear();
+            m_next_expected = 0;
+            m_since_ack = 0;
+            m_retries = 0;
+            server_arm_timer();
+        }
+        server_send('A');
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void LinkEmulator::server_complete_frame(uint32_t id, uint32_t crc, uint32_t flags, const std::vector<uint8_t> &data)
+{
+    if (crc32_update(0, data.data(), data.size()) != crc)
+        m_stats.crc_errors++;
+    m_images.push_back(data);
+    m_flags.push_back(flags);
+    if (flags & FRAME_FLAG_EVENT)
+        m_event_ids.push_back(id);
+    m_resume = {id, (uint32_t)data.size(), crc};
+    m_resume_data = data;
+}
+
+// The bytes of a resumed frame that arrived in an earlier connection.
+static bool resumed_prefix(const ResumePoint &resume, const std::vector<uint8_t> &held, uint32_t id, uint32_t crc,
+                           uint32_t offset, std::vector<uint8_t> &out)
+{
+    out.clear();
+    if (offset == 0)
+        return true;
+    if (resume.frame_id != id || resume.crc32 != crc || held.size() < offset)
+        return false;
+    out.assign(held.begin(), held.begin() + offset);
+    return true;
+}
+
+// Splits a batch container, or the prefix of one that broke off, back into frames
+// as handle_batch_transfer() does. A frame cut short becomes the resume point.
+void LinkEmulator::server_split_container(size_t available)
+{
+    const uint8_t *c = m_image.data();
+    if (available < 20 || memcmp(c, "JKB1", 4) != 0)
+        return;
+    uint16_t count = c[6] | (c[7] << 8);
+    uint32_t first_offset = get_u32(c + 16);
+    if (available < 20 + (size_t)count * 24)
+        return;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        const uint8_t *entry = c + 20 + i * 24;
+        uint32_t id = get_u32(entry);
+        uint32_t offset = get_u32(entry + 4);
+        uint32_t length = get_u32(entry + 8);
+        uint32_t crc = get_u32(entry + 16);
+        uint32_t flags = get_u32(entry + 20);
+        std::vector<uint8_t> data;
+        if (!resumed_prefix(m_resume, m_resume_data, id, crc, i == 0 ? first_offset : 0, data))
+        {
+            m_stats.crc_errors++;
+            continue;
+        }
+        size_t have = offset < available ? std::min((size_t)length, available - offset) : 0;
+        data.insert(data.end(), c + offset, c + offset + have);
+        if (have < length)
+        {
+            if (!data.empty())
+            {
+                m_resume = {id, (uint32_t)data.size(), crc};
+                m_resume_data = data;
+            }
+            return;
+        }
+        server_complete_frame(id, crc, flags, data);
+    }
+}
+
+// Reads a preview container (handle_preview_transfer() on the server): counts the
+// previews that decoded and remembers every frame id for the pick list.
+void LinkEmulator::server_read_previews()
+{
+    const uint8_t *c = m_image.data();
+    if (m_image.size() < 20 || memcmp(c, "JKP1", 4) != 0)
+        return;
+    uint16_t count = c[6] | (c[7] << 8);
+    if (m_image.size() < 20 + (size_t)count * 24)
+        return;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        const uint8_t *entry = c + 20 + i * 24;
+        uint32_t offset = get_u32(entry + 4);
+        if (offset < m_image.size() && m_image[offset] == 1)
+            m_stats.previews++;
+        m_previewed.push_back(get_u32(entry));
+    }
+}
+
+// Answers PICK: with the policy's choice, every pick_every-th preview, then 'G'.
+// Frames passed over are not asked for again.
+void LinkEmulator::server_pick()
+{
+    for (uint32_t id : m_previewed)
+    {
+        if (m_config.pick_every > 0 && m_preview_seen++ % m_config.pick_every == 0)
+        {
+            m_picked.push_back(id);
+            server_send('F', 0, 0, id);
+        }
+    }
+    m_previewed.clear();
+    server_send('G');
+}
+
+void LinkEmulator::server_finish_image()
+{
+    m_active = false;
+    m_timer_generation++;
+    if (m_is_preview)
+    {
+        server_read_previews();
+        return;
+    }
+    if (m_is_container)
+    {
+        server_split_container(m_image.size());
+        return;
+    }
+    std::vector<uint8_t> data;
+    if (!resumed_prefix(m_resume, m_resume_data, m_frame_id, m_frame_crc, m_frame_offset, data))
+        return;
+    data.insert(data.end(), m_image.begin(), m_image.end());
+    server_complete_frame(m_frame_id, m_frame_crc, m_frame_flags, data);
+}
+
+// The transfer broke off: hold on to the contiguous prefix that did arrive.
+void LinkEmulator::server_keep_partial()
+{
+    size_t available = m_window > 0 ? std::min((size_t)m_next_expected * m_chunk_size, m_expected) : m_image.size();
+    if (m_is_preview)
+        return;
+    if (m_is_container)
+    {
+        server_split_container(available);
+        return;
+    }
+    std::vector<uint8_t> data;
+    if (available == 0 || !resumed_prefix(m_resume, m_resume_data, m_frame_id, m_frame_crc, m_frame_offset, data))
+        return;
+    data.insert(data.end(), m_image.begin(), m_image.begin() + available);
+    m_resume = {m_frame_id, (uint32_t)data.size(), m_frame_crc};
+    m_resume_data = data;
+}
+
+void LinkEmulator::server_on_data(const std::vector<uint8_t> &packet)
+{
+    if (!m_active)
+    {
+        // A retransmit after completion means the final ACK was lost; repeat it.
+        if (m_window > 0 && m_have_last_ack)
+            server_send('K', m_last_ack, m_window);
+        return;
+    }
+
+    if (m_window == 0)
+    {
+        // Every chunk is answered with 'N', the last one included, so the device
+        // knows the whole stream arrived.
+        m_image.insert(m_image.end(), packet.begin(), packet.end());
+        if (m_image.size() >= m_expected)
+            server_finish_image();
+        server_send('N');
+        return;
+    }
+
+    if (packet.size() < WINDOW_CHUNK_HEADER)
+        return;
+    uint16_t seq = packet[0] | (packet[1] << 8);
+    if (seq >= m_received.size() || m_received[seq])
+        return;
+    size_t offset = (size_t)seq * m_chunk_size;
+    size_t len = std::min(packet.size() - WINDOW_CHUNK_HEADER, m_expected - offset);
+    memcpy(m_image.data() + offset, packet.data() + WINDOW_CHUNK_HEADER, len);
+    m_received[seq] = true;
+    m_retries = 0;
+
+    for (uint16_t missing = m_next_expected; missing < seq; missing++)
+    {
+        if (!m_received[missing] && m_nacked.insert(missing).second)
+            server_send('X', missing);
+    }
+    while (m_next_expected < m_received.size() && m_received[m_next_expected])
+        m_next_expected++;
+
+    m_since_ack++;
+    bool done = m_next_expected == m_received.size();
+    if (m_since_ack >= (uint32_t)std::max(1, m_window / 2) || done)
+    {
+        m_since_ack = 0;
+        m_last_ack = m_next_expected;
+        m_have_last_ack = true;
+        server_send('K', m_next_expected, m_window);
+    }
+    if (done)
+        server_finish_image();
+    else
+        server_arm_timer();
+}
+
+void LinkEmulator::server_on_timer(uint32_t generation)
+{
+    if (!m_active || generation != m_timer_generation)
+        return;
+    if (++m_retries > SERVER_MAX_RETRIES)
+    {
+        server_keep_partial();
+        m_active = false;
+        return;
+    }
+    server_send('K', m_next_expected, m_window);
+    server_send('X', m_next_expected);
+    server_arm_timer();
+}
@@ -0,0 +1,155 @@
+#ifndef LINK_EMULATOR_H
+#define LINK_EMULATOR_H
+
+#include "transport.h"
+#include "transfer_session.h"
+#include <deque>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+struct LinkConfig
+{
+    uint16_t mtu = 517;           // ATT MTU; notifications are truncated to mtu - 3 like a real stack would
+    uint32_t latency_ms = 15;     // One-way latency
+    uint32_t jitter_ms = 5;       // Uniform +/- jitter added to each delivery
+    double loss = 0.0;            // Probability that a data notification is lost
+    uint32_t queue_depth = 8;     // Notifications the stack holds before it starts dropping
+    uint32_t rate_kbps = 700;     // Effective air throughput
+    uint32_t server_delay_ms = 2; // Server-side processing (the asyncio hop) per reply
+    uint32_t drop_at_ms = 0;      // The connection drops at this virtual time (0 = never)
+    uint32_t poll_ms = 0;         // Device notices commands only every poll_ms, like a delay() loop (0 = at once)
+    uint32_t pick_every = 0;      // Preview-first mode: the server pulls every Nth previewed frame in full
+    uint32_t seed = 1;
+};
+
+struct LinkStats
+{
+    uint32_t notifies;
+    uint32_t dropped_queue; // Rejected because the notify queue was full
+    uint32_t dropped_loss;  // Lost in the air
+    uint32_t truncated;     // Longer than the MTU allowed
+    uint32_t commands;      // Commands written back by the server
+    uint32_t crc_errors;    // Frames in a batch container whose CRC did not match
+    uint32_t previews;      // Decodable previews received
+};
+
+// A discrete-event model of the BLE link plus a server that speaks the same
+// protocol as srv/app/ble_handler.py. Time is virtual, so a batch that takes
+// minutes over the air drains in milliseconds and results are reproducible.
+class LinkEmulator : public Transport
+{
+public:
+    explicit LinkEmulator(const LinkConfig &config);
+
+    bool is_connected() override { return m_connected; }
+    void send_status(const char *text) override;
+    void send_data(const uint8_t *data, size_t size) override;
+    size_t max_payload() override { return m_config.mtu > ATT_NOTIFY_OVERHEAD ? m_config.mtu - ATT_NOTIFY_OVERHEAD : 0; }
+    bool wait_command(TransportCommand &cmd, uint32_t timeout_ms) override;
+    uint32_t now_ms() override { return (uint32_t)(m_now_us / 1000); }
+    uint64_t now_us() override { return m_now_us; }
+    void sleep_ms(uint32_t ms) override;
+
+    // Brings a dropped link back up, as a fresh connection: the server forgets the
+    // negotiated window but keeps what it has received.
+    void reconnect();
+    // The resume point the server writes ('P') when a device connects.
+    ResumePoint server_resume() const { return m_resume; }
+
+    const LinkStats &stats() const { return m_stats; }
+    const std::vector<std::vector<uint8_t>> &received_images() const { return m_images; }
+    // Frame ids the server asked for in full after previews.
+    const std::vector<uint32_t> &picked_ids() const { return m_picked; }
+    // Frame ids that arrived tagged FRAME_FLAG_EVENT.
+    const std::vector<uint32_t> &event_ids() const { return m_event_ids; }
+    // FRAME_FLAG_* bits of each received image, in step with received_images().
+    const std::vector<uint32_t> &received_flags() const { return m_flags; }
+
+private:
+    enum EventKind
+    {
+        STATUS_TO_SERVER,
+        DATA_TO_SERVER,
+        COMMAND_TO_DEVICE,
+        SERVER_TIMER
+    };
+
+    struct Event
+    {
+        uint64_t at_us;
+        uint64_t order;
+        EventKind kind;
+        std::vector<uint8_t> payload;
+        TransportCommand cmd;
+        uint32_t generation;
+
+        bool operator>(const Event &other) const
+        {
+            return at_us != other.at_us ? at_us > other.at_us : order > other.order;
+        }
+    };
+
+    uint64_t delivery_us(uint64_t from_us);
+    void schedule(Event event);
+    bool advance_to(uint64_t deadline_us, bool stop_on_command);
+    void disconnect();
+
+    // --- Server model ---
+    void server_on_status(const std::string &status);
+    void server_on_data(const std::vector<uint8_t> &packet);
+    void server_on_timer(uint32_t generation);
+    void server_send(char type, uint16_t seq = 0, uint8_t credit = 0, uint32_t frame_id = 0);
+    void server_arm_timer();
+    void server_finish_image();
+    void server_split_container(size_t available);
+    void server_complete_frame(uint32_t id, uint32_t crc, uint32_t flags, const std::vector<uint8_t> &data);
+    void server_keep_partial();
+    void server_read_previews();
+    void server_pick();
+
+    LinkConfig m_config;
+    LinkStats m_stats;
+    std::mt19937 m_rng;
+    bool m_connected = true;
+    uint64_t m_now_us = 0;
+    uint64_t m_order = 0;
+    uint64_t m_air_free_us = 0;
+    uint64_t m_last_data_us = 0;
+    uint64_t m_last_command_us = 0;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_events;
+    std::deque<uint64_t> m_tx_queue; // Departure times of notifications still in the stack
+    std::deque<TransportCommand> m_inbox;
+
+    uint8_t m_window = 0;
+    size_t m_chunk_size = 512;
+    bool m_active = false;
+    bool m_is_container = false;
+    bool m_is_preview = false;
+    size_t m_expected = 0;
+    uint32_t m_frame_id = 0;     // IMAGE: fields for the frame being received
+    uint32_t m_frame_offset = 0;
+    uint32_t m_frame_crc = 0;
+    uint32_t m_frame_flags = 0;
+    std::vector<uint8_t> m_image;
+    std::vector<bool> m_received;
+    std::set<uint16_t> m_nacked;
+    uint16_t m_next_expected = 0;
+    uint32_t m_since_ack = 0;
+    uint32_t m_timer_generation = 0;
+    uint32_t m_retries = 0;
+    bool m_have_last_ack = false;
+    uint16_t m_last_ack = 0;
+    std::vector<std::vector<uint8_t>> m_images;
+    ResumePoint m_resume = {};
+    std::vector<uint8_t> m_resume_data; // The bytes of m_resume.frame_id we hold
+    std::vector<uint32_t> m_previewed;  // Ids of previewed frames not yet picked or passed over
+    std::vector<uint32_t> m_picked;
+    std::vector<uint32_t> m_event_ids;
+    std::vector<uint32_t> m_flags;
+    uint32_t m_preview_seen = 0;        // Previews seen so far, for pick_every
+};
+
+#endif // LINK_EMULATOR_H
@@ -0,0 +1,139 @@
+#include "globals.h"
+#include "log_handler.h"
+#include "freertos/ringbuf.h"
+#include <stdarg.h>
+
+static TaskHandle_t log_task_handle = NULL;
+static RingbufHandle_t text_queue = NULL;
+static std::atomic<uint32_t> text_dropped(0); // PLATFORM_LOG lines that found the queue full
+
+// A line already taken from the ring that did not fit in the TX buffer yet.
+// Only touched under the event log's drain lock.
+static char line[EVENT_LOG_LINE + 2];
+static size_t line_len = 0;
+
+// The same for a PLATFORM_LOG line, with the records written before it.
+static char text[LOG_TEXT_LINE];
+static size_t text_len = 0;
+static uint32_t text_after = 0;
+static uint32_t text_reported = 0;
+
+static size_t next_line()
+{
+    LogRecord record;
+    if (!event_log.pop(record))
+        return 0;
+    size_t len = EventLog::format(record, line, EVENT_LOG_LINE);
+    line[len++] = '\n';
+    return len;
+}
+
+static size_t next_text()
+{
+    uint32_t dropped = text_dropped.load(std::memory_order_relaxed);
+    if (dropped != text_reported)
+    {
+        text_after = 0;
+        int len = snprintf(text, sizeof(text), "Log: %u lines dropped\n", (unsigned)(dropped - text_reported));
+        text_reported = dropped;
+        return (size_t)len;
+    }
+    if (!text_queue)
+        return 0;
+    size_t size;
+    uint8_t *item = (uint8_t *)xRingbufferReceive(text_queue, &size, 0);
+    if (!item)
+        return 0;
+    memcpy(&text_after, item, sizeof(text_after));
+    size -= sizeof(text_after);
+    memcpy(text, item + sizeof(text_after), size);
+    vRingbufferReturnItem(text_queue, item);
+    return size;
+}
+
+// What goes out next: a record line already taken, a text line once the records
+// written before it are out, or else the next record. A text line also goes
+// when no record is left, in case the ones it waits for were dropped.
+static bool next_output(char *&out, size_t *&len)
+{
+    if (line_len == 0)
+    {
+        if (text_len == 0)
+            text_len = next_text();
+        if (text_len == 0 || event_log.taken() < text_after)
+            line_len = next_line();
+    }
+    if (line_len > 0)
+    {
+        out = line;
+        len = &line_len;
+        return true;
+    }
+    out = text;
+    len = &text_len;
+    return text_len > 0;
+}
+
+static void log_task(void *param)
+{
+    for (;;)
+    {
+        vTaskDelay(pdMS_TO_TICKS(LOG_FLUSH_PERIOD_MS));
+        event_log.lock_drain();
+        char *out;
+        size_t *len;
+        while (next_output(out, len) && (size_t)Serial.availableForWrite() >= *len)
+        {
+            Serial.write((const uint8_t *)out, *len);
+            *len = 0;
+        }
+        event_log.unlock_drain();
+    }
+}
+
+void init_log()
+{
+    Serial.setTxBufferSize(LOG_UART_TX_BUFFER);
+    if (!text_queue)
+        text_queue = xRingbufferCreate(LOG_TEXT_QUEUE, RINGBUF_TYPE_NOSPLIT);
+    if (!log_task_handle)
+        xTaskCreatePinnedToCore(log_task, "log", LOG_TASK_STACK, NULL, 1, &log_task_handle, 1);
+}
+
+void log_drain()
+{
+    event_log.lock_drain();
+    char *out;
+    size_t *len;
+    while (next_output(out, len))
+    {
+        Serial.write((const uint8_t *)out, *len);
+        *len = 0;
+    }
+    event_log.unlock_drain();
+}
+
+void platform_log(const char *format, ...)
+{
+    uint8_t item[sizeof(uint32_t) + LOG_TEXT_LINE];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf((char *)item + sizeof(uint32_t), LOG_TEXT_LINE, format, args);
+    va_end(args);
+    if (len <= 0)
+        return;
+    if (len >= LOG_TEXT_LINE)
+    {
+        len = LOG_TEXT_LINE - 1;
+        item[sizeof(uint32_t) + len - 1] = '\n'; // Cut, but still a line of its own
+    }
+    if (!text_queue)
+    {
+        Serial.write(item + sizeof(uint32_t), len);
+        return;
+    }
+    uint32_t after = event_log.written();
+    memcpy(item, &after, sizeof(after));
+    if (xRingbufferSend(text_queue, item, sizeof(uint32_t) + len, 0) != pdTRUE)
+        text_dropped.fetch_add(1, std::memory_order_relaxed);
+}
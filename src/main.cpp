@@ -1,304 +1,578 @@
 #include "globals.h"
 #include "display_handler.h"
+#include "camera_handler.h"
 #include "esp_heap_caps.h"
+#include "driver/gpio.h"
+#include <LittleFS.h>
 #include <cstring>
 
 // --- GLOBAL OBJECTS & VARIABLE DEFINITIONS ---
-SSD1306 display(0x3c, I2C_SDA, I2C_SCL, GEOMETRY_128_64);
 Preferences preferences;
 
-// Configuration settings with defaults
-int deep_sleep_seconds = 10;
-float storage_threshold_percent = 5.0;
+// Configuration settings, defaults until load_settings()
+DeviceConfig device_config = config_defaults();
+// A validated write waiting for the capture task, and the lock both share
+static DeviceConfig pending_config;
+static PlatformLock settings_lock;
 
 // Global state flags
 volatile bool client_connected = false;
-volatile bool next_chunk_requested = false;
-volatile bool transfer_acknowledged = false;
 volatile bool new_config_received = false;
-volatile bool server_ready_for_data = false; // FIX: Definition for handshake flag
-char pending_config_str[64];
+volatile uint8_t transfer_window = 0;
 
-// Forward declaration from bluetooth_handler.cpp, where these are defined
-extern uint8_t *framebuffers[IMAGE_BATCH_SIZE];
-extern size_t fb_lengths[IMAGE_BATCH_SIZE];
-extern int image_count;
+// Images waiting to be sent, in one preallocated PSRAM ring
+FrameArena image_arena;
+StorageManager storage_manager(image_arena);
+FrameQueue frame_queue;
 
-// Stable sleep function with added serial synchronization.
-void enter_light_sleep(int sleep_time_seconds)
+// Drops near-duplicate frames between the camera and the arena
+ChangeDetector change_detector;
+
+// Steers the JPEG quality towards device_config.frame_target_bytes
+QualityController rate_controller;
+
+// Per-phase timings and histograms, published over BLE after each batch
+Telemetry telemetry;
+
+// Clock and sleep locks for each phase of the cycle, with time-in-state counters
+PowerPolicy power_policy;
+
+// Batches that could not be delivered, on the "spill" flash partition
+FlashStore spill_store;
+
+// Timelapse slots plus PIR-triggered captures
+CaptureScheduler capture_scheduler;
+
+// Several frames per motion capture, from the camera's two framebuffers
+BurstCapture burst_capture(storage_manager, frame_queue);
+
+// Skips stale and unsettled frames after each light-sleep wake; every capture goes through it
+SensorWarmup sensor_warmup;
+WarmupFrameSource warm_camera(camera_source, sensor_warmup);
+
+// Pipeline tasks
+TaskHandle_t capture_task_handle = NULL;
+TaskHandle_t transfer_task_handle = NULL;
+volatile bool transfer_in_progress = false;
+
+// Any PIR edge while the capture task is awake ends its wait.
+void IRAM_ATTR pir_isr()
+{
+  BaseType_t woken = pdFALSE;
+  if (capture_task_handle)
+    vTaskNotifyGiveFromISR(capture_task_handle, &woken);
+  if (woken)
+    portYIELD_FROM_ISR();
+}
+
+// Light-sleeps until the next timer slot, or until the PIR output reaches the
+// level the scheduler is waiting for. Returns true if the PIR woke us. Only the
+// bare minimum runs before returning, so an event capture follows the edge
+// within a few milliseconds; the display comes back in wake_peripherals().
+bool enter_light_sleep(uint32_t sleep_ms)
 {
-  Serial.printf("Entering light sleep for %d seconds.\n", sleep_time_seconds);
+  bool watch_pir = capture_scheduler.events_enabled();
+  PLATFORM_LOG("Entering light sleep for %u ms%s.\n", sleep_ms, watch_pir ? " or until motion" : "");
 
   // 1. Power down peripherals
   stop_bluetooth();
-  display.displayOff();
+  display_sleep();
   delay(100);
 
-  // 2. Configure wakeup source
-  esp_sleep_enable_timer_wakeup(sleep_time_seconds * 1000000ULL);
+  // 2. Configure wakeup sources. GPIO19 is not an RTC pin, so the level-triggered
+  // light-sleep GPIO wakeup is the only way to watch it; the edge interrupt is
+  // parked meanwhile, since both use the pin's interrupt type.
+  esp_sleep_enable_timer_wakeup(sleep_ms * 1000ULL);
+  if (watch_pir)
+  {
+    detachInterrupt(PIR_GPIO_NUM);
+    gpio_wakeup_enable((gpio_num_t)PIR_GPIO_NUM,
+                       capture_scheduler.wake_on_high() ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+  }
+
+  // The sensor idles in standby, keeping its registers and exposure.
+  bool standby = camera_standby(true);
 
-  // Wait for the serial buffer to empty before sleeping to prevent cutoff messages.
+  // Print what the log holds and let the UART finish before the clocks stop.
+  log_drain();
   Serial.flush();
 
   // 3. Enter light sleep
+  power_policy.sleep_begin();
   esp_light_sleep_start();
+  power_policy.sleep_end();
 
   // --- WAKE UP ---
+  telemetry.begin(TRACE_SLEEP_EXIT);
+  if (standby)
+    camera_standby(false);
+  // Whatever the framebuffers held from before this point is stale.
+  sensor_warmup.wake(platform_micros());
+  bool pir = esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_GPIO;
+  if (watch_pir)
+  {
+    gpio_wakeup_disable((gpio_num_t)PIR_GPIO_NUM);
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_GPIO);
+    attachInterrupt(PIR_GPIO_NUM, pir_isr, CHANGE);
+  }
+  telemetry.end(TRACE_SLEEP_EXIT, pir);
+  return pir;
+}
 
+// Brings serial and the display back after a light sleep, once the frame is taken.
+void wake_peripherals()
+{
   // Short delay to allow serial port hardware to stabilize after waking up.
   delay(100);
+  PLATFORM_LOG("\nWoke up from light sleep.\n"); // Added newline for cleaner logs
 
-  Serial.println("\nWoke up from light sleep."); // Added newline for cleaner logs
-
-  // 4. Re-initialize peripherals
-  display.displayOn();
-  init_display();
+  telemetry.begin(TRACE_DISPLAY_INIT);
+  display_wake();
   update_display(0, "System Ready", true);
+  telemetry.end(TRACE_DISPLAY_INIT);
 }
 
-void clear_image_buffers()
+StoreResult store_image_in_psram(uint32_t flags)
 {
-  Serial.println("Clearing image buffers and freeing PSRAM...");
-  for (int i = 0; i < IMAGE_BATCH_SIZE; i++)
-  {
-    if (framebuffers[i] != NULL)
-    {
-      heap_caps_free(framebuffers[i]);
-      framebuffers[i] = NULL;
-    }
-    fb_lengths[i] = 0;
-  }
-  image_count = 0;
-  Serial.println("Buffers cleared.");
+  return storage_manager.store(warm_camera, millis(), flags);
 }
 
-bool store_image_in_psram()
+// Burst pacing on the capture task: sleeps through whole ticks, so the rest of
+// the system runs between frames.
+class TaskBurstClock : public BurstClock
 {
-  if (image_count >= IMAGE_BATCH_SIZE)
+public:
+  uint64_t now_us() override { return platform_micros(); }
+  void wait_until_us(uint64_t deadline_us) override
   {
-    Serial.println("Image batch limit reached. Cannot store more images.");
-    return false;
+    uint64_t now = platform_micros();
+    if (deadline_us > now)
+      vTaskDelay(pdMS_TO_TICKS((deadline_us - now) / 1000));
   }
-  camera_fb_t *fb = esp_camera_fb_get();
-  if (!fb)
+};
+
+// Takes a motion burst straight into the arena and the frame queue. Returns
+// STORE_KEPT if any frame made it.
+StoreResult capture_burst(uint32_t flags)
+{
+  TaskBurstClock clock;
+  // The camera streams between burst frames, so the whole burst is one capture phase.
+  PowerPhaseGuard phase(&power_policy, POWER_PHASE_CAPTURE);
+  BurstReport report =
+      burst_capture.run(warm_camera, clock, device_config.burst_frames, device_config.burst_fps, flags);
+  EVLOG_INFO(LOGF_BURST, report.burst_id, report.kept, report.requested, report.span_us / 1000, report.fps,
+             device_config.burst_fps);
+  return report.kept > 0 ? STORE_KEPT : STORE_FAILED;
+}
+
+// Grabs the arena once at boot; halves the request until PSRAM can satisfy it.
+void init_frame_arena()
+{
+  size_t capacity = FRAME_ARENA_BYTES;
+  while (capacity >= 64 * 1024 && !image_arena.begin(capacity))
   {
-    Serial.println("Camera capture failed");
-    return false;
+    capacity /= 2;
   }
-  framebuffers[image_count] = (uint8_t *)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM);
-  if (!framebuffers[image_count])
+  storage_manager.set_budget(device_config.budget_bytes);
+  change_detector.configure(device_config.change_pct, device_config.keyframe_interval);
+  storage_manager.set_change_detector(&change_detector);
+  storage_manager.set_telemetry(&telemetry);
+  burst_capture.set_telemetry(&telemetry);
+  warm_camera.set_telemetry(&telemetry);
+  storage_manager.set_power(&power_policy);
+}
+
+// Mounts the spill partition (formatting it on first boot) and reloads its index,
+// so batches spilled before a reset are still sent. LittleFS keeps a few blocks
+// for its own metadata, so the store gets 7/8 of the partition.
+void init_spill_store()
+{
+  if (!LittleFS.begin(true, SPILL_MOUNT_POINT, 10, SPILL_PARTITION_LABEL))
   {
-    Serial.println("PSRAM malloc failed");
-    esp_camera_fb_return(fb);
-    return false;
+    PLATFORM_LOG("Spill partition unavailable; undelivered batches stay in PSRAM only.\n");
+    return;
   }
-  memcpy(framebuffers[image_count], fb->buf, fb->len);
-  fb_lengths[image_count] = fb->len;
-  Serial.printf("Stored image %d in batch (%u bytes).\n", image_count + 1, fb_lengths[image_count]);
-  image_count++;
-  esp_camera_fb_return(fb);
-  return true;
+  spill_store.begin(SPILL_MOUNT_POINT, LittleFS.totalBytes() / 8 * 7);
+}
+
+void configure_rate_controller()
+{
+  RateConfig config = rate_controller.config();
+  config.target_bytes = device_config.frame_target_bytes;
+  rate_controller.configure(config);
+}
+
+void configure_scheduler()
+{
+  capture_scheduler.configure(device_config.interval_s * 1000UL, device_config.event_holdoff_s * 1000UL);
 }
 
+static void log_settings(const char *what)
+{
+  const DeviceConfig &c = device_config;
+  PLATFORM_LOG("%s: Capture Interval = %u sec, Batch Budget = %u bytes, Change Gate = %u%% (keyframe every %u), "
+               "Frame Target = %u bytes, PIR Hold-off = %u sec, Burst = %u frames at %u fps, Frame Size = %u, "
+               "Quality = %u, XCLK = %u MHz, Chunk = %u bytes, Delays = %u/%u/%u ms\n",
+               what, c.interval_s, c.budget_bytes, c.change_pct, c.keyframe_interval, c.frame_target_bytes,
+               c.event_holdoff_s, c.burst_frames, c.burst_fps, c.frame_size, c.jpeg_quality, c.xclk_mhz, c.chunk_size,
+               c.status_delay_ms, c.chunk_delay_ms, c.image_delay_ms);
+}
+
+// The settings are kept as one blob in the config characteristic's format, so
+// the version travels with them. Settings saved by older firmware, one key
+// each, are read first; a blob saved since overrides them.
 void load_settings()
 {
+  DeviceConfig &c = device_config;
+  uint8_t blob[CONFIG_ENCODED_MAX];
+  size_t len = 0;
   preferences.begin("settings", true);
-  deep_sleep_seconds = preferences.getInt("sleep_sec", deep_sleep_seconds);
-  storage_threshold_percent = preferences.getFloat("storage_pct", storage_threshold_percent);
+  c.interval_s = preferences.getInt("sleep_sec", c.interval_s);
+  c.budget_bytes = preferences.getUInt("budget_b", c.budget_bytes);
+  c.change_pct = preferences.getUChar("chg_pct", c.change_pct);
+  c.keyframe_interval = preferences.getUShort("key_n", c.keyframe_interval);
+  c.frame_target_bytes = preferences.getUInt("target_b", c.frame_target_bytes);
+  c.event_holdoff_s = preferences.getUShort("pir_hold", c.event_holdoff_s);
+  c.burst_frames = preferences.getUChar("burst_n", c.burst_frames);
+  c.burst_fps = preferences.getUChar("burst_fps", c.burst_fps);
+  if (preferences.isKey("config"))
+    len = preferences.getBytes("config", blob, sizeof(blob));
+  preferences.end();
+
+  uint8_t bad_tag;
+  if (len > 0 && config_decode(blob, len, c, FRAME_ARENA_BYTES, bad_tag) != CONFIG_OK)
+    PLATFORM_LOG("Saved settings unreadable at tag %u; keeping the older ones.\n", bad_tag);
+  log_settings("Loaded Settings");
+  configure_rate_controller();
+  configure_scheduler();
+}
+
+static void save_settings()
+{
+  uint8_t blob[CONFIG_ENCODED_MAX];
+  size_t len = config_encode(device_config, blob, sizeof(blob));
+  preferences.begin("settings", false);
+  preferences.clear(); // Drops the per-key settings of older firmware
+  preferences.putBytes("config", blob, len);
   preferences.end();
-  Serial.printf("Loaded Settings: Capture Interval = %d sec, Storage Threshold = %.1f%%\n",
-                deep_sleep_seconds, storage_threshold_percent);
 }
 
+ConfigResult queue_settings(const uint8_t *data, size_t len, uint8_t &bad_tag)
+{
+  PlatformLockGuard guard(settings_lock);
+  DeviceConfig next = new_config_received ? pending_config : device_config;
+  ConfigResult result = config_decode(data, len, next, image_arena.capacity(), bad_tag);
+  if (result != CONFIG_OK)
+    return result;
+  pending_config = next;
+  new_config_received = true;
+  // The capture task applies them as soon as it is not taking a frame.
+  if (capture_task_handle)
+    xTaskNotifyGive(capture_task_handle);
+  return CONFIG_OK;
+}
+
+size_t encode_settings(uint8_t *dst, size_t capacity)
+{
+  PlatformLockGuard guard(settings_lock);
+  return config_encode(new_config_received ? pending_config : device_config, dst, capacity);
+}
+
+TransferTiming transfer_timing()
+{
+  PlatformLockGuard guard(settings_lock);
+  return {device_config.chunk_size, device_config.status_delay_ms, device_config.chunk_delay_ms,
+          device_config.image_delay_ms};
+}
+
+// Everything but the camera is reconfigured in place; the camera is reprogrammed
+// only if one of its settings changed, and its next frames go through the
+// warm-up as after a wake. Transfer settings take effect with the next session.
 void apply_new_settings()
 {
   if (!new_config_received)
     return;
 
-  Serial.printf("Applying new settings: '%s'\n", pending_config_str);
+  DeviceConfig previous;
+  {
+    PlatformLockGuard guard(settings_lock);
+    previous = device_config;
+    device_config = pending_config;
+    new_config_received = false;
+  }
 
-  char temp_str[64];
-  strcpy(temp_str, pending_config_str);
+  storage_manager.set_budget(device_config.budget_bytes);
+  change_detector.configure(device_config.change_pct, device_config.keyframe_interval);
+  configure_rate_controller();
+  configure_scheduler();
+  if (device_config.frame_size != previous.frame_size || device_config.jpeg_quality != previous.jpeg_quality ||
+      device_config.xclk_mhz != previous.xclk_mhz)
+  {
+    bool reinit = reconfigure_camera(device_config);
+    sensor_warmup.wake(platform_micros());
+    PLATFORM_LOG("Camera %s: frame size %u, quality %u, XCLK %u MHz\n", reinit ? "re-initialized" : "reprogrammed",
+                 device_config.frame_size, device_config.jpeg_quality, device_config.xclk_mhz);
+  }
+  save_settings();
 
-  char *f_part = strstr(temp_str, "F:");
-  if (f_part)
+  log_settings("Settings saved and applied");
+  flash_display(4, "New Settings OK!", 1500);
+}
+
+// Runs one flush session: advertise, wait for the server, stream every queued frame.
+void run_transfer_session()
+{
+  // The radio is up from here to stop_bluetooth(); the clock stays low while
+  // waiting for the server and only goes up for the transfer itself. Until the
+  // server connects nothing is held, so the chip can light-sleep between
+  // advertising events.
+  PowerPhaseGuard advertise(&power_policy, POWER_PHASE_ADVERTISE);
+  telemetry.begin(TRACE_BLE_START);
+  start_bluetooth();
+  telemetry.end(TRACE_BLE_START);
+  delay(200);
+
+  PLATFORM_LOG("Transfer condition met (Buffered: %u/%u bytes, next ~%u, Count: %d).\n",
+               storage_manager.buffered_bytes(), storage_manager.budget(),
+               storage_manager.predicted_next(), image_arena.count());
+  // Frames leave the arena only once the server acknowledges them; whatever a
+  // failed session leaves queued is spilled to flash for the next one.
+  bool transfer_successful = false;
+  bool delivered = false;
+
+  // Step 1: Wait for a client to connect (if not already connected)
+  if (!client_connected)
   {
-    int new_freq = atoi(f_part + 2);
-    if (new_freq > 0)
+    PLATFORM_LOG("Waiting for a client to connect for transfer...\n");
+    update_display(2, "Batch full. Wait conn.", true);
+    telemetry.begin(TRACE_CONNECT_WAIT);
+    if (!(wait_link_event(LINK_EVENT_CONNECTED, ADV_FAST_WINDOW_MS) & LINK_EVENT_CONNECTED))
     {
-      deep_sleep_seconds = new_freq;
-      Serial.printf("Parsed Frequency: %d\n", new_freq);
+      slow_advertising();
+      wait_link_event(LINK_EVENT_CONNECTED, CONNECT_WAIT_MS - ADV_FAST_WINDOW_MS);
     }
+    telemetry.end(TRACE_CONNECT_WAIT, client_connected);
   }
+  // A live connection keeps the radio busy: no automatic light sleep from here.
+  PowerPhaseGuard link(client_connected ? &power_policy : NULL, POWER_PHASE_LINK);
 
-  char *t_part = strstr(temp_str, "T:");
-  if (t_part)
+  // Step 2: Once connected, wait for the server to signal it's ready
+  if (client_connected)
   {
-    float new_thresh = atof(t_part + 2);
-    if (new_thresh >= 2 && new_thresh <= 95)
+    PLATFORM_LOG("Client connected. Waiting for server to signal ready...\n");
+    update_display(2, "Connected. Wait ready.", true);
+    telemetry.begin(TRACE_READY_WAIT);
+    // The ready bit is cleared on every new connection, so an 'R' that lands
+    // before we get here is not lost.
+    bool server_ready = wait_link_event(LINK_EVENT_READY | LINK_EVENT_DISCONNECTED, 10000) & LINK_EVENT_READY;
+    telemetry.end(TRACE_READY_WAIT, server_ready);
+
+    // Step 3: If server is ready, start the transfer
+    if (server_ready)
     {
-      storage_threshold_percent = new_thresh;
-      Serial.printf("Parsed Threshold: %.1f\n", new_thresh);
+      PLATFORM_LOG("Server is ready. Starting data transfer.\n");
+      update_display(2, "Ready! Sending...", true);
+      {
+        PowerPhaseGuard transfer(&power_policy, POWER_PHASE_TRANSFER);
+        delivered = send_batched_data();
+        publish_telemetry();
+        publish_log();
+      }
+      transfer_successful = true; // Assume success, send_batched_data handles internal errors
+    }
+    else
+    {
+      PLATFORM_LOG("Timeout: Server did not signal ready. Aborting transfer.\n");
+      update_display(2, "Server not ready.", true);
+      delay(2000);
     }
   }
+  else
+  {
+    PLATFORM_LOG("No client connected within timeout. Keeping the batch for the next window.\n");
+    update_display(2, "No connection. Kept.", true);
+    delay(2000);
+  }
 
-  preferences.begin("settings", false);
-  preferences.putInt("sleep_sec", deep_sleep_seconds);
-  preferences.putFloat("storage_pct", storage_threshold_percent);
-  preferences.end();
-
-  Serial.printf("Settings saved and applied: Interval=%ds, Threshold=%.1f%%\n", deep_sleep_seconds, storage_threshold_percent);
-  update_display(4, "New Settings OK!", true);
-  delay(1500);
-  update_display(4, "", true);
-
-  new_config_received = false;
-}
-
-// --- SETUP: Runs once at power-on ---
-void setup()
-{
-  Serial.begin(115200);
-  Serial.println("\n--- T-Camera Continuous Timelapse (Low Power) ---");
+  // Step 4: Finalize the transfer session
+  if (transfer_successful)
+  {
+    PLATFORM_LOG("\n=== Batch Transfer Complete ===\n");
+    update_display(2, "Sent. Wait disconnect", true);
 
-  setCpuFrequencyMhz(80);
-  Serial.end();
-  Serial.begin(115200);
-  Serial.printf("CPU Freq set to %d MHz\n", getCpuFrequencyMhz());
+    PLATFORM_LOG("Waiting for client to disconnect...\n");
+    telemetry.begin(TRACE_DISCONNECT_WAIT);
+    wait_link_event(LINK_EVENT_DISCONNECTED, 10000);
+    telemetry.end(TRACE_DISCONNECT_WAIT, !client_connected);
 
-  init_display();
-  load_settings();
-  init_camera();
+    if (client_connected)
+    {
+      PLATFORM_LOG("WARN: Timeout waiting for client disconnect. Forcing cleanup.\n");
+    }
+    else
+    {
+      PLATFORM_LOG("Client disconnected cleanly.\n");
+    }
+  }
+  stop_bluetooth();
 
-  update_display(0, "System Ready", true);
-  Serial.println("System initialized. Waiting for first capture interval.");
+  // Whatever is still queued moves to flash, freeing the arena for new captures.
+  if (!delivered && frame_queue.size() > 0)
+  {
+    update_display(2, "Spilling to flash...", true);
+    ArenaBacklog backlog(image_arena, frame_queue);
+    spill_store.spill(backlog);
+  }
+  update_display(2, "", true);
 }
 
-// --- LOOP: Main program cycle ---
-void loop()
+// Waits until the scheduler has a capture due: light sleep when nothing else is
+// running, otherwise a task wait that the PIR interrupt cuts short. Sets slept
+// if the chip went to sleep on the way.
+CaptureTrigger wait_for_capture(bool &slept)
 {
-  enter_light_sleep(deep_sleep_seconds);
-
-  setCpuFrequencyMhz(240);
-  Serial.end();
-  Serial.begin(115200);
-  Serial.printf("CPU Freq set to %d MHz for capture\n", getCpuFrequencyMhz());
-
-  Serial.println("Capture interval elapsed. Taking picture...");
-  if (!store_image_in_psram())
+  for (;;)
   {
-    Serial.println("Failed to store image. Check PSRAM or batch size limit.");
+    apply_new_settings();
+    capture_scheduler.on_pir(millis(), digitalRead(PIR_GPIO_NUM) == HIGH);
+    CaptureTrigger trigger = capture_scheduler.poll(millis());
+    if (trigger != TRIGGER_NONE)
+      return trigger;
+
+    uint32_t wait_ms = capture_scheduler.sleep_ms(millis());
+    if (!transfer_in_progress)
+    {
+      // Nothing else is running, so the whole chip can sleep until the next frame.
+      enter_light_sleep(wait_ms);
+      slept = true;
+    }
+    else
+    {
+      // The transfer task owns the radio and the clock; just keep to the schedule.
+      ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_ms));
+    }
   }
+}
 
-  setCpuFrequencyMhz(80);
-  Serial.end();
-  Serial.begin(115200);
-  Serial.printf("CPU Freq returned to %d MHz\n", getCpuFrequencyMhz());
+// --- CAPTURE TASK: keeps the timelapse schedule, even while a batch is streaming,
+// and takes an extra frame (or a burst of them) whenever the PIR sees motion ---
+void capture_task(void *param)
+{
+  pinMode(PIR_GPIO_NUM, INPUT_PULLDOWN);
+  attachInterrupt(PIR_GPIO_NUM, pir_isr, CHANGE);
+  capture_scheduler.start(millis());
+  for (;;)
+  {
+    bool slept = false;
+    CaptureTrigger trigger = wait_for_capture(slept);
+
+    // Shutter first; serial and the display come back afterwards.
+    bool burst = trigger == TRIGGER_EVENT && device_config.burst_frames > 1;
+    StoreResult stored = burst ? capture_burst(FRAME_FLAG_EVENT)
+                               : store_image_in_psram(trigger == TRIGGER_EVENT ? FRAME_FLAG_EVENT : 0);
+    capture_scheduler.captured(trigger, millis());
+    if (slept)
+    {
+      wake_peripherals();
+      const WarmupStats &warmup = sensor_warmup.stats();
+      EVLOG_INFO(LOGF_WAKE_TO_FRAME, warmup.last_latency_us / 1000, warmup.last_stale, warmup.last_settle,
+                 sensor_warmup.expected_settle());
+    }
 
-  size_t total_psram = heap_caps_get_total_size(MALLOC_CAP_SPIRAM);
-  size_t free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
-  float used_percentage = total_psram > 0 ? (1.0 - ((float)free_psram / total_psram)) * 100.0 : 0;
+    const SchedulerStats &schedule = capture_scheduler.stats();
+    EVLOG_INFO(trigger == TRIGGER_EVENT ? LOGF_MOTION_CAPTURE : LOGF_TIMELAPSE_CAPTURE, schedule.event_captures,
+               schedule.debounced, schedule.timer_captures, schedule.coalesced);
+    if (stored == STORE_FAILED)
+      EVLOG_ERROR(LOGF_STORE_FAILED);
+    else if (stored == STORE_KEPT && !burst && !frame_queue.push(image_arena.newest()))
+      EVLOG_WARN(LOGF_QUEUE_FULL);
 
-  char status_buf[40];
-  sprintf(status_buf, "PSRAM: %.1f%% | Imgs: %d", used_percentage, image_count);
-  Serial.println(status_buf);
-  update_display(1, status_buf, true);
+    if (stored != STORE_FAILED)
+    {
+      // Steer the next frame towards the size target; skipped frames still measure the scene.
+      uint8_t quality = rate_controller.quality();
+      uint8_t downscale = rate_controller.downscale();
+      size_t captured = storage_manager.last_capture_bytes();
+      if (rate_controller.update(captured))
+        apply_camera_rate(rate_controller.quality(), rate_controller.downscale());
+      EVLOG_INFO(LOGF_RATE_CONTROL, captured, quality, 1 << downscale, device_config.frame_target_bytes,
+                 rate_controller.quality(), 1 << rate_controller.downscale());
+    }
 
-  bool should_transfer = (image_count > 0 && (used_percentage >= storage_threshold_percent || image_count >= IMAGE_BATCH_SIZE));
+    const ChangeStats &change = change_detector.stats();
+    EVLOG_INFO(LOGF_CHANGE_GATE, change.last_change, change.skipped, change.captures, change_detector.skip_percent(),
+               change.keyframes);
 
-  // FIX: Reworked transfer logic with explicit handshake
-  if (should_transfer)
-  {
-    start_bluetooth();
-    delay(200);
-    setCpuFrequencyMhz(240);
-    Serial.end();
-    Serial.begin(115200);
-    Serial.printf("CPU Freq boosted to %d MHz for transfer\n", getCpuFrequencyMhz());
-
-    Serial.printf("Transfer condition met (Usage: %.1f%%, Count: %d).\n", used_percentage, image_count);
-    bool transfer_successful = false;
-    server_ready_for_data = false; // Reset handshake flag for this session
-
-    // Step 1: Wait for a client to connect (if not already connected)
-    if (!client_connected)
+    // Time in each power state per frame captured so far, and what it costs.
+    PowerStats power = power_policy.stats();
+    if (power.frames > 0)
     {
-      Serial.println("Waiting for a client to connect for transfer...");
-      update_display(2, "Batch full. Wait conn.", true);
-      uint32_t start_time = millis();
-      while (!client_connected && (millis() - start_time < 30000))
-      {
-        delay(100);
-      }
+      PowerModel model = power_model();
+      EVLOG_INFO(LOGF_POWER, (uint32_t)(power.time_us[POWER_STATE_MAX] / 1000 / power.frames),
+                 (uint32_t)(power.time_us[POWER_STATE_AWAKE] / 1000 / power.frames),
+                 (uint32_t)(power.time_us[POWER_STATE_IDLE] / 1000 / power.frames),
+                 (uint32_t)(power.time_us[POWER_STATE_SLEEP] / 1000 / power.frames),
+                 PowerPolicy::energy_per_frame_mj(power, model), PowerPolicy::fixed_clock_energy_per_frame_mj(power, model));
     }
 
-    // Step 2: Once connected, wait for the server to signal it's ready
-    if (client_connected)
-    {
-      Serial.println("Client connected. Waiting for server to signal ready...");
-      update_display(2, "Connected. Wait ready.", true);
-      uint32_t wait_start_time = millis();
-      while (!server_ready_for_data && client_connected && (millis() - wait_start_time < 10000)) // 10s timeout
-      {
-        delay(50);
-      }
+    // Buffered JPEG bytes against the batch budget, so this measures data rather than heap fragmentation.
+    float used_percentage = storage_manager.fill_percent();
 
-      // Step 3: If server is ready, start the transfer
-      if (server_ready_for_data)
-      {
-        Serial.println("Server is ready. Starting data transfer.");
-        update_display(2, "Ready! Sending...", true);
-        send_batched_data();
-        transfer_successful = true; // Assume success, send_batched_data handles internal errors
-      }
-      else
-      {
-        Serial.println("Timeout: Server did not signal ready. Aborting transfer.");
-        update_display(2, "Server not ready.", true);
-        delay(2000);
-      }
-    }
-    else
+    EVLOG_INFO(LOGF_ARENA_FILL, used_percentage, image_arena.count());
+#ifndef HEADLESS
+    char status_buf[40];
+    snprintf(status_buf, sizeof(status_buf), "PSRAM: %.1f%% | Imgs: %d", used_percentage, image_arena.count());
+    update_display(1, status_buf, true);
+    const DisplayStats &panel = display_stats();
+    EVLOG_DEBUG(LOGF_DISPLAY_STATS, panel.draws, panel.flushes, panel.pages_sent, panel.draws * 8);
+#endif
+
+    // Flush once the predicted next frame would no longer fit in the budget.
+    if (!transfer_in_progress && storage_manager.should_flush())
     {
-      Serial.println("No client connected within timeout. Discarding data to continue.");
-      update_display(2, "No connection. Clearing.", true);
-      delay(2000);
+      transfer_in_progress = true;
+      xTaskNotifyGive(transfer_task_handle);
     }
+  }
+}
 
-    // Step 4: Finalize the transfer session
-    if (transfer_successful)
-    {
-      Serial.println("\n=== Batch Transfer Complete ===");
-      update_display(2, "Sent. Wait disconnect", true);
+// --- TRANSFER TASK: drains a batch whenever the capture task asks for it ---
+void transfer_task(void *param)
+{
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    run_transfer_session();
+    transfer_in_progress = false;
+  }
+}
 
-      Serial.println("Waiting for client to disconnect to finalize and apply settings...");
-      uint32_t finalization_start = millis();
+// --- SETUP: Runs once at power-on ---
+void setup()
+{
+  init_log();
+  Serial.begin(115200);
+  PLATFORM_LOG("\n--- T-Camera Continuous Timelapse (Low Power) ---\n");
 
-      while (client_connected && (millis() - finalization_start < 10000))
-      {
-        if (new_config_received)
-        {
-          apply_new_settings();
-        }
-        delay(100);
-      }
+  init_power(power_policy);
 
-      if (client_connected)
-      {
-        Serial.println("WARN: Timeout waiting for client disconnect. Forcing cleanup.");
-      }
-      else
-      {
-        Serial.println("Client disconnected cleanly.");
-      }
-    }
+  init_display();
+  load_settings();
+  init_camera();
+  init_frame_arena();
+  init_spill_store();
 
-    clear_image_buffers();
-    update_display(2, "", true);
+  update_display(0, "System Ready", true);
+  PLATFORM_LOG("System initialized. Waiting for first capture interval.\n");
 
-    setCpuFrequencyMhz(80);
-    Serial.end();
-    Serial.begin(115200);
-    Serial.printf("CPU Freq returned to %d MHz\n", getCpuFrequencyMhz());
-  }
+  // Capture on the app core; transfer next to the BLE stack on the protocol core.
+  xTaskCreatePinnedToCore(transfer_task, "transfer", TRANSFER_TASK_STACK, NULL, 2, &transfer_task_handle, 0);
+  xTaskCreatePinnedToCore(capture_task, "capture", CAPTURE_TASK_STACK, NULL, 3, &capture_task_handle, 1);
+}
+
+// --- LOOP: Unused; capture and transfer run in their own tasks ---
+void loop()
+{
+  vTaskDelete(NULL);
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "globals.h"
+#include "power_handler.h"
+#include "sdkconfig.h"
+
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+
+class EspPmBackend : public PowerBackend
+{
+public:
+    bool begin()
+    {
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        m_auto_sleep = true;
+#else
+        m_auto_sleep = false;
+#endif
+        esp_pm_config_esp32_t config = {};
+        config.max_freq_mhz = POWER_MAX_MHZ;
+        config.min_freq_mhz = POWER_MIN_MHZ;
+        config.light_sleep_enable = m_auto_sleep;
+        if (esp_pm_configure(&config) != ESP_OK ||
+            esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "cpu_max", &m_handles[POWER_LOCK_CPU_MAX]) != ESP_OK ||
+            esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "no_sleep", &m_handles[POWER_LOCK_NO_SLEEP]) != ESP_OK)
+            return false;
+        return true;
+    }
+
+    void acquire(PowerLock lock) override { esp_pm_lock_acquire(m_handles[lock]); }
+    void release(PowerLock lock) override { esp_pm_lock_release(m_handles[lock]); }
+    bool auto_sleep() const { return m_auto_sleep; }
+
+private:
+    esp_pm_lock_handle_t m_handles[POWER_LOCK_COUNT];
+    bool m_auto_sleep;
+};
+
+static EspPmBackend pm_backend;
+
+// Whether the BT controller lets the chip light-sleep between advertising events.
+#if CONFIG_BTDM_CTRL_MODEM_SLEEP && CONFIG_BTDM_CTRL_LPCLK_SEL_EXT_32K_XTAL
+static const char *const advertise_sleep = "";
+#else
+static const char *const advertise_sleep = ", not while advertising (no BT modem sleep on a 32 kHz crystal)";
+#endif
+#endif
+
+// Without esp_pm: full clock while any phase needs it, the minimum otherwise.
+class FixedClockBackend : public PowerBackend
+{
+public:
+    void acquire(PowerLock lock) override
+    {
+        if (lock == POWER_LOCK_CPU_MAX)
+            set_mhz(POWER_MAX_MHZ);
+    }
+    void release(PowerLock lock) override
+    {
+        if (lock == POWER_LOCK_CPU_MAX)
+            set_mhz(POWER_MIN_MHZ);
+    }
+    void set_mhz(uint32_t mhz)
+    {
+        setCpuFrequencyMhz(mhz);
+        EVLOG_DEBUG(LOGF_CPU_FREQ, getCpuFrequencyMhz());
+    }
+};
+
+static FixedClockBackend clock_backend;
+static bool auto_sleep = false;
+
+void init_power(PowerPolicy &policy)
+{
+#if CONFIG_PM_ENABLE
+    if (pm_backend.begin())
+    {
+        auto_sleep = pm_backend.auto_sleep();
+        policy.begin(&pm_backend);
+        PLATFORM_LOG("Power: esp_pm scaling %u-%u MHz, automatic light sleep %s%s\n", POWER_MIN_MHZ, POWER_MAX_MHZ,
+                     auto_sleep ? "on" : "off (no tickless idle in this core)", auto_sleep ? advertise_sleep : "");
+        return;
+    }
+    PLATFORM_LOG("Power: esp_pm_configure failed; switching clocks by hand.\n");
+#endif
+    clock_backend.set_mhz(POWER_MIN_MHZ);
+    policy.begin(&clock_backend);
+    PLATFORM_LOG("Power: %u MHz while working, %u MHz otherwise (no esp_pm in this core)\n", POWER_MAX_MHZ,
+                 POWER_MIN_MHZ);
+}
+
+bool power_auto_sleep()
+{
+    return auto_sleep;
+}
+
+// ESP32 datasheet figures, both cores running, radio off.
+PowerModel power_model()
+{
+    PowerModel model;
+    model.max_ma = 50.0f;
+    model.awake_ma = 25.0f;
+    model.idle_ma = auto_sleep ? 0.8f : model.awake_ma;
+    model.sleep_ma = 0.8f;
+    model.volts = 3.3f;
+    return model;
+}
@@ -0,0 +1,146 @@
+#include "power_policy.h"
+#include <cstring>
+
+#define LOCK_BIT(lock) (1 << (lock))
+
+// Locks each phase needs, indexed by PowerPhase.
+static const uint8_t phase_locks[POWER_PHASE_COUNT] = {
+    LOCK_BIT(POWER_LOCK_CPU_MAX) | LOCK_BIT(POWER_LOCK_NO_SLEEP), // Capture
+    LOCK_BIT(POWER_LOCK_CPU_MAX),                                 // Store
+    0,                                                            // Advertise
+    LOCK_BIT(POWER_LOCK_NO_SLEEP),                                // Link
+    LOCK_BIT(POWER_LOCK_CPU_MAX) | LOCK_BIT(POWER_LOCK_NO_SLEEP), // Transfer
+};
+
+PowerPolicy::PowerPolicy() : m_backend(NULL), m_held(0), m_sleeping(false), m_since(0)
+{
+    memset(m_phases, 0, sizeof(m_phases));
+    memset(m_locks, 0, sizeof(m_locks));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void PowerPolicy::begin(PowerBackend *backend, uint64_t now_us)
+{
+    PlatformLockGuard guard(m_lock);
+    m_backend = backend;
+    m_since = now_us;
+}
+
+PowerState PowerPolicy::state_locked() const
+{
+    if (m_sleeping)
+        return POWER_STATE_SLEEP;
+    if (m_locks[POWER_LOCK_CPU_MAX])
+        return POWER_STATE_MAX;
+    if (m_locks[POWER_LOCK_NO_SLEEP])
+        return POWER_STATE_AWAKE;
+    return POWER_STATE_IDLE;
+}
+
+PowerState PowerPolicy::state() const
+{
+    PlatformLockGuard guard(m_lock);
+    return state_locked();
+}
+
+// Charges the time since the last change to the state that held through it.
+void PowerPolicy::account(uint64_t now_us)
+{
+    if (now_us <= m_since)
+        return;
+    uint64_t elapsed = now_us - m_since;
+    m_stats.time_us[state_locked()] += elapsed;
+    if (m_held > 0 && !m_sleeping)
+        m_stats.phase_us += elapsed;
+    m_since = now_us;
+}
+
+void PowerPolicy::enter(PowerPhase phase, uint64_t now_us)
+{
+    PlatformLockGuard guard(m_lock);
+    account(now_us);
+    m_phases[phase]++;
+    m_held++;
+    for (uint8_t lock = 0; lock < POWER_LOCK_COUNT; lock++)
+    {
+        if (!(phase_locks[phase] & LOCK_BIT(lock)) || m_locks[lock]++ > 0)
+            continue;
+        if (m_backend)
+            m_backend->acquire((PowerLock)lock);
+        m_stats.switches++;
+    }
+}
+
+void PowerPolicy::leave(PowerPhase phase, uint64_t now_us)
+{
+    PlatformLockGuard guard(m_lock);
+    if (m_phases[phase] == 0)
+        return; // leave() without enter()
+    account(now_us);
+    m_phases[phase]--;
+    m_held--;
+    for (uint8_t lock = 0; lock < POWER_LOCK_COUNT; lock++)
+    {
+        if (!(phase_locks[phase] & LOCK_BIT(lock)) || --m_locks[lock] > 0)
+            continue;
+        if (m_backend)
+            m_backend->release((PowerLock)lock);
+        m_stats.switches++;
+    }
+}
+
+void PowerPolicy::sleep_begin(uint64_t now_us)
+{
+    PlatformLockGuard guard(m_lock);
+    account(now_us);
+    m_sleeping = true;
+}
+
+void PowerPolicy::sleep_end(uint64_t now_us)
+{
+    PlatformLockGuard guard(m_lock);
+    account(now_us);
+    m_sleeping = false;
+}
+
+void PowerPolicy::count_frame()
+{
+    PlatformLockGuard guard(m_lock);
+    m_stats.frames++;
+}
+
+PowerStats PowerPolicy::stats(uint64_t now_us) const
+{
+    PlatformLockGuard guard(m_lock);
+    PowerStats stats = m_stats;
+    if (now_us > m_since)
+    {
+        stats.time_us[state_locked()] += now_us - m_since;
+        if (m_held > 0 && !m_sleeping)
+            stats.phase_us += now_us - m_since;
+    }
+    return stats;
+}
+
+// mA x us x V = nJ; per frame in mJ.
+static float per_frame_mj(double na_us, const PowerStats &stats, const PowerModel &model)
+{
+    return stats.frames ? (float)(na_us * model.volts / 1e6 / stats.frames) : 0;
+}
+
+float PowerPolicy::energy_per_frame_mj(const PowerStats &stats, const PowerModel &model)
+{
+    double charge = (double)stats.time_us[POWER_STATE_MAX] * model.max_ma +
+                    (double)stats.time_us[POWER_STATE_AWAKE] * model.awake_ma +
+                    (double)stats.time_us[POWER_STATE_IDLE] * model.idle_ma +
+                    (double)stats.time_us[POWER_STATE_SLEEP] * model.sleep_ma;
+    return per_frame_mj(charge, stats, model);
+}
+
+float PowerPolicy::fixed_clock_energy_per_frame_mj(const PowerStats &stats, const PowerModel &model)
+{
+    uint64_t awake = stats.time_us[POWER_STATE_MAX] + stats.time_us[POWER_STATE_AWAKE] + stats.time_us[POWER_STATE_IDLE];
+    double charge = (double)stats.phase_us * model.max_ma + (double)(awake - stats.phase_us) * model.awake_ma +
+                    (double)stats.time_us[POWER_STATE_SLEEP] * model.sleep_ma;
+    return per_frame_mj(charge, stats, model);
+}
@@ -0,0 +1,144 @@
+#include "preview_ledger.h"
+#include "platform.h"
+
+PreviewLedger::PreviewLedger() : m_entries(NULL), m_capacity(0), m_first(0), m_count(0), m_retention_ms(0)
+{
+}
+
+PreviewLedger::~PreviewLedger()
+{
+    end();
+}
+
+bool PreviewLedger::begin(int capacity)
+{
+    end();
+    m_entries = (Entry *)platform_alloc_large(sizeof(Entry) * capacity);
+    if (!m_entries)
+        return false;
+    m_capacity = capacity;
+    return true;
+}
+
+void PreviewLedger::end()
+{
+    platform_free_large(m_entries);
+    m_entries = NULL;
+    m_capacity = 0;
+    m_first = 0;
+    m_count = 0;
+}
+
+// Both lists are in id order, so one merge walk finds the entries whose frames
+// are gone. What is left is compacted towards the front of the ring.
+void PreviewLedger::sync(const FrameBacklog &backlog)
+{
+    int kept = 0;
+    int at = 0;
+    FrameRef frame = {};
+    for (int i = 0; i < m_count; i++)
+    {
+        const Entry e = entry(i);
+        while (backlog.peek_at(at, frame) && frame.id < e.id)
+            at++;
+        if (at >= backlog.count() || frame.id != e.id || frame.crc32 != e.crc32)
+            continue;
+        if (at != kept)
+            break; // A frame that was never previewed sits in front of this one
+        entry(kept++) = e;
+        at++;
+    }
+    if (kept < m_count)
+        PLATFORM_LOG("Preview ledger: %d of %d previewed frames left the backlog.\n", m_count - kept, m_count);
+    m_count = kept;
+}
+
+int PreviewLedger::add(const FrameBacklog &backlog, int n, uint32_t now_ms)
+{
+    int added = 0;
+    FrameRef frame = {};
+    while (added < n && m_count < m_capacity && backlog.peek_at(m_count, frame))
+    {
+        entry(m_count++) = {frame.id, frame.crc32, now_ms, HELD};
+        added++;
+    }
+    return added;
+}
+
+bool PreviewLedger::pick(uint32_t id)
+{
+    for (int i = 0; i < m_count; i++)
+    {
+        Entry &e = entry(i);
+        if (e.id == id)
+        {
+            if (e.state == HELD)
+                e.state = PICKED;
+            return true;
+        }
+    }
+    return false;
+}
+
+int PreviewLedger::release(FrameBacklog &backlog, uint32_t now_ms)
+{
+    int expired = 0;
+    while (m_count > 0)
+    {
+        Entry &e = entry(0);
+        if (e.state == PICKED)
+            e.state = HELD;
+        bool aged = now_ms - e.previewed_ms >= m_retention_ms;
+        if (e.state != DELIVERED && !aged)
+            break;
+        if (e.state != DELIVERED)
+            expired++;
+        backlog.release_front();
+        m_first = (m_first + 1) % m_capacity;
+        m_count--;
+    }
+    for (int i = 0; i < m_count; i++)
+    {
+        if (entry(i).state == PICKED)
+            entry(i).state = HELD;
+    }
+    return expired;
+}
+
+int SelectionBacklog::backlog_index(int index) const
+{
+    for (int i = 0; i < m_ledger.count(); i++)
+    {
+        if (m_ledger.picked(i) && index-- == 0)
+            return i;
+    }
+    return -1;
+}
+
+int SelectionBacklog::count() const
+{
+    int n = 0;
+    for (int i = 0; i < m_ledger.count(); i++)
+        n += m_ledger.picked(i) ? 1 : 0;
+    return n;
+}
+
+bool SelectionBacklog::peek_at(int index, FrameRef &frame) const
+{
+    int at = backlog_index(index);
+    return at >= 0 && m_backlog.peek_at(at, frame);
+}
+
+void SelectionBacklog::read(int index, size_t offset, uint8_t *dst, size_t len) const
+{
+    int at = backlog_index(index);
+    if (at >= 0)
+        m_backlog.read(at, offset, dst, len);
+}
+
+void SelectionBacklog::release_front()
+{
+    int at = backlog_index(0);
+    if (at >= 0)
+        m_ledger.mark_delivered(at);
+}
@@ -0,0 +1,96 @@
+#include "quality_controller.h"
+
+// One frame size step down (VGA to QVGA) leaves about this share of the bytes.
+// The frame size steps back up once the larger frame would hit the target at
+// no worse than this share of quality_max, which keeps a gap between the two
+// switch points so the resolution does not flap.
+#define DOWNSCALE_BYTES_PCT 30
+#define UPSCALE_MARGIN_PCT 75
+#define SETTLE_FRAMES 1
+
+QualityController::QualityController() : m_quality(12), m_downscale(0), m_smoothed(0), m_settling(0)
+{
+    m_config = {0, 8, 40, 10, 50, 1}; // Off until a target is set; may drop one frame size step
+}
+
+void QualityController::configure(const RateConfig &config)
+{
+    m_config = config;
+    if (m_config.quality_max < m_config.quality_min)
+        m_config.quality_max = m_config.quality_min;
+    if (m_config.max_step_pct == 0)
+        m_config.max_step_pct = 1;
+    if (m_downscale > m_config.max_downscale)
+        m_downscale = m_config.max_downscale;
+    m_smoothed = 0;
+}
+
+void QualityController::reset(uint8_t quality)
+{
+    m_quality = quality;
+    m_downscale = 0;
+    m_smoothed = 0;
+    m_settling = 0;
+}
+
+bool QualityController::update(size_t frame_bytes)
+{
+    if (m_config.target_bytes == 0 || frame_bytes == 0)
+        return false;
+    if (m_settling > 0)
+    {
+        m_settling--;
+        return false;
+    }
+
+    // Half-weight average: settles in a couple of frames, but one odd frame
+    // only moves it halfway.
+    m_smoothed = m_smoothed == 0 ? (uint32_t)frame_bytes : (uint32_t)((m_smoothed + frame_bytes) / 2);
+    uint32_t ratio_pct = (uint32_t)((uint64_t)m_smoothed * 100 / m_config.target_bytes);
+    if (ratio_pct + m_config.hysteresis_pct >= 100 && ratio_pct <= 100u + m_config.hysteresis_pct)
+        return false;
+
+    // size * quality is roughly constant, so aim straight for the target.
+    int wanted = (int)((m_quality * ratio_pct + 50) / 100);
+
+    // Pinned at a bound: trade resolution instead, re-aiming the quality for the new size.
+    int next;
+    bool resized = true;
+    if (wanted > m_config.quality_max && m_quality == m_config.quality_max && m_downscale < m_config.max_downscale)
+    {
+        m_downscale++;
+        next = wanted * DOWNSCALE_BYTES_PCT / 100;
+    }
+    else if (m_downscale > 0 &&
+             wanted * 100 / DOWNSCALE_BYTES_PCT <= m_config.quality_max * UPSCALE_MARGIN_PCT / 100)
+    {
+        m_downscale--;
+        next = wanted * 100 / DOWNSCALE_BYTES_PCT;
+    }
+    else
+    {
+        resized = false;
+        int limit = m_quality * m_config.max_step_pct / 100;
+        if (limit < 1)
+            limit = 1;
+        int step = wanted - m_quality;
+        if (step == 0)
+            step = ratio_pct > 100 ? 1 : -1;
+        if (step > limit)
+            step = limit;
+        if (step < -limit)
+            step = -limit;
+        next = m_quality + step;
+    }
+
+    if (next > m_config.quality_max)
+        next = m_config.quality_max;
+    if (next < m_config.quality_min)
+        next = m_config.quality_min;
+    if (next == m_quality && !resized)
+        return false;
+    m_quality = (uint8_t)next;
+    m_smoothed = 0;
+    m_settling = SETTLE_FRAMES;
+    return true;
+}
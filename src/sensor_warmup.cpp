@@ -0,0 +1,99 @@
+#include "sensor_warmup.h"
+#include "change_detector.h"
+#include "platform.h"
+#include <cstdlib>
+#include <cstring>
+
+SensorWarmup::SensorWarmup()
+    : m_tolerance(2), m_settling(false), m_cap(WARMUP_MAX_FRAMES), m_wake_us(0), m_fresh(0), m_stale(0),
+      m_last_luma(-1), m_used_luma(-1), m_expected(4)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void SensorWarmup::wake(uint64_t wake_us)
+{
+    m_stats.wakes++;
+    m_settling = true;
+    m_wake_us = wake_us;
+    m_fresh = 0;
+    m_stale = 0;
+    m_last_luma = m_used_luma;
+    // Room for twice the usual settling, and at least one comparison between fresh frames.
+    int cap = (int)(2 * m_expected + 0.5f) + 2;
+    m_cap = (uint8_t)(cap < WARMUP_MAX_FRAMES ? cap : WARMUP_MAX_FRAMES);
+}
+
+WarmupVerdict SensorWarmup::ready(int luma, uint64_t now_us, bool capped)
+{
+    m_settling = false;
+    m_used_luma = luma;
+    uint8_t discarded = m_fresh - 1;
+    m_stats.last_latency_us = (uint32_t)(now_us - m_wake_us);
+    m_stats.last_settle = discarded;
+    m_stats.last_stale = m_stale;
+    m_stats.settle_frames += discarded;
+    if (capped)
+        m_stats.capped++;
+    // Only wakes where exposure had to move say how long it takes to settle.
+    if (discarded == 0)
+        m_stats.unchanged++;
+    else
+        m_expected = (3 * m_expected + (capped ? m_cap : discarded)) / 4;
+    return WARMUP_READY;
+}
+
+WarmupVerdict SensorWarmup::judge(uint64_t captured_us, int luma, uint64_t now_us)
+{
+    if (!m_settling)
+        return WARMUP_READY;
+    if (captured_us < m_wake_us && m_stale < WARMUP_MAX_STALE)
+    {
+        m_stale++;
+        m_stats.stale++;
+        return WARMUP_STALE;
+    }
+    // The first fresh frame is compared with the last frame used before the sleep,
+    // later ones with the frame before them.
+    m_fresh++;
+    if (luma >= 0 && m_last_luma >= 0 && abs(luma - m_last_luma) <= m_tolerance)
+        return ready(luma, now_us, false);
+    if (m_fresh >= m_cap)
+        return ready(luma, now_us, true);
+    m_last_luma = luma;
+    return WARMUP_SETTLING;
+}
+
+static int mean_luma(const Frame &frame)
+{
+    FrameSignature signature;
+    if (!jpeg_dc_signature(frame.buf, frame.len, signature))
+        return -1;
+    uint32_t sum = 0;
+    for (int i = 0; i < CHANGE_GRID_CELLS; i++)
+        sum += signature.cells[i];
+    return (int)(sum / CHANGE_GRID_CELLS);
+}
+
+bool WarmupFrameSource::acquire(Frame &frame)
+{
+    if (!m_warmup.settling())
+        return m_camera.acquire(frame);
+    for (;;)
+    {
+        if (!m_camera.acquire(frame))
+            return false;
+        int luma = m_warmup.needs_luma(frame.captured_us) ? mean_luma(frame) : -1;
+        if (m_warmup.judge(frame.captured_us, luma, platform_micros()) == WARMUP_READY)
+            break;
+        m_camera.release(frame);
+    }
+    // detail: fresh frames discarded in the low byte, stale ones in the high byte.
+    if (m_telemetry)
+    {
+        const WarmupStats &stats = m_warmup.stats();
+        m_telemetry->record(TRACE_WARMUP, m_warmup.wake_us(), stats.last_latency_us,
+                            (uint16_t)(stats.last_settle | stats.last_stale << 8));
+    }
+    return true;
+}
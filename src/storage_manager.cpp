@@ -0,0 +1,105 @@
+#include "storage_manager.h"
+#include "platform.h"
+
+// Record overhead the arena adds per frame (header plus alignment).
+#define ARENA_RECORD_OVERHEAD 24
+
+StorageManager::StorageManager(FrameArena &arena) : m_arena(arena), m_detector(NULL), m_telemetry(NULL), m_power(NULL), m_last_capture(0), m_budget(0), m_avg_len(0), m_dev_len(0)
+{
+}
+
+void StorageManager::set_budget(size_t bytes)
+{
+    // 0 (or anything too big) means "use the whole arena".
+    if (bytes == 0 || bytes > m_arena.capacity())
+        bytes = m_arena.capacity();
+    m_budget = bytes;
+}
+
+// detail is the id the frame was stored under (low 16 bits), 0 when it was not.
+void StorageManager::trace_store(uint64_t start_us, uint32_t frame_id)
+{
+    if (m_telemetry)
+        m_telemetry->record(TRACE_STORE, start_us, (uint32_t)(platform_micros() - start_us), (uint16_t)frame_id);
+}
+
+StoreResult StorageManager::store(FrameSource &source, uint32_t timestamp_ms, uint32_t flags)
+{
+    if (m_budget == 0)
+        set_budget(0);
+
+    Frame frame;
+    uint64_t start = platform_micros();
+    bool acquired;
+    {
+        PowerPhaseGuard phase(m_power, POWER_PHASE_CAPTURE);
+        acquired = source.acquire(frame);
+    }
+    uint64_t captured = platform_micros();
+    if (m_telemetry)
+    {
+        m_telemetry->record(TRACE_CAPTURE, start, (uint32_t)(captured - start));
+        m_telemetry->add_capture_latency((uint32_t)(captured - start));
+    }
+    if (!acquired)
+    {
+        PLATFORM_LOG("Camera capture failed\n");
+        return STORE_FAILED;
+    }
+    if (m_power)
+        m_power->count_frame();
+    PowerPhaseGuard phase(m_power, POWER_PHASE_STORE);
+    m_last_capture = frame.len;
+    if (m_detector && !m_detector->check(frame.buf, frame.len, flags & (FRAME_FLAG_EVENT | FRAME_FLAG_BURST)))
+    {
+        PLATFORM_LOG("Skipped near-duplicate frame (%u%% changed, %u bytes).\n", m_detector->stats().last_change,
+                     (unsigned)frame.len);
+        source.release(frame);
+        trace_store(captured, 0);
+        return STORE_SKIPPED;
+    }
+    bool stored = m_arena.append(frame.buf, frame.len, timestamp_ms, flags);
+    source.release(frame);
+    trace_store(captured, stored ? m_arena.newest().id : 0);
+    if (!stored)
+    {
+        PLATFORM_LOG("Frame of %u bytes does not fit in the arena\n", (unsigned)frame.len);
+        return STORE_FAILED;
+    }
+    if (m_detector)
+        m_detector->accept();
+    PLATFORM_LOG("Stored %simage %u in arena (%u bytes).\n", flags & FRAME_FLAG_EVENT ? "event " : "",
+                 m_arena.newest().id, (unsigned)frame.len);
+
+    // Same gains as TCP's RTT estimator: 1/8 for the mean, 1/4 for the deviation.
+    uint32_t len = m_arena.newest().len;
+    if (m_avg_len == 0)
+    {
+        m_avg_len = len;
+        m_dev_len = len / 2;
+    }
+    else
+    {
+        uint32_t err = len > m_avg_len ? len - m_avg_len : m_avg_len - len;
+        m_dev_len = (3 * m_dev_len + err) / 4;
+        m_avg_len = (7 * m_avg_len + len) / 8;
+    }
+    return STORE_KEPT;
+}
+
+size_t StorageManager::predicted_next() const
+{
+    return m_avg_len + 2 * m_dev_len + ARENA_RECORD_OVERHEAD;
+}
+
+float StorageManager::fill_percent() const
+{
+    return m_budget > 0 ? (float)buffered_bytes() * 100.0f / m_budget : 0;
+}
+
+bool StorageManager::should_flush() const
+{
+    if (m_arena.count() == 0)
+        return false;
+    return buffered_bytes() + predicted_next() > m_budget;
+}
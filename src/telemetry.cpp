@@ -0,0 +1,164 @@
+#include "telemetry.h"
+#include <cstring>
+
+#define HEADER_FIXED_SIZE 16 // Magic, four u8 counts, uptime, tracepoints recorded
+#define HISTOGRAM_SIZE (16 + 2 * HISTOGRAM_BUCKETS)
+#define TRACE_POINT_SIZE 12
+#define BUILD_MAX 32
+
+static void put_u16(uint8_t *out, uint16_t v)
+{
+    out[0] = v & 0xFF;
+    out[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t v)
+{
+    out[0] = v & 0xFF;
+    out[1] = (v >> 8) & 0xFF;
+    out[2] = (v >> 16) & 0xFF;
+    out[3] = v >> 24;
+}
+
+void Histogram::clear()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+void Histogram::add(uint32_t value)
+{
+    int bucket = 0;
+    for (uint32_t v = value; v > 0 && bucket < HISTOGRAM_BUCKETS - 1; v >>= 1)
+        bucket++;
+    if (buckets[bucket] < 0xFFFF)
+        buckets[bucket]++;
+    if (count == 0 || value < min)
+        min = value;
+    if (value > max)
+        max = value;
+    count++;
+    sum += value;
+}
+
+Telemetry::Telemetry() : m_total(0)
+{
+    memset(m_ring, 0, sizeof(m_ring));
+    memset(m_open, 0, sizeof(m_open));
+    m_capture.clear();
+    m_rtt.clear();
+    m_rate.clear();
+}
+
+void Telemetry::begin(TracePhase phase)
+{
+    PlatformLockGuard guard(m_lock);
+    m_open[phase] = platform_micros();
+}
+
+void Telemetry::end(TracePhase phase, uint16_t detail)
+{
+    uint64_t now = platform_micros();
+    uint64_t start;
+    {
+        PlatformLockGuard guard(m_lock);
+        start = m_open[phase];
+        m_open[phase] = 0;
+    }
+    if (start == 0)
+        return; // end() without begin()
+    record(phase, start, (uint32_t)(now - start), detail);
+}
+
+void Telemetry::record(TracePhase phase, uint64_t start_us, uint32_t duration_us, uint16_t detail)
+{
+    PlatformLockGuard guard(m_lock);
+    TracePoint &point = m_ring[m_total % TELEMETRY_TRACE_LEN];
+    point.start_us = (uint32_t)start_us;
+    point.duration_us = duration_us;
+    point.phase = phase;
+    point.detail = detail;
+    m_total++;
+}
+
+void Telemetry::add_capture_latency(uint32_t us)
+{
+    PlatformLockGuard guard(m_lock);
+    m_capture.add(us);
+}
+
+void Telemetry::add_chunk_rtt(uint32_t us)
+{
+    PlatformLockGuard guard(m_lock);
+    m_rtt.add(us);
+}
+
+void Telemetry::add_session_rate(uint32_t bytes_per_s)
+{
+    PlatformLockGuard guard(m_lock);
+    m_rate.add(bytes_per_s);
+}
+
+static size_t build_length(const char *build)
+{
+    size_t len = build ? strlen(build) : 0;
+    return len > BUILD_MAX ? BUILD_MAX : len;
+}
+
+size_t Telemetry::encoded_size(const char *build) const
+{
+    uint32_t traces = m_total < TELEMETRY_TRACE_LEN ? m_total : TELEMETRY_TRACE_LEN;
+    return HEADER_FIXED_SIZE + 1 + build_length(build) + 3 * HISTOGRAM_SIZE + traces * TRACE_POINT_SIZE;
+}
+
+static uint8_t *put_histogram(uint8_t *out, const Histogram &histogram)
+{
+    put_u32(out, histogram.count);
+    put_u32(out + 4, histogram.min);
+    put_u32(out + 8, histogram.max);
+    put_u32(out + 12, histogram.mean());
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        put_u16(out + 16 + 2 * i, histogram.buckets[i]);
+    return out + HISTOGRAM_SIZE;
+}
+
+size_t Telemetry::encode(uint8_t *dst, size_t capacity, const char *build) const
+{
+    size_t build_len = build_length(build);
+    size_t fixed = HEADER_FIXED_SIZE + 1 + build_len + 3 * HISTOGRAM_SIZE;
+    if (capacity < fixed)
+        return 0;
+
+    PlatformLockGuard guard(m_lock);
+    uint32_t traces = m_total < TELEMETRY_TRACE_LEN ? m_total : TELEMETRY_TRACE_LEN;
+    uint32_t room = (uint32_t)((capacity - fixed) / TRACE_POINT_SIZE);
+    if (traces > room)
+        traces = room;
+
+    uint8_t *out = dst;
+    memcpy(out, "JKT1", 4);
+    out[4] = VERSION;
+    out[5] = TRACE_PHASE_COUNT;
+    out[6] = HISTOGRAM_BUCKETS;
+    out[7] = (uint8_t)traces;
+    put_u32(out + 8, (uint32_t)(platform_micros() / 1000));
+    put_u32(out + 12, m_total);
+    out[16] = (uint8_t)build_len;
+    memcpy(out + 17, build, build_len);
+    out += HEADER_FIXED_SIZE + 1 + build_len;
+
+    out = put_histogram(out, m_capture);
+    out = put_histogram(out, m_rtt);
+    out = put_histogram(out, m_rate);
+
+    for (uint32_t i = m_total - traces; i < m_total; i++)
+    {
+        const TracePoint &point = m_ring[i % TELEMETRY_TRACE_LEN];
+        put_u32(out, point.start_us);
+        put_u32(out + 4, point.duration_us);
+        out[8] = point.phase;
+        out[9] = 0;
+        put_u16(out + 10, point.detail);
+        out += TRACE_POINT_SIZE;
+    }
+    return out - dst;
+}
@@ -0,0 +1,474 @@
+#include "transfer_session.h"
+#include "event_log.h"
+#include "platform.h"
+#include <cstdio>
+#include <cstring>
+
+TransferSession::TransferSession(Transport &transport, uint8_t window, bool container)
+    : m_transport(transport), m_window(window > TRANSFER_WINDOW_MAX ? TRANSFER_WINDOW_MAX : window),
+      m_container(container), m_has_resume(false), m_resume(), m_progress(), m_start_offset(0), m_stream_acked(0),
+      m_chunk_size(CHUNK_SIZE), m_telemetry(NULL), m_ledger(NULL), m_renderer(NULL)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+    memset(m_sent_us, 0, sizeof(m_sent_us));
+    m_timing = {CHUNK_SIZE, 50, 10, 500};
+}
+
+void TransferSession::set_timing(const TransferTiming &timing)
+{
+    m_timing = timing;
+    if (m_timing.chunk_max > CHUNK_SIZE)
+        m_timing.chunk_max = CHUNK_SIZE;
+    if (m_timing.chunk_max < WINDOW_MIN_CHUNK)
+        m_timing.chunk_max = WINDOW_MIN_CHUNK;
+}
+
+void TransferSession::resume_from(const ResumePoint &point)
+{
+    m_resume = point;
+    m_has_resume = true;
+}
+
+// Fits each chunk, plus its sequence header in windowed mode, into one
+// notification at the MTU the link actually negotiated. When that is too small
+// for the u16 sequence space to cover a full batch, the session falls back to
+// stop-and-wait; the server keeps reading 'N' chunks until it sees WIN:.
+void TransferSession::size_chunks()
+{
+    size_t payload = m_transport.max_payload();
+    if (payload < ATT_MTU_DEFAULT - ATT_NOTIFY_OVERHEAD)
+        payload = ATT_MTU_DEFAULT - ATT_NOTIFY_OVERHEAD; // No BLE link goes below the default MTU
+    if (m_window > 0 && payload < WINDOW_CHUNK_HEADER + WINDOW_MIN_CHUNK)
+    {
+        EVLOG_WARN(LOGF_WINDOW_FALLBACK, payload);
+        m_window = 0;
+    }
+    if (m_window > 0)
+        payload -= WINDOW_CHUNK_HEADER;
+    m_chunk_size = payload < m_timing.chunk_max ? (uint16_t)payload : m_timing.chunk_max;
+}
+
+// Waits for a specific command, discarding anything stale that arrives first.
+bool TransferSession::wait_for(char type, uint32_t timeout_ms)
+{
+    uint32_t start = m_transport.now_ms();
+    TransportCommand cmd;
+    while (m_transport.now_ms() - start < timeout_ms)
+    {
+        uint32_t remaining = timeout_ms - (m_transport.now_ms() - start);
+        if (!m_transport.wait_command(cmd, remaining))
+            return false;
+        if (cmd.type == type)
+            return true;
+    }
+    return false;
+}
+
+// Sends a status line and waits for the server's 'A'. The record keeps the
+// first four characters of the status, which name its kind.
+bool TransferSession::announce(const char *status, const char *label)
+{
+    m_transport.send_status(status);
+    char kind[4] = {' ', ' ', ' ', ' '};
+    for (int i = 0; i < 4 && status[i]; i++)
+        kind[i] = status[i];
+    EVLOG_INFO(LOGF_STATUS_SENT, kind[0], kind[1], kind[2], kind[3], strlen(status));
+    uint32_t sent_ms = m_transport.now_ms();
+    m_transport.sleep_ms(m_timing.status_delay_ms);
+
+    if (!wait_for('A', 10000))
+    {
+        PLATFORM_LOG("[%s] ERROR: Timeout waiting for server ACK.\n", label);
+        return false;
+    }
+
+    EVLOG_INFO(LOGF_STATUS_ACKED, m_transport.now_ms() - sent_ms);
+    return true;
+}
+
+bool TransferSession::send_stream(const StreamSource &source, const char *label, uint16_t detail)
+{
+    m_stream_acked = 0;
+    if (source.size() == 0)
+        return true;
+    uint64_t start = m_transport.now_us();
+    bool ok = m_window > 0 ? send_stream_windowed(source, label) : send_stream_stop_and_wait(source, label);
+    if (m_telemetry)
+        m_telemetry->record(TRACE_TRANSFER, start, (uint32_t)(m_transport.now_us() - start), detail);
+    return ok;
+}
+
+bool TransferSession::send_stream_stop_and_wait(const StreamSource &source, const char *label)
+{
+    size_t total_size = source.size();
+    size_t sent = 0;
+    int chunk_count = 0;
+    uint64_t sent_us = 0;
+
+    while (sent < total_size)
+    {
+        if (sent > 0 && !wait_for('N', 15000))
+        {
+            PLATFORM_LOG("[%s] ERROR: Timeout waiting for chunk request at byte %u/%u\n", label, (unsigned)sent, (unsigned)total_size);
+            return false;
+        }
+        if (sent > 0 && m_telemetry)
+            m_telemetry->add_chunk_rtt((uint32_t)(m_transport.now_us() - sent_us));
+        m_stream_acked = sent; // Each request confirms everything sent before it
+
+        size_t remaining = total_size - sent;
+        size_t chunk_size = (remaining < m_chunk_size) ? remaining : m_chunk_size;
+        source.read(sent, m_packet, chunk_size);
+        sent_us = m_transport.now_us();
+        m_transport.send_data(m_packet, chunk_size);
+        m_transport.sleep_ms(m_timing.chunk_delay_ms);
+        sent += chunk_size;
+        chunk_count++;
+        m_stats.chunks++;
+
+        if (chunk_count % 5 == 0 || sent == total_size)
+            EVLOG_INFO(LOGF_STREAM_PROGRESS, sent, total_size);
+    }
+
+    // A resume-aware server answers the last chunk with one more 'N'; without it we
+    // cannot tell whether the tail arrived, so the frame stays unacknowledged.
+    if (m_has_resume)
+    {
+        if (!wait_for('N', 15000))
+        {
+            PLATFORM_LOG("[%s] ERROR: Timeout waiting for the server to confirm the last chunk\n", label);
+            return false;
+        }
+        m_stream_acked = sent;
+    }
+
+    EVLOG_INFO(LOGF_STREAM_DONE, sent, chunk_count, 0);
+    return true;
+}
+
+// Sends chunk `seq` of the stream with its sequence number prefixed. The server places it
+// by offset (seq * chunk size), so retransmissions and reordering are harmless.
+void TransferSession::send_window_chunk(const StreamSource &source, uint16_t seq, bool retransmit)
+{
+    size_t offset = (size_t)seq * m_chunk_size;
+    size_t remaining = source.size() - offset;
+    size_t chunk_size = (remaining < m_chunk_size) ? remaining : m_chunk_size;
+
+    m_packet[0] = seq & 0xFF;
+    m_packet[1] = seq >> 8;
+    source.read(offset, m_packet + WINDOW_CHUNK_HEADER, chunk_size);
+    // Karn's rule: the ACK of a retransmitted chunk says nothing about the round trip.
+    m_sent_us[seq % TRANSFER_WINDOW_MAX] = retransmit ? 0 : m_transport.now_us();
+    m_transport.send_data(m_packet, WINDOW_CHUNK_HEADER + chunk_size);
+    m_stats.chunks++;
+}
+
+// Sliding-window sender: streams up to m_window sequence-numbered chunks ahead of
+// the server's cumulative ACK, retransmitting selectively on NACK or after a quiet period.
+bool TransferSession::send_stream_windowed(const StreamSource &source, const char *label)
+{
+    size_t chunk_count = (source.size() + m_chunk_size - 1) / m_chunk_size;
+    if (chunk_count > 0xFFFF)
+    {
+        PLATFORM_LOG("[%s] ERROR: %u chunks of %u bytes overflow the sequence number\n", label,
+                     (unsigned)chunk_count, m_chunk_size);
+        return false;
+    }
+    uint16_t total_chunks = (uint16_t)chunk_count;
+    uint16_t acked = 0;
+    uint16_t next_seq = 0;
+    uint8_t credit = m_window;
+    uint32_t retransmits = 0;
+    uint32_t last_progress = m_transport.now_ms();
+    uint32_t last_activity = m_transport.now_ms();
+
+    while (acked < total_chunks)
+    {
+        if (!m_transport.is_connected())
+            return false;
+
+        while (next_seq < total_chunks && next_seq < acked + credit)
+        {
+            send_window_chunk(source, next_seq, false);
+            next_seq++;
+            last_activity = m_transport.now_ms();
+        }
+
+        uint32_t idle = m_transport.now_ms() - last_activity;
+        uint32_t wait_ms = idle < WINDOW_RETRANSMIT_MS ? WINDOW_RETRANSMIT_MS - idle : 0;
+        TransportCommand cmd;
+        if (wait_ms > 0 && m_transport.wait_command(cmd, wait_ms))
+        {
+            if (cmd.type == 'K')
+            {
+                if (cmd.seq > acked && cmd.seq <= total_chunks)
+                {
+                    uint64_t sent_us = m_sent_us[(cmd.seq - 1) % TRANSFER_WINDOW_MAX];
+                    if (m_telemetry && sent_us != 0)
+                        m_telemetry->add_chunk_rtt((uint32_t)(m_transport.now_us() - sent_us));
+                    acked = cmd.seq;
+                    m_stream_acked = acked == total_chunks ? source.size() : (size_t)acked * m_chunk_size;
+                    last_progress = m_transport.now_ms();
+                    if (acked % 20 == 0 || acked == total_chunks)
+                        EVLOG_INFO(LOGF_STREAM_ACKED, acked, total_chunks);
+                }
+                if (cmd.credit > 0)
+                    credit = cmd.credit > TRANSFER_WINDOW_MAX ? TRANSFER_WINDOW_MAX : cmd.credit;
+                if (next_seq < acked)
+                    next_seq = acked;
+            }
+            else if (cmd.type == 'X' && cmd.seq >= acked && cmd.seq < next_seq)
+            {
+                send_window_chunk(source, cmd.seq, true);
+                retransmits++;
+                last_activity = m_transport.now_ms();
+            }
+            continue;
+        }
+
+        if (m_transport.now_ms() - last_progress > 15000)
+        {
+            PLATFORM_LOG("[%s] ERROR: No ACK progress at chunk %u/%u\n", label, acked, total_chunks);
+            return false;
+        }
+        if (m_transport.now_ms() - last_activity >= WINDOW_RETRANSMIT_MS)
+        {
+            // Nothing heard for a while: the tail of the window or the ACK was lost.
+            send_window_chunk(source, acked, true);
+            retransmits++;
+            last_activity = m_transport.now_ms();
+        }
+    }
+
+    EVLOG_INFO(LOGF_STREAM_DONE, source.size(), total_chunks, retransmits);
+    m_stats.retransmits += retransmits;
+    return true;
+}
+
+// Honors the server's resume point: every frame before it, and the frame itself
+// once complete, is already on the server, so it is released rather than resent.
+void TransferSession::apply_resume(FrameBacklog &backlog)
+{
+    m_start_offset = 0;
+    if (!m_has_resume || m_resume.frame_id == 0)
+        return;
+
+    FrameRef frame = {};
+    int index = 0;
+    while (backlog.peek_at(index, frame) && frame.id < m_resume.frame_id)
+        index++;
+    if (index == backlog.count() || frame.id != m_resume.frame_id || frame.crc32 != m_resume.crc32)
+    {
+        EVLOG_WARN(LOGF_RESUME_UNKNOWN, m_resume.frame_id);
+        return;
+    }
+
+    bool complete = m_resume.offset >= frame.len;
+    int release = complete ? index + 1 : index;
+    for (int i = 0; i < release; i++)
+    {
+        FrameRef front = {};
+        backlog.peek_at(0, front);
+        backlog.release_front();
+        m_stats.bytes += front.len;
+        m_stats.images++;
+    }
+    if (!complete)
+        m_start_offset = m_resume.offset;
+    EVLOG_INFO(LOGF_RESUMING, m_resume.frame_id, m_resume.offset, release);
+}
+
+bool TransferSession::send_images(FrameBacklog &backlog, int image_count)
+{
+    char status_buf[64];
+    snprintf(status_buf, sizeof(status_buf), "COUNT:%d", image_count);
+    if (!announce(status_buf, "Batch"))
+        return false;
+
+    for (int i = 0; i < image_count; i++)
+    {
+        if (!m_transport.is_connected())
+        {
+            PLATFORM_LOG("Client disconnected mid-batch. Aborting.\n");
+            return false;
+        }
+        FrameRef frame = {};
+        if (!backlog.peek_at(0, frame))
+            break;
+        EVLOG_INFO(LOGF_SENDING_IMAGE, i + 1, image_count, frame.len);
+
+        // IMAGE:<length>:<id>:<offset>:<crc32>:<flags>; only length - offset bytes follow.
+        uint32_t offset = i == 0 ? m_start_offset : 0;
+        char label[24];
+        snprintf(label, sizeof(label), "Image %d", i + 1);
+        snprintf(status_buf, sizeof(status_buf), "IMAGE:%u:%u:%u:%u:%u", (unsigned)frame.len, frame.id,
+                 offset, frame.crc32, frame.flags);
+        FrameStreamSource source(backlog, 0, offset, frame.len - offset);
+        m_progress = {frame.id, offset, frame.crc32};
+        bool sent = announce(status_buf, label) && send_stream(source, label, (uint16_t)(i + 1));
+        m_progress.offset = offset + m_stream_acked;
+        if (!sent)
+        {
+            PLATFORM_LOG("Failed to send image %d; %u of %u bytes acknowledged. Aborting batch.\n", i + 1,
+                         m_progress.offset, (unsigned)frame.len);
+            return false;
+        }
+        if (m_window == 0)
+            m_transport.sleep_ms(100);
+        backlog.release_front();
+        m_stats.bytes += frame.len;
+        m_stats.images++;
+        m_transport.sleep_ms(m_timing.image_delay_ms);
+    }
+    return true;
+}
+
+// One handshake per container: BATCH:<stream bytes>:<frames>, then the container.
+// A backlog longer than one container's frame table goes as several.
+bool TransferSession::send_container(FrameBacklog &backlog, int image_count)
+{
+    while (image_count > 0)
+    {
+        BatchContainer container(backlog, image_count, m_transport.now_ms(), m_start_offset);
+        char status_buf[40];
+        snprintf(status_buf, sizeof(status_buf), "BATCH:%u:%d", (unsigned)container.size(), container.frame_count());
+        bool sent = announce(status_buf, "Batch") &&
+                    send_stream(container, "Batch", (uint16_t)container.frame_count());
+
+        // The server keeps every complete frame of a partial container, so release
+        // whatever was acknowledged even if the stream broke off.
+        int delivered = sent ? container.frame_count() : container.frames_within(m_stream_acked);
+        FrameRef frame = {};
+        for (int i = 0; i < delivered; i++)
+        {
+            backlog.peek_at(0, frame);
+            m_progress = {frame.id, (uint32_t)frame.len, frame.crc32};
+            backlog.release_front();
+            m_stats.bytes += frame.len;
+            m_stats.images++;
+        }
+        if (!sent)
+        {
+            if (delivered < container.frame_count() && backlog.peek_at(0, frame))
+                m_progress = {frame.id, container.frame_progress(delivered, m_stream_acked), frame.crc32};
+            PLATFORM_LOG("Batch container broke off after %d of %d frames; the rest stay queued.\n", delivered,
+                         container.frame_count());
+            return false;
+        }
+        image_count -= delivered;
+        m_start_offset = 0;
+    }
+    return true;
+}
+
+// PREVIEW:<stream bytes>:<frames>, then a PreviewContainer, for every frame
+// queued behind the ones the server has already previewed.
+bool TransferSession::send_previews(FrameBacklog &backlog)
+{
+    m_ledger->sync(backlog);
+    int fresh = backlog.count() - m_ledger->count();
+    while (fresh > 0)
+    {
+        int room = m_ledger->capacity() - m_ledger->count();
+        int count = fresh < FRAME_QUEUE_LEN ? fresh : FRAME_QUEUE_LEN;
+        if (count > room)
+            count = room;
+        if (count == 0)
+        {
+            PLATFORM_LOG("Preview ledger full; %d frames wait for their previews.\n", fresh);
+            break;
+        }
+        PreviewContainer container(backlog, m_ledger->count(), count, m_transport.now_ms(), *m_renderer);
+        char status_buf[40];
+        snprintf(status_buf, sizeof(status_buf), "PREVIEW:%u:%d", (unsigned)container.size(), container.frame_count());
+        // A preview stream that breaks off is sent again whole next time; it is small.
+        if (!announce(status_buf, "Preview") ||
+            !send_stream(container, "Preview", (uint16_t)container.frame_count()))
+            return false;
+        m_ledger->add(backlog, count, m_transport.now_ms());
+        m_stats.previews += count;
+        fresh -= count;
+    }
+    return true;
+}
+
+// PICK:<previewed frames>, answered with an 'F' per frame the server wants in
+// full and a closing 'G'. The picks go out like any batch; afterwards everything
+// delivered or past retention leaves the backlog.
+bool TransferSession::send_picks(FrameBacklog &backlog)
+{
+    if (m_ledger->count() == 0)
+        return true;
+
+    char status_buf[24];
+    snprintf(status_buf, sizeof(status_buf), "PICK:%d", m_ledger->count());
+    m_transport.send_status(status_buf);
+    EVLOG_INFO(LOGF_PICK_ASKED, m_ledger->count());
+
+    uint32_t start = m_transport.now_ms();
+    bool listed = false;
+    TransportCommand cmd;
+    while (!listed && m_transport.now_ms() - start < 10000)
+    {
+        if (!m_transport.wait_command(cmd, 10000 - (m_transport.now_ms() - start)))
+            break;
+        if (cmd.type == 'F' && !m_ledger->pick(cmd.frame_id))
+            EVLOG_WARN(LOGF_PICK_UNKNOWN, cmd.frame_id);
+        listed = cmd.type == 'G';
+    }
+    if (!listed)
+    {
+        PLATFORM_LOG("[Pick] ERROR: Timeout waiting for the end of the pick list.\n");
+        m_ledger->release(backlog, m_transport.now_ms());
+        return false;
+    }
+
+    SelectionBacklog selection(backlog, *m_ledger);
+    int picked = selection.count();
+    EVLOG_INFO(LOGF_PICKED, picked, m_ledger->count());
+    bool ok = picked == 0 || (m_container ? send_container(selection, picked) : send_images(selection, picked));
+    int expired = m_ledger->release(backlog, m_transport.now_ms());
+    if (expired > 0)
+        EVLOG_INFO(LOGF_PICKS_EXPIRED, expired);
+    return ok;
+}
+
+bool TransferSession::send_batch(FrameArena &arena, FrameQueue &queue)
+{
+    ArenaBacklog backlog(arena, queue);
+    return send_batch(backlog);
+}
+
+bool TransferSession::send_batch(FrameBacklog &backlog)
+{
+    if (!m_transport.is_connected())
+        return false;
+
+    uint32_t start = m_transport.now_ms();
+
+    // Previews replace the resume point: only picked frames are sent in full.
+    bool previews = m_ledger && m_renderer;
+    if (!previews)
+        apply_resume(backlog);
+    int image_count = backlog.count();
+    size_chunks();
+
+    // Confirm the negotiated window before the batch so the server knows how chunks are framed.
+    if (m_window > 0)
+    {
+        char win_buf[32];
+        snprintf(win_buf, sizeof(win_buf), "WIN:%u:%u", m_window, m_chunk_size);
+        m_transport.send_status(win_buf);
+        EVLOG_INFO(LOGF_WINDOWED, m_window, m_chunk_size);
+        m_transport.sleep_ms(m_timing.status_delay_ms);
+    }
+
+    bool ok;
+    if (previews)
+        ok = send_previews(backlog) && send_picks(backlog);
+    else
+        ok = m_container ? send_container(backlog, image_count) : send_images(backlog, image_count);
+
+    m_stats.elapsed_ms = m_transport.now_ms() - start;
+    return ok;
+}
@@ -0,0 +1,162 @@
+import struct
+import zlib
+
+# Mirrors include/batch_container.h on the device. All fields are little-endian:
+#   "JKB1"  u16 version  u16 frame_count  u32 total_size  u32 device_now_ms  u32 first_offset
+#   frame_count x { u32 id  u32 offset  u32 length  u32 timestamp_ms  u32 crc32  u32 flags }
+#   JPEG data
+# A resumed container skips the first first_offset bytes of its first frame.
+MAGIC = b'JKB1'
+VERSION = 3
+HEADER = struct.Struct('<4sHHIII')
+ENTRY = struct.Struct('<IIIIII')
+
+# Frame flags (FRAME_FLAG_* in include/protocol.h).
+FLAG_EVENT = 0x01  # Captured on a PIR trigger rather than the timelapse timer
+FLAG_BURST = 0x02  # One of a burst: bits 8-15 are its position, bits 16-31 the burst id
+
+# Preview-first mode's container (PreviewContainer on the device):
+#   "JKP1"  u16 version  u16 frame_count  u32 total_size  u32 device_now_ms  u8 cols  u8 rows  u16 reserved
+#   frame_count x { u32 id  u32 offset  u32 length  u32 timestamp_ms  u32 crc32  u32 flags }
+#   frame_count x { u8 valid  cols x rows luma bytes }
+# offset is where the frame's preview record starts; length and crc32 are those
+# of the full JPEG, which stays on the device until picked.
+PREVIEW_MAGIC = b'JKP1'
+PREVIEW_VERSION = 2
+PREVIEW_HEADER = struct.Struct('<4sHHIIBBH')
+
+
+class BatchFormatError(ValueError):
+    pass
+
+
+def burst_id(flags):
+    """The id of the burst a frame belongs to, 0 for a single frame."""
+    return flags >> 16 if flags & FLAG_BURST else 0
+
+
+def resumed_prefix(resume, frame_id, crc, offset):
+    """The bytes of a frame held from an earlier connection, or None if we lack them."""
+    if offset == 0:
+        return b''
+    if not resume or resume["id"] != frame_id or resume["crc"] != crc or len(resume["data"]) < offset:
+        return None
+    return resume["data"][:offset]
+
+
+def read_table(head, available, complete=True):
+    """Reads the header and frame table from the first bytes of a container.
+
+    `available` is how many bytes of the container arrived; with complete=False
+    that is only the prefix received before a transfer broke off.
+
+    Returns (device_now_ms, first_offset, entries), each entry a tuple of
+    (id, offset, length, timestamp_ms, crc, flags). Raises BatchFormatError if the
+    header or table is unusable.
+    """
+    if len(head) < HEADER.size:
+        raise BatchFormatError("container shorter than its header")
+    magic, version, count, total, device_now_ms, first_offset = HEADER.unpack_from(head, 0)
+    if magic != MAGIC or version != VERSION:
+        raise BatchFormatError(f"unknown container {magic!r} v{version}")
+    size_ok = total == available if complete else total >= available
+    if not size_ok:
+        raise BatchFormatError(f"container is {available} bytes, header says {total}")
+    if len(head) < table_size(count):
+        raise BatchFormatError("container shorter than its frame table")
+
+    entries = [ENTRY.unpack_from(head, HEADER.size + i * ENTRY.size) for i in range(count)]
+    for frame_id, offset, length, _, _, _ in entries:
+        if offset + length > total:
+            raise BatchFormatError(f"frame {frame_id} runs past the end of the container")
+    return device_now_ms, first_offset, entries
+
+
+def table_size(count):
+    return HEADER.size + count * ENTRY.size
+
+
+def frame_count(head):
+    """The frame count from a container header, to size the table read."""
+    if len(head) < HEADER.size:
+        raise BatchFormatError("container shorter than its header")
+    return HEADER.unpack_from(head, 0)[2]
+
+
+def iter_frames(entries, first_offset, read, available, resume=None):
+    """Yields the frames of a container one at a time, reading each with read(offset, length).
+
+    Each frame is a dict with id, timestamp_ms, crc, event, burst, data, crc_ok and complete.
+    The last one has complete=False when the container was cut short inside it;
+    nothing after it is yielded. Only one frame's data is held at a time, so a
+    container streamed to disk is split without loading it whole.
+    """
+    for i, (frame_id, offset, length, timestamp_ms, crc, flags) in enumerate(entries):
+        prefix = resumed_prefix(resume, frame_id, crc, first_offset if i == 0 else 0)
+        if prefix is None:
+            print(f"-> Frame {frame_id} resumes data we no longer hold; skipping.")
+            continue
+        end = min(offset + length, available)
+        data = prefix + read(offset, max(0, end - offset))
+        if offset + length > available:
+            if len(data) > 0:
+                yield {"id": frame_id, "timestamp_ms": timestamp_ms, "crc": crc, "event": bool(flags & FLAG_EVENT),
+                       "burst": burst_id(flags), "data": data, "crc_ok": False, "complete": False}
+            return
+        yield {"id": frame_id, "timestamp_ms": timestamp_ms, "crc": crc, "event": bool(flags & FLAG_EVENT),
+               "burst": burst_id(flags), "data": data, "crc_ok": zlib.crc32(data) == crc, "complete": True}
+
+
+def parse(buffer, resume=None, complete=True):
+    """Splits an in-memory batch container into frames.
+
+    `resume` is the partial frame kept from an earlier connection (id, crc, data),
+    used when the container picks up mid-frame. With complete=False the buffer is
+    only the prefix that arrived before a transfer broke off.
+
+    Returns (device_now_ms, frames, partial). Each frame is a dict with id,
+    timestamp_ms, crc, event, burst, data and crc_ok; partial is the frame cut short, if any.
+    Raises BatchFormatError if the header or table is unusable.
+    """
+    device_now_ms, first_offset, entries = read_table(buffer, len(buffer), complete)
+    frames = []
+    partial = None
+    for frame in iter_frames(entries, first_offset, lambda offset, length: bytes(buffer[offset:offset + length]),
+                             len(buffer), resume):
+        if frame["complete"]:
+            frames.append(frame)
+        else:
+            partial = {"id": frame["id"], "crc": frame["crc"], "data": frame["data"]}
+    return device_now_ms, frames, partial
+
+
+def parse_previews(buffer):
+    """Splits a complete preview container.
+
+    Returns (device_now_ms, cols, rows, previews). Each preview is a dict with
+    id, timestamp_ms, length, crc, event, burst and pixels (cols x rows luma bytes, or
+    None if the device could not decode the frame). Raises BatchFormatError if the
+    container is unusable.
+    """
+    if len(buffer) < PREVIEW_HEADER.size:
+        raise BatchFormatError("preview container shorter than its header")
+    magic, version, count, total, device_now_ms, cols, rows, _ = PREVIEW_HEADER.unpack_from(buffer, 0)
+    if magic != PREVIEW_MAGIC or version != PREVIEW_VERSION:
+        raise BatchFormatError(f"unknown preview container {magic!r} v{version}")
+    if total != len(buffer):
+        raise BatchFormatError(f"preview container is {len(buffer)} bytes, header says {total}")
+    pixels = cols * rows
+    if PREVIEW_HEADER.size + count * (ENTRY.size + 1 + pixels) != total:
+        raise BatchFormatError("preview container size does not match its frame count")
+
+    previews = []
+    for i in range(count):
+        entry = ENTRY.unpack_from(buffer, PREVIEW_HEADER.size + i * ENTRY.size)
+        frame_id, offset, length, timestamp_ms, crc, flags = entry
+        if offset + 1 + pixels > total:
+            raise BatchFormatError(f"preview {frame_id} runs past the end of the container")
+        valid = buffer[offset] == 1
+        previews.append({"id": frame_id, "timestamp_ms": timestamp_ms, "length": length, "crc": crc,
+                         "event": bool(flags & FLAG_EVENT), "burst": burst_id(flags),
+                         "pixels": bytes(buffer[offset + 1:offset + 1 + pixels]) if valid else None})
+    return device_now_ms, cols, rows, previews
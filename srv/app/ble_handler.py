@@ -2,191 +2,832 @@ import asyncio
 import datetime
 import os
 import functools
-from bleak import BleakScanner, BleakClient
+import time
 
-from . import config, state_manager, database_handler
+try:
+    from bleak import BleakScanner as Scanner, BleakClient as Client
+    from bleak.exc import BleakDeviceNotFoundError
+    # How a direct connection attempt ends when its scan saw no advertisement in time.
+    NOT_ADVERTISING = (asyncio.TimeoutError, BleakDeviceNotFoundError)
+except ImportError:  # Only the simulated backend (fake_ble.py) can run without bleak
+    Scanner = Client = None
+    NOT_ADVERTISING = (asyncio.TimeoutError,)
+
+from . import config, state_manager, database_handler, batch_container, telemetry, ingest, thumbnails, previews, device_log, device_config
+
+
+
+def use_backend(scanner, client):
+    """Swaps the BLE backend, e.g. for the simulated devices in fake_ble.py."""
+    global Scanner, Client
+    Scanner, Client = scanner, client
 
 # --- BLE DATA TRANSFER ---
 
 
-async def transfer_file_data(client, expected_size, buffer, data_type):
-    """Handles the chunk-by-chunk reception of file data."""
+async def transfer_file_data(session, expected_size, sink, data_type):
+    """Handles the chunk-by-chunk reception of file data into `sink` (an ingest.StreamFile)."""
     if expected_size == 0:
         return True
+    client = session.client
     bytes_received = 0
     try:
-        print(f"Waiting for first chunk of {data_type}...")
-        first_chunk = await asyncio.wait_for(state_manager.data_queue.get(), timeout=15.0)
-        buffer.extend(first_chunk)
-        bytes_received = len(buffer)
-        state_manager.data_queue.task_done()
-        print(
+        session.log(f"Waiting for first chunk of {data_type}...")
+        first_chunk = await asyncio.wait_for(session.data_queue.get(), timeout=15.0)
+        sink.write_at(0, first_chunk)
+        bytes_received = len(first_chunk)
+        session.data_queue.task_done()
+        session.log(
             f"Receiving {data_type}: {bytes_received}/{expected_size} bytes", end='\r')
 
         while bytes_received < expected_size:
             await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_NEXT_CHUNK, response=False)
-            chunk = await asyncio.wait_for(state_manager.data_queue.get(), timeout=15.0)
-            buffer.extend(chunk)
-            bytes_received = len(buffer)
-            state_manager.data_queue.task_done()
-            print(
+            chunk = await asyncio.wait_for(session.data_queue.get(), timeout=15.0)
+            sink.write_at(bytes_received, chunk)
+            bytes_received += len(chunk)
+            session.data_queue.task_done()
+            session.log(
                 f"Receiving {data_type}: {bytes_received}/{expected_size} bytes", end='\r')
 
+        # One more 'N' confirms the last chunk, so the device can release the frame.
+        await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_NEXT_CHUNK, response=False)
+
     except asyncio.TimeoutError:
-        print(
-            f"\nERROR: Timeout waiting for {data_type} data at {bytes_received}/{expected_size} bytes.")
+        session.log(
+            f"ERROR: Timeout waiting for {data_type} data at {bytes_received}/{expected_size} bytes.")
+        return False
+    except Exception as e:
+        session.log(f"ERROR: Link lost during {data_type} at {bytes_received}/{expected_size} bytes: {e}")
         return False
 
-    print(
-        f"\n-> {data_type} transfer complete ({bytes_received} bytes received).")
+    session.log(
+        f"-> {data_type} transfer complete ({bytes_received} bytes received).")
     return True
 
 
-async def handle_image_transfer(client, img_size):
-    """Manages the complete image transfer process."""
+def _window_ack_packet(next_expected, credit):
+    return config.CMD_CUMULATIVE_ACK + next_expected.to_bytes(2, 'little') + bytes([credit])
+
+
+async def transfer_file_data_windowed(session, expected_size, sink, data_type):
+    """Receives sequence-numbered chunks, writing each at its offset in `sink`.
+
+    Gaps are NACKed for selective retransmit, and every cumulative ACK grants the
+    device another window of credit.
+    """
+    if expected_size == 0:
+        return True
+    client = session.client
+    chunk_size = session.transfer_chunk_size
+    window = session.transfer_window
+    total_chunks = (expected_size + chunk_size - 1) // chunk_size
+    received = [False] * total_chunks
+    nacked = set()
+    next_expected = 0
+    since_ack = 0
+    retries = 0
+
     try:
-        state_manager.server_state["status"] = f"Receiving image ({img_size} bytes)..."
-        await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_ACKNOWLEDGE, response=False)
-        img_buffer = bytearray()
+        while next_expected < total_chunks:
+            try:
+                chunk = await asyncio.wait_for(session.data_queue.get(), timeout=config.WINDOW_GAP_TIMEOUT)
+            except asyncio.TimeoutError:
+                retries += 1
+                if retries > config.WINDOW_MAX_RETRIES:
+                    raise
+                # Re-grant credit and ask for the first hole; either may have been lost.
+                await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, _window_ack_packet(next_expected, window), response=False)
+                await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_NACK + next_expected.to_bytes(2, 'little'), response=False)
+                continue
+            session.data_queue.task_done()
+            retries = 0
+
+            if len(chunk) < config.WINDOW_CHUNK_HEADER:
+                continue
+            seq = int.from_bytes(chunk[:config.WINDOW_CHUNK_HEADER], 'little')
+            if seq >= total_chunks or received[seq]:
+                continue
+            offset = seq * chunk_size
+            sink.write_at(offset, chunk[config.WINDOW_CHUNK_HEADER:])
+            received[seq] = True
+
+            # Anything between the cumulative point and this chunk is a hole.
+            for missing in range(next_expected, seq):
+                if not received[missing] and missing not in nacked:
+                    nacked.add(missing)
+                    await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_NACK + missing.to_bytes(2, 'little'), response=False)
+
+            while next_expected < total_chunks and received[next_expected]:
+                next_expected += 1
+            since_ack += 1
+            session.log(
+                f"Receiving {data_type}: {min(next_expected * chunk_size, expected_size)}/{expected_size} bytes", end='\r')
+
+            if since_ack >= max(1, window // 2) or next_expected == total_chunks:
+                since_ack = 0
+                session.last_window_ack = _window_ack_packet(next_expected, window)
+                await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, session.last_window_ack, response=False)
 
-        if await transfer_file_data(client, img_size, img_buffer, "Image"):
-            timestamp = datetime.datetime.now()
-            filename = timestamp.strftime("%Y-%m-%d_%H-%M-%S-%f") + ".jpg"
-            filepath = os.path.join(config.IMGS_PATH, filename)
-            with open(filepath, "wb") as f:
-                f.write(img_buffer)
+    except asyncio.TimeoutError:
+        session.log(
+            f"ERROR: Timeout waiting for {data_type} data at chunk {next_expected}/{total_chunks}.")
+        sink.truncate(next_expected * chunk_size)  # Keep the contiguous prefix for a resume
+        return False
+    except Exception as e:
+        session.log(f"ERROR: Link lost during {data_type} at chunk {next_expected}/{total_chunks}: {e}")
+        sink.truncate(next_expected * chunk_size)
+        return False
+
+    session.log(
+        f"-> {data_type} transfer complete ({expected_size} bytes, {len(nacked)} NACKs).")
+    return True
+
+
+async def receive_stream(session, size, data_type, sink):
+    """ACKs an announced stream and receives it into `sink` with whichever protocol is active.
+
+    Returns True once all of it arrived. When the transfer fails, sink holds the
+    contiguous prefix that did arrive.
+    """
+    windowed = session.transfer_window > 0
+    if windowed:
+        # Drop stray retransmissions of the previous stream before this one starts.
+        while not session.data_queue.empty():
+            session.data_queue.get_nowait()
+    session.transfer_active = True
+    await session.client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_ACKNOWLEDGE, response=False)
+    try:
+        if windowed:
+            return await transfer_file_data_windowed(session, size, sink, data_type)
+        return await transfer_file_data(session, size, sink, data_type)
+    finally:
+        session.transfer_active = False
+
+
+def frame_filename(timestamp, device_tag, frame_id=None):
+    # The device tag keeps names unique when several cameras deliver in the same microsecond.
+    suffix = f"_{frame_id}" if frame_id is not None else ""
+    return timestamp.strftime("%Y-%m-%d_%H-%M-%S-%f") + f"_{device_tag}" + suffix + ".jpg"
+
+
+def capture_row(session, timestamp, filename, frame_id=None, crc=None, full=True, event=False, burst=0):
+    return (timestamp.isoformat(), os.path.join(config.IMGS_FOLDER_NAME, filename), session.address,
+            frame_id, crc, 1 if full else 0, 1 if event else 0, burst)
+
+
+def save_frame(session, timestamp, data, frame_id=None, crc=None, full=True, event=False, burst=0):
+    """Writes one JPEG (or a preview of one) to disk and returns its row for the database."""
+    filename = frame_filename(timestamp, session.tag, frame_id if full else f"{frame_id}_preview")
+    ingest.write_atomically(os.path.join(config.IMGS_PATH, filename), data)
+    thumbnails.make_thumbnail(filename, data)
+    return capture_row(session, timestamp, filename, frame_id, crc, full, event, burst)
+
+
+def store_captures(session, rows):
+    """Records capture rows in one transaction; full frames replace their previews."""
+    previews.discard(database_handler.db_insert_captures(rows))
+    full = sum(row[5] for row in rows)
+    session.status["images_received"] += full
+    session.status["previews_received"] += len(rows) - full
+
+
+def queue_capture(session, row):
+    """Holds a per-image capture row until its batch (announced by COUNT:) is complete."""
+    session.pending_captures.append(row)
+    session.batch_remaining -= 1
+    if session.batch_remaining <= 0:
+        flush_captures(session)
+
+
+def flush_captures(session):
+    """Records the held capture rows in one transaction."""
+    rows, session.pending_captures = session.pending_captures, []
+    store_captures(session, rows)
+
+
+def remember_frame(session, frame_id, crc, data):
+    """Records how much of a frame we hold, for the resume point sent on connect."""
+    if frame_id is not None:
+        session.resume_point = {"id": frame_id, "crc": crc, "data": bytes(data)}
+
+
+def resume_packet(session):
+    point = session.resume_point or {"id": 0, "crc": 0, "data": b""}
+    return (config.CMD_RESUME + point["id"].to_bytes(4, 'little') +
+            len(point["data"]).to_bytes(4, 'little') + point["crc"].to_bytes(4, 'little'))
+
+
+async def handle_image_transfer(session, img_size, frame_id=None, offset=0, crc=0, flags=0):
+    """Manages the complete image transfer process.
 
-            db_path = os.path.join(config.IMGS_FOLDER_NAME, filename)
-            database_handler.db_insert_capture(timestamp.isoformat(), db_path)
+    A resumed image (offset > 0) carries only the bytes from offset on; the rest
+    comes from the partial frame kept when the previous transfer broke off.
+    """
+    sink = None
+    try:
+        session.set_status(f"Receiving image ({img_size} bytes)...")
+        prefix = batch_container.resumed_prefix(session.resume_point, frame_id, crc, offset)
+        sink = ingest.StreamFile(config.IMGS_PATH, prefix or b'')
+        transfer_ok = await receive_stream(session, img_size - offset, "Image", sink)
+
+        if prefix is None:
+            session.log(f"-> Image {frame_id} resumes data we no longer hold; discarding.")
+            session.set_status("Image transfer failed")
+        elif transfer_ok:
+            timestamp = datetime.datetime.now()
+            filename = frame_filename(timestamp, session.tag, frame_id)
+            data = sink.read_all()
+            sink.commit(os.path.join(config.IMGS_PATH, filename))
+            thumbnails.make_thumbnail(filename, data)
+            queue_capture(session, capture_row(session, timestamp, filename, frame_id, crc,
+                                               event=flags & batch_container.FLAG_EVENT,
+                                               burst=batch_container.burst_id(flags)))
+            remember_frame(session, frame_id, crc, data)
+
+            session.log(f"-> Saved image to {filename}")
+            session.set_status(f"Image saved: {filename}")
+        else:
+            remember_frame(session, frame_id, crc, sink.read_all())
+            session.set_status("Image transfer failed")
 
-            print(f"-> Saved image to {filepath}")
-            state_manager.server_state["status"] = f"Image saved: {filename}"
+    except Exception as e:
+        session.transfer_active = False
+        session.log(f"Error during image transfer task: {e}")
+        session.set_status("Image transfer failed due to connection error.")
+    finally:
+        if sink:
+            sink.discard()
+
+
+async def handle_batch_transfer(session, batch_size, frame_count):
+    """Receives a whole batch container, splits it into files and records them together.
+
+    The container streams to a temp file and is split one frame at a time. If
+    the stream breaks off, every complete frame in the prefix that arrived is
+    still kept, and the frame cut short becomes the resume point. So does a
+    frame that fails its CRC in a prefix, from its first byte, as the device
+    still holds it and everything after it.
+    """
+    sink = ingest.StreamFile(config.IMGS_PATH)
+    try:
+        session.set_status(f"Receiving batch of {frame_count} images ({batch_size} bytes)...")
+        transfer_ok = await receive_stream(session, batch_size, "Batch", sink)
+
+        available = sink.size()
+        count = batch_container.frame_count(sink.read(0, batch_container.HEADER.size))
+        device_now_ms, first_offset, entries = batch_container.read_table(
+            sink.read(0, batch_container.table_size(count)), available, complete=transfer_ok)
+        received_at = datetime.datetime.now()
+        rows = []
+        frames = 0
+        last = None
+        partial = None
+        bad = None
+        for frame in batch_container.iter_frames(entries, first_offset, sink.read, available,
+                                                 session.resume_point):
+            if not frame["complete"]:
+                partial = frame
+                break
+            frames += 1
+            if not frame["crc_ok"]:
+                if transfer_ok:
+                    # The device released the whole container once it was acknowledged.
+                    session.log(f"-> Frame {frame['id']} failed its CRC check; the device no longer holds it.")
+                    continue
+                # Still queued on the device: resume from its first byte, so it and
+                # everything after it are sent again.
+                session.log(f"-> Frame {frame['id']} failed its CRC check; asking for it again.")
+                bad = frame
+                break
+            last = frame
+            # Frame timestamps are device millis; anchor them to our clock at receipt.
+            age_ms = (device_now_ms - frame["timestamp_ms"]) & 0xFFFFFFFF
+            timestamp = received_at - datetime.timedelta(milliseconds=age_ms)
+            rows.append(save_frame(session, timestamp, frame["data"], frame["id"], frame["crc"],
+                                   event=frame["event"], burst=frame["burst"]))
+        if bad:
+            remember_frame(session, bad["id"], bad["crc"], b"")
+        elif partial:
+            remember_frame(session, partial["id"], partial["crc"], partial["data"])
+        elif last:
+            remember_frame(session, last["id"], last["crc"], last["data"])
+
+        store_captures(session, rows)
+        session.log(f"-> Saved {len(rows)}/{frames} images from batch.")
+        if transfer_ok:
+            session.set_status(f"Batch saved: {len(rows)} images")
         else:
-            state_manager.server_state["status"] = "Image transfer failed"
+            session.set_status(f"Batch broke off; kept {len(rows)} images")
 
+    except batch_container.BatchFormatError as e:
+        session.log(f"Bad batch container: {e}")
+        session.set_status("Batch transfer failed: bad container.")
     except Exception as e:
-        print(f"\nError during image transfer task: {e}")
-        state_manager.server_state["status"] = "Image transfer failed due to connection error."
+        session.transfer_active = False
+        session.log(f"Error during batch transfer task: {e}")
+        session.set_status("Batch transfer failed due to connection error.")
+    finally:
+        sink.discard()
+
+async def handle_preview_transfer(session, size, frame_count):
+    """Receives a preview container and stores each preview as a capture row with full = 0.
+
+    The full frames stay on the device until PICK:, when handle_pick() asks for
+    the ones the policy or the gallery wants.
+    """
+    sink = ingest.StreamFile(config.IMGS_PATH)
+    try:
+        session.set_status(f"Receiving {frame_count} previews ({size} bytes)...")
+        if not await receive_stream(session, size, "Previews", sink):
+            session.set_status("Preview transfer failed")
+            return
+        device_now_ms, cols, rows, batch = batch_container.parse_previews(sink.read_all())
+        received_at = datetime.datetime.now()
+        captures = []
+        for preview in batch:
+            if preview["pixels"] is None:
+                session.log(f"-> Frame {preview['id']} has no preview; it will be pulled in full.")
+                continue
+            age_ms = (device_now_ms - preview["timestamp_ms"]) & 0xFFFFFFFF
+            timestamp = received_at - datetime.timedelta(milliseconds=age_ms)
+            captures.append(save_frame(session, timestamp, previews.preview_jpeg(preview["pixels"], cols, rows),
+                                       preview["id"], preview["crc"], full=False, event=preview["event"],
+                                       burst=preview["burst"]))
+        store_captures(session, captures)
+        session.preview_batch = (cols, rows, batch)
+        session.log(f"-> Saved {len(captures)}/{len(batch)} previews.")
+        session.set_status(f"Previews saved: {len(captures)}")
+    except batch_container.BatchFormatError as e:
+        session.log(f"Bad preview container: {e}")
+        session.set_status("Preview transfer failed: bad container.")
+    except Exception as e:
+        session.transfer_active = False
+        session.log(f"Error during preview transfer task: {e}")
+        session.set_status("Preview transfer failed due to connection error.")
+    finally:
+        sink.discard()
+
+
+async def handle_pick(session, held):
+    """Answers PICK: with an 'F' for each frame wanted in full, then 'G'.
+
+    The policy chooses among this connection's previews; frames flagged in the
+    gallery are asked for whichever connection previewed them. The device
+    ignores ids it no longer holds.
+    """
+    if session.preview_task:
+        await session.preview_task
+    picks = []
+    if session.preview_batch:
+        cols, rows, batch = session.preview_batch
+        picks = previews.choose(session, batch, cols, rows)
+        session.preview_batch = None
+    wanted = [frame_id for frame_id, _ in picks]
+    flagged = [frame_id for frame_id in database_handler.get_writer().requested_frames(session.address)
+               if frame_id not in wanted]
+    wanted += flagged
+    reasons = {}
+    for _, reason in picks:
+        reasons[reason] = reasons.get(reason, 0) + 1
+    session.log(f"Pulling {len(wanted)} of {held} previewed frames in full "
+                f"({', '.join(f'{n} {r}' for r, n in reasons.items()) or 'none by policy'}, {len(flagged)} flagged).")
+
+    mtu = session.status["link"]["mtu"] if session.status["link"] else 23
+    per_write = max(1, (mtu - 3 - len(config.CMD_FULL_FRAME)) // 4)
+    for start in range(0, len(wanted), per_write):
+        ids = b''.join(frame_id.to_bytes(4, 'little') for frame_id in wanted[start:start + per_write])
+        await session.client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_FULL_FRAME + ids, response=False)
+    await session.client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_PICKS_DONE, response=False)
+    session.set_status(f"Pulling {len(wanted)} full frames...")
 
 # --- BLE NOTIFICATION HANDLERS ---
 
 
-def data_notification_handler(sender, data):
-    """Puts incoming data chunks into the queue."""
-    if state_manager.data_queue:
-        state_manager.data_queue.put_nowait(data)
+def data_notification_handler(sender, data, session):
+    """Puts incoming data chunks into the session's queue."""
+    if session.transfer_window > 0 and not session.transfer_active:
+        # A retransmit after the image completed means our final ACK was lost; repeat it.
+        if session.client and session.last_window_ack:
+            asyncio.create_task(session.client.write_gatt_char(
+                config.CHARACTERISTIC_UUID_COMMAND, session.last_window_ack, response=False))
+        return
+    if session.data_queue:
+        session.data_queue.put_nowait(data)
+
+
+def telemetry_notification_handler(sender, data, session):
+    """Reassembles a paged telemetry snapshot, then decodes and stores it."""
+    snapshot = session.telemetry_pages.add(data)
+    if snapshot is None:
+        return
+    try:
+        decoded = telemetry.parse(snapshot)
+    except telemetry.TelemetryFormatError as e:
+        session.log(f"Bad telemetry snapshot: {e}")
+        return
+    rtt = decoded["histograms"]["chunk_rtt_us"]
+    session.log(f"[TELEMETRY] build {decoded['build']}, {len(decoded['trace'])} tracepoints, "
+                f"chunk RTT mean {rtt['mean']} us over {rtt['count']} chunks.")
+    database_handler.db_insert_telemetry(datetime.datetime.now().isoformat(), decoded, session.address)
+
+
+def log_notification_handler(sender, data, session):
+    """Reassembles the paged device log and replays its lines into the session log."""
+    dump = session.log_pages.add(data)
+    if dump is None:
+        return
+    try:
+        decoded = device_log.parse(dump)
+    except device_log.LogFormatError as e:
+        session.log(f"Bad device log: {e}")
+        return
+    for record in decoded["records"]:
+        session.log(f"[DEVICE] {device_log.format_line(record)}")
+    if decoded["dropped"]:
+        session.log(f"[DEVICE] {decoded['dropped']} log records dropped on the device since boot.")
 
 
-def status_notification_handler(sender, data, client, loop):
+def status_notification_handler(sender, data, session, loop):
     """Handles status updates from the BLE device."""
     async def process_status_update():
         try:
             status_str = data.decode('utf-8').strip()
-            print(f"\n[STATUS] Received: {status_str}")
+            session.log(f"[STATUS] Received: {status_str}")
 
             if status_str.startswith("PSRAM:"):
                 try:
                     usage_val = float(status_str.split(':')[1].split('%')[0])
-                    state_manager.server_state["storage_usage"] = round(
-                        usage_val, 1)
+                    session.status["storage_usage"] = round(usage_val, 1)
                 except (ValueError, IndexError):
                     pass
-                if not state_manager.pending_config_command:
-                    state_manager.server_state["status"] = "Device ready to transfer."
+                session.set_status("Device ready to transfer.")
+
+            elif status_str.startswith("WIN:"):
+                _, window, chunk_size = status_str.split(':')
+                session.transfer_window = int(window)
+                session.transfer_chunk_size = int(chunk_size)
+                session.log(
+                    f"Windowed transfer confirmed: {window} chunks of {chunk_size} bytes.")
+
+            elif status_str.startswith("LINK:"):
+                # LINK:<mtu>:<interval in 1.25 ms units>:<LL data length>, sent as each session starts.
+                mtu, interval, data_length = (int(f) for f in status_str.split(':')[1:4])
+                session.status["link"] = {
+                    "mtu": mtu, "interval_ms": interval * 1.25, "data_length": data_length}
+                # Stop-and-wait chunks are at most one notification; the windowed size follows in WIN:.
+                session.transfer_chunk_size = min(512, mtu - 3)
+                session.log(f"Link: MTU {mtu}, interval {interval * 1.25:.2f} ms, LL data length {data_length}.")
+
+            elif status_str.startswith("CONNECT:"):
+                # CONNECT:<ms advertising before we connected>:<within the fast interval 0|1>:<bonded 0|1>,
+                # bonded meaning the device held our keys when we connected.
+                connect_ms, fast, bonded = (int(f) for f in status_str.split(':')[1:4])
+                report = session.status["connect"] or {}
+                report.update(device_connect_ms=connect_ms, fast_advertising=bool(fast), bonded=bool(bonded))
+                if report.get("path") == "direct":
+                    report["connect_ms"] = connect_ms
+                session.status["connect"] = report
+                session.log(f"Device advertised {connect_ms} ms ({'fast' if fast else 'slow'} interval) before "
+                            f"the {report.get('path', 'scan')} connection; setup took {report.get('setup_ms')} ms"
+                            f"{', link bonded' if bonded else ''}.")
+                if session.bonded_at_connect and not bonded:
+                    # The device lost its keys (reflashed); pair again on the next connection.
+                    session.log("Device does not hold our bond; pairing again next time.")
+                    session.bonded = False
+
+            elif status_str.startswith("CHANGE:"):
+                captures, skipped, keyframes = (int(f) for f in status_str.split(':')[1:4])
+                session.status["change_gate"] = {
+                    "captures": captures, "skipped": skipped, "keyframes": keyframes}
+                rate = 100.0 * skipped / captures if captures else 0.0
+                session.log(f"Change gate skipped {skipped} of {captures} captures ({rate:.1f}%), {keyframes} keyframes.")
+
+            elif status_str.startswith("POWER:"):
+                # POWER:<full clock ms>:<awake ms>:<idle ms>:<asleep ms>:<frames>:<auto sleep>, totals since boot.
+                full, awake, idle, asleep, frames, auto_sleep = (int(f) for f in status_str.split(':')[1:7])
+                session.status["power"] = {
+                    "full_clock_ms": full, "awake_ms": awake, "idle_ms": idle, "asleep_ms": asleep,
+                    "frames": frames, "auto_sleep": bool(auto_sleep)}
+                if frames:
+                    session.log(f"Power per frame: {full / frames:.0f} ms at full clock, {awake / frames:.0f} ms awake, "
+                                f"{idle / frames:.0f} ms idle{' (auto light sleep)' if auto_sleep else ''}, "
+                                f"{asleep / frames:.0f} ms asleep over {frames} frames.")
+
+            elif status_str.startswith("CONFIG:"):
+                # CONFIG:<result>:<tag>:<version>, the device's answer to a settings write.
+                accepted, message = device_config.parse_result(status_str)
+                session.log(message)
+                session.set_status("Settings applied on device." if accepted else "Device refused the settings.")
+                if accepted:
+                    await read_device_config(session)
 
             elif status_str.startswith("COUNT:"):
                 image_count = int(status_str.split(':')[1])
+                flush_captures(session)
+                session.batch_remaining = image_count
                 status_msg = f"Batch of {image_count} images incoming. Acknowledging."
-                state_manager.server_state["status"] = status_msg
-                print(status_msg)
-                await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_ACKNOWLEDGE, response=False)
+                session.set_status(status_msg)
+                session.log(status_msg)
+                await session.client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_ACKNOWLEDGE, response=False)
 
             elif status_str.startswith("IMAGE:"):
-                img_size = int(status_str.split(':')[1])
-                asyncio.create_task(handle_image_transfer(client, img_size))
+                # IMAGE:<length>[:<id>:<offset>:<crc32>[:<flags>]]; older firmware sends the length only.
+                fields = [int(f) for f in status_str.split(':')[1:]]
+                if len(fields) >= 4:
+                    asyncio.create_task(handle_image_transfer(session, *fields[:5]))
+                else:
+                    asyncio.create_task(handle_image_transfer(session, fields[0]))
+
+            elif status_str.startswith("BATCH:"):
+                _, batch_size, frame_count = status_str.split(':')
+                asyncio.create_task(handle_batch_transfer(
+                    session, int(batch_size), int(frame_count)))
+
+            elif status_str.startswith("PREVIEW:"):
+                _, size, frame_count = status_str.split(':')
+                session.preview_task = asyncio.create_task(handle_preview_transfer(
+                    session, int(size), int(frame_count)))
+
+            elif status_str.startswith("PICK:"):
+                await handle_pick(session, int(status_str.split(':')[1]))
 
         except Exception as e:
-            print(f"Error in process_status_update: {e}")
+            session.log(f"Error in process_status_update: {e}")
 
     asyncio.run_coroutine_threadsafe(process_status_update(), loop)
 
+# --- SESSIONS ---
+
+
+def update_summary():
+    """The top-level status line: how many cameras are being served right now."""
+    active = state_manager.active_sessions()
+    if active:
+        names = ", ".join(session.tag for session in active)
+        state_manager.server_state["status"] = (
+            f"Scanning; {len(active)} of {config.MAX_SESSIONS} sessions active ({names}).")
+    else:
+        state_manager.server_state["status"] = "Scanning for camera devices..."
+
+
+async def read_device_config(session):
+    """Keeps what the device reports holding in its status, for /api/settings."""
+    try:
+        data = await session.client.read_gatt_char(config.CHARACTERISTIC_UUID_CONFIG)
+        session.status["config"] = device_config.decode(bytes(data))
+    except Exception as e:
+        session.log(f"Device settings not readable: {e}")
+
+
+async def send_pending_config(session):
+    """Sends the latest settings once to each device that has not had them.
+
+    The device checks and applies them straight away, mid-transfer included,
+    and answers with a CONFIG: status line.
+    """
+    version = state_manager.config_version
+    if session.config_version >= version or not state_manager.pending_config_command:
+        return
+    cmd = state_manager.pending_config_command
+    session.log(f"Sending settings v{version} ({len(cmd)} bytes): {device_config.decode(cmd)}")
+    try:
+        await session.client.write_gatt_char(config.CHARACTERISTIC_UUID_CONFIG, cmd, response=False)
+        session.config_version = version
+        session.set_status("Settings sent to device.")
+    except Exception as e:
+        session.log(f"Failed to send config: {e}")
 
-def detection_callback(device, advertising_data):
-    """Callback triggered when a BLE device is found."""
-    if device.name and any(name in device.name for name in config.DEVICE_NAMES):
+
+async def pair(session, client):
+    """Bonds with a camera on its first session, so later ones reconnect encrypted
+    without pairing and the host keeps its GATT database."""
+    if not config.BOND or session.bonded:
+        return
+    try:
+        await client.pair()
+        session.bonded = True
+        session.log("Bonded with device.")
+    except Exception as e:
+        session.log(f"Pairing failed, continuing without a bond: {e}")
+
+
+def claim_slot(session):
+    """Marks a connected session active. Once every slot is taken, pending direct
+    connection attempts are cancelled, so none lands on a full server."""
+    session.active = True
+    session.connecting = None
+    if len(state_manager.active_sessions()) >= config.MAX_SESSIONS:
+        for other in state_manager.devices.values():
+            if other.connecting:
+                other.connecting.cancel()
+    update_summary()
+
+
+async def run_session(session, target, loop, direct=False):
+    """Serves one connection to one device, from connect to disconnect.
+
+    Each session has its own client, queue and transfer state, so several run
+    side by side while the scanner keeps looking for more. `target` is what the
+    scanner reported, or on the direct path just the device's address.
+    """
+    started = time.monotonic()
+    connected = False
+    session.set_status(f"{'Waiting to connect directly to' if direct else 'Connecting to'} {session.address}...")
+    try:
+        async with Client(target, timeout=config.DIRECT_CONNECT_TIMEOUT if direct else 20.0) as client:
+            if client.is_connected:
+                connected = True
+                connected_at = time.monotonic()
+                if direct:
+                    if len(state_manager.active_sessions()) >= config.MAX_SESSIONS:
+                        session.log("Connected directly, but every session slot is taken; dropping the link.")
+                        return
+                    claim_slot(session)
+                session.reset_link(client)
+                # The direct attempt may have been open since before the camera
+                # woke, so its figure is replaced by the device's own
+                # advertising time once CONNECT: arrives.
+                session.status["connect"] = {
+                    "path": "direct" if direct else "scan",
+                    "connect_ms": round((connected_at - (started if direct else session.seen_at or started)) * 1000),
+                    "setup_ms": None}
+                session.set_status("Connected. Setting up notifications...")
+                await pair(session, client)
+                database_handler.db_remember_device(session.address, session.name, session.bonded,
+                                                    datetime.datetime.now().isoformat())
+
+                status_handler = functools.partial(
+                    status_notification_handler, session=session, loop=loop)
+                data_handler = functools.partial(
+                    data_notification_handler, session=session)
+                await client.start_notify(config.CHARACTERISTIC_UUID_STATUS, status_handler)
+                await client.start_notify(config.CHARACTERISTIC_UUID_DATA, data_handler)
+                session.telemetry_pages = telemetry.PageAssembler()
+                try:
+                    await client.start_notify(config.CHARACTERISTIC_UUID_TELEMETRY,
+                                              functools.partial(telemetry_notification_handler, session=session))
+                except Exception as e:
+                    session.log(f"Telemetry not available on this device: {e}")
+                session.log_pages = telemetry.PageAssembler()
+                try:
+                    await client.start_notify(config.CHARACTERISTIC_UUID_LOG,
+                                              functools.partial(log_notification_handler, session=session))
+                except Exception as e:
+                    session.log(f"Device log not available on this device: {e}")
+
+                await read_device_config(session)
+
+                if config.TRANSFER_WINDOW > 0:
+                    # Devices without windowed support ignore this and stay on 'N'.
+                    await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_WINDOW + bytes([config.TRANSFER_WINDOW]), response=False)
+
+                if config.BATCH_CONTAINER:
+                    # Older firmware ignores this and keeps sending IMAGE: per frame.
+                    await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_BATCH_CONTAINER, response=False)
+
+                if config.PREVIEW_FIRST:
+                    # Older firmware ignores this and sends every frame in full.
+                    await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_PREVIEWS +
+                                                 config.PREVIEW_RETENTION_MIN.to_bytes(2, 'little'), response=False)
+
+                # Tell the device what we already hold so it resumes instead of resending.
+                await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, resume_packet(session), response=False)
+
+                session.log(
+                    "Subscribed to notifications. Signaling device that we are ready.")
+                await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_READY, response=False)
+                session.status["connect"]["setup_ms"] = round((time.monotonic() - connected_at) * 1000)
+                session.set_status("Ready. Waiting for device data...")
+
+                while client.is_connected:
+                    await send_pending_config(session)
+                    await asyncio.sleep(1)
+                session.log("Client disconnected.")
+                session.set_status("Disconnected.")
+
+    except NOT_ADVERTISING:
+        if connected or not direct:
+            session.set_status("Connection Error: timed out")
+    except Exception as e:
+        session.set_status(f"Connection Error: {e}")
+        if direct and not connected:
+            session.log(f"Direct connection failed: {e}")
+            session.retry_after = time.monotonic() + config.RECONNECT_DELAY
+    finally:
+        if direct and not connected:
+            # The camera did not advertise while the attempt was scanning, or
+            # the attempt was cancelled; direct_connect makes the next one.
+            session.connecting = None
+            if session.status["status"].startswith("Waiting to connect directly"):
+                session.set_status("Asleep.")
+        elif session.active or connected:
+            flush_captures(session)  # Images of a batch cut short by the disconnect
+            session.status["connected"] = False
+            session.client = None
+            session.active = False
+            session.connecting = None
+            session.seen_at = None
+            session.retry_after = time.monotonic() + config.RECONNECT_DELAY
+            update_summary()
+
+
+async def direct_connect(session, loop):
+    """Keeps a direct connection attempt running for a bonded camera while it has
+    no session and a slot is free. Given just the address, the client runs a
+    scan filtered to that address and connects on the first advertisement it
+    sees, without waiting for the main scanner to report the camera or match
+    its name. An attempt that sees nothing within DIRECT_CONNECT_TIMEOUT is
+    replaced by a new one."""
+    while True:
+        if (not session.bonded or session.active or session.connecting or time.monotonic() < session.retry_after
+                or len(state_manager.active_sessions()) >= config.MAX_SESSIONS):
+            await asyncio.sleep(0.2)
+            continue
+        session.connecting = loop.create_task(run_session(session, session.address, loop, direct=True))
+        await asyncio.wait([session.connecting])
+
+
+def is_camera(device, advertising_data):
+    """A camera we have not met: our service in the advertisement, or a known name."""
+    if advertising_data is not None and config.SERVICE_UUID in (advertising_data.service_uuids or []):
+        return True
+    return bool(device.name) and any(name in device.name for name in config.DEVICE_NAMES)
+
+
+def detection_callback(device, advertising_data, loop, tasks):
+    """Called by the scanner for every advertisement; starts a session for a target device if a slot is free.
+
+    Known cameras are matched by address alone, so a bare advertisement without
+    the name or scan response is enough.
+    """
+    session = state_manager.devices.get(device.address)
+    if session is None:
+        if not is_camera(device, advertising_data):
+            return
+        session = state_manager.devices[device.address] = state_manager.DeviceSession(device.address, device.name)
         print(f"[SCAN] Target device found: {device.address} ({device.name})")
-        if state_manager.device_found_event and not state_manager.device_found_event.is_set():
-            state_manager.found_device = device
-            state_manager.device_found_event.set()
+        if config.DIRECT_CONNECT:
+            start_direct_connect(session, loop, tasks)
+    if session.active or session.connecting or time.monotonic() < session.retry_after:
+        return
+    if len(state_manager.active_sessions()) >= config.MAX_SESSIONS:
+        session.set_status("Waiting for a free session slot.")
+        return
+    # Claimed here, before the task runs, so the next advertisement cannot start a second session.
+    session.seen_at = time.monotonic()
+    claim_slot(session)
+    task = loop.create_task(run_session(session, device, loop))
+    tasks.add(task)
+    task.add_done_callback(tasks.discard)
+
+
+def start_direct_connect(session, loop, tasks):
+    task = loop.create_task(direct_connect(session, loop))
+    tasks.add(task)
+    task.add_done_callback(tasks.discard)
+
+
+def load_known_devices(loop, tasks):
+    """Sessions for every camera that has connected before, from the devices table."""
+    for address, name, bonded in database_handler.db_known_devices():
+        if address in state_manager.devices:
+            continue
+        session = state_manager.devices[address] = state_manager.DeviceSession(address, name)
+        session.bonded = bonded
+        session.set_status("Known; waiting for it to advertise.")
+        if config.DIRECT_CONNECT:
+            start_direct_connect(session, loop, tasks)
+    if state_manager.devices:
+        print(f"[SCAN] {len(state_manager.devices)} known device(s), "
+              f"{sum(session.bonded for session in state_manager.devices.values())} bonded.")
 
 # --- MAIN BLE TASK ---
 
 
 async def ble_communication_task():
-    """The main asynchronous task that handles all BLE communication."""
-    state_manager.data_queue = asyncio.Queue()
-    state_manager.device_found_event = asyncio.Event()
+    """The main asynchronous task that handles all BLE communication.
+
+    The scanner runs for as long as the server does; every target device it
+    reports gets its own session task, up to config.MAX_SESSIONS at a time.
+    Bonded cameras are also connected to directly (see direct_connect).
+    """
     loop = asyncio.get_running_loop()
+    tasks = set()  # Keeps the running session and direct connection tasks referenced
+    callback = functools.partial(detection_callback, loop=loop, tasks=tasks)
+    load_known_devices(loop, tasks)
 
     while True:
-        if not state_manager.pending_config_command:
-            state_manager.server_state["status"] = "Scanning for camera device..."
+        update_summary()
         print(f"\n{state_manager.server_state['status']}")
-
-        scanner = BleakScanner(detection_callback=detection_callback)
+        scanner = Scanner(detection_callback=callback)
         try:
             await scanner.start()
-            await asyncio.wait_for(state_manager.device_found_event.wait(), timeout=120.0)
-            await scanner.stop()
-        except asyncio.TimeoutError:
-            await scanner.stop()
-            continue
+            await asyncio.Event().wait()  # Scan until the task is cancelled
         except Exception as e:
             print(f"Error during scan: {e}")
-            await scanner.stop()
-            continue
-
-        if state_manager.found_device:
-            if not state_manager.pending_config_command:
-                state_manager.server_state[
-                    "status"] = f"Connecting to {state_manager.found_device.address}..."
+        finally:
             try:
-                async with BleakClient(state_manager.found_device, timeout=20.0) as client:
-                    if client.is_connected:
-                        state_manager.server_state["status"] = "Connected. Setting up notifications..."
-                        while not state_manager.data_queue.empty():
-                            state_manager.data_queue.get_nowait()
-
-                        status_handler = functools.partial(
-                            status_notification_handler, client=client, loop=loop)
-                        await client.start_notify(config.CHARACTERISTIC_UUID_STATUS, status_handler)
-                        await client.start_notify(config.CHARACTERISTIC_UUID_DATA, data_notification_handler)
-
-                        print(
-                            "Subscribed to notifications. Signaling device that we are ready.")
-                        await client.write_gatt_char(config.CHARACTERISTIC_UUID_COMMAND, config.CMD_READY, response=False)
-
-                        if not state_manager.pending_config_command:
-                            state_manager.server_state["status"] = "Ready. Waiting for device data..."
-
-                        while client.is_connected:
-                            if state_manager.pending_config_command:
-                                cmd = state_manager.pending_config_command
-                                print(f"Sending config command: {cmd}")
-                                try:
-                                    await client.write_gatt_char(config.CHARACTERISTIC_UUID_CONFIG, bytearray(cmd, 'utf-8'), response=False)
-                                    state_manager.pending_config_command = None
-                                    state_manager.server_state["status"] = "Settings sent to device."
-                                except Exception as e:
-                                    print(f"Failed to send config: {e}")
-                            await asyncio.sleep(1)
-                        print("Client disconnected.")
-
-            except Exception as e:
-                state_manager.server_state["status"] = f"Connection Error: {e}"
-            finally:
-                if not state_manager.pending_config_command:
-                    state_manager.server_state["status"] = "Disconnected. Resuming scan."
-                state_manager.device_found_event.clear()
-                state_manager.found_device = None
-                await asyncio.sleep(2)
+                await scanner.stop()
+            except Exception:
+                pass
+        await asyncio.sleep(config.RECONNECT_DELAY)
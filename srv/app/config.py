@@ -6,12 +6,35 @@ ROOT_DIR = os.path.abspath(os.path.join(os.path.dirname(__file__), '..'))
 IMGS_FOLDER_NAME = 'imgs'
 IMGS_PATH = os.path.join(ROOT_DIR, IMGS_FOLDER_NAME)
 DB_PATH = os.path.join(ROOT_DIR, 'captures.db')
+# Thumbnails share the image's file name; they are made once at ingest.
+THUMBS_FOLDER_NAME = 'thumbs'
+THUMBS_PATH = os.path.join(ROOT_DIR, THUMBS_FOLDER_NAME)
+THUMB_SIZE = (320, 240)
+THUMB_QUALITY = 70
 
 # --- WEB SERVER ---
 FLASK_PORT = 5550
+CAPTURES_PAGE_DEFAULT = 24  # Rows per /api/captures page unless ?limit= says otherwise
+CAPTURES_PAGE_MAX = 200
 
 # --- BLE DEVICE & PROTOCOL ---
 DEVICE_NAMES = ["T-Camera-BLE-Batch", "T-Camera-BLE"]
+# Cameras served at once. The scanner keeps running while sessions are active;
+# a device seen while every slot is taken is picked up on a later advertisement.
+MAX_SESSIONS = 3
+RECONNECT_DELAY = 2.0  # Seconds a device is left alone after its session ends
+
+# --- RECONNECT ---
+# A camera is remembered by address once it has connected (the devices table)
+# and bonded on its first session. After that the scanner matches it by address
+# on its first advertisement, whatever the packet carries, and a bonded camera
+# also gets a standing direct connection attempt: a scan filtered to its address
+# that connects on the first advertisement it sees, instead of waiting for the
+# main scanner to report it. New cameras are
+# matched by the service UUID in their advertisement, or by name.
+BOND = True
+DIRECT_CONNECT = True
+DIRECT_CONNECT_TIMEOUT = 30.0  # Seconds per attempt's scan; a new one starts when it runs out
 
 # UUIDs for BLE Service and Characteristics
 SERVICE_UUID = "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
@@ -19,8 +42,47 @@ CHARACTERISTIC_UUID_STATUS = "beb5483e-36e1-4688-b7f5-ea07361b26a8"
 CHARACTERISTIC_UUID_DATA = "7347e350-5552-4822-8243-b8923a4114d2"
 CHARACTERISTIC_UUID_COMMAND = "a244c201-1fb5-459e-8fcc-c5c9c331914b"
 CHARACTERISTIC_UUID_CONFIG = "a31a6820-8437-4f55-8898-5226c04a29a3"
+# Paged wake-cycle telemetry snapshot (see telemetry.py); missing on older firmware.
+CHARACTERISTIC_UUID_TELEMETRY = "d2a5c7f0-3b8e-4c1a-9f62-5e0b7a41c3d8"
+# Paged event log records drained since the last session (see device_log.py); missing on older firmware.
+CHARACTERISTIC_UUID_LOG = "6e1f3b9a-84c2-4d7e-a5f0-2c9b8d17e4a6"
 
 # Protocol Command Bytes
 CMD_NEXT_CHUNK = b'N'
 CMD_ACKNOWLEDGE = b'A'
 CMD_READY = b'R'
+CMD_WINDOW = b'W'           # Followed by one byte: requested window size in chunks
+CMD_CUMULATIVE_ACK = b'K'   # Followed by u16 next expected seq (LE) and u8 credit
+CMD_NACK = b'X'             # Followed by u16 missing seq (LE)
+CMD_BATCH_CONTAINER = b'B'  # We accept the whole batch as one container stream
+CMD_RESUME = b'P'           # Followed by u32 frame id, u32 bytes held, u32 crc32 (LE)
+CMD_PREVIEWS = b'V'         # Followed by u16 minutes the device holds frames nobody picked (LE)
+CMD_FULL_FRAME = b'F'       # Followed by u32 frame ids (LE) to send in full, as many as fit one write
+CMD_PICKS_DONE = b'G'       # End of the 'F' list
+
+# --- WINDOWED TRANSFER ---
+# Number of chunks the device may stream ahead of our cumulative ACK. Set to 0 to
+# force the legacy stop-and-wait ('N') protocol.
+TRANSFER_WINDOW = 8
+WINDOW_CHUNK_HEADER = 2     # u16 sequence number at the start of each windowed chunk
+WINDOW_GAP_TIMEOUT = 1.5    # Seconds without data before NACKing the first missing chunk
+WINDOW_MAX_RETRIES = 10
+
+# --- BATCH CONTAINER ---
+# Ask for the whole batch as a single stream (one handshake, one DB transaction)
+# instead of one IMAGE: exchange per frame.
+BATCH_CONTAINER = True
+
+# --- PREVIEW-FIRST ---
+# The device sends a small luma preview of every frame, and only the frames
+# picked from them in full: every PIR-triggered one with FULL_FRAME_EVENTS, every
+# FULL_FRAME_EVERY-th, any whose preview changed by FULL_FRAME_CHANGE percent of
+# its cells since the last one pulled, and any flagged in the gallery while the
+# device still holds it. Frames nobody picks are
+# dropped after PREVIEW_RETENTION_MIN minutes. 0 turns either rule off.
+PREVIEW_FIRST = True
+PREVIEW_RETENTION_MIN = 60
+FULL_FRAME_EVENTS = True
+FULL_FRAME_EVERY = 10
+FULL_FRAME_CHANGE = 25
+PREVIEW_SCALE = 4           # Previews are stored upscaled by this much, for the gallery
@@ -1,51 +1,225 @@
+import json
 import os
 import sqlite3
-from .config import DB_PATH, IMGS_PATH
+import threading
+from . import config
+from .ingest import remove_partials
 
 
 def get_db_connection():
     """Establishes a connection to the SQLite database."""
-    conn = sqlite3.connect(DB_PATH)
+    conn = sqlite3.connect(config.DB_PATH)
     return conn
 
 
+def create_schema(conn):
+    """Creates the tables on a fresh database; a no-op on an existing one."""
+    conn.execute('''
+        CREATE TABLE IF NOT EXISTS captures (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            timestamp TEXT NOT NULL,
+            image_path TEXT NOT NULL,
+            gps_lat REAL,
+            gps_lon REAL,
+            device TEXT,
+            frame_id INTEGER,
+            frame_crc INTEGER,
+            full INTEGER NOT NULL DEFAULT 1,
+            requested INTEGER NOT NULL DEFAULT 0,
+            event INTEGER NOT NULL DEFAULT 0,
+            burst INTEGER NOT NULL DEFAULT 0
+        )
+    ''')
+    # The gallery pages newest-first by (timestamp, id) and filters on time ranges.
+    conn.execute("CREATE INDEX IF NOT EXISTS captures_by_time ON captures (timestamp, id)")
+    # One row per decoded device telemetry snapshot; last_capture_id ties it
+    # to the captures that had arrived when it was received.
+    conn.execute('''
+        CREATE TABLE IF NOT EXISTS telemetry (
+            id INTEGER PRIMARY KEY AUTOINCREMENT,
+            received_at TEXT NOT NULL,
+            build TEXT,
+            uptime_ms INTEGER,
+            last_capture_id INTEGER,
+            data TEXT NOT NULL,
+            device TEXT
+        )
+    ''')
+    # Every camera that has connected, so a restarted server can match it by
+    # address and connect to it directly (see ble_handler.direct_connect).
+    conn.execute('''
+        CREATE TABLE IF NOT EXISTS devices (
+            address TEXT PRIMARY KEY,
+            name TEXT,
+            bonded INTEGER NOT NULL DEFAULT 0,
+            last_connected TEXT
+        )
+    ''')
+    # Older databases lack the device column, the preview-first ones (full = 0
+    # for a row that only has the preview so far), event (1 for a frame the
+    # PIR triggered) and burst (the device's burst id, 0 for a single frame).
+    added = {"captures": [("device", "TEXT"), ("frame_id", "INTEGER"), ("frame_crc", "INTEGER"),
+                          ("full", "INTEGER NOT NULL DEFAULT 1"), ("requested", "INTEGER NOT NULL DEFAULT 0"),
+                          ("event", "INTEGER NOT NULL DEFAULT 0"), ("burst", "INTEGER NOT NULL DEFAULT 0")],
+             "telemetry": [("device", "TEXT")]}
+    for table, wanted in added.items():
+        columns = [row[1] for row in conn.execute(f"PRAGMA table_info({table})")]
+        for name, kind in wanted:
+            if name not in columns:
+                conn.execute(f"ALTER TABLE {table} ADD COLUMN {name} {kind}")
+    # A full frame finds the preview row it replaces by device and frame id.
+    conn.execute("CREATE INDEX IF NOT EXISTS captures_by_frame ON captures (device, frame_id)")
+    conn.commit()
+
+
+class CaptureWriter:
+    """The single long-lived connection every insert goes through.
+
+    WAL mode lets the web routes read on their own connections while a batch is
+    being written, and synchronous=NORMAL only syncs at checkpoints, so a commit
+    costs no fsync. Each insert_* call is one transaction however many rows it
+    carries. The BLE loop and the web thread may both write, hence the lock.
+    """
+
+    def __init__(self, path):
+        self.conn = sqlite3.connect(path, check_same_thread=False)
+        self.conn.execute("PRAGMA journal_mode=WAL")
+        self.conn.execute("PRAGMA synchronous=NORMAL")
+        self.lock = threading.Lock()
+
+    def insert_captures(self, rows):
+        """Inserts capture rows in one transaction.
+
+        Rows are (timestamp, image_path, device, frame_id, frame_crc, full, event, burst). A full
+        frame whose preview is already stored takes over the preview's row, so it
+        keeps its place in the gallery. Returns the image paths of the previews
+        replaced, for the caller to delete.
+        """
+        if not rows:
+            return []
+        replaced = []
+        with self.lock, self.conn:
+            previews = {}
+            for device in {row[2] for row in rows if row[5] and row[3] is not None}:
+                for row_id, frame_id, crc, path in self.conn.execute(
+                        "SELECT id, frame_id, frame_crc, image_path FROM captures "
+                        "WHERE device IS ? AND full = 0 ORDER BY id", (device,)):
+                    previews[(device, frame_id, crc)] = (row_id, path)
+            inserts, updates = [], []
+            for row in rows:
+                preview = previews.pop((row[2], row[3], row[4]), None) if row[5] else None
+                if preview:
+                    updates.append((row[1], preview[0]))
+                    replaced.append(preview[1])
+                else:
+                    inserts.append(row)
+            self.conn.executemany(
+                "INSERT INTO captures (timestamp, image_path, device, frame_id, frame_crc, full, event, burst) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?, ?)", inserts)
+            self.conn.executemany(
+                "UPDATE captures SET image_path = ?, full = 1, requested = 0 WHERE id = ?", updates)
+        return replaced
+
+    def request_full(self, capture_id):
+        """Flags a preview row for its full frame; False if there is no such preview."""
+        with self.lock, self.conn:
+            cursor = self.conn.execute("UPDATE captures SET requested = 1 WHERE id = ? AND full = 0", (capture_id,))
+            return cursor.rowcount > 0
+
+    def requested_frames(self, device):
+        """Frame ids flagged for a full pull from this device that have not arrived."""
+        with self.lock:
+            return [row[0] for row in self.conn.execute(
+                "SELECT frame_id FROM captures WHERE device IS ? AND full = 0 AND requested = 1", (device,))]
+
+    def insert_telemetry(self, received_at, snapshot, device=None):
+        with self.lock, self.conn:
+            self.conn.execute(
+                "INSERT INTO telemetry (received_at, build, uptime_ms, last_capture_id, data, device) "
+                "VALUES (?, ?, ?, (SELECT MAX(id) FROM captures WHERE device IS ?), ?, ?)",
+                (received_at, snapshot["build"], snapshot["uptime_ms"], device, json.dumps(snapshot), device))
+
+    def remember_device(self, address, name, bonded, connected_at):
+        with self.lock, self.conn:
+            self.conn.execute(
+                "INSERT INTO devices (address, name, bonded, last_connected) VALUES (?, ?, ?, ?) "
+                "ON CONFLICT (address) DO UPDATE SET name = excluded.name, bonded = excluded.bonded, "
+                "last_connected = excluded.last_connected",
+                (address, name, int(bonded), connected_at))
+
+    def known_devices(self):
+        """(address, name, bonded) of every camera that has connected, most recent first."""
+        with self.lock:
+            return [(address, name, bool(bonded)) for address, name, bonded in self.conn.execute(
+                "SELECT address, name, bonded FROM devices ORDER BY last_connected DESC")]
+
+    def close(self):
+        with self.lock:
+            self.conn.close()
+
+
+_writer = None
+
+
+def get_writer():
+    global _writer
+    if _writer is None:
+        _writer = CaptureWriter(config.DB_PATH)
+    return _writer
+
+
 def setup_filesystem():
-    """Ensures the image directory and database table exist."""
-    if not os.path.exists(IMGS_PATH):
-        print(f"Image directory not found. Creating at: {IMGS_PATH}")
-        os.makedirs(IMGS_PATH)
+    """Ensures the image directory and database tables exist."""
+    if not os.path.exists(config.IMGS_PATH):
+        print(f"Image directory not found. Creating at: {config.IMGS_PATH}")
+        os.makedirs(config.IMGS_PATH)
+    remove_partials(config.IMGS_PATH)
+    os.makedirs(config.THUMBS_PATH, exist_ok=True)
+    remove_partials(config.THUMBS_PATH)
 
     try:
-        conn = get_db_connection()
-        cursor = conn.cursor()
-        cursor.execute('''
-            CREATE TABLE IF NOT EXISTS captures (
-                id INTEGER PRIMARY KEY AUTOINCREMENT,
-                timestamp TEXT NOT NULL,
-                image_path TEXT NOT NULL,
-                gps_lat REAL,
-                gps_lon REAL
-            )
-        ''')
-        conn.commit()
+        create_schema(get_writer().conn)
     except sqlite3.Error as e:
         print(f"Database setup error: {e}")
-    finally:
-        if conn:
-            conn.close()
     print("Filesystem and database are ready.")
 
 
-def db_insert_capture(timestamp, image_path):
+def db_insert_capture(timestamp, image_path, device=None):
     """Inserts a new capture record into the database."""
+    db_insert_captures([(timestamp, image_path, device, None, None, 1, 0, 0)])
+
+
+def db_insert_captures(rows):
+    """Inserts capture rows for a whole batch in one transaction (see CaptureWriter.insert_captures).
+
+    Returns the image paths of the previews that full frames replaced.
+    """
     try:
-        conn = get_db_connection()
-        cursor = conn.cursor()
-        cursor.execute(
-            "INSERT INTO captures (timestamp, image_path) VALUES (?, ?)", (timestamp, image_path))
-        conn.commit()
+        return get_writer().insert_captures(rows)
     except sqlite3.Error as e:
         print(f"Database insert error: {e}")
-    finally:
-        if conn:
-            conn.close()
+        return []
+
+
+def db_insert_telemetry(received_at, snapshot, device=None):
+    """Stores a decoded telemetry snapshot as JSON next to the device's latest capture id."""
+    try:
+        get_writer().insert_telemetry(received_at, snapshot, device)
+    except sqlite3.Error as e:
+        print(f"Database insert error: {e}")
+
+
+def db_remember_device(address, name, bonded, connected_at):
+    """Records a connection from a camera, and whether it is bonded to us."""
+    try:
+        get_writer().remember_device(address, name, bonded, connected_at)
+    except sqlite3.Error as e:
+        print(f"Database insert error: {e}")
+
+
+def db_known_devices():
+    try:
+        return get_writer().known_devices()
+    except sqlite3.Error as e:
+        print(f"Database read error: {e}")
+        return []
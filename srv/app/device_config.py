@@ -0,0 +1,122 @@
+import struct
+import sys
+
+# Mirrors include/device_config.h on the device. All fields are little-endian:
+#   "JKC1"  u8 version  u8 0  then any number of { u8 tag  u8 length  value }
+# A write changes only the tags it carries and is applied whole or not at all;
+# the device answers CONFIG:<result>:<tag>:<version> on the status characteristic,
+# and reading the config characteristic returns every setting it holds.
+MAGIC = b'JKC1'
+VERSION = 1
+HEADER = struct.Struct('<4sBB')
+
+WIDTHS = {1: '<B', 2: '<H', 4: '<I'}
+
+# 4:3 frame sizes by esp32-camera framesize_t (CONFIG_FRAME_SIZES).
+FRAME_SIZES = {"QQVGA": 1, "QVGA": 5, "VGA": 8, "SVGA": 9, "XGA": 10, "UXGA": 13}
+
+# ConfigTag in the same order, with the ranges device_config.cpp enforces:
+# (tag, setting name, width, min, max, zero allowed, label for errors).
+# batch_budget is what the device reports; writes use threshold, a share of
+# its frame arena. chunk_size bounds are WINDOW_MIN_CHUNK and CHUNK_SIZE.
+FIELDS = [
+    (1, "frequency", 4, 1, 86400, False, "Capture frequency (seconds)"),
+    (2, "threshold", 1, 2, 95, False, "Send threshold (% of frame buffer)"),
+    (3, "batch_budget", 4, 16 * 1024, 2 * 1024 * 1024, True, "Batch budget (bytes)"),
+    (4, "change_threshold", 1, 0, 100, True, "Change threshold (%)"),
+    (5, "keyframe_interval", 2, 0, 1000, True, "Keyframe interval (captures)"),
+    (6, "frame_target", 4, 2048, 256 * 1024, True, "Frame size target (bytes)"),
+    (7, "event_holdoff", 2, 0, 600, True, "Motion hold-off (seconds)"),
+    (8, "burst_frames", 1, 0, 30, True, "Burst length (frames)"),
+    (9, "burst_fps", 1, 1, 30, False, "Burst rate (frames per second)"),
+    (10, "frame_size", 1, 1, 13, False, "Frame size"),
+    (11, "jpeg_quality", 1, 4, 63, False, "JPEG quality"),
+    (12, "xclk_mhz", 1, 8, 20, False, "Sensor clock (MHz)"),
+    (13, "chunk_size", 2, 64, 512, False, "Chunk size (bytes)"),
+    (14, "status_delay_ms", 2, 0, 1000, True, "Status delay (ms)"),
+    (15, "chunk_delay_ms", 2, 0, 100, True, "Chunk delay (ms)"),
+    (16, "image_delay_ms", 2, 0, 5000, True, "Image delay (ms)"),
+]
+BY_NAME = {field[1]: field for field in FIELDS}
+BY_TAG = {field[0]: field for field in FIELDS}
+
+# ConfigResult, indexed by the result in a CONFIG: status line.
+RESULTS = ["ok", "bad header", "version too new", "unknown tag", "bad length", "out of range"]
+
+
+class ConfigFormatError(ValueError):
+    pass
+
+
+def check(name, value):
+    """None if the device would accept value for this setting, otherwise why not."""
+    _, _, _, low, high, zero_ok, label = BY_NAME[name]
+    if name == "frame_size":
+        if value in FRAME_SIZES:
+            return None
+        return f"{label} must be one of {', '.join(FRAME_SIZES)}."
+    if value == 0 and zero_ok:
+        return None
+    if not low <= value <= high:
+        zero = " (or 0 to turn it off)" if zero_ok else ""
+        return f"{label} must be between {low} and {high}{zero}."
+    return None
+
+
+def encode(settings):
+    """A config write carrying every known setting in `settings`, by name."""
+    out = HEADER.pack(MAGIC, VERSION, 0)
+    for name, value in settings.items():
+        if name not in BY_NAME:
+            continue
+        tag, _, width = BY_NAME[name][:3]
+        if name == "frame_size":
+            value = FRAME_SIZES[value]
+        out += bytes([tag, width]) + struct.pack(WIDTHS[width], value)
+    return out
+
+
+def decode(buffer):
+    """Settings by name from a config write or the characteristic's read value."""
+    if len(buffer) < HEADER.size:
+        raise ConfigFormatError("config shorter than its header")
+    magic, version, _ = HEADER.unpack_from(buffer, 0)
+    if magic != MAGIC:
+        raise ConfigFormatError(f"bad magic {magic!r}")
+    if version > VERSION:
+        raise ConfigFormatError(f"config version {version} is newer than {VERSION}")
+    settings = {}
+    pos = HEADER.size
+    while pos < len(buffer):
+        if pos + 2 > len(buffer):
+            raise ConfigFormatError("config ends inside a tag")
+        tag, width = buffer[pos], buffer[pos + 1]
+        field = BY_TAG.get(tag)
+        if field is None:
+            raise ConfigFormatError(f"unknown tag {tag}")
+        if width != field[2] or pos + 2 + width > len(buffer):
+            raise ConfigFormatError(f"bad length {width} for {field[1]}")
+        value = struct.unpack_from(WIDTHS[width], buffer, pos + 2)[0]
+        if field[1] == "frame_size":
+            value = next((name for name, number in FRAME_SIZES.items() if number == value), value)
+        settings[field[1]] = value
+        pos += 2 + width
+    return settings
+
+
+def parse_result(status):
+    """(accepted, message) from a CONFIG:<result>:<tag>:<version> status line."""
+    result, tag, version = (int(part) for part in status[len("CONFIG:"):].split(":")[:3])
+    if result == 0:
+        return True, f"settings accepted (config v{version})"
+    reason = RESULTS[result] if result < len(RESULTS) else f"error {result}"
+    field = BY_TAG.get(tag)
+    where = f" at {field[1]}" if field else (f" at tag {tag}" if tag else "")
+    return False, f"settings refused: {reason}{where} (device speaks config v{version})"
+
+
+if __name__ == '__main__':
+    # python -m app.device_config <file> prints a config saved by the host bench.
+    with open(sys.argv[1], 'rb') as f:
+        for name, value in decode(f.read()).items():
+            print(f"{name:20s} {value}")
@@ -0,0 +1,127 @@
+import re
+import struct
+import sys
+
+# Mirrors include/event_log.h on the device. All fields are little-endian:
+#   "JKL1"  u8 version  u8 0  u16 record_count  u32 uptime_ms  u32 first_sequence  u32 dropped
+#   record_count x { u32 time_ms  u16 format  u8 level  u8 argc  argc x u32 args }
+# Arguments are 32-bit integers, or floats by bit pattern where the format says %f.
+# Over BLE the dump arrives paged like the telemetry snapshot (telemetry.PageAssembler).
+MAGIC = b'JKL1'
+VERSION = 1
+HEADER = struct.Struct('<4sBBHIII')
+RECORD = struct.Struct('<IHBB')
+
+LEVELS = "DIWE"
+
+# LOG_FORMATS in include/log_formats.h, in the same order: records carry the index.
+FORMATS = [
+    "Log overflow: %u records dropped",
+    "Sent %u/%u bytes",
+    "Acked %u/%u chunks",
+    "Received command: %c (0x%02X)",
+    "ACK received from server",
+    "Received 'Ready' signal from server",
+    "Server requested transfer window of %u chunks",
+    "Server holds frame %u up to byte %u (we last saw frame %u byte %u)",
+    "Server accepts batch containers",
+    "Server wants previews first; unpicked frames are kept for %u min",
+    "Queued %u bytes of new settings",
+    "Client connected",
+    "Client disconnected",
+    "CPU at %u MHz",
+    "Wake to frame: %u ms, skipped %u stale and %u settling frames (exposure usually needs %.1f)",
+    "Motion capture. Events: %u taken, %u retriggers ignored; timer: %u taken, %u covered by events",
+    "Timelapse capture. Events: %u taken, %u retriggers ignored; timer: %u taken, %u covered by events",
+    "Burst %u: %u/%u frames over %u ms, %.1f fps achieved (asked %u)",
+    "Failed to store image. Check camera or frame arena",
+    "Frame queue full; frame stays in the arena for a later batch",
+    "Rate control: %u bytes at q%u 1/%u (target %u) -> q%u 1/%u",
+    "Change gate: %u%% changed, skipped %u of %u captures (%.1f%%), %u keyframes",
+    "PSRAM: %.1f%% | Imgs: %d",
+    "Display: %u updates in %u flushes, %u pages sent (a full refresh per update would be %u)",
+    "Power per frame: %u ms at full clock, %u ms awake, %u ms idle, %u ms asleep; %.2f mJ (fixed clocks %.2f)",
+    "Rejected %u bytes of settings: error %u at tag %u",
+    "Client connected after %u ms of advertising (fast interval %u, bonded peer %u)",
+    "Link encrypted with the server's bond (new bond %u)",
+    "Pairing with the server failed: reason 0x%02X",
+    "Sent status %c%c%c%c... (%u bytes); waiting for ACK",
+    "Server ACK after %u ms",
+    "Stream complete: %u bytes in %u chunks, %u retransmits",
+    "Sending image %u of %u (%u bytes)",
+    "Using windowed transfer: %u chunks of %u bytes",
+    "Notifications carry only %u bytes; using stop-and-wait instead of a window",
+    "Resume point (frame %u) matches nothing queued; sending the batch from the start",
+    "Resuming at frame %u byte %u (%u frames already delivered)",
+    "Asked the server to pick from %u previews",
+    "Pick for frame %u, which was not previewed; ignored",
+    "Server wants %u of %u previewed frames in full",
+    "Released %u frames nobody picked within the retention window",
+]
+
+CONVERSION = re.compile(r'%([-+ #0-9.]*)([diuxXcf%])')
+
+
+class LogFormatError(ValueError):
+    pass
+
+
+def format_message(format_id, args):
+    """Expands a record's format with its raw u32 arguments, as the device does."""
+    if format_id >= len(FORMATS):
+        return f"format {format_id} " + " ".join(str(a) for a in args)
+    pending = list(args)
+
+    def expand(match):
+        flags, conversion = match.groups()
+        if conversion == '%':
+            return '%'
+        value = pending.pop(0) if pending else 0
+        if conversion == 'f':
+            value = struct.unpack('<f', struct.pack('<I', value))[0]
+        elif conversion in 'di':
+            value = value - (1 << 32) if value & 0x80000000 else value
+        elif conversion == 'u':
+            conversion = 'd'
+        return f"%{flags}{conversion}" % value
+
+    return CONVERSION.sub(expand, FORMATS[format_id])
+
+
+def parse(buffer):
+    """Decodes a log dump into a dict with its records, oldest first."""
+    if len(buffer) < HEADER.size:
+        raise LogFormatError("log shorter than its header")
+    magic, version, _, count, uptime_ms, first, dropped = HEADER.unpack_from(buffer, 0)
+    if magic != MAGIC or version != VERSION:
+        raise LogFormatError(f"unknown log {magic!r} v{version}")
+    pos = HEADER.size
+    records = []
+    for i in range(count):
+        if pos + RECORD.size > len(buffer):
+            raise LogFormatError(f"log ends inside record {i} of {count}")
+        time_ms, format_id, level, argc = RECORD.unpack_from(buffer, pos)
+        pos += RECORD.size
+        if pos + 4 * argc > len(buffer):
+            raise LogFormatError(f"log ends inside the arguments of record {i}")
+        args = struct.unpack_from(f'<{argc}I', buffer, pos)
+        pos += 4 * argc
+        records.append({"sequence": (first + i) & 0xFFFFFFFF, "time_ms": time_ms,
+                        "level": LEVELS[level] if level < len(LEVELS) else '?',
+                        "message": format_message(format_id, args)})
+    return {"uptime_ms": uptime_ms, "first": first, "dropped": dropped, "records": records}
+
+
+def format_line(record):
+    """The line the device prints on serial for the same record."""
+    t = record["time_ms"]
+    return f"{t // 1000}.{t % 1000:03d} {record['level']} {record['message']}"
+
+
+if __name__ == '__main__':
+    # python -m app.device_log <dump file> prints a log saved by the host bench.
+    with open(sys.argv[1], 'rb') as f:
+        decoded = parse(f.read())
+    for record in decoded["records"]:
+        print(format_line(record))
+    print(f"({len(decoded['records'])} records from #{decoded['first']}, {decoded['dropped']} dropped since boot)")
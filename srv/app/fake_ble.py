@@ -0,0 +1,535 @@
+import asyncio
+import functools
+import io
+import os
+import random
+import struct
+import sys
+import tempfile
+import time
+import types
+import zlib
+
+from . import config, batch_container, device_config
+
+# A simulated BLE backend for running the server against N cameras without a
+# radio. FakeScanner and FakeClient stand in for bleak's BleakScanner and
+# BleakClient (install them with ble_handler.use_backend), and each FakeDevice
+# plays the firmware's side of a wake cycle: capture, advertise for a window,
+# wait for 'R', send LINK:/CHANGE:/POWER:/WIN: and the batch container, then drop the
+# link after the finalize window. Frames a window did not deliver stay queued
+# for the next one, as on the device. A server that sends 'V' gets previews
+# first (PREVIEW:, PICK:) and only the frames it picks in full. Settings writes
+# are checked like the firmware does, answered with CONFIG:, and the chunk size
+# they set is used from the next stream on. Devices advertise at a fast interval
+# for the first ADV_FAST_WINDOW of a window and slowly after it; a direct
+# connection (FakeClient given just an address) scans for that address and
+# connects on the first advertisement it sees, and CONNECT: reports how long
+# the device advertised.
+
+STATUS = config.CHARACTERISTIC_UUID_STATUS
+DATA = config.CHARACTERISTIC_UUID_DATA
+CONTAINER_MAX_FRAMES = 64
+PREVIEW_COLS, PREVIEW_ROWS = 40, 30  # PREVIEW_COLS/ROWS in include/protocol.h
+# ADV_FAST_* in include/globals.h, scaled to the simulation's short windows.
+ADV_FAST_WINDOW = 1.0
+ADV_FAST_INTERVAL = 0.025
+ADV_SLOW_INTERVAL = 0.2
+
+
+class FakeDevice:
+    def __init__(self, address, name, rng, mtu=247, chunk_delay=0.002, loss=0.0):
+        self.address = address
+        self.name = name
+        self.rng = rng
+        self.mtu = mtu
+        self.chunk_delay = chunk_delay  # Seconds per notification
+        self.loss = loss                # Probability that a data notification is lost
+        self.advertising = False
+        self.advertised_at = 0.0        # When this window's advertising began
+        self.client = None
+        self.bonded = False             # Holds the server's keys
+        self.known_peer = False         # Held them when the current connection was made
+        self.connects = []              # (direct, ms advertising before the connection)
+        self.commands = None
+        self.backlog = []               # (id, jpeg, timestamp_ms, flags) not yet acknowledged
+        self.next_id = 1
+        self.started = time.monotonic()
+        self.captured = 0
+        self.events = 0                 # Captures tagged as PIR-triggered
+        self.bursts = 0                 # Event captures taken as a three-frame burst
+        self.windows = 0
+        self.missed_windows = 0
+        self.previews = False           # The server sent 'V' on this connection
+        self.retention_ms = 0
+        self.previewed = {}             # Frame id -> when its preview was sent
+        self.pulled = 0                 # Frames picked from previews and sent in full
+        self.settings = {"frequency": 10, "batch_budget": 0, "frame_size": "VGA", "chunk_size": 512}
+
+    def now_ms(self):
+        return int((time.monotonic() - self.started) * 1000) & 0xFFFFFFFF
+
+    def capture(self, count):
+        from PIL import Image
+        for _ in range(count):
+            # About one capture in five stands for a PIR trigger, and half of those for a burst.
+            flags = batch_container.FLAG_EVENT if self.rng.random() < 0.2 else 0
+            frames = 1
+            if flags and self.rng.random() < 0.5:
+                self.bursts += 1
+                frames = 3
+            for index in range(frames):
+                img = Image.new('RGB', (160, 120), tuple(self.rng.randrange(256) for _ in range(3)))
+                out = io.BytesIO()
+                img.save(out, 'JPEG', quality=90)
+                tag = flags
+                if frames > 1:
+                    tag |= batch_container.FLAG_BURST | index << 8 | self.bursts << 16
+                self.backlog.append((self.next_id, out.getvalue(), self.now_ms(), tag))
+                self.next_id += 1
+                self.captured += 1
+                self.events += 1 if flags else 0
+
+    # --- Link, as seen from FakeClient ---
+
+    def next_advertisement(self):
+        """Seconds until this device's next advertisement."""
+        elapsed = time.monotonic() - self.advertised_at
+        interval = ADV_FAST_INTERVAL if elapsed < ADV_FAST_WINDOW else ADV_SLOW_INTERVAL
+        return interval - elapsed % interval
+
+    def connect(self, client):
+        if not self.advertising or self.client:
+            raise ConnectionError(f"{self.address} is not connectable")
+        self.advertising = False
+        self.client = client
+        self.commands = asyncio.Queue()
+        self.connect_ms = int((time.monotonic() - self.advertised_at) * 1000)
+        self.known_peer = self.bonded
+        self.connects.append((client.direct, self.connect_ms))
+
+    def disconnect(self):
+        if self.client:
+            self.client = None
+            self.commands.put_nowait(None)
+
+    def notify(self, uuid, data):
+        if self.client:
+            self.client.deliver(uuid, data)
+
+    def configure(self, data):
+        """A write to the config characteristic: all of it applies, or none."""
+        try:
+            written = device_config.decode(data)
+        except device_config.ConfigFormatError:
+            self.notify(STATUS, f"CONFIG:1:0:{device_config.VERSION}".encode())
+            return
+        bad = next((name for name, value in written.items() if device_config.check(name, value)), None)
+        if bad:
+            self.notify(STATUS, f"CONFIG:5:{device_config.BY_NAME[bad][0]}:{device_config.VERSION}".encode())
+            return
+        if "threshold" in written:
+            written["batch_budget"] = 2 * 1024 * 1024 * written.pop("threshold") // 100
+        self.settings.update(written)
+        self.notify(STATUS, f"CONFIG:0:0:{device_config.VERSION}".encode())
+
+    # --- Firmware side ---
+
+    async def wait_command(self, accept, timeout):
+        """The next command whose type is in `accept`; None on timeout or disconnect."""
+        deadline = time.monotonic() + timeout
+        while self.client:
+            try:
+                cmd = await asyncio.wait_for(self.commands.get(), max(0.0, deadline - time.monotonic()))
+            except asyncio.TimeoutError:
+                return None
+            if cmd is None:
+                return None
+            if cmd[:1] in accept:
+                return cmd
+        return None
+
+    async def wake_cycle(self, advertise_for, finalize_for):
+        """One transfer window. Returns True once the whole backlog was acknowledged."""
+        self.windows += 1
+        self.advertised_at = time.monotonic()
+        self.advertising = True
+        deadline = time.monotonic() + advertise_for
+        while not self.client and time.monotonic() < deadline:
+            await asyncio.sleep(0.02)
+        self.advertising = False
+        if not self.client:
+            self.missed_windows += 1
+            return False
+
+        window = 0
+        self.previews = False
+        while True:  # 'W', 'B', 'V' and 'P' come before 'R'
+            cmd = await self.wait_command((b'W', b'B', b'V', b'P', b'R'), 10.0)
+            if cmd is None:
+                self.disconnect()
+                return False
+            if cmd[:1] == b'W':
+                window = cmd[1]
+            elif cmd[:1] == b'V':
+                self.previews = True
+                self.retention_ms = int.from_bytes(cmd[1:3], 'little') * 60000
+            elif cmd[:1] == b'P':
+                self.apply_resume(*struct.unpack_from('<III', cmd, 1))
+            elif cmd[:1] == b'R':
+                break
+
+        self.notify(STATUS, f"PSRAM: {min(100.0, len(self.backlog) * 2.5):.1f}% | Imgs: {len(self.backlog)}".encode())
+        self.notify(STATUS, f"LINK:{self.mtu}:6:251".encode())
+        fast = self.connect_ms < ADV_FAST_WINDOW * 1000
+        self.notify(STATUS, f"CONNECT:{self.connect_ms}:{int(fast)}:{int(self.known_peer)}".encode())
+        self.notify(STATUS, f"CHANGE:{self.captured}:0:0".encode())
+        self.notify(STATUS, f"POWER:{self.captured * 180}:{self.captured * 40}:0:{self.captured * 9800}:{self.captured}:0".encode())
+        delivered = await (self.send_previews(window) if self.previews else self.send_batch(window))
+
+        # The firmware waits for the server to drop the link, then stops BLE itself.
+        deadline = time.monotonic() + finalize_for
+        while self.client and time.monotonic() < deadline:
+            await asyncio.sleep(0.05)
+        self.disconnect()
+        return delivered
+
+    def apply_resume(self, frame_id, offset, crc):
+        for i, (queued_id, jpeg, _, _) in enumerate(self.backlog):
+            if queued_id == frame_id and offset >= len(jpeg) and zlib.crc32(jpeg) == crc:
+                del self.backlog[:i + 1]
+                return
+
+    def container(self, frames):
+        offset = batch_container.table_size(len(frames))
+        table = b''
+        for frame_id, jpeg, timestamp_ms, flags in frames:
+            table += batch_container.ENTRY.pack(frame_id, offset, len(jpeg), timestamp_ms, zlib.crc32(jpeg), flags)
+            offset += len(jpeg)
+        header = batch_container.HEADER.pack(batch_container.MAGIC, batch_container.VERSION, len(frames),
+                                             offset, self.now_ms(), 0)
+        return header + table + b''.join(frame[1] for frame in frames)
+
+    def preview_container(self, frames):
+        """The device's PreviewContainer, with PIL standing in for its DC-only decode."""
+        from PIL import Image
+        record = 1 + PREVIEW_COLS * PREVIEW_ROWS
+        offset = batch_container.PREVIEW_HEADER.size + len(frames) * batch_container.ENTRY.size
+        table, records = b'', b''
+        for i, (frame_id, jpeg, timestamp_ms, flags) in enumerate(frames):
+            table += batch_container.ENTRY.pack(frame_id, offset + i * record, len(jpeg), timestamp_ms,
+                                                zlib.crc32(jpeg), flags)
+            with Image.open(io.BytesIO(jpeg)) as img:
+                records += b'\x01' + img.convert('L').resize((PREVIEW_COLS, PREVIEW_ROWS)).tobytes()
+        total = offset + len(records)
+        header = batch_container.PREVIEW_HEADER.pack(batch_container.PREVIEW_MAGIC, batch_container.PREVIEW_VERSION,
+                                                     len(frames), total, self.now_ms(), PREVIEW_COLS, PREVIEW_ROWS, 0)
+        return header + table + records
+
+    async def send_stream(self, status, stream, window):
+        """Announces a stream, sends it and returns how many of its bytes were acknowledged."""
+        chunk_size = min(self.mtu - 3 - (config.WINDOW_CHUNK_HEADER if window else 0), self.settings["chunk_size"])
+        if window:
+            self.notify(STATUS, f"WIN:{window}:{chunk_size}".encode())
+        self.notify(STATUS, status.encode())
+        if await self.wait_command((b'A',), 10.0) is None:
+            return 0
+        chunks = [stream[i:i + chunk_size] for i in range(0, len(stream), chunk_size)]
+        acked = await (self.send_windowed(chunks, window) if window else self.send_stop_and_wait(chunks))
+        return min(len(stream), acked * chunk_size)
+
+    async def send_frames(self, frames, window):
+        """Sends frames as one batch container; returns how many of them the server has whole."""
+        stream = self.container(frames)
+        acked_bytes = await self.send_stream(f"BATCH:{len(stream)}:{len(frames)}", stream, window)
+        # Frames wholly inside the acknowledged prefix are released, as on the device.
+        end = batch_container.table_size(len(frames))
+        released = 0
+        for frame in frames:
+            end += len(frame[1])
+            if end > acked_bytes:
+                break
+            released += 1
+        return released
+
+    async def send_batch(self, window):
+        if not self.backlog:
+            return True
+        frames = self.backlog[:CONTAINER_MAX_FRAMES]
+        released = await self.send_frames(frames, window)
+        del self.backlog[:released]
+        return released == len(frames) and not self.backlog
+
+    async def send_previews(self, window):
+        """Preview-first: previews of new frames, PICK:, then the picked frames in full."""
+        fresh = [frame for frame in self.backlog if frame[0] not in self.previewed][:CONTAINER_MAX_FRAMES]
+        if fresh:
+            stream = self.preview_container(fresh)
+            if await self.send_stream(f"PREVIEW:{len(stream)}:{len(fresh)}", stream, window) < len(stream):
+                return False
+            for frame_id, *_ in fresh:
+                self.previewed[frame_id] = self.now_ms()
+        if not self.previewed:
+            return True
+
+        self.notify(STATUS, f"PICK:{len(self.previewed)}".encode())
+        picked = set()
+        while True:
+            cmd = await self.wait_command((b'F', b'G'), 10.0)
+            if cmd is None:
+                return False
+            if cmd[:1] == b'G':
+                break
+            picked.update(int.from_bytes(cmd[i:i + 4], 'little') for i in range(1, len(cmd) - 3, 4))
+        frames = [frame for frame in self.backlog if frame[0] in picked and frame[0] in self.previewed]
+        delivered = {frame[0] for frame in frames[:await self.send_frames(frames, window)]} if frames else set()
+        self.pulled += len(delivered)
+
+        now = self.now_ms()
+        done = {frame_id for frame_id, at in self.previewed.items()
+                if frame_id in delivered or now - at >= self.retention_ms}
+        self.backlog = [frame for frame in self.backlog if frame[0] not in done]
+        for frame_id in done:
+            del self.previewed[frame_id]
+        return not self.backlog
+
+    async def send_data(self, payload):
+        await asyncio.sleep(self.chunk_delay)
+        if self.rng.random() >= self.loss:
+            self.notify(DATA, payload)
+
+    async def send_stop_and_wait(self, chunks):
+        for i, chunk in enumerate(chunks):
+            await self.send_data(chunk)
+            if await self.wait_command((b'N',), 15.0) is None:
+                return i
+        return len(chunks)
+
+    async def send_windowed(self, chunks, window):
+        acked = 0
+        credit = window
+        next_seq = 0
+        while acked < len(chunks):
+            while next_seq < min(len(chunks), acked + credit):
+                await self.send_data(next_seq.to_bytes(2, 'little') + chunks[next_seq])
+                next_seq += 1
+            cmd = await self.wait_command((b'K', b'X'), 5.0)
+            if cmd is None:
+                return acked
+            seq = int.from_bytes(cmd[1:3], 'little')
+            if cmd[:1] == b'K':
+                acked = max(acked, seq)
+                credit = cmd[3]
+            elif acked <= seq < next_seq:
+                await self.send_data(cmd[1:3] + chunks[seq])
+        return acked
+
+
+class FakeScanner:
+    """Reports every advertising device to detection_callback, like BleakScanner's callback mode."""
+
+    def __init__(self, detection_callback, world, interval=0.1):
+        self.callback = detection_callback
+        self.world = world
+        self.interval = interval
+        self.task = None
+
+    async def start(self):
+        self.task = asyncio.create_task(self.scan())
+
+    async def stop(self):
+        if self.task:
+            self.task.cancel()
+
+    async def scan(self):
+        while True:
+            for device in self.world.values():
+                if device.advertising:
+                    self.callback(types.SimpleNamespace(address=device.address, name=device.name),
+                                  types.SimpleNamespace(service_uuids=[config.SERVICE_UUID]))
+            await asyncio.sleep(self.interval)
+
+
+class FakeClient:
+    """Connects to a FakeDevice by address; the subset of BleakClient the server uses.
+
+    Given what the scanner reported it connects straight away. Given only an
+    address it does what BleakClient does: scans up to `timeout` for an
+    advertisement from that address, then connects to it.
+    """
+
+    def __init__(self, device, timeout, world, connect_delay=0.1):
+        self.direct = isinstance(device, str)
+        self.device = world[device if self.direct else device.address]
+        self.timeout = timeout
+        self.connect_delay = connect_delay
+        self.handlers = {}
+
+    async def __aenter__(self):
+        if self.direct:
+            deadline = time.monotonic() + self.timeout
+            while not self.device.advertising or self.device.client:
+                if time.monotonic() >= deadline:
+                    raise asyncio.TimeoutError(f"{self.device.address} did not advertise")
+                await asyncio.sleep(0.01)
+            await asyncio.sleep(self.device.next_advertisement())
+        await asyncio.sleep(self.connect_delay)
+        self.device.connect(self)
+        return self
+
+    async def __aexit__(self, *exc):
+        if self.device.client is self:
+            self.device.disconnect()
+
+    @property
+    def is_connected(self):
+        return self.device.client is self
+
+    async def pair(self):
+        self.device.bonded = True
+
+    async def start_notify(self, uuid, handler):
+        self.handlers[uuid] = handler
+
+    async def write_gatt_char(self, uuid, data, response=False):
+        if not self.is_connected:
+            raise ConnectionError("not connected")
+        if uuid == config.CHARACTERISTIC_UUID_COMMAND:
+            self.device.commands.put_nowait(bytes(data))
+        elif uuid == config.CHARACTERISTIC_UUID_CONFIG:
+            self.device.configure(bytes(data))
+
+    async def read_gatt_char(self, uuid):
+        if not self.is_connected:
+            raise ConnectionError("not connected")
+        if uuid != config.CHARACTERISTIC_UUID_CONFIG:
+            raise ValueError(f"{uuid} is not readable")
+        return bytearray(device_config.encode(self.device.settings))
+
+    def deliver(self, uuid, data):
+        handler = self.handlers.get(uuid)
+        if handler:
+            handler(uuid, bytearray(data))
+
+
+# --- Simulation ---
+# python -m app.fake_ble [devices] [max_sessions] [cycles] [loss] [previews]   (from srv/)
+# Runs the real scanner and session code against simulated cameras that all
+# wake on the same period, into a temporary image folder and database. Reports
+# per-device frames captured and stored, missed windows, and the peak number of
+# concurrent sessions. Exits non-zero if any frame was lost or the cap was exceeded.
+# With previews=1 the server runs preview-first with no retention: every frame
+# must be stored, and exactly those the devices sent in full stored in full.
+# Either way every frame tagged as PIR-triggered must be stored as an event, and
+# every burst as three rows under its burst id. A settings change is queued at
+# the start; every device must end up reporting it. Every device must bond on its
+# first session, and direct connections must carry some of the reconnects (a
+# device that wakes while every slot is taken waits for the scanner instead);
+# the last connection must have reported a connect time, whichever path made
+# it, and the mean time each path kept the devices advertising is printed.
+
+async def _device_life(device, cycles, period, advertise_for, finalize_for, frames_per_cycle):
+    await asyncio.sleep(device.rng.uniform(0, period / 2))  # Cameras are not in phase
+    for cycle in range(cycles + 5):
+        if cycle < cycles:
+            device.capture(frames_per_cycle)
+        elif not device.backlog:
+            return
+        await device.wake_cycle(advertise_for, finalize_for)
+        await asyncio.sleep(period)
+
+
+async def _simulate(count, max_sessions, cycles, loss):
+    from . import ble_handler, state_manager
+
+    rng = random.Random(7)
+    world = {}
+    for i in range(count):
+        address = f"24:6F:28:00:00:{i + 1:02X}"
+        world[address] = FakeDevice(address, "T-Camera-BLE-Batch", random.Random(rng.random()), loss=loss)
+    ble_handler.use_backend(functools.partial(FakeScanner, world=world),
+                            functools.partial(FakeClient, world=world))
+
+    settings = state_manager.server_state["settings"]
+    settings.update(chunk_size=200, image_delay_ms=100)
+    state_manager.pending_config_command = device_config.encode(settings)
+    state_manager.config_version += 1
+
+    peak = 0
+    server = asyncio.create_task(ble_handler.ble_communication_task())
+    lives = asyncio.gather(*(_device_life(device, cycles, 2.0, 4.0, 0.5, 4) for device in world.values()))
+    while not lives.done():
+        peak = max(peak, len(state_manager.active_sessions()))
+        await asyncio.sleep(0.01)
+    await asyncio.sleep(1.5)  # Let the last sessions notice the disconnect
+    server.cancel()
+    return world, peak
+
+
+def _mean(values):
+    return round(sum(values) / len(values)) if values else '-'
+
+
+def _run(count, max_sessions, cycles, loss, preview_first=False):
+    from . import database_handler, state_manager
+
+    with tempfile.TemporaryDirectory() as directory:
+        config.IMGS_PATH = os.path.join(directory, config.IMGS_FOLDER_NAME)
+        config.THUMBS_PATH = os.path.join(directory, config.THUMBS_FOLDER_NAME)
+        config.DB_PATH = os.path.join(directory, "captures.db")
+        config.MAX_SESSIONS = max_sessions
+        config.RECONNECT_DELAY = 0.5
+        config.PREVIEW_FIRST = preview_first
+        config.PREVIEW_RETENTION_MIN = 0
+        database_handler.setup_filesystem()
+
+        start = time.monotonic()
+        world, peak = asyncio.run(_simulate(count, max_sessions, cycles, loss))
+        elapsed = time.monotonic() - start
+
+        conn = database_handler.get_db_connection()
+        stored = dict(conn.execute("SELECT device, COUNT(*) FROM captures GROUP BY device").fetchall())
+        full = dict(conn.execute("SELECT device, COUNT(*) FROM captures WHERE full = 1 GROUP BY device").fetchall())
+        events = dict(conn.execute("SELECT device, COUNT(*) FROM captures WHERE event = 1 GROUP BY device").fetchall())
+        bursts = {}
+        for device, burst, frames in conn.execute(
+                "SELECT device, burst, COUNT(*) FROM captures WHERE burst != 0 GROUP BY device, burst"):
+            bursts.setdefault(device, []).append(frames)
+        conn.close()
+        database_handler.get_writer().close()
+
+    print(f"\n{count} devices, at most {max_sessions} sessions, {cycles} cycles, {loss:.0%} loss, "
+          f"{'previews first, ' if preview_first else ''}{elapsed:.1f} s")
+    ok = peak <= max_sessions and any(is_direct for device in world.values() for is_direct, _ in device.connects)
+    for device in world.values():
+        got = stored.get(device.address, 0)
+        got_full = full.get(device.address, 0)
+        got_events = events.get(device.address, 0)
+        got_bursts = bursts.get(device.address, [])
+        ok = ok and got == device.captured and got_events == device.events
+        ok = ok and len(got_bursts) == device.bursts and all(frames == 3 for frames in got_bursts)
+        if preview_first:
+            ok = ok and got_full == device.pulled and device.pulled > 0
+        session = state_manager.devices[device.address]
+        reported = session.status.get("config", {}).get("chunk_size")
+        ok = ok and device.settings["chunk_size"] == reported == 200
+        direct = [ms for is_direct, ms in device.connects if is_direct]
+        scanned = [ms for is_direct, ms in device.connects if not is_direct]
+        report = session.status["connect"] or {}
+        ok = ok and device.bonded and session.bonded and report.get("connect_ms") is not None
+        print(f"{device.address}  connects {len(scanned)} by scan ({_mean(scanned)} ms), "
+              f"{len(direct)} direct ({_mean(direct)} ms), bonded {int(device.bonded)}, "
+              f"last {report.get('path')} {report.get('connect_ms')} ms")
+        print(f"{device.address}  captured {device.captured:3d}  stored {got:3d}  full {got_full:3d}  "
+              f"events {got_events:3d}/{device.events:<3d}  bursts {len(got_bursts):2d}/{device.bursts:<2d}  windows {device.windows:2d}  missed {device.missed_windows:2d}  "
+              f"chunk {reported}")
+    print(f"peak concurrent sessions {peak}")
+    return ok
+
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+    count, max_sessions, cycles = (int(a) for a in (args[:3] + ['5', '3', '3'][len(args[:3]):]))
+    loss = float(args[3]) if len(args) > 3 else 0.0
+    preview_first = len(args) > 4 and args[4] == '1'
+    sys.exit(0 if _run(count, max_sessions, cycles, loss, preview_first) else 1)
@@ -0,0 +1,156 @@
+import os
+import sys
+import tempfile
+
+# Where received streams land on disk. Chunks are written straight into a temp
+# file next to their final location as they arrive, in whatever order, and the
+# file is renamed into place only once it is complete, so a reader never sees a
+# half-written image and a broken transfer never holds more than one chunk in memory.
+
+PARTIAL_SUFFIX = '.part'
+
+
+class StreamFile:
+    """A stream being received into a temp file in `directory`.
+
+    Offsets are relative to the stream; `prefix` (bytes of the same frame held
+    from an earlier connection) is written ahead of it.
+    """
+
+    def __init__(self, directory, prefix=b''):
+        fd, self.path = tempfile.mkstemp(suffix=PARTIAL_SUFFIX, dir=directory)
+        self.file = os.fdopen(fd, 'w+b')
+        self.origin = len(prefix)
+        self.file.write(prefix)
+
+    def write_at(self, offset, data):
+        self.file.seek(self.origin + offset)
+        self.file.write(data)
+
+    def truncate(self, size):
+        """Drops everything from stream offset `size` on (keeps the contiguous prefix)."""
+        self.file.truncate(self.origin + size)
+
+    def size(self):
+        """Bytes in the file, the held prefix included."""
+        self.file.flush()
+        return os.fstat(self.file.fileno()).st_size
+
+    def read(self, offset, length):
+        """Reads from the file, prefix included: offset 0 is the first byte of the frame."""
+        self.file.flush()
+        return os.pread(self.file.fileno(), length, offset)
+
+    def read_all(self):
+        return self.read(0, self.size())
+
+    def commit(self, path):
+        """Moves the complete file into place atomically."""
+        self.file.close()
+        os.replace(self.path, path)
+
+    def discard(self):
+        if not self.file.closed:
+            self.file.close()
+        try:
+            os.remove(self.path)
+        except FileNotFoundError:
+            pass
+
+
+def write_atomically(path, data):
+    """Writes a whole file under a temp name and renames it into place."""
+    partial = path + PARTIAL_SUFFIX
+    with open(partial, 'wb') as f:
+        f.write(data)
+    os.replace(partial, path)
+
+
+def remove_partials(directory):
+    """Deletes temp files left behind by a server that stopped mid-transfer."""
+    for name in os.listdir(directory):
+        if name.endswith(PARTIAL_SUFFIX):
+            os.remove(os.path.join(directory, name))
+
+
+# --- Benchmark ---
+# python -m app.ingest [images] [image_bytes] [batch]   (from srv/)
+# Feeds a synthetic chunk source (512-byte chunks, every window of 8 delivered in
+# a shuffled order, like a windowed transfer with reordering) through the old
+# ingest path, a bytearray per image, a fresh connection and a commit per row,
+# and through the streaming one, StreamFile plus the long-lived WAL writer with
+# one transaction per batch. Reports images/s for each.
+
+def _synthetic_chunks(image_bytes, chunk_size, rng):
+    data = rng.randbytes(image_bytes)
+    chunks = [(offset, data[offset:offset + chunk_size]) for offset in range(0, image_bytes, chunk_size)]
+    for start in range(0, len(chunks), 8):
+        window = chunks[start:start + 8]
+        rng.shuffle(window)
+        yield from window
+
+
+def _bench_legacy(directory, db_path, images, image_bytes, rng):
+    import sqlite3
+    for i in range(images):
+        buffer = bytearray(image_bytes)
+        for offset, chunk in _synthetic_chunks(image_bytes, 512, rng):
+            buffer[offset:offset + len(chunk)] = chunk
+        path = os.path.join(directory, f"legacy_{i}.jpg")
+        with open(path, 'wb') as f:
+            f.write(buffer)
+        conn = sqlite3.connect(db_path)
+        conn.execute("INSERT INTO captures (timestamp, image_path) VALUES (?, ?)", ("t", path))
+        conn.commit()
+        conn.close()
+
+
+def _bench_streaming(directory, writer, images, image_bytes, batch, rng):
+    rows = []
+    for i in range(images):
+        sink = StreamFile(directory)
+        for offset, chunk in _synthetic_chunks(image_bytes, 512, rng):
+            sink.write_at(offset, chunk)
+        path = os.path.join(directory, f"stream_{i}.jpg")
+        sink.commit(path)
+        rows.append(("t", path, None, None, None, 1, 0, 0))
+        if len(rows) == batch:
+            writer.insert_captures(rows)
+            rows = []
+    writer.insert_captures(rows)
+
+
+def _bench(images, image_bytes, batch):
+    import random
+    import sqlite3
+    import time
+    from .database_handler import CaptureWriter, create_schema
+
+    rng = random.Random(1)
+    with tempfile.TemporaryDirectory() as directory:
+        legacy_db = os.path.join(directory, "legacy.db")
+        conn = sqlite3.connect(legacy_db)
+        create_schema(conn)
+        conn.close()
+        start = time.perf_counter()
+        _bench_legacy(directory, legacy_db, images, image_bytes, rng)
+        legacy_s = time.perf_counter() - start
+
+        writer = CaptureWriter(os.path.join(directory, "stream.db"))
+        create_schema(writer.conn)
+        start = time.perf_counter()
+        _bench_streaming(directory, writer, images, image_bytes, batch, rng)
+        stream_s = time.perf_counter() - start
+        stored = writer.conn.execute("SELECT COUNT(*) FROM captures").fetchone()[0]
+        writer.close()
+
+    print(f"{images} images of {image_bytes} bytes, batches of {batch}")
+    print(f"buffer + commit per image   {images / legacy_s:8.1f} images/s")
+    print(f"stream file + WAL batch     {images / stream_s:8.1f} images/s  ({stored} rows)")
+    return stored == images
+
+
+if __name__ == '__main__':
+    args = [int(a) for a in sys.argv[1:]]
+    images, image_bytes, batch = (args + [500, 40000, 20][len(args):])[:3]
+    sys.exit(0 if _bench(images, image_bytes, batch) else 1)
@@ -0,0 +1,81 @@
+import io
+import os
+
+from PIL import Image
+
+from . import config, thumbnails
+
+# Preview-first transfers: storing the device's luma previews and choosing which
+# frames to pull in full (see PREVIEW-FIRST in config.py).
+
+CHANGE_CELL_DELTA = 10  # As on the device (include/change_detector.h)
+CELL = 2                # Preview pixels per change grid cell, each way
+
+
+def preview_jpeg(pixels, cols, rows):
+    """The preview as a grey JPEG, upscaled by PREVIEW_SCALE for the gallery."""
+    img = Image.frombytes('L', (cols, rows), pixels)
+    img = img.resize((cols * config.PREVIEW_SCALE, rows * config.PREVIEW_SCALE), Image.BILINEAR)
+    out = io.BytesIO()
+    img.save(out, 'JPEG', quality=85)
+    return out.getvalue()
+
+
+def _cells(pixels, cols, rows):
+    grid_cols, grid_rows = cols // CELL, rows // CELL
+    cells = []
+    for gy in range(grid_rows):
+        for gx in range(grid_cols):
+            total = 0
+            for y in range(gy * CELL, gy * CELL + CELL):
+                start = y * cols + gx * CELL
+                total += sum(pixels[start:start + CELL])
+            cells.append(total // (CELL * CELL))
+    return cells
+
+
+def change_percent(a, b, cols, rows):
+    """Percent of grid cells that changed between two previews, the mean shift taken out.
+
+    The same measure as signature_change_percent() on the device, so
+    FULL_FRAME_CHANGE means what the change gate's threshold means.
+    """
+    cells_a, cells_b = _cells(a, cols, rows), _cells(b, cols, rows)
+    if not cells_a:
+        return 0
+    shift = int((sum(cells_b) - sum(cells_a)) / len(cells_a))
+    changed = sum(1 for x, y in zip(cells_a, cells_b) if abs(y - x - shift) > CHANGE_CELL_DELTA)
+    return changed * 100 // len(cells_a)
+
+
+def choose(session, previews, cols, rows):
+    """Ids of the frames among this connection's previews to pull in full, with why."""
+    picks = []
+    for preview in previews:
+        session.previews_seen += 1
+        reason = None
+        if config.FULL_FRAME_EVENTS and preview["event"]:
+            reason = "event"
+        elif config.FULL_FRAME_EVERY and (session.previews_seen - 1) % config.FULL_FRAME_EVERY == 0:
+            reason = "every"
+        elif preview["pixels"] is None:
+            reason = "undecodable"  # Nothing to judge by; better see the real frame
+        elif config.FULL_FRAME_CHANGE and session.last_pulled_preview is not None and \
+                change_percent(session.last_pulled_preview, preview["pixels"], cols, rows) >= config.FULL_FRAME_CHANGE:
+            reason = "change"
+        if reason:
+            picks.append((preview["id"], reason))
+            if preview["pixels"] is not None:
+                session.last_pulled_preview = preview["pixels"]
+    return picks
+
+
+def discard(image_paths):
+    """Deletes replaced preview images and their thumbnails."""
+    for path in image_paths:
+        filename = os.path.basename(path)
+        for stale in (os.path.join(config.IMGS_PATH, filename), thumbnails.thumbnail_path(filename)):
+            try:
+                os.remove(stale)
+            except OSError:
+                pass
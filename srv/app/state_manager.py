@@ -1,15 +1,136 @@
 # This module holds the shared application state to be accessed
 # by both the web server and the BLE handler.
+import asyncio
+import time
 
 # --- SHARED STATE ---
 server_state = {
     "status": "Initializing...",
-    "storage_usage": 0,
-    "settings": {"frequency": 30, "threshold": 80}
+    "settings": {"frequency": 30, "threshold": 80, "change_threshold": 3, "keyframe_interval": 10,
+                 "frame_target": 16384, "event_holdoff": 10,
+                 "burst_frames": 0, "burst_fps": 10,
+                 "frame_size": "VGA", "jpeg_quality": 12, "xclk_mhz": 20, "chunk_size": 512,
+                 "status_delay_ms": 50, "chunk_delay_ms": 10, "image_delay_ms": 500}
 }
 
-# --- BLE COMMUNICATION GLOBALS ---
-data_queue = None
-device_found_event = None
-found_device = None
+# --- SETTINGS ---
+# The latest settings write (app.device_config) and its version. Every device gets it once on its
+# next connection; it counts as pending until the first one has.
 pending_config_command = None
+config_version = 0
+
+
+class DeviceSession:
+    """Everything the server tracks for one camera, by BLE address.
+
+    The object outlives its connections: transfer state is reset for each new
+    one, while the resume point and status carry over to the next.
+    """
+
+    def __init__(self, address, name):
+        self.address = address
+        self.name = name
+        self.tag = address.replace(':', '')[-4:].lower()  # Short id for logs and file names
+        self.active = False        # Claimed by a running session task
+        self.retry_after = 0.0     # monotonic time before which the scanner leaves it alone
+        self.bonded = False        # Paired with us; reconnects go through direct_connect
+        self.bonded_at_connect = False  # bonded when the current connection was made
+        self.connecting = None     # The pending direct connection attempt, if any
+        self.seen_at = None        # monotonic time the scanner reported the advertisement being served
+        self.client = None
+        self.config_version = 0    # Settings version this device has received
+
+        # --- WINDOWED TRANSFER STATE ---
+        # transfer_window is 0 until the device confirms a window with a WIN: status.
+        self.data_queue = None
+        self.transfer_window = 0
+        self.transfer_chunk_size = 512
+        self.transfer_active = False
+        self.last_window_ack = None
+
+        # --- INGEST ---
+        # Rows of per-image transfers held until their batch is complete, so a batch is
+        # one transaction whichever way it arrives. batch_remaining counts down from COUNT:.
+        self.pending_captures = []
+        self.batch_remaining = 0
+
+        # Reassembles the paged telemetry snapshot the device notifies after each batch.
+        self.telemetry_pages = None
+        # And the device's event log, notified after the telemetry.
+        self.log_pages = None
+
+        # --- PREVIEW-FIRST ---
+        # The task storing this connection's previews, which PICK: waits for, and
+        # what it stored: (cols, rows, previews). The pick policy's memory carries
+        # over between connections: previews seen so far and the preview of the
+        # last frame pulled in full.
+        self.preview_task = None
+        self.preview_batch = None
+        self.previews_seen = 0
+        self.last_pulled_preview = None
+
+        # --- RESUME STATE ---
+        # The last frame we touched: {"id", "crc", "data"}. data is the whole JPEG once the
+        # frame is complete, or the prefix that arrived before a transfer broke off.
+        # Sent back to the device on connect so it can skip what we already hold.
+        self.resume_point = None
+
+        self.status = {
+            "name": name,
+            "connected": False,
+            "status": "Discovered",
+            "storage_usage": 0,
+            # Device change gate totals since its last boot, from the CHANGE: status.
+            "change_gate": {"captures": 0, "skipped": 0, "keyframes": 0},
+            # Parameters of the current or last connection, from the LINK: status.
+            "link": None,
+            # How the current or last connection was made and how long it took:
+            # {"path": "scan"|"direct", "connect_ms", "setup_ms", "device_connect_ms",
+            # "fast_advertising", "bonded"}. connect_ms runs from the advertisement the
+            # scanner reported; on the direct path it is the device's advertising time
+            # from CONNECT: (the time the attempt was open, for firmware without it).
+            # setup_ms runs from connected to 'R', and the device_ fields come from
+            # its CONNECT: status.
+            "connect": None,
+            "images_received": 0,
+            "previews_received": 0,
+            "last_connected": None,
+        }
+
+    def reset_link(self, client):
+        """Fresh per-connection state; the device starts each connection in legacy mode."""
+        self.client = client
+        self.bonded_at_connect = self.bonded
+        self.data_queue = asyncio.Queue()
+        self.transfer_window = 0
+        self.transfer_active = False
+        self.last_window_ack = None
+        self.pending_captures = []
+        self.batch_remaining = 0
+        self.telemetry_pages = None
+        self.log_pages = None
+        self.preview_task = None
+        self.preview_batch = None
+        self.status["connected"] = True
+        self.status["last_connected"] = time.time()
+
+    def set_status(self, text):
+        self.status["status"] = text
+
+    def log(self, message, end='\n'):
+        # Sessions run side by side, so every line says which device it is about.
+        print(f"[{self.tag}] {message}", end=end)
+
+
+# --- SESSIONS ---
+# Every device seen since startup, by address. At most config.MAX_SESSIONS are active.
+devices = {}
+
+
+def active_sessions():
+    return [session for session in devices.values() if session.active]
+
+
+def settings_pending():
+    return pending_config_command is not None and not any(
+        session.config_version == config_version for session in devices.values())
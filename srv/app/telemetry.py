@@ -0,0 +1,102 @@
+import json
+import struct
+import sys
+
+# Mirrors include/telemetry.h on the device. All fields are little-endian:
+#   "JKT1"  u8 version  u8 phase_count  u8 bucket_count  u8 trace_count
+#   u32 uptime_ms  u32 tracepoints_recorded  u8 build_len  build
+#   3 histograms (capture_us, chunk_rtt_us, session_bytes_per_s):
+#     u32 count  u32 min  u32 max  u32 mean  u16 buckets[bucket_count]
+#   trace_count x { u32 start_us  u32 duration_us  u8 phase  u8 0  u16 detail }
+# Bucket 0 counts zeros, bucket i counts [2^(i-1), 2^i), the last one everything above.
+# Over BLE the snapshot arrives as notifications of u8 page, u8 page_count + payload.
+MAGIC = b'JKT1'
+VERSION = 1
+HEADER = struct.Struct('<4sBBBBIIB')
+HISTOGRAM = struct.Struct('<IIII')
+TRACE = struct.Struct('<IIBBH')
+
+PHASES = ["sleep_exit", "display_init", "capture", "store", "ble_start",
+          "connect_wait", "ready_wait", "transfer", "disconnect_wait", "burst",
+          "warmup"]
+HISTOGRAMS = ["capture_us", "chunk_rtt_us", "session_bytes_per_s"]
+
+
+class TelemetryFormatError(ValueError):
+    pass
+
+
+def parse(buffer):
+    """Decodes a telemetry snapshot into a JSON-ready dict."""
+    if len(buffer) < HEADER.size:
+        raise TelemetryFormatError("snapshot shorter than its header")
+    magic, version, phase_count, bucket_count, trace_count, uptime_ms, recorded, build_len = \
+        HEADER.unpack_from(buffer, 0)
+    if magic != MAGIC or version != VERSION:
+        raise TelemetryFormatError(f"unknown telemetry {magic!r} v{version}")
+    pos = HEADER.size
+    build = bytes(buffer[pos:pos + build_len]).decode('ascii', 'replace')
+    pos += build_len
+
+    histogram_size = HISTOGRAM.size + 2 * bucket_count
+    expected = pos + len(HISTOGRAMS) * histogram_size + trace_count * TRACE.size
+    if len(buffer) < expected:
+        raise TelemetryFormatError(f"snapshot is {len(buffer)} bytes, needs {expected}")
+
+    histograms = {}
+    for name in HISTOGRAMS:
+        count, low, high, mean = HISTOGRAM.unpack_from(buffer, pos)
+        buckets = list(struct.unpack_from(f'<{bucket_count}H', buffer, pos + HISTOGRAM.size))
+        histograms[name] = {"count": count, "min": low, "max": high, "mean": mean, "buckets": buckets}
+        pos += histogram_size
+
+    trace = []
+    for _ in range(trace_count):
+        start_us, duration_us, phase, _, detail = TRACE.unpack_from(buffer, pos)
+        name = PHASES[phase] if phase < len(PHASES) else f"phase_{phase}"
+        trace.append({"phase": name, "start_us": start_us, "duration_us": duration_us, "detail": detail})
+        pos += TRACE.size
+
+    return {"build": build, "uptime_ms": uptime_ms, "tracepoints_recorded": recorded,
+            "phase_count": phase_count, "histograms": histograms, "trace": trace}
+
+
+def phase_totals(snapshot):
+    """Total and count of each phase's durations in the trace, in microseconds."""
+    totals = {}
+    for point in snapshot["trace"]:
+        entry = totals.setdefault(point["phase"], {"count": 0, "total_us": 0})
+        entry["count"] += 1
+        entry["total_us"] += point["duration_us"]
+    return totals
+
+
+class PageAssembler:
+    """Collects the paged notifications of one snapshot."""
+
+    def __init__(self):
+        self.pages = {}
+        self.page_count = 0
+
+    def add(self, data):
+        """Returns the whole snapshot once its last missing page arrives, else None."""
+        if len(data) < 2:
+            return None
+        index, count = data[0], data[1]
+        if index == 0 or count != self.page_count:
+            self.pages = {}
+            self.page_count = count
+        self.pages[index] = bytes(data[2:])
+        if len(self.pages) < self.page_count:
+            return None
+        snapshot = b''.join(self.pages[i] for i in range(self.page_count) if i in self.pages)
+        self.pages = {}
+        return snapshot
+
+
+if __name__ == '__main__':
+    # python -m app.telemetry <snapshot file> prints a snapshot saved by the host bench.
+    with open(sys.argv[1], 'rb') as f:
+        decoded = parse(f.read())
+    decoded["phase_totals"] = phase_totals(decoded)
+    print(json.dumps(decoded, indent=2))
@@ -0,0 +1,38 @@
+import io
+import os
+
+from PIL import Image
+
+from . import config, ingest
+
+
+def thumbnail_path(filename):
+    return os.path.join(config.THUMBS_PATH, filename)
+
+
+def make_thumbnail(filename, data):
+    """Writes the thumbnail of one JPEG under the same file name. Returns False if it cannot be decoded."""
+    try:
+        with Image.open(io.BytesIO(data)) as img:
+            # draft() lets the JPEG decoder scale by 1/2..1/8 while decoding, far cheaper than a full decode.
+            img.draft('RGB', config.THUMB_SIZE)
+            img = img.convert('RGB')
+            img.thumbnail(config.THUMB_SIZE)
+            out = io.BytesIO()
+            img.save(out, 'JPEG', quality=config.THUMB_QUALITY)
+    except (OSError, ValueError) as e:
+        print(f"-> No thumbnail for {filename}: {e}")
+        return False
+    ingest.write_atomically(thumbnail_path(filename), out.getvalue())
+    return True
+
+
+def ensure_thumbnail(filename):
+    """Makes a missing thumbnail from the stored image, for captures that predate thumbnails."""
+    if os.path.exists(thumbnail_path(filename)):
+        return True
+    image = os.path.join(config.IMGS_PATH, filename)
+    if not os.path.exists(image):
+        return False
+    with open(image, 'rb') as f:
+        return make_thumbnail(filename, f.read())
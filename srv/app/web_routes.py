@@ -1,8 +1,11 @@
+import datetime
+import json
 import sqlite3
 import os
-from flask import Flask, render_template, jsonify, request
-# NOTE: send_from_directory is no longer needed
-from . import config, state_manager, database_handler
+from flask import Flask, render_template, jsonify, request, send_from_directory, abort
+from . import config, state_manager, database_handler, thumbnails, device_config
+
+THUMB_MAX_AGE = 365 * 24 * 3600
 
 # FIX: Point static_folder to the correct absolute path and set the URL path.
 app = Flask(__name__,
@@ -26,32 +29,170 @@ def index():
 # --- API Routes ---
 
 
+def _skip_rate(gate):
+    return round(100.0 * gate["skipped"] / gate["captures"], 1) if gate["captures"] else 0
+
+
 @app.route('/api/status')
 def api_status():
+    """Scanner summary and totals across cameras, plus one entry per device under "devices".
+
+    The top-level storage_usage and link are those of the most recently connected device.
+    """
+    sessions = sorted(state_manager.devices.values(),
+                      key=lambda session: session.status["last_connected"] or 0, reverse=True)
+    devices = {}
+    captured = skipped = 0
+    for session in sessions:
+        gate = session.status["change_gate"]
+        captured += gate["captures"]
+        skipped += gate["skipped"]
+        devices[session.address] = dict(session.status, skip_rate=_skip_rate(gate),
+                                        settings_pending=session.config_version < state_manager.config_version)
+    latest = sessions[0].status if sessions else {}
     return jsonify({
         "status": state_manager.server_state.get("status"),
-        "storage_usage": state_manager.server_state.get("storage_usage"),
-        "settings_pending": state_manager.pending_config_command is not None
+        "storage_usage": latest.get("storage_usage", 0),
+        "frames_captured": captured,
+        "frames_skipped": skipped,
+        "skip_rate": _skip_rate({"captures": captured, "skipped": skipped}),
+        "link": latest.get("link"),
+        "active_sessions": len(state_manager.active_sessions()),
+        "max_sessions": config.MAX_SESSIONS,
+        "devices": devices,
+        "settings_pending": state_manager.settings_pending()
     })
 
 
+def _encode_cursor(row):
+    return f"{row['timestamp']}|{row['id']}"
+
+
+def _decode_cursor(cursor):
+    """A cursor is the (timestamp, id) of the last row of the previous page."""
+    timestamp, _, row_id = cursor.rpartition('|')
+    if not timestamp:
+        raise ValueError("malformed cursor")
+    return timestamp, int(row_id)
+
+
+def _iso_arg(name):
+    """An optional ISO 8601 query argument, normalized to the stored timestamp format."""
+    value = request.args.get(name)
+    if not value:
+        return None
+    return datetime.datetime.fromisoformat(value).isoformat()
+
+
 @app.route('/api/captures')
 def api_captures():
+    """One page of captures, newest first.
+
+    ?limit= rows (default CAPTURES_PAGE_DEFAULT), ?before= the next_cursor of the
+    previous page, ?start= / ?end= an ISO 8601 time range (start inclusive, end
+    exclusive). Keyset pagination on (timestamp, id) walks the index, so a page
+    costs the same however deep it is.
+    """
+    try:
+        limit = max(1, min(request.args.get('limit', config.CAPTURES_PAGE_DEFAULT, type=int),
+                           config.CAPTURES_PAGE_MAX))
+        start = _iso_arg('start')
+        end = _iso_arg('end')
+        cursor = request.args.get('before')
+        cursor = _decode_cursor(cursor) if cursor else None
+    except ValueError as e:
+        return jsonify({"error": f"Invalid query: {e}"}), 400
+
+    where = []
+    params = []
+    if start:
+        where.append("timestamp >= ?")
+        params.append(start)
+    if end:
+        where.append("timestamp < ?")
+        params.append(end)
+    if cursor:
+        where.append("(timestamp, id) < (?, ?)")
+        params.extend(cursor)
+    query = "SELECT id, timestamp, image_path, device, full, requested, event, burst FROM captures"
+    if where:
+        query += " WHERE " + " AND ".join(where)
+    query += " ORDER BY timestamp DESC, id DESC LIMIT ?"
+    params.append(limit + 1)  # One extra row tells us whether there is another page
+
+    try:
+        conn = database_handler.get_db_connection()
+        conn.row_factory = sqlite3.Row
+        rows = conn.execute(query, params).fetchall()
+        conn.close()
+    except sqlite3.Error as e:
+        print(f"Database select error: {e}")
+        return jsonify({"error": str(e)}), 500
+
+    captures_list = []
+    for row in rows[:limit]:
+        filename = os.path.basename(row['image_path'])
+        captures_list.append({
+            "id": row['id'],
+            "timestamp": row['timestamp'],
+            "image_path": f"{config.IMGS_FOLDER_NAME}/{filename}",
+            "thumb_path": f"{config.THUMBS_FOLDER_NAME}/{filename}",
+            "device": row['device'],
+            # full is false while only the device's preview has arrived; requested
+            # once someone has asked for the full frame.
+            "full": bool(row['full']),
+            "requested": bool(row['requested']),
+            # Taken because the PIR saw motion, not on the timelapse schedule.
+            "event": bool(row['event']),
+            # The device's burst id; consecutive rows sharing it came from one burst.
+            "burst": row['burst'],
+        })
+    next_cursor = _encode_cursor(rows[limit - 1]) if len(rows) > limit else None
+    return jsonify({"captures": captures_list, "next_cursor": next_cursor})
+
+
+@app.route('/api/captures/<int:capture_id>/request', methods=['POST'])
+def request_full_frame(capture_id):
+    """Flags a preview so its camera is asked for the full frame on its next connection."""
+    try:
+        if not database_handler.get_writer().request_full(capture_id):
+            return jsonify({"error": "No preview with that id is waiting for its full frame."}), 404
+    except sqlite3.Error as e:
+        print(f"Database update error: {e}")
+        return jsonify({"error": str(e)}), 500
+    return jsonify({"message": "Requested. The full frame comes with the camera's next transfer, "
+                               "if it still holds it."})
+
+
+@app.route(f'/{config.THUMBS_FOLDER_NAME}/<path:filename>')
+def serve_thumbnail(filename):
+    """Thumbnails never change once written (file names are unique), so clients may cache them for good."""
+    if not thumbnails.ensure_thumbnail(os.path.basename(filename)):
+        abort(404)
+    response = send_from_directory(config.THUMBS_PATH, os.path.basename(filename),
+                                   max_age=THUMB_MAX_AGE, etag=True, conditional=True)
+    response.headers['Cache-Control'] = f"public, max-age={THUMB_MAX_AGE}, immutable"
+    return response
+
+
+@app.route('/api/telemetry')
+def api_telemetry():
+    """Latest device telemetry snapshots, newest first (?limit=, default 10)."""
+    limit = request.args.get('limit', 10, type=int)
+    limit = max(1, min(limit, 100))
     try:
         conn = database_handler.get_db_connection()
         conn.row_factory = sqlite3.Row
-        captures_from_db = conn.execute(
-            "SELECT * FROM captures ORDER BY timestamp DESC").fetchall()
+        rows = conn.execute(
+            "SELECT * FROM telemetry ORDER BY id DESC LIMIT ?", (limit,)).fetchall()
         conn.close()
 
-        captures_list = []
-        for row in captures_from_db:
+        snapshots = []
+        for row in rows:
             row_dict = dict(row)
-            # This part is still correct: build the full URL path for the frontend.
-            row_dict['image_path'] = f"{config.IMGS_FOLDER_NAME}/{os.path.basename(row_dict['image_path'])}"
-            captures_list.append(row_dict)
-
-        return jsonify(captures_list)
+            row_dict['data'] = json.loads(row_dict['data'])
+            snapshots.append(row_dict)
+        return jsonify(snapshots)
     except sqlite3.Error as e:
         print(f"Database select error: {e}")
         return jsonify({"error": str(e)}), 500
@@ -59,7 +200,10 @@ def api_captures():
 
 @app.route('/api/settings', methods=['GET'])
 def get_settings():
-    return jsonify(state_manager.server_state["settings"])
+    # What each camera last reported holding, next to the settings being handed out.
+    reported = {address: session.status["config"] for address, session in state_manager.devices.items()
+                if "config" in session.status}
+    return jsonify({**state_manager.server_state["settings"], "device_settings": reported})
 
 
 @app.route('/api/settings', methods=['POST'])
@@ -68,26 +212,31 @@ def set_settings():
     if not data:
         return jsonify({"error": "Invalid data"}), 400
 
-    if state_manager.pending_config_command:
+    if state_manager.settings_pending():
         return jsonify({"error": "A previous settings change is still pending. Please wait."}), 429
 
-    try:
-        freq = int(data['frequency'])
-        thresh = int(data['threshold'])
-    except (ValueError, TypeError, KeyError):
-        return jsonify({"error": "Invalid or missing frequency/threshold"}), 400
-
-    if not (freq >= 3):
+    settings = state_manager.server_state["settings"]
+    updated = {}
+    for name in settings:
+        value = data.get(name, settings[name])
+        if name != "frame_size":
+            try:
+                value = int(value)
+            except (ValueError, TypeError):
+                return jsonify({"error": f"{device_config.BY_NAME[name][6]} must be a number."}), 400
+        error = device_config.check(name, value)
+        if error:
+            return jsonify({"error": error}), 400
+        updated[name] = value
+    if updated["frequency"] < 3:
         return jsonify({"error": "Frequency must be 3 seconds or greater."}), 400
-    if not (2 <= thresh <= 95):
-        return jsonify({"error": "Threshold must be between 2% and 95%."}), 400
 
-    state_manager.server_state["settings"]["frequency"] = freq
-    state_manager.server_state["settings"]["threshold"] = thresh
-    state_manager.pending_config_command = f"F:{freq},T:{thresh}"
-    state_manager.server_state["status"] = "Settings queued. Will send on next connection."
+    settings.update(updated)
+    # Each device picks up the new version on its next connection.
+    state_manager.pending_config_command = device_config.encode(settings)
+    state_manager.config_version += 1
 
-    return jsonify({"message": "Settings queued successfully"})
+    return jsonify({"message": "Settings queued. Each camera receives them on its next connection."})
 
 # --- Flask App Runner ---
 